@@ -0,0 +1,64 @@
+/*
+ * Benchmark of parallel decode with PSB shards against time windows
+ *
+ * Decodes the trace with 1, 2, 4 and so on up to the given number of jobs with each way of
+ * splitting it, and prints the wall time and speedup over a single perf script.
+ *
+ * Usage: itrace_decode_bench <trace.data> [max jobs]
+ * */
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "libitrace/decode.hpp"
+#include "libitrace/traceindex.hpp"
+
+using std::cerr, std::endl;
+
+double time_seconds(const std::function<void()>& run) {
+	auto begin = std::chrono::steady_clock::now();
+	run();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " <trace.data> [max jobs]" << endl;
+		exit(1);
+	}
+	std::string infile {argv[1]};
+	std::string outfile {infile + ".bench.trace"};
+	size_t max_jobs = argc > 2 ? std::strtoul(argv[2], nullptr, 10)
+	                           : std::max(1u, std::thread::hardware_concurrency());
+
+	auto decode = [&](size_t jobs, libitrace::DecodeSplit split) {
+		return time_seconds([&]() {
+			libitrace::Decode instance {infile, outfile};
+			instance.SetJobs(jobs);
+			instance.SetSplit(split);
+			instance.Run();
+		});
+	};
+
+	double serial = decode(1, libitrace::DecodeSplit::Psb);
+	std::printf("[ 1 job: %.2f s ]\n", serial);
+
+	for (size_t jobs {2}; jobs <= max_jobs; jobs *= 2) {
+		double psb  = decode(jobs, libitrace::DecodeSplit::Psb);
+		double time = decode(jobs, libitrace::DecodeSplit::Time);
+		std::printf(
+		    "[ %zu jobs: psb %.2f s (%.2fx), time %.2f s (%.2fx) ]\n", jobs, psb, serial / psb,
+		    time, serial / time
+		);
+	}
+
+	unlink(outfile.c_str());
+	unlink(libitrace::TraceIndex::SidecarPath(outfile).c_str());
+}
@@ -0,0 +1,108 @@
+/*
+ * Benchmark of the native Fuchsia exporter against the perf2perfetto dlfilter
+ *
+ * Each exporter runs in its own child process so its peak RSS, and the peak RSS of the perf
+ * script it spawns, are measured separately. The dlfilter path is skipped if no library is given.
+ *
+ * Usage: itrace_export_bench <trace.data> [libperf2perfetto.so]
+ * */
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "libitrace/export.hpp"
+#include "libitrace/subprocess.hpp"
+#include "libitrace/utils.hpp"
+
+using std::cerr, std::endl;
+
+// Count event records so both exporters are measured in the same unit
+size_t count_events(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) die("open");
+	struct stat st {};
+	if (fstat(fd, &st) == -1) die("fstat");
+
+	std::vector<uint64_t> words(st.st_size / sizeof(uint64_t));
+	size_t loaded {0};
+	char* data = reinterpret_cast<char*>(words.data());
+	while (loaded < words.size() * sizeof(uint64_t)) {
+		ssize_t bytes = read(fd, data + loaded, words.size() * sizeof(uint64_t) - loaded);
+		if (bytes <= 0) die("read");
+		loaded += bytes;
+	}
+	close(fd);
+
+	size_t events {0};
+	for (size_t i {1}; i < words.size();) {
+		uint64_t size = (words[i] >> 4) & 0xfff;
+		if ((words[i] & 0xf) == 4) ++events;
+		if (size == 0) break;
+		i += size;
+	}
+	return events;
+}
+
+void measure(const char* name, const std::string& outfile, const std::function<void()>& run) {
+	pid_t pid = fork();
+	if (pid == -1) die("fork");
+	if (pid == 0) {
+		auto begin = std::chrono::steady_clock::now();
+		run();
+		double seconds =
+		    std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+		struct rusage self {}, children {};
+		getrusage(RUSAGE_SELF, &self);
+		getrusage(RUSAGE_CHILDREN, &children);
+		size_t events = count_events(outfile);
+		std::printf(
+		    "[ %s: %zu events in %.2f s (%.0f events/s), peak RSS %ld KiB, perf peak RSS %ld KiB "
+		    "]\n",
+		    name, events, seconds, seconds > 0 ? events / seconds : 0.0, self.ru_maxrss,
+		    children.ru_maxrss
+		);
+		exit(0);
+	}
+
+	int status {};
+	if (waitpid(pid, &status, 0) != pid) die("waitpid");
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) cerr << name << " failed" << endl;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " <trace.data> [libperf2perfetto.so]" << endl;
+		exit(1);
+	}
+	std::string infile {argv[1]};
+
+	std::string native {infile + ".native.ftf"};
+	measure("native", native, [&]() {
+		libitrace::Export instance {infile, native};
+		instance.Run();
+	});
+
+	if (argc < 3) return 0;
+
+	std::string dlfilter {infile + ".dlfilter.ftf"};
+	measure("dlfilter", dlfilter, [&]() {
+		libitrace::Subprocess perfscript {
+		    "perf",
+		    {"script", "-i", infile, "--itrace=bei0ns", "--dlfilter", argv[2], "--dlarg", dlfilter,
+		     "--dlarg", "t"}
+		};
+		auto res = perfscript.Run();
+		if (!res || res->Exit != 0) exit(1);
+	});
+}
@@ -0,0 +1,88 @@
+/*
+ * Throughput benchmark for ScriptParser
+ *
+ * Parses a decoded trace (the output of itrace decode) from memory and from the file descriptor
+ * and reports MiB/s for both.
+ *
+ * Usage: itrace_parser_bench <trace file> [iterations]
+ * */
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "libitrace/parser.hpp"
+#include "libitrace/utils.hpp"
+
+using std::cerr, std::endl;
+
+void report(const char* name, const libitrace::ScriptParser& parser, double seconds) {
+	double mib = parser.Bytes() / 1048576.0;
+	std::printf(
+	    "[ %s: %zu records, %zu skipped, %.2f MiB in %.3f s (%.2f MiB/s) ]\n", name,
+	    parser.Records(), parser.Skipped(), mib, seconds, seconds > 0 ? mib / seconds : 0.0
+	);
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " <trace file> [iterations]" << endl;
+		exit(1);
+	}
+	int iterations = argc > 2 ? std::atoi(argv[2]) : 5;
+	if (iterations < 1) iterations = 1;
+
+	int fd = open(argv[1], O_RDONLY);
+	if (fd == -1) die("open");
+	struct stat st {};
+	if (fstat(fd, &st) == -1) die("fstat");
+
+	std::vector<char> fixture(st.st_size);
+	size_t loaded {0};
+	while (loaded < fixture.size()) {
+		ssize_t bytes = read(fd, fixture.data() + loaded, fixture.size() - loaded);
+		if (bytes <= 0) die("read");
+		loaded += bytes;
+	}
+
+	// Touch every field so the callback cannot be optimized away
+	uint64_t checksum {0};
+	auto callback = [&checksum](const libitrace::ScriptRecord& record) {
+		checksum += record.time ^ record.ip ^ record.addr ^ record.sym.size() ^ record.insn.size();
+	};
+
+	// Feed in pipe sized chunks to exercise lines split across chunk boundaries
+	constexpr size_t chunk {65536};
+	libitrace::ScriptParser memparser {callback};
+	auto begin = std::chrono::steady_clock::now();
+	for (int i {0}; i < iterations; ++i) {
+		for (size_t off {0}; off < fixture.size(); off += chunk)
+			memparser.Feed({fixture.data() + off, std::min(chunk, fixture.size() - off)});
+		memparser.Finish();
+	}
+	report(
+	    "memory", memparser,
+	    std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count()
+	);
+
+	libitrace::ScriptParser fdparser {callback};
+	begin = std::chrono::steady_clock::now();
+	for (int i {0}; i < iterations; ++i) {
+		if (lseek(fd, 0, SEEK_SET) == -1) die("lseek");
+		fdparser.ParseFd(fd);
+	}
+	report(
+	    "fd", fdparser,
+	    std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count()
+	);
+	close(fd);
+
+	std::printf("[ checksum: %llx ]\n", static_cast<unsigned long long>(checksum));
+}
@@ -0,0 +1,110 @@
+/*
+ * Benchmark of the native Intel PT packet scanner
+ *
+ * Without a trace, fills a buffer with random bytes and a PSB every 4 KiB, checks FindPsb against
+ * memmem and times both. With a trace, times a shallow and a deep scan of its AUX data.
+ *
+ * Usage: itrace_ptscan_bench [trace.data] [MiB]
+ * */
+#include <string.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libitrace/ptscan.hpp"
+
+using std::cerr, std::endl;
+
+constexpr uint8_t PSB[libitrace::PT_PSB_SIZE] {0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82,
+                                               0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82};
+
+double time_seconds(const std::function<void()>& run) {
+	auto begin = std::chrono::steady_clock::now();
+	run();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+size_t find_memmem(const uint8_t* data, size_t size, size_t from) {
+	const void* found = memmem(data + from, size - from, PSB, sizeof(PSB));
+	return found ? static_cast<const uint8_t*>(found) - data : size;
+}
+
+void bench_synthetic(size_t mib) {
+	std::vector<uint8_t> data(mib << 20);
+	std::mt19937_64 rng {1};
+	for (size_t i {0}; i + 8 <= data.size(); i += 8) {
+		uint64_t value = rng();
+		memcpy(data.data() + i, &value, sizeof(value));
+	}
+
+	// Stagger the PSBs so every alignment is covered
+	size_t expected {0};
+	for (size_t i {0}; i + 4096 <= data.size(); i += 4096) {
+		memcpy(data.data() + i + expected % 61, PSB, sizeof(PSB));
+		++expected;
+	}
+
+	size_t native {0}, reference {0}, mismatches {0};
+	double native_s = time_seconds([&]() {
+		for (size_t i = libitrace::PtScanner::FindPsb(data.data(), data.size()); i < data.size();
+		     i = libitrace::PtScanner::FindPsb(data.data(), data.size(), i + 1))
+			++native;
+	});
+	double reference_s = time_seconds([&]() {
+		for (size_t i = find_memmem(data.data(), data.size(), 0); i < data.size();
+		     i = find_memmem(data.data(), data.size(), i + 1))
+			++reference;
+	});
+
+	for (size_t i {0}, j {0}; i < data.size() || j < data.size();) {
+		i = libitrace::PtScanner::FindPsb(data.data(), data.size(), i);
+		j = find_memmem(data.data(), data.size(), j);
+		if (i != j) ++mismatches;
+		i = i < data.size() ? i + 1 : i;
+		j = j < data.size() ? j + 1 : j;
+		if (i != j) break;
+	}
+
+	double gb = data.size() / 1e9;
+	std::printf("[ FindPsb: %zu PSBs in %.3f s (%.2f GB/s) ]\n", native, native_s, gb / native_s);
+	std::printf(
+	    "[ memmem: %zu PSBs in %.3f s (%.2f GB/s) ]\n", reference, reference_s, gb / reference_s
+	);
+	std::printf("[ %zu planted, %zu mismatches ]\n", expected, mismatches);
+}
+
+void bench_trace(const std::string& trace) {
+	libitrace::PtScanner scanner {trace};
+	for (bool deep : {false, true}) {
+		std::vector<libitrace::PtSyncPoint> points {};
+		double seconds = time_seconds([&]() { points = scanner.Scan(deep); });
+
+		const auto& stats = scanner.Stats();
+		std::printf(
+		    "[ %s scan: %lu buffers, %.1f MiB, %lu PSBs, %lu packets, %lu errors in %.3f s "
+		    "(%.2f GB/s) ]\n",
+		    deep ? "deep" : "shallow", stats.buffers, stats.aux_bytes / 1048576.0, stats.psbs,
+		    stats.packets, stats.errors, seconds, stats.aux_bytes / 1e9 / seconds
+		);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1 && std::string {argv[1]} != "-") {
+		bench_trace(argv[1]);
+		return 0;
+	}
+
+	size_t mib = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1024;
+	if (mib == 0) {
+		cerr << "Usage: " << argv[0] << " [trace.data] [MiB]" << endl;
+		exit(1);
+	}
+	bench_synthetic(mib);
+}
@@ -0,0 +1,107 @@
+/*
+ * Benchmark of subprocess launch latency and output throughput
+ *
+ * Launch latency is measured for fork and posix_spawn with the parent's resident set inflated to
+ * a given size, since the cost of fork grows with the page tables it has to copy. Throughput is
+ * measured by reading head -c from /dev/zero through the chunk callback, the byte ring, and Wait.
+ *
+ * Usage: itrace_subprocess_bench [launches] [rss MiB] [output MiB]
+ * */
+#include <string.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libitrace/ring.hpp"
+#include "libitrace/subprocess.hpp"
+
+using std::cerr, std::endl;
+
+double time_seconds(const std::function<void()>& run) {
+	auto begin = std::chrono::steady_clock::now();
+	run();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void launch(const char* name, libitrace::Launcher launcher, size_t launches) {
+	double seconds = time_seconds([&]() {
+		for (size_t i {0}; i < launches; ++i) {
+			libitrace::Subprocess truecmd {"true"};
+			truecmd.SetLauncher(launcher);
+			auto res = truecmd.Run();
+			if (!res || res->Exit != 0) {
+				cerr << name << " failed" << endl;
+				exit(1);
+			}
+		}
+	});
+	std::printf(
+	    "[ %s: %zu launches, %.1f us per launch ]\n", name, launches, seconds / launches * 1e6
+	);
+}
+
+void throughput(
+    const char* name, size_t bytes, const std::function<size_t(libitrace::RunningProcess&)>& run
+) {
+	libitrace::Subprocess head {"head", {"-c", std::to_string(bytes), "/dev/zero"}};
+	size_t received {0};
+	double seconds = time_seconds([&]() {
+		auto context = head.Popen();
+		if (!context) exit(1);
+		received = run(*context);
+	});
+	if (received != bytes) cerr << name << " received " << received << " of " << bytes << endl;
+	std::printf(
+	    "[ %s: %zu MiB in %.3f s (%.0f MiB/s) ]\n", name, bytes >> 20, seconds,
+	    seconds > 0 ? (bytes >> 20) / seconds : 0.0
+	);
+}
+
+int main(int argc, char** argv) {
+	size_t launches = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+	size_t rss      = argc > 2 ? std::strtoull(argv[2], nullptr, 10) << 20 : 1ull << 30;
+	size_t output   = argc > 3 ? std::strtoull(argv[3], nullptr, 10) << 20 : 1ull << 30;
+	if (launches == 0) {
+		cerr << "Usage: " << argv[0] << " [launches] [rss MiB] [output MiB]" << endl;
+		exit(1);
+	}
+
+	// Touch every page so it is resident and mapped in the page tables fork has to copy
+	std::vector<char> ballast(rss);
+	memset(ballast.data(), 1, ballast.size());
+	std::printf("[ parent RSS inflated by %zu MiB ]\n", rss >> 20);
+
+	launch("fork", libitrace::Launcher::Fork, launches);
+	launch("posix_spawn", libitrace::Launcher::Spawn, launches);
+
+	throughput("callback", output, [](libitrace::RunningProcess& context) {
+		size_t received {0};
+		libitrace::Subprocess::Stream(context, [&received](std::string_view chunk) {
+			received += chunk.size();
+		});
+		return received;
+	});
+
+	throughput("ring", output, [](libitrace::RunningProcess& context) {
+		libitrace::ByteRing ring {};
+		size_t received {0};
+		std::thread consumer {[&]() {
+			std::vector<char> buf(1048576);
+			while (size_t read = ring.ReadSome(buf.data(), buf.size())) received += read;
+		}};
+		libitrace::Subprocess::Stream(context, ring);
+		consumer.join();
+		return received;
+	});
+
+	throughput("wait", output, [output](libitrace::RunningProcess& context) {
+		auto res = libitrace::Subprocess::Wait(context, true, output);
+		return res ? res->Stdout.size() : 0;
+	});
+}
@@ -0,0 +1,115 @@
+/*
+ * Benchmark of native ELF symbol loading and address lookup
+ *
+ * Loads the symbols of an ELF file with a cold and a warm symbol cache, checks lookups in the
+ * Eytzinger table against std::upper_bound over the sorted starts, then times both.
+ *
+ * Usage: itrace_symbols_bench <elf file> [lookups]
+ * */
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libitrace/symbols.hpp"
+
+using std::cerr, std::endl;
+
+double time_seconds(const std::function<void()>& run) {
+	auto begin = std::chrono::steady_clock::now();
+	run();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " <elf file> [lookups]" << endl;
+		exit(1);
+	}
+	std::string path {argv[1]};
+	size_t lookups = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000000;
+
+	char cachedir[] = "/tmp/itrace_symbols_benchXXXXXX";
+	if (!mkdtemp(cachedir)) {
+		perror("mkdtemp");
+		exit(1);
+	}
+
+	double parse = time_seconds([&]() { libitrace::ElfSymbols symbols {path, cachedir}; });
+	std::unique_ptr<libitrace::ElfSymbols> loaded {};
+	double load = time_seconds([&]() {
+		loaded = std::make_unique<libitrace::ElfSymbols>(path, cachedir);
+	});
+	const libitrace::ElfSymbols& symbols = *loaded;
+	std::printf(
+	    "[ %zu symbols, parsed in %.3f ms, loaded from cache in %.3f ms (%s) ]\n", symbols.Size(),
+	    parse * 1e3, load * 1e3, symbols.FromCache() ? "hit" : "miss"
+	);
+	if (symbols.Size() == 0) return 0;
+
+	std::vector<uint64_t> starts {};
+	for (size_t i {0}; i < symbols.Size(); ++i) starts.push_back(symbols.At(i).start);
+	auto last = symbols.At(symbols.Size() - 1);
+
+	// Random addresses over the whole span so every level of the table is exercised
+	std::mt19937_64 rng {1};
+	std::uniform_int_distribution<uint64_t> span {starts.front(), last.start + last.size};
+	std::vector<uint64_t> addrs(1 << 20);
+	for (auto& addr : addrs) addr = span(rng);
+
+	auto reference = [&](uint64_t addr) -> std::optional<uint64_t> {
+		auto it = std::upper_bound(starts.begin(), starts.end(), addr);
+		if (it == starts.begin()) return std::nullopt;
+		auto symbol = symbols.At(it - starts.begin() - 1);
+		if (symbol.size ? addr - symbol.start >= symbol.size : addr != symbol.start)
+			return std::nullopt;
+		return symbol.start;
+	};
+
+	for (uint64_t addr : addrs) {
+		auto symbol   = symbols.Lookup(addr);
+		auto expected = reference(addr);
+		if (symbol.has_value() != expected.has_value() || (symbol && symbol->start != *expected)) {
+			cerr << "Lookup mismatch at 0x" << std::hex << addr << endl;
+			exit(1);
+		}
+	}
+
+	auto measure = [&](const char* name) {
+		uint64_t checksum {0};
+		double eytzinger = time_seconds([&]() {
+			for (size_t i {0}; i < lookups; ++i) {
+				auto symbol = symbols.Lookup(addrs[i & (addrs.size() - 1)]);
+				if (symbol) checksum += symbol->start;
+			}
+		});
+		double binary = time_seconds([&]() {
+			for (size_t i {0}; i < lookups; ++i) {
+				auto start = reference(addrs[i & (addrs.size() - 1)]);
+				if (start) checksum -= *start;
+			}
+		});
+		std::printf(
+		    "[ %s: eytzinger %.1f ns per lookup, upper_bound %.1f ns per lookup ]\n", name,
+		    eytzinger / lookups * 1e9, binary / lookups * 1e9
+		);
+		// Both loops see the same symbols so the sum cancels out
+		if (checksum != 0) cerr << "Lookup mismatch" << endl;
+	};
+	measure("random");
+
+	// A trace mostly stays within a few hot functions, so lookups repeat the same descent
+	std::uniform_int_distribution<size_t> hot {0, std::min<size_t>(starts.size(), 16) - 1};
+	for (auto& addr : addrs) {
+		auto symbol = symbols.At(hot(rng));
+		addr        = symbol.start + (symbol.size ? rng() % symbol.size : 0);
+	}
+	measure("hot");
+}
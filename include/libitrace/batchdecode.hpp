@@ -0,0 +1,89 @@
+/*
+ * batchdecode.hpp
+ *
+ * Decoding every trace in a directory, such as the captures of a snapshot mode recording.
+ * */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libitrace/decode.hpp"
+
+namespace libitrace {
+
+enum class BatchStatus { Decoded, UpToDate, Failed };
+
+/*
+ * @struct BatchEntry
+ * @brief Outcome of decoding one trace of a batch
+ * */
+struct BatchEntry {
+	std::string infile {};
+	std::string outfile {};
+	BatchStatus status {BatchStatus::Failed};
+	uint64_t bytes {};      // of the trace
+	uint64_t out_bytes {};  // of the decoded output
+	double seconds {};
+	bool cached {false};   // served from the decode cache
+	std::string error {};  // why it failed
+};
+
+/*
+ * @class BatchDecode
+ * @brief Decodes the perf.data files of a directory into <trace>.trace next to each of them.
+ * Traces are taken largest first by as many threads as the job scheduler has slots, so the long
+ * decodes start early and the short ones fill in around them. A trace whose output is newer than
+ * it is skipped, and a trace that fails to decode is reported without stopping the others
+ * */
+class BatchDecode {
+public:
+	using Configure = std::function<void(Decode&)>;
+	using Progress  = std::function<void(const BatchEntry&)>;
+
+	BatchDecode() = delete;
+
+	/*
+	 * @param directory holding the traces, not searched recursively
+	 * @param applies the options of every decode, such as UseXed or SetFormat
+	 * */
+	explicit BatchDecode(const std::string& dir, Configure configure = {})
+	    : dir_ {dir},
+	      configure_ {std::move(configure)} {}
+
+	/*
+	 * @brief perf.data files of dir, largest first
+	 * */
+	static std::vector<std::string> Discover(const std::string& dir);
+
+	static std::string OutfileFor(const std::string& infile) { return infile + ".trace"; }
+
+	/*
+	 * @brief Whether outfile exists, is not empty and was modified after infile
+	 * */
+	static bool UpToDate(const std::string& infile, const std::string& outfile);
+
+	/*
+	 * @brief Decode even the traces whose outputs are up to date
+	 * */
+	void SetForce(bool force) { force_ = force; }
+
+	/*
+	 * @brief Decode every trace of the directory
+	 * @param called as each trace is done, from the thread that decoded it but never concurrently
+	 * @return an entry per trace, largest first
+	 * */
+	std::vector<BatchEntry> Run(const Progress& progress = {});
+
+private:
+	std::string dir_ {};
+	Configure configure_ {};
+	bool force_ {false};
+
+	void decode_(BatchEntry& entry);
+};
+
+}  // namespace libitrace
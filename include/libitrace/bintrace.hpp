@@ -0,0 +1,163 @@
+/*
+ * bintrace.hpp
+ *
+ * A seekable binary columnar format for decoded traces.
+ *
+ * Layout of a file:
+ *   BinTraceHeader
+ *   blocks, each a uint32_t size per column followed by the varint encoded columns. Strings are
+ *   ids into the string table, time and ip are deltas from the previous record of the block and
+ *   addr is a delta from ip
+ *   string table, a uint32_t length followed by the bytes for every interned string
+ *   index, one BinTraceBlock per block
+ *   BinTraceTrailer
+ *
+ * Only samples are kept, so the source lines interleaved by perf script --src are not stored.
+ * */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "libitrace/interner.hpp"
+#include "libitrace/parser.hpp"
+
+namespace libitrace {
+
+constexpr char BINTRACE_MAGIC[8]     = {'I', 'T', 'R', 'A', 'C', 'E', 'B', 'N'};
+constexpr uint32_t BINTRACE_VERSION  = 3;
+constexpr size_t BINTRACE_BLOCK_SIZE = 16384;  // records per block
+
+struct BinTraceHeader {
+	char magic[8] {};
+	uint32_t version {};
+	uint32_t block_records {};
+};
+
+/*
+ * @struct BinTraceBlock
+ * @brief Footer index entry for a block
+ * */
+struct BinTraceBlock {
+	uint64_t offset {};
+	uint64_t size {};
+	uint64_t records {};
+	uint64_t min_time {};
+	uint64_t max_time {};
+};
+
+struct BinTraceTrailer {
+	uint64_t strings_offset {};
+	uint64_t strings {};
+	uint64_t index_offset {};
+	uint64_t blocks {};
+	uint64_t records {};
+	uint64_t sorted {};  // blocks are in timestamp order and do not overlap
+	char magic[8] {};
+};
+
+/*
+ * @class BinTraceWriter
+ * @brief Appends parsed records to a binary trace. Records are buffered into one block at a time
+ * and the string table and index are written by Close()
+ * */
+class BinTraceWriter {
+public:
+	BinTraceWriter() = delete;
+	BinTraceWriter(const BinTraceWriter&) = delete;
+	BinTraceWriter& operator=(const BinTraceWriter&) = delete;
+
+	/*
+	 * @brief Create or truncate a binary trace
+	 * @param path of the output file
+	 * @param number of records per block
+	 * */
+	explicit BinTraceWriter(const std::string& path, size_t block_records = BINTRACE_BLOCK_SIZE);
+	~BinTraceWriter();
+
+	void Append(const ScriptRecord& record);
+
+	/*
+	 * @brief Flush the last block and write the string table, index and trailer
+	 * */
+	void Close();
+
+	size_t Records() const { return records_; }
+
+private:
+	int fd_ {-1};
+	size_t block_records_ {};
+	uint64_t offset_ {0};
+	size_t records_ {0};
+	bool sorted_ {true};
+
+	std::vector<std::vector<uint8_t>> columns_ {};
+	BinTraceBlock block_ {};
+	uint64_t prev_time_ {0};
+	uint64_t prev_ip_ {0};
+
+	StringInterner strings_ {};
+	std::vector<BinTraceBlock> index_ {};
+
+	void flush_block_();
+	void write_(const void* data, size_t size);
+};
+
+/*
+ * @class BinTraceReader
+ * @brief Maps a binary trace into memory. Only the blocks that overlap a requested time range are
+ * decoded, everything else is never touched
+ * */
+class BinTraceReader {
+public:
+	BinTraceReader() = delete;
+	BinTraceReader(const BinTraceReader&) = delete;
+	BinTraceReader& operator=(const BinTraceReader&) = delete;
+
+	explicit BinTraceReader(const std::string& path);
+	~BinTraceReader();
+
+	/*
+	 * @brief Check the magic at the start of a file
+	 * */
+	static bool IsBinTrace(const std::string& path);
+
+	/*
+	 * @brief Hand every record within [start, end] to callback in file order. String fields point
+	 * into the mapping and stay valid for the lifetime of the reader
+	 * @param start time in nanoseconds, unbounded if not given
+	 * @param end time in nanoseconds, unbounded if not given
+	 * */
+	void Read(
+	    const ScriptParser::Callback& callback, std::optional<uint64_t> start = std::nullopt,
+	    std::optional<uint64_t> end = std::nullopt
+	) const;
+
+	/*
+	 * @brief Regenerate the perf script text for [start, end] into fd
+	 * */
+	void WriteText(
+	    int fd, std::optional<uint64_t> start = std::nullopt,
+	    std::optional<uint64_t> end = std::nullopt
+	) const;
+
+	size_t Records() const { return trailer_.records; }
+	const std::vector<BinTraceBlock>& Blocks() const { return blocks_; }
+
+private:
+	const uint8_t* data_ {nullptr};
+	size_t size_ {0};
+	BinTraceTrailer trailer_ {};
+	std::vector<BinTraceBlock> blocks_ {};
+	std::vector<std::string_view> strings_ {};
+
+	void read_block_(
+	    const BinTraceBlock& block, const ScriptParser::Callback& callback, uint64_t start,
+	    uint64_t end
+	) const;
+};
+
+}  // namespace libitrace
@@ -0,0 +1,164 @@
+/*
+ * calltree.hpp
+ *
+ * Rebuilds the call stacks of a trace and aggregates time per call path.
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "libitrace/interner.hpp"
+#include "libitrace/parser.hpp"
+#include "libitrace/subprocess.hpp"
+
+namespace libitrace {
+
+constexpr size_t CALLTREE_POOL_CHUNK = 65536;  // nodes per pool allocation
+constexpr uint32_t CALLTREE_NONE     = UINT32_MAX;
+
+/*
+ * @struct CallTreeNode
+ * @brief One call path. Times are in nanoseconds, exclusive time is the part of the inclusive time
+ * not spent in a callee. Children form a singly linked list through next_sibling
+ * */
+struct CallTreeNode {
+	uint32_t parent {CALLTREE_NONE};
+	uint32_t function {CALLTREE_NONE};
+	uint32_t first_child {CALLTREE_NONE};
+	uint32_t next_sibling {CALLTREE_NONE};
+	uint64_t calls {};
+	uint64_t inclusive {};
+	uint64_t exclusive {};
+};
+
+/*
+ * @struct CallTreeStats
+ * @brief Counters of the stack reconstruction. unwound counts frames popped without their own
+ * return, e.g. by longjmp, exceptions or returns lost to trace errors. resynced counts events
+ * whose source function did not match the top of the stack
+ * */
+struct CallTreeStats {
+	size_t calls {};
+	size_t returns {};
+	size_t unwound {};
+	size_t resynced {};
+};
+
+/*
+ * @class CallTreePool
+ * @brief Hands out objects from fixed size chunks. Objects never move once allocated so
+ * references stay valid, and growth never copies what is already there
+ * */
+template <typename T>
+class CallTreePool {
+public:
+	uint32_t Allocate() {
+		if (size_ % CALLTREE_POOL_CHUNK == 0)
+			chunks_.emplace_back(std::make_unique<T[]>(CALLTREE_POOL_CHUNK));
+		return size_++;
+	}
+
+	T& operator[](uint32_t id) {
+		return chunks_[id / CALLTREE_POOL_CHUNK][id % CALLTREE_POOL_CHUNK];
+	}
+	const T& operator[](uint32_t id) const {
+		return chunks_[id / CALLTREE_POOL_CHUNK][id % CALLTREE_POOL_CHUNK];
+	}
+
+	size_t Size() const { return size_; }
+
+private:
+	std::vector<std::unique_ptr<T[]>> chunks_ {};
+	size_t size_ {0};
+};
+
+/*
+ * @class CallTree
+ * @brief Replays the calls and returns of every thread onto a shadow stack and merges identical
+ * call paths into one node. Node 0 is a root whose children are one node per thread, named after
+ * the thread. A function is identified by its symbol and DSO
+ * */
+class CallTree {
+public:
+	CallTree() = delete;
+	CallTree(const CallTree&) = delete;
+	CallTree& operator=(const CallTree&) = delete;
+
+	/*
+	 * @brief Initialize a CallTree instance
+	 * @param path to trace binary file
+	 * */
+	explicit CallTree(const std::string& infile);
+
+	/*
+	 * @brief Run perf script over the trace and build the tree
+	 * */
+	void Run();
+
+	/*
+	 * @brief Replay a single sample. Run feeds every sample of the trace through this
+	 * */
+	void Add(const ScriptRecord& record);
+
+	/*
+	 * @brief Close the frames still open on every thread at the last time seen on that thread.
+	 * Called by Run
+	 * */
+	void Finish();
+
+	const CallTreeNode& Node(uint32_t id) const { return nodes_[id]; }
+	size_t Nodes() const { return nodes_.Size(); }
+	uint32_t Root() const { return 0; }
+
+	/*
+	 * @brief Symbol and DSO of a function id of a node. The DSO of a thread node is empty
+	 * */
+	std::string_view Name(uint32_t function) const { return names_[functions_[function].name]; }
+	std::string_view Dso(uint32_t function) const { return names_[functions_[function].dso]; }
+
+	const CallTreeStats& Stats() const { return stats_; }
+
+private:
+	struct Function {
+		uint32_t name {};
+		uint32_t dso {};
+	};
+
+	struct Frame {
+		uint32_t node {};
+		uint64_t entered {};
+	};
+
+	struct ThreadState {
+		std::vector<Frame> stack {};  // stack[0] is the thread node
+		uint64_t last {};
+	};
+
+	CallScriptArgs args_ {};
+	CallTreeStats stats_ {};
+	CallTreePool<CallTreeNode> nodes_ {};
+	std::unordered_map<uint64_t, uint32_t> children_ {};  // parent << 32 | function
+
+	StringInterner names_ {};  // of functions and dsos
+	std::vector<Function> functions_ {};
+	std::unordered_map<uint64_t, uint32_t> function_ids_ {};  // name << 32 | dso
+
+	std::unordered_map<pid_t, ThreadState> threads_ {};
+
+	uint32_t function_(std::string_view name, std::string_view dso);
+	uint32_t child_(uint32_t parent, uint32_t function);
+	ThreadState& thread_(const ScriptRecord& record);
+	void advance_(ThreadState& thread, uint64_t time);
+	void push_(ThreadState& thread, uint32_t function, uint64_t time);
+	void pop_(ThreadState& thread, uint64_t time);
+	void sync_(ThreadState& thread, uint32_t function, uint64_t time);
+};
+
+}  // namespace libitrace
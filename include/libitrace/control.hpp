@@ -0,0 +1,77 @@
+/*
+ * control.hpp
+ *
+ * Turning tracing of a running perf record on and off through its control fifos.
+ * */
+#pragma once
+
+#include <chrono>
+#include <string>
+
+namespace libitrace {
+
+constexpr int CONTROL_ACK_TIMEOUT_MS = 1000;
+
+/*
+ * @class TraceControl
+ * @brief A control fifo and an ack fifo as taken by perf record --control=fifo:<ctl>,<ack>. perf
+ * polls the control fifo along with the trace buffers, so a command takes effect in microseconds
+ * instead of the seconds it takes to start perf against a running process. Both fifos are opened
+ * read and write so neither side blocks on the other opening them
+ * */
+class TraceControl {
+public:
+	TraceControl() = delete;
+	TraceControl(const TraceControl&) = delete;
+	TraceControl& operator=(const TraceControl&) = delete;
+
+	/*
+	 * @brief Open the fifos in dir, creating them if create is set. Fifos that were created here
+	 * are removed again on destruction
+	 * @param directory of the fifos
+	 * @param whether to create them or only open the fifos of another instance
+	 * */
+	explicit TraceControl(const std::string& dir, bool create = true);
+
+	~TraceControl();
+
+	/*
+	 * @brief Directory used when none is given, unique to the calling process
+	 * */
+	static std::string DefaultDir();
+
+	/*
+	 * @brief Value of perf record --control
+	 * */
+	std::string PerfArg() const;
+
+	/*
+	 * @brief Turn tracing on, blocking until perf acknowledges. Throws if it does not in time
+	 * @return round trip from sending the command to the ack
+	 * */
+	std::chrono::nanoseconds Enable() { return command_("enable"); }
+
+	/*
+	 * @brief Turn tracing off, blocking until perf acknowledges. Throws if it does not in time
+	 * @return round trip from sending the command to the ack
+	 * */
+	std::chrono::nanoseconds Disable() { return command_("disable"); }
+
+	/*
+	 * @brief Take a snapshot of a recording in snapshot mode
+	 * @return round trip from sending the command to the ack
+	 * */
+	std::chrono::nanoseconds Snapshot() { return command_("snapshot"); }
+
+private:
+	std::string dir_ {};
+	std::string ctl_ {};
+	std::string ack_ {};
+	int ctlfd_ {-1};
+	int ackfd_ {-1};
+	bool owner_ {false};
+
+	std::chrono::nanoseconds command_(const std::string& command);
+};
+
+}  // namespace libitrace
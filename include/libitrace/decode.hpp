@@ -6,9 +6,14 @@
 #pragma once
 
 #include <argparse/argparse.hpp>
+#include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
+#include "libitrace/decodecache.hpp"
+#include "libitrace/parser.hpp"
+#include "libitrace/scheduler.hpp"
 #include "libitrace/subprocess.hpp"
 
 namespace libitrace {
@@ -29,11 +34,42 @@ struct ScriptArgs {
 	bool xed {};
 };
 
+/*
+ * @enum DecodeFormat
+ * @brief Output format of a decode. Text is the perf script output, Bin is the columnar format in
+ * bintrace.hpp
+ * */
+enum class DecodeFormat { Text, Bin };
+
+/*
+ * @enum DecodeSplit
+ * @brief How a parallel decode divides the trace. Psb cuts the AUX data into shards at PSB packets
+ * so each perf script only reads its own shard. Time gives each perf script a time window, and
+ * each of them still reads the whole trace to find its window
+ * */
+enum class DecodeSplit { Psb, Time };
+
+/*
+ * @struct DecodeWorkerStats
+ * @brief Throughput of a single perf script worker of a parallel decode
+ * */
+struct DecodeWorkerStats {
+	size_t window {};  // or shard
+	int cpu {-1};      // of a shard, -1 if recorded per thread
+	uint64_t aux_bytes {};
+	std::optional<struct timespec> start_time {std::nullopt};
+	std::optional<struct timespec> end_time {std::nullopt};
+	size_t bytes {};
+	double seconds {};
+	double queued {};  // seconds waiting for a slot of the job scheduler
+};
+
 /*
  * @class Decode
  * @brief A class that abstracts the decoding of a trace into human readable.
  * The perf command used to run this is `perf script --insn-trace --xed -i
- * <input_file>` output. Uses subprocesses to spawn perf script instance.
+ * <input_file>` output. Uses subprocesses to spawn perf script instance. An infile that is already
+ * a binary trace, or a text trace with an index sidecar, is sliced directly without perf.
  * */
 class Decode {
 public:
@@ -50,6 +86,13 @@ public:
 
 	void Run();
 
+	/*
+	 * @brief Run perf script and hand its output to a parser as it is produced instead of writing
+	 * it to the outfile
+	 * @param parser that receives every sample
+	 * */
+	void Stream(ScriptParser& parser);
+
 	/*
 	 * @brief Use xed to decode x86 instructions
 	 * */
@@ -70,11 +113,80 @@ public:
 	 * */
 	void AddSource();
 
+	/*
+	 * @brief Decode the trace with multiple perf script workers. The trace is split as set by
+	 * SetSplit and the outputs are merged in timestamp order.
+	 * @param number of perf script instances to run concurrently
+	 * */
+	void SetJobs(size_t jobs);
+
+	/*
+	 * @brief Set the priority of the perf script of a decode that is not split into workers.
+	 * Interactive by default, the workers of a parallel decode are always Batch
+	 * */
+	void SetPriority(JobPriority priority);
+
+	/*
+	 * @brief Set how a parallel decode divides the trace. Psb by default
+	 * */
+	void SetSplit(DecodeSplit split);
+
+	/*
+	 * @brief Set the format of the outfile. Text by default. Bin keeps only the samples, so it
+	 * cannot be combined with AddSource
+	 * */
+	void SetFormat(DecodeFormat format);
+
+	/*
+	 * @brief Index a text outfile once it is written, so later time ranges are sliced out of it
+	 * without perf. This reads the whole output again
+	 * */
+	void WriteIndex();
+
+	/*
+	 * @brief Serve the output from a decode cache if the same trace was already decoded with the
+	 * same arguments, and store it in the cache otherwise
+	 * @param path of the cache directory
+	 * @param total size of the cache in bytes
+	 * */
+	void UseCache(
+	    const std::string& dir = DecodeCache::DefaultDir(),
+	    uint64_t max_bytes     = DECODECACHE_MAX_BYTES
+	);
+
+	/*
+	 * @brief The cache set by UseCache, nullptr if there is none
+	 * */
+	const DecodeCache* Cache() const { return cache_.get(); }
+
+	/*
+	 * @brief Per worker throughput of the last parallel Run()
+	 * */
+	const std::vector<DecodeWorkerStats>& WorkerStats() const { return stats_; }
+
 private:
 	ScriptArgs args_ {};
 	std::string outfile_ {};
+	size_t jobs_ {1};
+	DecodeSplit split_ {DecodeSplit::Psb};
+	DecodeFormat format_ {DecodeFormat::Text};
+	bool index_ {false};
+	JobPriority priority_ {JobPriority::Interactive};
+	std::vector<DecodeWorkerStats> stats_ {};
+	std::unique_ptr<DecodeCache> cache_ {};
 
-	libitrace::arglist build_arglist_();
+	void run_perf_();
+	void run_cached_();
+	void run_script_();
+	void run_parallel_();
+	void run_sharded_();
+	void merge_parts_(const std::vector<std::string>& parts);
+	void run_bin_input_();
+	void run_indexed_input_();
+	void check_not_infile_();
+	std::pair<uint64_t, uint64_t> time_span_();
+	std::string cache_key_();
+	static libitrace::arglist build_arglist_(const ScriptArgs& args);
 };
 
 }  // namespace libitrace
@@ -0,0 +1,100 @@
+/*
+ * decodecache.hpp
+ *
+ * An on-disk cache of decoded traces shared by every tool that decodes through libitrace.
+ * */
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "libitrace/subprocess.hpp"
+
+namespace libitrace {
+
+constexpr uint64_t DECODECACHE_MAX_BYTES    = 8ull << 30;
+constexpr size_t DECODECACHE_SAMPLES        = 16;     // blocks of the trace that are hashed
+constexpr size_t DECODECACHE_SAMPLE_BYTES   = 65536;  // bytes per hashed block
+constexpr const char* DECODECACHE_STATS     = "stats";
+constexpr const char* DECODECACHE_TEMP_MARK = ".tmp.";
+
+/*
+ * @struct DecodeCacheStats
+ * @brief Lookup counters. bytes_saved is the size of every output served from the cache
+ * */
+struct DecodeCacheStats {
+	uint64_t hits {};
+	uint64_t misses {};
+	uint64_t bytes_saved {};
+};
+
+/*
+ * @class DecodeCache
+ * @brief A directory of decoded outputs named by a hash of the trace contents and the perf script
+ * arguments that produced them. Entries are evicted least recently used first once the directory
+ * grows past its size limit. The last use of an entry is its mtime so no separate index has to be
+ * kept consistent between processes
+ * */
+class DecodeCache {
+public:
+	DecodeCache() = delete;
+	DecodeCache(const DecodeCache&) = delete;
+	DecodeCache& operator=(const DecodeCache&) = delete;
+
+	/*
+	 * @brief Open a cache directory, creating it if needed
+	 * @param path of the cache directory
+	 * @param total size of the entries in bytes before eviction starts
+	 * */
+	explicit DecodeCache(
+	    const std::string& dir = DefaultDir(), uint64_t max_bytes = DECODECACHE_MAX_BYTES
+	);
+
+	/*
+	 * @brief $ITRACE_CACHE_DIR, else $XDG_CACHE_HOME/itrace, else $HOME/.cache/itrace
+	 * */
+	static std::string DefaultDir();
+
+	/*
+	 * @brief Hash a trace and the arguments used to decode it. The trace is identified by its size
+	 * and a sample of its blocks, not its path, so copies of a trace share entries
+	 * @param path to the trace
+	 * @param arguments that affect the decoded output, without the path of the trace
+	 * @return hex digest used as the name of the entry
+	 * */
+	static std::string Key(const std::string& trace, const arglist& args);
+
+	/*
+	 * @brief Copy the entry for key to outfile and mark it as recently used
+	 * @return false on a miss
+	 * */
+	bool Fetch(const std::string& key, const std::string& outfile);
+
+	/*
+	 * @brief Copy file into the cache under key and evict old entries to stay under the limit
+	 * */
+	void Store(const std::string& key, const std::string& file);
+
+	/*
+	 * @brief Counters of every process that used this cache directory
+	 * */
+	DecodeCacheStats Totals() const;
+
+	/*
+	 * @brief Counters of this instance
+	 * */
+	const DecodeCacheStats& Stats() const { return stats_; }
+
+	const std::string& Dir() const { return dir_; }
+
+private:
+	std::string dir_ {};
+	uint64_t max_bytes_ {};
+	DecodeCacheStats stats_ {};
+
+	std::string entry_(const std::string& key) const { return dir_ + "/" + key; }
+	void record_(bool hit, uint64_t bytes);
+	void evict_();
+};
+
+}  // namespace libitrace
@@ -0,0 +1,174 @@
+/*
+ * dutycycle.hpp
+ *
+ * Sampled tracing: tracing is only on for a short window every period, and counts of the trace
+ * are extrapolated to the whole recording.
+ * */
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libitrace/parser.hpp"
+#include "libitrace/profile.hpp"
+#include "libitrace/record.hpp"
+
+namespace libitrace {
+
+/*
+ * @struct DutyCycleSchedule
+ * @brief Tracing is on for on_ns out of every period_ns. Each period is moved by a uniformly
+ * random offset of up to jitter_ns either way so windows do not lock onto periodic work
+ * */
+struct DutyCycleSchedule {
+	uint64_t on_ns {};
+	uint64_t period_ns {};
+	uint64_t jitter_ns {};
+};
+
+/*
+ * @struct DutyWindow
+ * @brief A window tracing was on for, from the ack of the enable to the ack of the disable, in
+ * CLOCK_MONOTONIC nanoseconds like the timestamps of the trace
+ * */
+struct DutyWindow {
+	uint64_t start {};
+	uint64_t end {};
+};
+
+/*
+ * @struct DutyCycleLog
+ * @brief The windows of a duty cycled recording, saved next to the trace
+ * */
+struct DutyCycleLog {
+	DutyCycleSchedule schedule {};
+	uint64_t duration {};  // of the whole recording
+	std::vector<DutyWindow> windows {};
+
+	/*
+	 * @brief Time tracing was on
+	 * */
+	uint64_t Traced() const;
+
+	/*
+	 * @brief Factor from counts of the traced windows to the whole recording
+	 * */
+	double Scale() const;
+
+	void Save(const std::string& path) const;
+
+	/*
+	 * @return std::nullopt if there is no log at path
+	 * */
+	static std::optional<DutyCycleLog> Load(const std::string& path);
+
+	/*
+	 * @brief Path of the log of a trace
+	 * */
+	static std::string PathFor(const std::string& trace) { return trace + ".windows"; }
+};
+
+/*
+ * @class DutyCycler
+ * @brief Turns tracing of a recording started with Record::UseControl on and off on a background
+ * thread by the schedule, logging every window. Stops on its own once perf no longer acknowledges,
+ * such as when the target exited. The recording is timestamped with CLOCK_MONOTONIC so samples can
+ * be matched to the windows
+ * */
+class DutyCycler {
+public:
+	DutyCycler() = delete;
+	DutyCycler(const DutyCycler&) = delete;
+	DutyCycler& operator=(const DutyCycler&) = delete;
+
+	/*
+	 * @brief Initialize a DutyCycler instance
+	 * @param recording to toggle, must outlive the instance and not be started yet
+	 * @param schedule of the windows
+	 * */
+	DutyCycler(Record& record, const DutyCycleSchedule& schedule);
+
+	~DutyCycler() { Stop(); }
+
+	void Start();
+
+	/*
+	 * @brief Close the current window and stop toggling. Tracing is left off
+	 * */
+	void Stop();
+
+	/*
+	 * @brief The windows so far. Only complete once Stop returned
+	 * */
+	const DutyCycleLog& Log() const { return log_; }
+
+private:
+	Record& record_;
+	DutyCycleLog log_ {};
+	std::thread thread_ {};
+	std::mutex lock_ {};
+	std::condition_variable wake_ {};
+	bool stop_ {false};
+
+	void run_();
+};
+
+/*
+ * @struct WindowStats
+ * @brief Counts of a logged window of a duty cycled trace, times are those of the window
+ * */
+struct WindowStats {
+	uint64_t start {};
+	uint64_t end {};
+	uint64_t samples {};
+	uint64_t instructions {};
+	uint64_t cycles {};
+};
+
+/*
+ * @class WindowedProfile
+ * @brief A Profile of a duty cycled trace that also splits the samples into the logged windows by
+ * timestamp. A sample outside every window, such as one traced before perf acknowledged an enable,
+ * goes to the nearest. Counts are those of the traced windows, multiply them by Scale for
+ * estimates of the whole recording
+ * */
+class WindowedProfile {
+public:
+	WindowedProfile() = delete;
+	WindowedProfile(const WindowedProfile&) = delete;
+	WindowedProfile& operator=(const WindowedProfile&) = delete;
+
+	/*
+	 * @brief Initialize a WindowedProfile instance
+	 * @param path to trace binary file
+	 * @param log saved by the recording
+	 * */
+	WindowedProfile(const std::string& infile, const DutyCycleLog& log);
+
+	void Run();
+
+	/*
+	 * @brief Assign a single sample to its window. Run feeds every sample through this
+	 * */
+	void Add(const ScriptRecord& record);
+
+	const std::vector<WindowStats>& Windows() const { return windows_; }
+
+	const Profile& Counts() const { return profile_; }
+
+	const DutyCycleLog& Log() const { return log_; }
+
+	double Scale() const { return log_.Scale(); }
+
+private:
+	Profile profile_;
+	DutyCycleLog log_ {};
+	std::vector<WindowStats> windows_ {};  // one per logged window
+};
+
+}  // namespace libitrace
@@ -0,0 +1,57 @@
+/*
+ * export.hpp
+ *
+ * A class for abstracting away the exporting of a trace to Fuchsia trace format.
+ * */
+#pragma once
+
+#include <string>
+
+#include "libitrace/parser.hpp"
+#include "libitrace/subprocess.hpp"
+
+namespace libitrace {
+
+constexpr size_t EXPORT_MAX_DEPTH = 4096;  // deepest call stack kept per thread
+
+/*
+ * @struct ExportStats
+ * @brief Counters of the last Run()
+ * */
+struct ExportStats {
+	size_t samples {};
+	size_t events {};
+	size_t bytes {};
+	double seconds {};
+};
+
+/*
+ * @class Export
+ * @brief A class that converts the calls and returns of a trace into Fuchsia trace format duration
+ * slices per thread for viewing with Perfetto. perf script output is parsed as it is produced so
+ * memory only depends on the number of threads and their call depth.
+ * */
+class Export {
+public:
+	Export() = delete;
+
+	/*
+	 * @brief Initialize an Export instance
+	 * @param path to trace binary file
+	 * @param path to .ftf output file
+	 * */
+	Export(const std::string& infile, const std::string& outfile) : outfile_ {outfile} {
+		args_.infile = infile;
+	}
+
+	void Run();
+
+	const ExportStats& Stats() const { return stats_; }
+
+private:
+	CallScriptArgs args_ {};
+	std::string outfile_ {};
+	ExportStats stats_ {};
+};
+
+}  // namespace libitrace
@@ -0,0 +1,76 @@
+/*
+ * filterplan.hpp
+ *
+ * Intel PT address filters chosen from the hot functions of a previous trace.
+ * */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "libitrace/symbols.hpp"
+
+namespace libitrace {
+
+constexpr double FILTER_COVERAGE = 0.95;  // share of the program's profile the filters aim for
+
+/*
+ * @struct HotFunction
+ * @brief A function of a previous profile. weight is its cycles if the profile has them and its
+ * instructions otherwise
+ * */
+struct HotFunction {
+	std::string name {};
+	std::string dso {};
+	uint64_t weight {};
+};
+
+/*
+ * @struct FilterRange
+ * @brief A range [start, end) of offsets in the program's ELF file to trace
+ * */
+struct FilterRange {
+	uint64_t start {};
+	uint64_t end {};
+	uint64_t weight {};
+	size_t functions {};
+};
+
+/*
+ * @struct FilterPlan
+ * @brief Ranges chosen for the filter slots. covered and total are weights of the program's
+ * functions inside the ranges and in the whole profile, unresolved counts hot functions whose
+ * names were not found in the ELF file or whose code is not in a loadable segment
+ * */
+struct FilterPlan {
+	std::vector<FilterRange> ranges {};
+	uint64_t covered {};
+	uint64_t total {};
+	size_t unresolved {};
+
+	double Coverage() const { return total ? static_cast<double>(covered) / total : 0.0; }
+};
+
+/*
+ * @brief Read the per function counts of a previous run, either a trace recorded by itrace
+ * record, which is profiled with perf script, or the output of itrace stats --csv
+ * */
+std::vector<HotFunction> read_hot_functions(const std::string& path);
+
+/*
+ * @brief Choose up to slots ranges of the ELF file that cover the hottest of its functions. The
+ * hottest functions are taken until they reach coverage of the program's weight, and while there
+ * are more ranges than slots the two neighbours with the smallest gap between them are merged, so
+ * the least cold code possible is traced along
+ * @param symbols of the program, matched to the profile by name, demangled or not
+ * @param functions of the profile, functions of other DSOs are ignored
+ * @param number of filter slots
+ * @param share of the program's weight to cover
+ * */
+FilterPlan plan_filters(
+    const ElfSymbols& symbols, const std::vector<HotFunction>& functions, size_t slots,
+    double coverage = FILTER_COVERAGE
+);
+
+}  // namespace libitrace
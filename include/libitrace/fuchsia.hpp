@@ -0,0 +1,109 @@
+/*
+ * fuchsia.hpp
+ *
+ * A writer for the Fuchsia trace format (FXT) that Perfetto imports.
+ * https://fuchsia.dev/fuchsia-src/reference/tracing/trace-format
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace libitrace {
+
+constexpr uint64_t FXT_MAGIC          = 0x0016547846040010;
+constexpr size_t FXT_MAX_STRINGS      = 0x7fff;  // string ref 0 is the empty string
+constexpr size_t FXT_MAX_THREADS      = 0xff;    // thread ref 0 is an inline thread
+constexpr size_t FXT_MAX_STRING_BYTES = 32000;
+
+/*
+ * @class FuchsiaWriter
+ * @brief Writes FXT records through a fixed size buffer. Strings and threads are referenced
+ * through the format's index tables. Once a table is full its oldest entry is reassigned, so memory
+ * stays bounded no matter how long the trace is
+ * */
+class FuchsiaWriter {
+public:
+	FuchsiaWriter() = delete;
+	FuchsiaWriter(const FuchsiaWriter&) = delete;
+	FuchsiaWriter& operator=(const FuchsiaWriter&) = delete;
+
+	/*
+	 * @brief Create or truncate an FXT file and write the magic and initialization records
+	 * @param path of the output file
+	 * @param size of the write buffer in bytes
+	 * */
+	explicit FuchsiaWriter(const std::string& path, size_t bufsize = 1048576);
+	~FuchsiaWriter();
+
+	/*
+	 * @brief Open a duration slice on a thread
+	 * @param time in nanoseconds
+	 * */
+	void DurationBegin(
+	    pid_t pid, pid_t tid, uint64_t time, std::string_view category, std::string_view name
+	);
+
+	/*
+	 * @brief Close the innermost open duration slice on a thread
+	 * @param time in nanoseconds
+	 * */
+	void DurationEnd(
+	    pid_t pid, pid_t tid, uint64_t time, std::string_view category, std::string_view name
+	);
+
+	void ProcessName(pid_t pid, std::string_view name);
+	void ThreadName(pid_t pid, pid_t tid, std::string_view name);
+
+	/*
+	 * @brief Flush the buffer and close the file
+	 * */
+	void Close();
+
+	size_t Events() const { return events_; }
+	size_t Bytes() const { return bytes_; }
+
+private:
+	template <typename Key>
+	struct Slot {
+		Key key {};
+		uint64_t used {0};  // serial of the last record that referenced the slot
+	};
+
+	int fd_ {-1};
+	std::vector<uint64_t> buffer_ {};
+	size_t used_ {0};
+	size_t events_ {0};
+	size_t bytes_ {0};
+	uint64_t serial_ {0};
+
+	// Slots are reserved up front so the map can key on views into them
+	std::vector<Slot<std::string>> string_slots_ {};
+	std::unordered_map<std::string_view, uint16_t> strings_ {};
+	size_t string_clock_ {0};
+	std::vector<Slot<uint64_t>> thread_slots_ {};
+	std::unordered_map<uint64_t, uint8_t> threads_ {};
+	size_t thread_clock_ {0};
+
+	uint16_t string_ref_(std::string_view str);
+	uint8_t thread_ref_(pid_t pid, pid_t tid);
+	template <typename Key>
+	size_t victim_(std::vector<Slot<Key>>& slots, size_t& clock, size_t max);
+
+	void event_(
+	    uint64_t type, pid_t pid, pid_t tid, uint64_t time, std::string_view category,
+	    std::string_view name
+	);
+	void kernel_object_(uint64_t type, uint64_t koid, std::string_view name, pid_t process);
+	void put_(uint64_t word);
+	void put_bytes_(std::string_view bytes);
+	void reserve_(size_t words);
+	void flush_();
+};
+
+}  // namespace libitrace
@@ -0,0 +1,71 @@
+/*
+ * histogram.hpp
+ *
+ * A log-linear histogram of durations in the style of HdrHistogram.
+ * */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace libitrace {
+
+// Values below 2^bits are counted exactly, larger ones in 2^(bits-1) buckets per power of two so
+// the error is below 2^(1-bits), under 0.8% for 8 bits
+constexpr int HISTOGRAM_PRECISION_BITS = 8;
+
+/*
+ * @class LatencyHistogram
+ * @brief Counts values from 0 to 2^64 - 1 in a fixed array of about 7400 buckets, so memory does
+ * not grow with the number of values recorded
+ * */
+class LatencyHistogram {
+public:
+	LatencyHistogram();
+
+	void Record(uint64_t value, uint64_t count = 1);
+
+	/*
+	 * @brief Add the counts of another histogram, e.g. one filled by another thread
+	 * */
+	void Merge(const LatencyHistogram& other);
+
+	/*
+	 * @brief Smallest recorded value that percentile percent of the values are at or below,
+	 * rounded up to the end of its bucket
+	 * @param percentile from 0 to 100
+	 * @return 0 if nothing was recorded
+	 * */
+	uint64_t Percentile(double percentile) const;
+
+	uint64_t Count() const { return count_; }
+	uint64_t Min() const { return count_ ? min_ : 0; }
+	uint64_t Max() const { return max_; }
+	double Mean() const { return count_ ? sum_ / count_ : 0.0; }
+
+	/*
+	 * @brief Bucket a value is counted in
+	 * */
+	static size_t Index(uint64_t value);
+
+	/*
+	 * @brief Largest value counted in a bucket
+	 * */
+	static uint64_t UpperBound(size_t index);
+
+	/*
+	 * @brief Buckets with a count, as (upper bound, count) in increasing order
+	 * */
+	std::vector<std::pair<uint64_t, uint64_t>> Buckets() const;
+
+private:
+	std::vector<uint64_t> counts_ {};
+	uint64_t count_ {0};
+	uint64_t min_ {UINT64_MAX};
+	uint64_t max_ {0};
+	double sum_ {0};
+};
+
+}  // namespace libitrace
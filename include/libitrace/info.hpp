@@ -0,0 +1,98 @@
+/*
+ * info.hpp
+ *
+ * A summary of a recorded trace read straight from its perf.data header and records.
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace libitrace {
+
+/*
+ * @struct TraceSummary
+ * @brief What a trace contains and whether any of it was lost. Header fields are empty if perf
+ * did not write the feature they come from
+ * */
+struct TraceSummary {
+	std::string path {};
+	uint64_t file_size {};
+
+	std::string perf_version {};
+	std::string hostname {};
+	std::string os_release {};
+	std::string arch {};
+	std::string cpu_desc {};
+	uint32_t cpus_online {};
+	std::vector<std::string> cmdline {};
+	std::vector<std::string> events {};
+
+	std::optional<uint64_t> first_time {};  // perf time in nanoseconds
+	std::optional<uint64_t> last_time {};
+
+	std::set<int> cpus {};
+	std::set<pid_t> pids {};
+	std::set<pid_t> tids {};
+	std::map<pid_t, std::string> comms {};  // last name of each thread
+
+	uint64_t records {};
+	uint64_t mmaps {};
+	uint64_t itrace_starts {};
+	uint64_t switches {};
+
+	uint64_t aux_bytes {};
+	uint64_t aux_buffers {};
+	std::map<int, uint64_t> aux_bytes_per_cpu {};  // -1 for traces recorded per thread
+
+	uint64_t aux_records {};
+	uint64_t aux_truncated {};  // AUX records flagged as dropping data because the buffer was full
+	uint64_t aux_partial {};
+	uint64_t aux_collision {};
+	uint64_t lost_records {};
+	uint64_t lost_events {};
+	uint64_t lost_samples {};
+
+	/*
+	 * @brief Whether any trace or sideband data was lost, which leaves gaps in the decode
+	 * */
+	bool HasLoss() const {
+		return aux_truncated || aux_collision || lost_records || lost_samples;
+	}
+
+	std::optional<uint64_t> Duration() const {
+		if (!first_time || !last_time) return std::nullopt;
+		return *last_time - *first_time;
+	}
+};
+
+/*
+ * @class TraceInfo
+ * @brief Reads a trace without decoding any events. The whole file is mapped, its records are
+ * walked once and AUX data is skipped over, so this takes milliseconds even for large traces
+ * */
+class TraceInfo {
+public:
+	TraceInfo() = delete;
+
+	/*
+	 * @brief Initialize a TraceInfo instance
+	 * @param path to trace binary file
+	 * */
+	explicit TraceInfo(const std::string& infile) { summary_.path = infile; }
+
+	void Run();
+
+	const TraceSummary& Summary() const { return summary_; }
+
+private:
+	TraceSummary summary_ {};
+};
+
+}  // namespace libitrace
@@ -0,0 +1,46 @@
+/*
+ * interner.hpp
+ *
+ * Dense ids for the names read out of a trace.
+ * */
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace libitrace {
+
+/*
+ * @class StringInterner
+ * @brief Gives every distinct string an id, counting up from 0 in the order they are first seen.
+ * The strings are kept in a deque, which never moves them, so the lookup map keys on views into
+ * it. Copying would leave the views pointing into the original, so it is only movable
+ * */
+class StringInterner {
+public:
+	StringInterner() = default;
+	StringInterner(const StringInterner&) = delete;
+	StringInterner& operator=(const StringInterner&) = delete;
+	StringInterner(StringInterner&&) = default;
+	StringInterner& operator=(StringInterner&&) = default;
+
+	uint32_t Intern(std::string_view str);
+
+	std::string_view operator[](uint32_t id) const { return strings_[id]; }
+
+	size_t Size() const { return strings_.size(); }
+
+	/*
+	 * @brief Every string in the order of its id
+	 * */
+	const std::deque<std::string>& Strings() const { return strings_; }
+
+private:
+	std::deque<std::string> strings_ {};
+	std::unordered_map<std::string_view, uint32_t> ids_ {};
+};
+
+}  // namespace libitrace
@@ -0,0 +1,107 @@
+/*
+ * latency.hpp
+ *
+ * Durations of every invocation of a function in a trace.
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "libitrace/histogram.hpp"
+#include "libitrace/parser.hpp"
+#include "libitrace/subprocess.hpp"
+
+namespace libitrace {
+
+constexpr size_t LATENCY_MAX_DEPTH = 4096;  // open invocations per thread, for deep recursion
+
+/*
+ * @struct LatencyCall
+ * @brief One invocation, times are in nanoseconds
+ * */
+struct LatencyCall {
+	uint64_t start {};
+	uint64_t end {};
+	pid_t tid {-1};
+
+	uint64_t Duration() const { return end - start; }
+};
+
+/*
+ * @struct LatencyStats
+ * @brief Counters of the pairing. Returns from invocations that started before the trace did are
+ * unmatched, and invocations still running when it ended are left open
+ * */
+struct LatencyStats {
+	size_t calls {};
+	size_t unmatched {};
+	size_t open {};
+	size_t dropped {};  // beyond LATENCY_MAX_DEPTH
+};
+
+/*
+ * @class Latency
+ * @brief Pairs every entry into a function with its return per thread and records the durations
+ * into a histogram. Only the worst invocations are kept, so memory stays constant no matter how
+ * many calls the trace has. Traces recorded with a filter on the function enter it through trace
+ * starts instead of calls and leave it through trace ends on its returns, and both are handled
+ * */
+class Latency {
+public:
+	Latency() = delete;
+	Latency(const Latency&) = delete;
+	Latency& operator=(const Latency&) = delete;
+
+	/*
+	 * @brief Initialize a Latency instance
+	 * @param path to trace binary file
+	 * @param name of the function to measure
+	 * @param number of the longest invocations to keep
+	 * */
+	Latency(const std::string& infile, const std::string& symbol, size_t worst = 10)
+	    : symbol_ {symbol},
+	      worst_ {worst} {
+		args_.fields = SCRIPT_ENTRY_FIELDS;
+		args_.infile = infile;
+	}
+
+	void Run();
+
+	/*
+	 * @brief Pair a single branch. Run feeds every branch of the trace through this
+	 * */
+	void Add(const ScriptRecord& record);
+
+	/*
+	 * @brief Count the invocations that never returned. Run calls this at the end
+	 * */
+	void Finish();
+
+	const LatencyHistogram& Histogram() const { return histogram_; }
+
+	/*
+	 * @brief The longest invocations, longest first
+	 * */
+	std::vector<LatencyCall> Worst() const;
+
+	const LatencyStats& Stats() const { return stats_; }
+
+private:
+	CallScriptArgs args_ {};
+	std::string symbol_ {};
+	size_t worst_ {};
+	LatencyHistogram histogram_ {};
+	std::vector<LatencyCall> heap_ {};  // min heap on duration of the worst calls
+	std::unordered_map<pid_t, std::vector<uint64_t>> open_ {};  // entry times per thread
+	LatencyStats stats_ {};
+
+	void enter_(pid_t tid, uint64_t time);
+	void exit_(pid_t tid, uint64_t time);
+};
+
+}  // namespace libitrace
@@ -0,0 +1,173 @@
+/*
+ * parser.hpp
+ *
+ * A streaming parser for the text output of perf script.
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "libitrace/scheduler.hpp"
+
+namespace libitrace {
+
+constexpr std::string_view SCRIPT_UNKNOWN = "[unknown]";  // a symbol or dso perf cannot resolve
+
+// Enough for ScriptRecord::Enters and Returns, symbol offsets tell a call from a jump back into the
+// middle of a function
+constexpr std::string_view SCRIPT_ENTRY_FIELDS = "tid,time,flags,ip,sym,symoff,addr";
+
+/*
+ * @struct ScriptRecord
+ * @brief A single sample printed by perf script. String fields point into the parser's buffer and
+ * are only valid for the duration of the callback. Fields perf did not print are left empty
+ * */
+struct ScriptRecord {
+	std::string_view comm {};
+	pid_t pid {-1};
+	pid_t tid {-1};
+	int cpu {-1};
+	uint64_t time {};    // nanoseconds
+	uint64_t period {};  // sample period, printed in front of the event and 0 if it was not
+	std::string_view event {};
+	std::string_view flags {};  // branch type such as call, return, jcc, tr strt
+	uint64_t ip {};
+	std::string_view sym {};
+	uint64_t symoff {};
+	std::string_view dso {};
+	bool has_addr {false};  // branch target after =>
+	uint64_t addr {};
+	std::string_view addr_sym {};
+	uint64_t addr_symoff {};
+	std::string_view addr_dso {};
+	uint64_t insn_cnt {};  // instructions and cycles since the previous IPC report, only printed
+	uint64_t cyc_cnt {};   // for -F ipc on traces recorded with cyc
+	std::string_view insn {};  // disassembly with --xed, raw bytes otherwise
+
+	/*
+	 * @brief Check for a whole word of flags, such as call or the two words of tr end
+	 * */
+	bool HasFlag(std::string_view flag) const;
+
+	/*
+	 * @brief Check if the branch enters function. Calls into it, tail calls and trace starts at its
+	 * first instruction enter it, a trace start anywhere else resumes an invocation, e.g. after a
+	 * callee outside the filter
+	 * */
+	bool Enters(std::string_view function) const;
+
+	/*
+	 * @brief Check if the branch returns from function
+	 * */
+	bool Returns(std::string_view function) const;
+};
+
+/*
+ * @class ScriptParser
+ * @brief Parses perf script output incrementally and hands every sample to a callback without
+ * copying lines. Input can be pushed in arbitrary chunks or read straight from a file descriptor
+ * into a reusable buffer.
+ * */
+class ScriptParser {
+public:
+	using Callback = std::function<void(const ScriptRecord&)>;
+
+	ScriptParser() = delete;
+
+	/*
+	 * @brief Initialize a parser
+	 * @param callback invoked once per parsed sample
+	 * @param initial size of the read buffer, grows only for lines longer than it
+	 * */
+	explicit ScriptParser(Callback callback, size_t bufsize = 1048576)
+	    : callback_ {std::move(callback)},
+	      buffer_(bufsize) {}
+
+	/*
+	 * @brief Parse every complete line in chunk. A trailing partial line is kept until the next
+	 * Feed or Finish
+	 * */
+	void Feed(std::string_view chunk);
+
+	/*
+	 * @brief Parse a trailing line that was not terminated by a newline
+	 * */
+	void Finish();
+
+	/*
+	 * @brief Read and parse fd until end of file
+	 * @return number of bytes read
+	 * */
+	size_t ParseFd(int fd);
+
+	/*
+	 * @brief Parse a single line of perf script output
+	 * @param line without the newline
+	 * @param record to fill in
+	 * @return false if the line is not a sample, e.g. interleaved source lines
+	 * */
+	static bool ParseLine(std::string_view line, ScriptRecord& record);
+
+	/*
+	 * @brief Print a record the way perf script does so ParseLine reads it back
+	 * @param record to print
+	 * @param line to append to, without a newline
+	 * */
+	static void FormatLine(const ScriptRecord& record, std::string& line);
+
+	/*
+	 * @brief Byte offset in the input of the line handed to the current callback
+	 * */
+	size_t LineOffset() const { return line_offset_; }
+
+	size_t Records() const { return records_; }
+	size_t Skipped() const { return skipped_; }
+	size_t Bytes() const { return bytes_; }
+
+private:
+	Callback callback_ {};
+	std::vector<char> buffer_ {};
+	size_t used_ {0};
+	size_t records_ {0};
+	size_t skipped_ {0};
+	size_t bytes_ {0};
+	size_t offset_ {0};  // offset in the input of the next line to parse
+	size_t line_offset_ {0};
+
+	size_t parse_lines_(const char* data, size_t size);
+	void parse_line_(std::string_view line);
+	void append_(const char* data, size_t size);
+};
+
+/*
+ * @struct CallScriptArgs
+ * @brief Arguments into a perf script subprocess that reads only calls, returns and errors
+ * */
+struct CallScriptArgs {
+	std::string prefix {"script"};
+	std::string synth_events {"--itrace=cre"};
+	std::string fields {"comm,pid,tid,time,flags,ip,sym,addr,dso"};
+	std::string infile {};
+};
+
+/*
+ * @brief Build the perf arguments for args, ready for run_script
+ * */
+arglist call_script_arglist(const CallScriptArgs& args);
+
+/*
+ * @brief Run perf with perfargs through the global scheduler and parse its output as it streams
+ * in. Throws with perf's stderr if it fails
+ * @param perfargs arguments to perf, starting with script
+ * @param parser to feed, finished before returning
+ * @param options of the job
+ * */
+void run_script(const arglist& perfargs, ScriptParser& parser, const JobOptions& options = {});
+
+}  // namespace libitrace
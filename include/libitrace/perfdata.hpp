@@ -0,0 +1,222 @@
+/*
+ * perfdata.hpp
+ *
+ * A reader for the perf.data file format written by perf record.
+ * https://github.com/torvalds/linux/blob/master/tools/perf/Documentation/perf.data-file-format.txt
+ * */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace libitrace {
+
+constexpr uint64_t PERF_MAGIC = 0x32454c4946524550;  // "PERFILE2"
+
+constexpr uint32_t PERF_RECORD_MMAP            = 1;
+constexpr uint32_t PERF_RECORD_LOST            = 2;
+constexpr uint32_t PERF_RECORD_COMM            = 3;
+constexpr uint32_t PERF_RECORD_EXIT            = 4;
+constexpr uint32_t PERF_RECORD_FORK            = 7;
+constexpr uint32_t PERF_RECORD_SAMPLE          = 9;
+constexpr uint32_t PERF_RECORD_MMAP2           = 10;
+constexpr uint32_t PERF_RECORD_AUX             = 11;
+constexpr uint32_t PERF_RECORD_ITRACE_START    = 12;
+constexpr uint32_t PERF_RECORD_LOST_SAMPLES    = 13;
+constexpr uint32_t PERF_RECORD_SWITCH          = 14;
+constexpr uint32_t PERF_RECORD_SWITCH_CPU_WIDE = 15;
+constexpr uint32_t PERF_RECORD_USER_TYPE_START = 64;  // synthesized by perf, no sample_id
+
+constexpr uint32_t PERF_RECORD_AUXTRACE_INFO = 70;
+constexpr uint32_t PERF_RECORD_AUXTRACE      = 71;
+constexpr uint32_t PERF_RECORD_TIME_CONV     = 79;
+
+// Flags of PERF_RECORD_AUX
+constexpr uint64_t PERF_AUX_FLAG_TRUNCATED = 0x01;  // the buffer was full and data was dropped
+constexpr uint64_t PERF_AUX_FLAG_OVERWRITE = 0x02;
+constexpr uint64_t PERF_AUX_FLAG_PARTIAL   = 0x04;
+constexpr uint64_t PERF_AUX_FLAG_COLLISION = 0x08;
+
+// Bits of perf_event_attr.sample_type that make up the sample_id of non sample records
+constexpr uint64_t PERF_SAMPLE_TID        = 1ull << 1;
+constexpr uint64_t PERF_SAMPLE_TIME       = 1ull << 2;
+constexpr uint64_t PERF_SAMPLE_ID         = 1ull << 6;
+constexpr uint64_t PERF_SAMPLE_CPU        = 1ull << 7;
+constexpr uint64_t PERF_SAMPLE_STREAM_ID  = 1ull << 9;
+constexpr uint64_t PERF_SAMPLE_IDENTIFIER = 1ull << 16;
+
+/*
+ * @enum PerfFeature
+ * @brief Optional header sections, numbered by their bit in PerfFileHeader.adds_features
+ * */
+enum class PerfFeature : int {
+	TracingData = 1,
+	BuildId     = 2,
+	Hostname    = 3,
+	OsRelease   = 4,
+	Version     = 5,
+	Arch        = 6,
+	NrCpus      = 7,
+	CpuDesc     = 8,
+	CpuId       = 9,
+	TotalMem    = 10,
+	Cmdline     = 11,
+	EventDesc   = 12,
+	Auxtrace    = 18,
+	SampleTime  = 21,
+	ClockId     = 23,
+};
+
+struct PerfFileSection {
+	uint64_t offset {};
+	uint64_t size {};
+};
+
+struct PerfFileHeader {
+	uint64_t magic {};
+	uint64_t size {};
+	uint64_t attr_size {};
+	PerfFileSection attrs {};
+	PerfFileSection data {};
+	PerfFileSection event_types {};
+	uint64_t adds_features[4] {};
+};
+
+struct PerfEventHeader {
+	uint32_t type {};
+	uint16_t misc {};
+	uint16_t size {};
+};
+
+/*
+ * @struct PerfAttr
+ * @brief The fields of a perf_event_attr in the attribute section that itrace looks at
+ * */
+struct PerfAttr {
+	uint32_t type {};
+	uint64_t config {};
+	uint64_t sample_type {};
+	bool sample_id_all {false};  // non sample records end in a sample_id
+	std::string name {};         // from the event description feature, empty without it
+};
+
+/*
+ * @struct PerfAuxtraceEvent
+ * @brief Header of a chunk of AUX area data. size bytes of trace data follow it in the file and
+ * are not counted in header.size. offset is where the chunk starts in the AUX stream of its cpu
+ * or thread
+ * */
+struct PerfAuxtraceEvent {
+	PerfEventHeader header {};
+	uint64_t size {};
+	uint64_t offset {};
+	uint64_t reference {};
+	uint32_t idx {};
+	uint32_t tid {};
+	uint32_t cpu {};
+	uint32_t reserved {};
+};
+
+/*
+ * @struct PerfTimeConv
+ * @brief Conversion from TSC to perf time
+ * */
+struct PerfTimeConv {
+	PerfEventHeader header {};
+	uint64_t time_shift {};
+	uint64_t time_mult {};
+	uint64_t time_zero {};
+};
+
+/*
+ * @class PerfData
+ * @brief Maps a perf.data file and walks the records of its data section. Only files written to
+ * disk are supported, not perf record -o - pipes
+ * */
+class PerfData {
+public:
+	/*
+	 * @brief Called with each record and its offset in the file. The AUX data that follows an
+	 * AUXTRACE record starts at offset + header.size
+	 * */
+	using Callback = std::function<void(const PerfEventHeader& header, uint64_t offset)>;
+
+	PerfData() = delete;
+	PerfData(const PerfData&) = delete;
+	PerfData& operator=(const PerfData&) = delete;
+
+	/*
+	 * @brief Map a perf.data file and check its header. Throws if it is not one
+	 * */
+	explicit PerfData(const std::string& path);
+	~PerfData();
+
+	/*
+	 * @brief Check the magic at the start of a file
+	 * */
+	static bool IsPerfData(const std::string& path);
+
+	void Records(const Callback& callback) const;
+
+	/*
+	 * @brief Timestamp in the sample_id at the end of a non sample record
+	 * @return std::nullopt if the events were not recorded with sample_id_all and time
+	 * */
+	std::optional<uint64_t> RecordTime(const PerfEventHeader& header, uint64_t offset) const;
+
+	/*
+	 * @brief Cpu in the sample_id at the end of a non sample record
+	 * */
+	std::optional<int> RecordCpu(const PerfEventHeader& header, uint64_t offset) const;
+
+	const std::vector<PerfAttr>& Attrs() const { return attrs_; }
+
+	/*
+	 * @brief Location of an optional header section
+	 * @return std::nullopt if perf did not write it
+	 * */
+	std::optional<PerfFileSection> Feature(PerfFeature feature) const;
+
+	/*
+	 * @brief Read a feature that is a single string, such as the hostname
+	 * */
+	std::optional<std::string> FeatureString(PerfFeature feature) const;
+
+	/*
+	 * @brief Read a feature that is a list of strings, such as the command line
+	 * */
+	std::vector<std::string> FeatureStrings(PerfFeature feature) const;
+
+	/*
+	 * @brief Convert a TSC value to perf time in nanoseconds with the TIME_CONV record
+	 * @return std::nullopt if the file has no TIME_CONV record
+	 * */
+	std::optional<uint64_t> TscToTime(uint64_t tsc) const;
+
+	const PerfFileHeader& Header() const { return header_; }
+	const uint8_t* Data() const { return data_; }
+	size_t Size() const { return size_; }
+
+private:
+	const uint8_t* data_ {nullptr};
+	size_t size_ {0};
+	PerfFileHeader header_ {};
+	std::optional<PerfTimeConv> timeconv_ {};
+	std::vector<PerfAttr> attrs_ {};
+	std::vector<PerfFileSection> features_ {};  // indexed by feature bit, empty if not present
+
+	// Layout of the sample_id shared by all events, offsets back from the end of a record
+	size_t sample_id_size_ {0};
+	std::optional<size_t> time_pos_ {};
+	std::optional<size_t> cpu_pos_ {};
+
+	void read_attrs_();
+	void read_features_();
+	void read_event_desc_();
+	bool read_string_(uint64_t& offset, uint64_t end, std::string& str) const;
+};
+
+}  // namespace libitrace
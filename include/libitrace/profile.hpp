@@ -0,0 +1,135 @@
+/*
+ * profile.hpp
+ *
+ * A flat profile of a trace: instructions, cycles and calls per function and per DSO.
+ * */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libitrace/interner.hpp"
+#include "libitrace/parser.hpp"
+#include "libitrace/subprocess.hpp"
+
+namespace libitrace {
+
+/*
+ * @struct ProfileArgs
+ * @brief Arguments into the perf script subprocess that is spawned to profile the trace. Traces
+ * recorded with cyc report instructions and cycles on branches through the ipc field. Others need
+ * a sample per instruction to count them
+ * */
+struct ProfileArgs {
+	std::string prefix {"script"};
+	std::string cyc_synth_events {"--itrace=be"};
+	std::string cyc_fields {"tid,time,event,flags,ip,sym,dso,addr,ipc"};
+	std::string synth_events {"--itrace=bei1i"};
+	std::string fields {"tid,time,event,flags,ip,sym,dso,addr"};
+	std::string infile {};
+};
+
+/*
+ * @struct ProfileEntry
+ * @brief Self counts of a function or a DSO. calls counts branches into it flagged as calls
+ * */
+struct ProfileEntry {
+	std::string_view name {};
+	std::string_view dso {};
+	uint64_t instructions {};
+	uint64_t cycles {};
+	uint64_t calls {};
+};
+
+/*
+ * @class Profile
+ * @brief Walks the branches of a trace once and accumulates counts per function. Symbol and DSO
+ * names are interned so the counters are keyed by a pair of ids, which keeps memory proportional
+ * to the number of distinct functions no matter how long the trace is
+ * */
+class Profile {
+public:
+	Profile() = delete;
+	Profile(const Profile&) = delete;
+	Profile& operator=(const Profile&) = delete;
+
+	/*
+	 * @brief Initialize a Profile instance
+	 * @param path to trace binary file
+	 * */
+	explicit Profile(const std::string& infile) { args_.infile = infile; }
+
+	void Run();
+
+	/*
+	 * @brief Count a single sample. Run feeds every sample of the trace through this
+	 * */
+	void Add(const ScriptRecord& record);
+
+	/*
+	 * @brief Per function counts in no particular order. Names are valid for the lifetime of the
+	 * profile
+	 * */
+	std::vector<ProfileEntry> Functions() const;
+
+	/*
+	 * @brief Per DSO counts in no particular order, name is left empty
+	 * */
+	std::vector<ProfileEntry> Dsos() const;
+
+	/*
+	 * @brief Sum over every function, name and dso are left empty
+	 * */
+	ProfileEntry Total() const;
+
+	/*
+	 * @brief Whether the trace was recorded with cyc so cycle counts are available
+	 * */
+	bool HasCycles() const { return cycles_; }
+
+	/*
+	 * @brief Set whether the trace has cycles instead of asking perf. Needed when the trace is not
+	 * a file that can be inspected before it is read, such as a live recording
+	 * */
+	void SetCycles(bool cycles) { cycles_ = cycles; }
+
+	/*
+	 * @brief Arguments of the perf script that feeds Add, for running it elsewhere
+	 * */
+	libitrace::arglist Arglist() const { return build_arglist_(); }
+
+	/*
+	 * @brief Also hand every sample Run reads to observer, after it is counted
+	 * */
+	void SetObserver(std::function<void(const ScriptRecord&)> observer) {
+		observer_ = std::move(observer);
+	}
+
+private:
+	struct Counters {
+		uint32_t sym {};
+		uint32_t dso {};
+		uint64_t instructions {};
+		uint64_t cycles {};
+		uint64_t calls {};
+	};
+
+	ProfileArgs args_ {};
+	bool cycles_ {false};
+	std::function<void(const ScriptRecord&)> observer_ {};
+
+	StringInterner names_ {};  // of functions and dsos
+	std::vector<Counters> counters_ {};
+	std::unordered_map<uint64_t, uint32_t> functions_ {};  // sym id << 32 | dso id
+
+	Counters& function_(std::string_view sym, std::string_view dso);
+	bool trace_has_cyc_() const;
+	libitrace::arglist build_arglist_() const;
+};
+
+}  // namespace libitrace
@@ -0,0 +1,125 @@
+/*
+ * ptcaps.hpp
+ *
+ * What the Intel PT of this machine supports, read from sysfs, and packet configurations picked
+ * from it.
+ * */
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace libitrace {
+
+constexpr const char* PT_SYSFS_ROOT = "/sys/bus/event_source/devices/intel_pt";
+constexpr const char* PT_SYSFS_ROOT_ENV = "ITRACE_PT_SYSFS";  // overrides PT_SYSFS_ROOT
+
+/*
+ * @enum PtProfile
+ * @brief Named packet configurations. LowOverhead emits the fewest packets, with compressed returns
+ * and the sparsest timing and sync packets. Balanced keeps perf's default periods with coarse
+ * cycle counts. CycleAccurate counts cycles at the finest granularity the hardware has
+ * */
+enum class PtProfile { LowOverhead, Balanced, CycleAccurate };
+
+/*
+ * @brief Profile named as on the command line: low-overhead, balanced or cycle-accurate
+ * */
+std::optional<PtProfile> parse_pt_profile(const std::string& name);
+
+std::string pt_profile_name(PtProfile profile);
+
+/*
+ * @struct PtConfig
+ * @brief Terms of an intel_pt event. Unset periods and cyc_thresh are left to perf's defaults,
+ * which is also what happens when the kernel does not expose the term
+ * */
+struct PtConfig {
+	bool cyc {false};
+	std::optional<unsigned> cyc_thresh {std::nullopt};
+	std::optional<unsigned> psb_period {std::nullopt};
+	std::optional<unsigned> mtc_period {std::nullopt};
+	bool branch {true};
+	bool noretcomp {true};
+
+	/*
+	 * @brief The event as passed to perf record -e, such as intel_pt/cyc,noretcomp=1/u
+	 * @param modifier of the privilege levels to trace
+	 * */
+	std::string Event(const std::string& modifier = "u") const;
+};
+
+/*
+ * @class PtCaps
+ * @brief Every file under caps and format of the intel_pt PMU, read once. Caps hold hex values,
+ * the *_periods and cycle_thresholds caps are bitmaps of the valid values of the matching format
+ * term. Reading the directory takes microseconds, unlike asking perf
+ * */
+class PtCaps {
+public:
+	/*
+	 * @brief Read the PMU at root, which may be a fake one laid out like sysfs
+	 * @param directory of the intel_pt PMU
+	 * */
+	explicit PtCaps(const std::string& root = PT_SYSFS_ROOT);
+
+	/*
+	 * @brief The PMU of this machine, or of $ITRACE_PT_SYSFS if it is set. Read on the first call
+	 * and cached for the rest of the process
+	 * */
+	static const PtCaps& Host();
+
+	/*
+	 * @brief Whether the PMU exists at all
+	 * */
+	bool Available() const { return available_; }
+
+	/*
+	 * @brief Value of a cap, nullopt if the kernel does not expose it
+	 * */
+	std::optional<uint64_t> Cap(const std::string& name) const;
+
+	/*
+	 * @brief Whether a cap is exposed and non zero
+	 * */
+	bool Has(const std::string& name) const { return Cap(name).value_or(0) != 0; }
+
+	/*
+	 * @brief Whether perf accepts the term in an intel_pt event
+	 * */
+	bool HasTerm(const std::string& term) const { return formats_.count(term) != 0; }
+
+	/*
+	 * @brief Values of a bitmap cap such as psb_periods in increasing order
+	 * */
+	std::vector<unsigned> Valid(const std::string& bitmap) const;
+
+	/*
+	 * @brief Number of address ranges that can be filtered on, 0 if there is no filtering
+	 * */
+	size_t AddressRanges() const;
+
+	/*
+	 * @brief Pick the terms of a profile that this PMU supports
+	 * */
+	PtConfig Config(PtProfile profile) const;
+
+	const std::map<std::string, std::string>& Caps() const { return caps_; }
+	const std::map<std::string, std::string>& Formats() const { return formats_; }
+
+private:
+	std::string root_ {};
+	bool available_ {false};
+	std::map<std::string, std::string> caps_ {};     // name to value
+	std::map<std::string, std::string> formats_ {};  // term to its config bits
+
+	std::optional<unsigned> nearest_(
+	    const std::string& term, const std::string& bitmap, unsigned wanted
+	) const;
+	static std::map<std::string, std::string> read_dir_(const std::string& dir);
+};
+
+}  // namespace libitrace
@@ -0,0 +1,95 @@
+/*
+ * ptscan.hpp
+ *
+ * A native scanner for the Intel PT packets in the AUX data of a perf.data file. It finds PSB sync
+ * points and the timestamps around them without decoding any instructions.
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "libitrace/perfdata.hpp"
+
+namespace libitrace {
+
+constexpr size_t PT_PSB_SIZE = 16;  // 02 82 repeated 8 times
+
+/*
+ * @struct PtSyncPoint
+ * @brief A PSB packet, where a decoder can start without any earlier context
+ * */
+struct PtSyncPoint {
+	uint64_t offset {};      // of the PSB in the perf.data file
+	uint64_t aux_offset {};  // of the PSB in the AUX stream of its cpu or thread
+	uint64_t size {};        // bytes up to the next PSB or the end of the AUX buffer
+	int cpu {-1};            // -1 for traces recorded per thread
+	pid_t tid {-1};
+	uint64_t tsc {};   // from the TSC packet in PSB+, 0 if there was none
+	uint64_t time {};  // tsc in perf time, 0 if the trace has no time conversion
+	uint16_t ctc {};   // from the TMA packet in PSB+
+	uint16_t fc {};
+	uint32_t mtc {};  // MTC and CYC packets up to the next PSB, only counted by a deep scan
+	uint32_t cyc {};
+};
+
+struct PtScanStats {
+	uint64_t buffers {};    // AUXTRACE records
+	uint64_t aux_bytes {};  // of PT data in them
+	uint64_t psbs {};
+	uint64_t packets {};  // walked by a deep scan
+	uint64_t errors {};   // packets a deep scan could not decode, it skips to the next PSB
+};
+
+/*
+ * @class PtScanner
+ * @brief Builds an index of the PSB sync points in a trace. A shallow scan only looks at the PSB+
+ * headers and runs at memory bandwidth. A deep scan also walks every packet between them
+ * */
+class PtScanner {
+public:
+	PtScanner() = delete;
+
+	/*
+	 * @brief Map a trace recorded by itrace record
+	 * */
+	explicit PtScanner(const std::string& trace) : perfdata_ {trace} {}
+
+	/*
+	 * @brief Scan every AUX buffer in the file
+	 * @param deep walk all packets to count MTC and CYC packets
+	 * @return sync points in file order, which is AUX stream order for each cpu or thread
+	 * */
+	std::vector<PtSyncPoint> Scan(bool deep = false);
+
+	/*
+	 * @brief Find the next PSB packet
+	 * @return offset of the PSB at or after from, size if there is none
+	 * */
+	static size_t FindPsb(const uint8_t* data, size_t size, size_t from = 0);
+
+	/*
+	 * @brief Length of the packet at the start of data
+	 * @return 0 if the packet is unknown or truncated
+	 * */
+	static size_t PacketLength(const uint8_t* data, size_t size);
+
+	const PtScanStats& Stats() const { return stats_; }
+	const PerfData& Data() const { return perfdata_; }
+
+private:
+	PerfData perfdata_;
+	PtScanStats stats_ {};
+
+	void scan_buffer_(
+	    const PerfAuxtraceEvent& event, uint64_t offset, bool deep, std::vector<PtSyncPoint>& points
+	);
+	size_t psb_header_(const uint8_t* data, size_t size, PtSyncPoint& point);
+	void walk_(const uint8_t* data, size_t size, PtSyncPoint& point);
+};
+
+}  // namespace libitrace
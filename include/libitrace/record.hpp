@@ -6,7 +6,15 @@
 #pragma once
 
 #include <argparse/argparse.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 
+#include "libitrace/control.hpp"
+#include "libitrace/filterplan.hpp"
+#include "libitrace/parser.hpp"
+#include "libitrace/ptcaps.hpp"
 #include "libitrace/subprocess.hpp"
 
 namespace libitrace {
@@ -25,11 +33,55 @@ struct RecordArgs {
 	arglist programargs {};
 	std::optional<pid_t> pid {std::nullopt};
 	std::optional<std::string> symbol;
-	std::optional<std::string> instrptr_range {};
+	std::vector<std::string> instrptr_ranges {};
+	std::optional<std::string> switch_output {std::nullopt};  // such as 100M or 30s
+	std::optional<std::string> control {std::nullopt};        // --control=fifo:<ctl>,<ack>
+	std::optional<std::string> clockid {std::nullopt};        // -k, such as CLOCK_MONOTONIC
+	bool start_disabled {false};
 	bool snapshot {false};
 	bool filter {false};
 };
 
+constexpr size_t RECORD_LIVE_PIPE_BYTES = 1048576;  // between perf record and perf script
+
+/*
+ * @struct LiveStats
+ * @brief Volume of a live recording. trace_bytes went from perf record into perf script and
+ * script_bytes from perf script into the parser
+ * */
+struct LiveStats {
+	uint64_t trace_bytes {};
+	uint64_t script_bytes {};
+	double seconds {};
+};
+
+/*
+ * @struct RecordChunk
+ * @brief A file of a rotating recording. Times are seconds since the recording started, processed
+ * is when the chunk worker finished with it
+ * */
+struct RecordChunk {
+	std::string path {};
+	uint64_t bytes {};
+	double completed {};
+	std::optional<double> processed {std::nullopt};
+	bool dropped {false};  // deleted to stay within the retention limits
+};
+
+/*
+ * @struct RotationStats
+ * @brief Outcome of a rotating recording. unprocessed counts chunks dropped before the worker got
+ * to them, backlog is the most chunks that were waiting for the worker at once
+ * */
+struct RotationStats {
+	std::vector<RecordChunk> chunks {};
+	size_t dropped {};
+	size_t unprocessed {};
+	size_t backlog {};
+	double max_lag {};  // seconds from completing a chunk until it was processed
+	double seconds {};
+};
+
 /*
  * @class Record
  * @brief A class that abstracts the tracing of a program using perf. Uses
@@ -52,12 +104,15 @@ public:
 		perfargs_.outfile     = outfile;
 		perfargs_.program     = targetprogram;
 		perfargs_.programargs = targetargs;
+		SetPtProfile(PtProfile::CycleAccurate);
+	}
 
-		if (check_cyc_avail()) {
-			perfargs_.ptargs = "intel_pt/cyc,cyc_thresh=1,noretcomp=1/u";
-		} else {
-			perfargs_.ptargs = "intel_pt/noretcomp=1/u";
-		}
+	/*
+	 * @brief Set the packet configuration of the trace from the capabilities of this machine.
+	 * CycleAccurate by default
+	 * */
+	void SetPtProfile(PtProfile profile) {
+		perfargs_.ptargs = PtCaps::Host().Config(profile).Event();
 	}
 
 	/*
@@ -72,9 +127,110 @@ public:
 	 * */
 	RunningProcess Attach(pid_t pid);
 
+	/*
+	 * @brief Arguments of a perf record attached to pid that starts with tracing off, with the
+	 * event and filters of this instance but its own output file and control fifos. Used by
+	 * RecordGroup to run one perf per process
+	 * @param Target pid
+	 * @param path of the output file
+	 * @param value of perf record --control
+	 * */
+	libitrace::arglist AttachArglist(
+	    pid_t pid, const std::string& outfile, const std::string& control
+	);
+
+	/*
+	 * @brief Start tracing the target program without waiting for it, like Attach does for a pid
+	 * @return Pid of tracer process
+	 * */
+	RunningProcess Start();
+
+	/*
+	 * @brief Control the recording through fifos so Enable and Disable can toggle tracing while
+	 * it runs. Call before Run, Start or Attach
+	 * @param directory of the fifos, created if missing
+	 * @param whether perf starts with tracing off until the first Enable
+	 * */
+	void UseControl(
+	    const std::string& dir = TraceControl::DefaultDir(), bool start_disabled = true
+	);
+
+	/*
+	 * @brief Turn tracing of a controlled recording on
+	 * @return round trip until perf acknowledged
+	 * */
+	std::chrono::nanoseconds Enable();
+
+	/*
+	 * @brief Turn tracing of a controlled recording off
+	 * @return round trip until perf acknowledged
+	 * */
+	std::chrono::nanoseconds Disable();
+
+	/*
+	 * @brief Timestamp the trace with a clock other than perf's own, so its times can be compared
+	 * with times taken outside of perf
+	 * @param clock as perf record -k takes it, such as CLOCK_MONOTONIC
+	 * */
+	void SetClock(const std::string& clockid);
+
+	/*
+	 * @brief Record and decode at the same time. perf record writes the trace into a pipe instead
+	 * of the outfile and perf script decodes it from there into parser while the target runs.
+	 * The stages are connected by pipes of bounded size, so a slow parser blocks perf script and
+	 * then perf record instead of the trace piling up in memory or on disk
+	 * @param perf script arguments that read the trace from stdin with -i -
+	 * @param parser that receives every sample
+	 * @param pid to attach to instead of running the target program
+	 * @return volume of the recording
+	 * */
+	LiveStats Live(
+	    const arglist& scriptargs, ScriptParser& parser, std::optional<pid_t> pid = std::nullopt
+	);
+
+	/*
+	 * @brief End a recording started by Live, may be called from another thread
+	 * */
+	void StopLive();
+
+	/*
+	 * @brief Rotate the output file once it reaches a size or after a time, as in perf record
+	 * --switch-output. Chunks are named after the outfile with a timestamp appended
+	 * @param threshold such as 100M or 30s
+	 * @param number of newest chunks to keep, 0 keeps all
+	 * @param total bytes of chunks to keep, 0 keeps all
+	 * */
+	void SetRotation(const std::string& threshold, size_t max_chunks = 0, uint64_t max_bytes = 0);
+
+	/*
+	 * @brief Record with the rotation set by SetRotation. Every completed chunk is handed to
+	 * worker on a background thread so processing overlaps recording, and the oldest chunks are
+	 * deleted once the retention limits are exceeded. A chunk the worker is busy with is never
+	 * deleted
+	 * @param worker invoked with the path of each chunk, may be empty
+	 * @param pid to attach to instead of running the target program, stopped by StopRotating
+	 * @return every chunk and how far the worker fell behind
+	 * */
+	RotationStats RunRotating(
+	    const std::function<void(const std::string&)>& worker = {},
+	    std::optional<pid_t> pid                               = std::nullopt
+	);
+
+	/*
+	 * @brief End a recording started by RunRotating, may be called from another thread
+	 * */
+	void StopRotating() { StopLive(); }
+
+	/*
+	 * @brief Whether the trace is recorded with cycle accurate timing
+	 * */
+	bool HasCycles() const { return perfargs_.ptargs.find("cyc") != std::string::npos; }
+
 	/*
 	 * @brief Add a symbol from the program binary to track. Perf will trace
-	 * only that symbol
+	 * only that symbol. The symbol is looked up in the program's ELF symbol
+	 * table and traced as the file offsets of its code, perf only resolves
+	 * symbols that are not in it
 	 * @param string
 	 * */
 	void AddSymbolFilter(std::string symbol);
@@ -82,27 +238,41 @@ public:
 	/*
 	 * @brief Add an instruction pointer range from the program binary to track.
 	 * Perf will trace only within the range
-	 * @param start address
-	 * @param end address
+	 * @param start offset in the program file
+	 * @param end offset in the program file
 	 * */
 	void AddInstrPtrFilter(long start, long end);
 
+	/*
+	 * @brief Trace only the hottest code of a previous run of the program, in as many address
+	 * ranges as the hardware has filter slots left after the filters added so far
+	 * @param previous trace of the program or itrace stats --csv output of one
+	 * @param share of the program's instructions, or cycles, the ranges should cover
+	 * @return the chosen ranges
+	 * */
+	FilterPlan AddProfileFilter(const std::string& profile, double coverage = FILTER_COVERAGE);
+
 	/*
 	 * @brief Record a trace using snapshotting instead of an exhaustive trace
 	 * */
 	void SetSnapshotMode();
 
 	/*
-	 * @brief Snapshot a trace for an instance started with snapshot mode
+	 * @brief Snapshot a trace for an instance started with snapshot mode. Goes through the control
+	 * fifo if UseControl was called, and SIGUSR2 otherwise
 	 * @param RunningProcess context returned by Attach
 	 * */
 	void TakeSnapshot(const RunningProcess& context);
 
 private:
 	RecordArgs perfargs_ {};
+	std::atomic<pid_t> live_ {-1};  // perf record of a running Live or RunRotating
+	size_t max_chunks_ {0};
+	uint64_t max_bytes_ {0};
+	std::unique_ptr<TraceControl> control_ {};
 
 	libitrace::arglist build_arglist_();
-	bool check_cyc_avail();
+	std::string program_path_() const;
 };
 
 }  // namespace libitrace
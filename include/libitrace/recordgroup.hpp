@@ -0,0 +1,137 @@
+/*
+ * recordgroup.hpp
+ *
+ * Tracing a set of processes at once, one perf record per process driven from a single event
+ * loop.
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "libitrace/control.hpp"
+#include "libitrace/record.hpp"
+#include "libitrace/subprocess.hpp"
+
+namespace libitrace {
+
+constexpr int GROUP_READY_TIMEOUT_MS = 10000;  // for every perf to attach before tracing starts
+constexpr const char* CGROUP_ROOT    = "/sys/fs/cgroup";
+
+/*
+ * @struct GroupMember
+ * @brief A traced process of a group. enabled and disabled are CLOCK_MONOTONIC nanoseconds of the
+ * acks of turning its tracing on and off, 0 if that never happened
+ * */
+struct GroupMember {
+	pid_t pid {};
+	std::string comm {};
+	std::string outfile {};
+	uint64_t enabled {};
+	uint64_t disabled {};
+	int exit {-1};  // of its perf record
+	uint64_t bytes {};
+	std::string error {};  // last line perf printed if it failed, not saved in the manifest
+};
+
+/*
+ * @struct GroupManifest
+ * @brief The outputs of a group recording, saved next to them
+ * */
+struct GroupManifest {
+	std::vector<GroupMember> members {};
+
+	/*
+	 * @brief Time between the first and the last member whose tracing was turned on
+	 * */
+	uint64_t Skew() const;
+
+	void Save(const std::string& path) const;
+
+	/*
+	 * @return std::nullopt if there is no manifest at path
+	 * */
+	static std::optional<GroupManifest> Load(const std::string& path);
+
+	/*
+	 * @brief Path of the manifest of a group recorded into outfile
+	 * */
+	static std::string PathFor(const std::string& outfile) { return outfile + ".manifest"; }
+};
+
+/*
+ * @brief Processes in a cgroup
+ * @param path of the cgroup, relative to CGROUP_ROOT unless it is absolute
+ * */
+std::vector<pid_t> cgroup_pids(const std::string& cgroup);
+
+/*
+ * @class RecordGroup
+ * @brief Attaches a perf record to every process of a set, with the event and filters of a
+ * Record. Each perf starts with tracing off and its own control fifos. Once all of them have
+ * attached, tracing is turned on for every one in a row so the traces start within microseconds
+ * of each other, and on Stop it is turned off the same way before the perfs are interrupted. The
+ * stdout and stderr of every perf, and the stop requests, are waited on with one epoll set
+ * */
+class RecordGroup {
+public:
+	RecordGroup() = delete;
+	RecordGroup(const RecordGroup&) = delete;
+	RecordGroup& operator=(const RecordGroup&) = delete;
+
+	/*
+	 * @param Record whose event and filters every perf uses
+	 * @param processes to trace
+	 * @param output file, each process is traced into OutfileFor(outfile, pid)
+	 * */
+	RecordGroup(Record& record, const std::vector<pid_t>& pids, const std::string& outfile);
+
+	~RecordGroup();
+
+	/*
+	 * @brief Trace until Stop is called, stopfd becomes readable or every traced process exited,
+	 * then save the manifest. End of file on stopfd is ignored so a closed stdin does not stop it
+	 * @param optional file descriptor to stop on, such as stdin
+	 * @return the manifest
+	 * */
+	GroupManifest Run(int stopfd = -1);
+
+	/*
+	 * @brief End a Run, may be called from another thread
+	 * */
+	void Stop();
+
+	static std::string OutfileFor(const std::string& outfile, pid_t pid) {
+		return outfile + "." + std::to_string(pid);
+	}
+
+private:
+	struct Child {
+		GroupMember member {};
+		std::unique_ptr<TraceControl> control {};
+		RunningProcess process {};
+		std::string stderr_ {};
+		bool ready {false};
+		bool running {false};
+		int open {0};  // pipes not yet at end of file
+	};
+
+	Record& record_;
+	std::string outfile_ {};
+	std::vector<Child> children_ {};
+	int stopfd_ {-1};  // eventfd written by Stop
+
+	void run_(int epfd, int stopfd);
+	void start_(Child& child);
+	void read_(Child& child, int fd, int epfd);
+	void reap_(Child& child);
+	void enable_all_();
+	void disable_all_();
+};
+
+}  // namespace libitrace
@@ -0,0 +1,82 @@
+/*
+ * ring.hpp
+ *
+ * A lock-free single producer single consumer byte ring for handing subprocess output to another
+ * thread.
+ * */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace libitrace {
+
+/*
+ * @class ByteRing
+ * @brief A bounded byte queue between exactly one writer thread and one reader thread. The
+ * non-blocking calls never wait, the blocking ones sleep on a futex until the other side makes
+ * progress
+ * */
+class ByteRing {
+public:
+	ByteRing(const ByteRing&) = delete;
+	ByteRing& operator=(const ByteRing&) = delete;
+
+	/*
+	 * @brief Initialize a ring
+	 * @param capacity in bytes, rounded up to a power of two
+	 * */
+	explicit ByteRing(size_t capacity = 16777216);
+
+	/*
+	 * @brief Copy as much of data as fits without waiting
+	 * @return number of bytes written
+	 * */
+	size_t Write(const char* data, size_t size);
+
+	/*
+	 * @brief Copy up to size bytes out without waiting
+	 * @return number of bytes read
+	 * */
+	size_t Read(char* data, size_t size);
+
+	/*
+	 * @brief Write all of data, waiting for the reader to make room
+	 * */
+	void WriteAll(const char* data, size_t size);
+
+	/*
+	 * @brief Wait until at least one byte is available or the writer closed the ring
+	 * @return number of bytes read, 0 once the ring is closed and empty
+	 * */
+	size_t ReadSome(char* data, size_t size);
+
+	/*
+	 * @brief Mark the end of the stream. Called by the writer
+	 * */
+	void Close();
+
+	size_t Capacity() const { return buffer_.size(); }
+
+private:
+	std::vector<char> buffer_ {};
+	size_t mask_ {};
+	// head and tail only ever grow and live on separate cache lines so the two threads do not
+	// invalidate each other on every access
+	alignas(64) std::atomic<size_t> head_ {0};  // bytes written
+	alignas(64) std::atomic<size_t> tail_ {0};  // bytes read
+	std::atomic<bool> closed_ {false};
+	// Futex words bumped whenever head or tail move or the ring closes. A side only pays for the
+	// wake system call while the other one sleeps
+	alignas(64) std::atomic<uint32_t> written_ {0};
+	std::atomic<uint32_t> drained_ {0};
+	std::atomic<bool> reader_waiting_ {false};
+	std::atomic<bool> writer_waiting_ {false};
+
+	void notify_(std::atomic<uint32_t>& word, const std::atomic<bool>& waiting);
+	void wait_(std::atomic<uint32_t>& word, uint32_t seen, std::atomic<bool>& waiting);
+};
+
+}  // namespace libitrace
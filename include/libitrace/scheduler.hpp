@@ -0,0 +1,226 @@
+/*
+ * scheduler.hpp
+ *
+ * A queue for subprocesses that runs a bounded number of them at once.
+ * */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "libitrace/subprocess.hpp"
+
+namespace libitrace {
+
+constexpr uint64_t JOB_MEMORY_BYTES = 512 * 1048576ull;  // a perf script decoding a large trace
+constexpr int JOB_KILL_GRACE_MS     = 2000;               // from SIGTERM to SIGKILL
+constexpr const char* JOBS_ENV      = "ITRACE_JOBS";      // overrides the default slot count
+
+/*
+ * @enum JobPriority
+ * @brief Realtime jobs start at once without taking a slot, for recordings that cannot wait for
+ * decodes to finish. Interactive jobs are queued ahead of Batch jobs, such as the workers of a
+ * parallel decode
+ * */
+enum class JobPriority { Realtime, Interactive, Batch };
+
+enum class JobState { Queued, Running, Done, Cancelled, TimedOut };
+
+/*
+ * @struct JobOptions
+ * @brief timeout counts from submission, so a job still queued at its deadline never runs and a
+ * running one is terminated
+ * */
+struct JobOptions {
+	JobPriority priority {JobPriority::Interactive};
+	std::optional<std::chrono::milliseconds> timeout {std::nullopt};
+};
+
+/*
+ * @struct JobResult
+ * @brief Outcome of a job. process is empty if it never ran or could not be started
+ * */
+struct JobResult {
+	JobState state {JobState::Queued};
+	std::optional<CompletedProcess> process {std::nullopt};
+	double wait_seconds {};  // in the queue
+	double run_seconds {};
+};
+
+/*
+ * @struct SchedulerStats
+ * @brief Totals over every job that finished
+ * */
+struct SchedulerStats {
+	size_t done {};
+	size_t cancelled {};
+	size_t timed_out {};
+	double wait_seconds {};
+	double run_seconds {};
+	double max_wait_seconds {};
+};
+
+/*
+ * @brief Drains and reaps a started job, like Subprocess::Wait, Stream or Splice
+ * */
+using JobBody = std::function<std::optional<CompletedProcess>(const RunningProcess&)>;
+
+class JobScheduler;
+
+/*
+ * @class Job
+ * @brief Handle of a submitted subprocess
+ * */
+class Job {
+public:
+	Job(const Job&) = delete;
+	Job& operator=(const Job&) = delete;
+
+	/*
+	 * @brief Block until the job finished. Rethrows what its body threw
+	 * */
+	JobResult Wait();
+
+	/*
+	 * @brief Drop the job if it is queued, or send it SIGTERM and SIGKILL after JOB_KILL_GRACE_MS
+	 * if it is running
+	 * */
+	void Cancel();
+
+	JobState State() const;
+
+private:
+	friend class JobScheduler;
+	using clock = std::chrono::steady_clock;
+
+	Job(JobScheduler& scheduler, Subprocess process, JobBody body, const JobOptions& options)
+	    : scheduler_ {scheduler},
+	      process_ {std::move(process)},
+	      body_ {std::move(body)},
+	      options_ {options} {}
+
+	JobScheduler& scheduler_;
+	Subprocess process_;
+	JobBody body_ {};
+	JobOptions options_ {};
+
+	// Guarded by the scheduler's lock
+	JobState state_ {JobState::Queued};
+	clock::time_point submitted_ {};
+	clock::time_point started_ {};
+	clock::time_point finished_ {};
+	std::optional<clock::time_point> deadline_ {std::nullopt};
+	std::optional<clock::time_point> kill_at_ {std::nullopt};
+	pid_t pid_ {-1};
+	bool cancelled_ {false};
+	bool timed_out_ {false};
+	std::optional<CompletedProcess> result_ {std::nullopt};
+	std::exception_ptr error_ {};
+};
+
+/*
+ * @class JobScheduler
+ * @brief Runs subprocesses on worker threads, at most Slots() of them at a time apart from
+ * Realtime ones, taking queued jobs by priority and then in submission order. A watchdog thread
+ * terminates jobs past their deadline
+ * */
+class JobScheduler {
+public:
+	JobScheduler(const JobScheduler&) = delete;
+	JobScheduler& operator=(const JobScheduler&) = delete;
+
+	/*
+	 * @param number of jobs to run at once
+	 * */
+	explicit JobScheduler(size_t slots = DefaultSlots());
+
+	/*
+	 * @brief Cancels every job that has not finished and waits for the running ones
+	 * */
+	~JobScheduler();
+
+	/*
+	 * @brief $ITRACE_JOBS if set, otherwise one per core limited to one per JOB_MEMORY_BYTES of
+	 * available memory
+	 * */
+	static size_t DefaultSlots();
+
+	/*
+	 * @brief The scheduler every perf of libitrace goes through
+	 * */
+	static JobScheduler& Global();
+
+	/*
+	 * @brief Queue a subprocess
+	 * @param subprocess to start once the job is admitted
+	 * @param priority and deadline
+	 * @param drains and reaps the started process, Subprocess::Wait with stdout and stderr
+	 * captured if empty
+	 * */
+	std::shared_ptr<Job> Submit(
+	    Subprocess process, const JobOptions& options = {}, JobBody body = {}
+	);
+
+	/*
+	 * @brief Submit and wait, like Subprocess::Run. Throws if the job was cancelled or timed out
+	 * */
+	std::optional<CompletedProcess> Run(Subprocess process, const JobOptions& options = {});
+
+	/*
+	 * @brief Submit and wait with stdout handed to callback, like Subprocess::Stream. Throws if
+	 * the job was cancelled or timed out
+	 * */
+	std::optional<CompletedProcess> Stream(
+	    Subprocess process, const chunk_callback& callback, const JobOptions& options = {}
+	);
+
+	void SetSlots(size_t slots);
+	size_t Slots() const;
+
+	/*
+	 * @brief Cancel every queued and running job
+	 * */
+	void CancelAll();
+
+	SchedulerStats Stats() const;
+
+private:
+	friend class Job;
+	using clock = Job::clock;
+
+	mutable std::mutex lock_ {};
+	std::condition_variable work_ {};   // a job can be admitted
+	std::condition_variable done_ {};   // a job finished
+	std::condition_variable watch_ {};  // a deadline changed
+	std::deque<std::shared_ptr<Job>> queues_[3] {};  // by priority
+	std::vector<std::shared_ptr<Job>> running_ {};
+	size_t slots_ {1};
+	size_t busy_ {0};  // slots taken by running jobs
+	size_t idle_ {0};  // workers waiting for a job
+	bool stop_ {false};
+	SchedulerStats stats_ {};
+	std::vector<std::thread> workers_ {};
+	std::thread watchdog_ {};
+
+	std::shared_ptr<Job> take_();
+	void spawn_worker_();
+	void work_loop_();
+	void run_(const std::shared_ptr<Job>& job);
+	void watch_loop_();
+	void cancel_(Job& job);
+	void terminate_(Job& job, clock::time_point now);
+	void finish_(Job& job, JobState state, clock::time_point now);
+	static std::optional<CompletedProcess> wait_(const std::shared_ptr<Job>& job);
+};
+
+}  // namespace libitrace
@@ -0,0 +1,81 @@
+/*
+ * shard.hpp
+ *
+ * Splits the AUX data of a trace at PSB boundaries into smaller traces that perf can decode
+ * independently of each other.
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "libitrace/perfdata.hpp"
+
+namespace libitrace {
+
+constexpr uint64_t SHARD_MIN_BYTES = 1048576;  // of AUX data, smaller shards are all overhead
+
+/*
+ * @struct TraceShardPiece
+ * @brief A byte range of the AUX data of one AUXTRACE record
+ * */
+struct TraceShardPiece {
+	uint64_t record {};  // offset of the AUXTRACE record in the trace
+	uint64_t begin {};
+	uint64_t end {};
+};
+
+/*
+ * @struct TraceShard
+ * @brief A contiguous range of the AUX stream of one cpu or thread that starts at a PSB, so the
+ * decoder can sync at its start. It ends where the next shard starts or at the end of the stream
+ * */
+struct TraceShard {
+	size_t index {};
+	int cpu {-1};  // -1 for traces recorded per thread
+	pid_t tid {-1};
+	uint64_t bytes {};
+	std::vector<TraceShardPiece> pieces {};
+};
+
+/*
+ * @class TraceSharder
+ * @brief Cuts every AUX stream of a trace into shards of about the same size and writes each one
+ * as a complete perf.data file. A shard file keeps the header, attributes, features and every
+ * sideband record (MMAP, COMM, switches and so on) of the trace and only the AUX data of the shard
+ * */
+class TraceSharder {
+public:
+	TraceSharder() = delete;
+
+	/*
+	 * @brief Map a trace recorded by itrace record
+	 * */
+	explicit TraceSharder(const std::string& trace) : perfdata_ {trace} {}
+
+	/*
+	 * @brief Cut the AUX streams at the first PSB after every target bytes
+	 * @return shards ordered by AUX stream and position in it
+	 * */
+	std::vector<TraceShard> Split(uint64_t target) const;
+
+	/*
+	 * @brief Write a shard as a perf.data file. Throws and removes the file on failure
+	 * */
+	void Write(const TraceShard& shard, const std::string& path) const;
+
+	/*
+	 * @brief Total bytes of AUX data in the trace
+	 * */
+	uint64_t AuxBytes() const;
+
+private:
+	PerfData perfdata_;
+
+	void write_(const TraceShard& shard, int fd) const;
+};
+
+}  // namespace libitrace
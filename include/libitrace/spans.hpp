@@ -0,0 +1,149 @@
+/*
+ * spans.hpp
+ *
+ * Spans of time per thread from entering one function to returning from another, such as the
+ * handling of a request, with the time inside them broken down per function.
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libitrace/histogram.hpp"
+#include "libitrace/interner.hpp"
+#include "libitrace/parser.hpp"
+#include "libitrace/subprocess.hpp"
+
+namespace libitrace {
+
+/*
+ * @struct Span
+ * @brief A span of a thread, times are in nanoseconds. breakdown has the time spent in each
+ * function while the span was open, functions being ids for SpanExtractor::Name, longest first
+ * */
+struct Span {
+	uint64_t start {};
+	uint64_t end {};
+	pid_t tid {-1};
+	std::vector<std::pair<uint32_t, uint64_t>> breakdown {};
+
+	uint64_t Duration() const { return end - start; }
+};
+
+/*
+ * @struct SpanFunction
+ * @brief Time of a function summed over every span
+ * */
+struct SpanFunction {
+	uint32_t function {};
+	uint64_t time {};
+	uint64_t spans {};     // spans it ran in
+	uint64_t max_time {};  // in a single span
+};
+
+/*
+ * @struct SpanStats
+ * @brief Counters of the matching. A start while a span is already open restarts it, and an end
+ * without an open span is unmatched
+ * */
+struct SpanStats {
+	size_t spans {};
+	size_t restarted {};
+	size_t unmatched {};
+	size_t open {};
+};
+
+/*
+ * @class SpanExtractor
+ * @brief Opens a span when a thread enters the start function and closes it when the thread returns
+ * from the end function, in a single pass over the branches of a trace. Time between two branches
+ * of a thread is charged to the function the first one went to, and to [untraced] between a trace
+ * end and the next trace start. State is one cursor per thread plus the breakdown of its open
+ * span, and closed spans are only kept in aggregate
+ * */
+class SpanExtractor {
+public:
+	using Callback = std::function<void(const Span&)>;
+
+	SpanExtractor() = delete;
+	SpanExtractor(const SpanExtractor&) = delete;
+	SpanExtractor& operator=(const SpanExtractor&) = delete;
+
+	/*
+	 * @brief Initialize a SpanExtractor instance
+	 * @param path to trace binary file
+	 * @param function whose entry starts a span
+	 * @param function whose return ends a span, may be the same as start
+	 * */
+	SpanExtractor(const std::string& infile, const std::string& start, const std::string& end);
+
+	/*
+	 * @brief Hand every span to a callback as it closes. The span is only valid during the call
+	 * */
+	void SetCallback(Callback callback) { callback_ = std::move(callback); }
+
+	void Run();
+
+	/*
+	 * @brief Match a single branch. Run feeds every branch of the trace through this
+	 * */
+	void Add(const ScriptRecord& record);
+
+	/*
+	 * @brief Count the spans still open. Run calls this at the end
+	 * */
+	void Finish();
+
+	/*
+	 * @brief Durations of every span
+	 * */
+	const LatencyHistogram& Histogram() const { return histogram_; }
+
+	/*
+	 * @brief Per function time over every span, longest first
+	 * */
+	std::vector<SpanFunction> Functions() const;
+
+	/*
+	 * @brief Total time of every span
+	 * */
+	uint64_t Total() const { return total_; }
+
+	std::string_view Name(uint32_t function) const { return names_[function]; }
+
+	const SpanStats& Stats() const { return stats_; }
+
+private:
+	struct ThreadState {
+		uint32_t function {};  // the thread is in
+		uint64_t last {};      // time of its previous branch
+		bool open {false};
+		Span span {};
+		std::unordered_map<uint32_t, uint64_t> breakdown {};
+	};
+
+	CallScriptArgs args_ {};
+	std::string start_ {};
+	std::string end_ {};
+	uint32_t untraced_ {};
+	Callback callback_ {};
+	LatencyHistogram histogram_ {};
+	uint64_t total_ {0};
+	SpanStats stats_ {};
+
+	StringInterner names_ {};  // of functions
+	std::unordered_map<uint32_t, SpanFunction> functions_ {};
+	std::unordered_map<pid_t, ThreadState> threads_ {};
+
+	void advance_(ThreadState& thread, uint64_t time);
+	void close_(ThreadState& thread, uint64_t time);
+};
+
+}  // namespace libitrace
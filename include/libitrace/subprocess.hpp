@@ -9,14 +9,27 @@
 
 #include <unistd.h>
 
+#include <functional>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "libitrace/ring.hpp"
+
 namespace libitrace {
 
-using cmd     = std::string;
-using arglist = std::vector<std::string>;
+using cmd            = std::string;
+using arglist        = std::vector<std::string>;
+using chunk_callback = std::function<void(std::string_view)>;
+
+constexpr size_t SUBPROCESS_CAPTURE_LIMIT = 64 * 1048576;  // bytes kept per captured stream
+
+/*
+ * @brief How Popen creates the child. Spawn uses posix_spawn, which glibc implements with
+ * CLONE_VFORK so the parent's page tables are never copied. Fork is kept for comparison
+ * */
+enum class Launcher { Fork, Spawn };
 
 /*
  * @struct RunningProcess
@@ -41,7 +54,9 @@ struct CompletedProcess {
 	arglist Arglist {};
 	std::string Stdout {};
 	std::string Stderr {};
-	int Exit {};
+	int Exit {};  // 128 + the signal if one killed it
+	size_t Stdout_bytes {};  // everything written to stdout, including what was not captured
+	bool Truncated {};       // a captured stream hit the capture limit
 };
 
 /*
@@ -62,6 +77,7 @@ public:
 	    : cmd_ {cmd},
 	      args_ {args},
 	      stdoutfd_ {-1},
+	      stdinfd_ {-1},
 	      capturestdout_ {true} {}
 
 	/*
@@ -84,11 +100,47 @@ public:
 	 * @param RunningProcess context returned by Popen
 	 * @param Whether or not to capture stdout and stderr in CompletedProcess
 	 * object
+	 * @param Maximum bytes kept per captured stream
 	 * @return An optional CompletedProcess object with stdout, stderr, and exit
 	 * status
 	 * */
 	static std::optional<CompletedProcess> Wait(
-	    const RunningProcess& context, bool capturestdout = false
+	    const RunningProcess& context, bool capturestdout = false,
+	    size_t limit = SUBPROCESS_CAPTURE_LIMIT
+	);
+
+	/*
+	 * @brief Move the stdout of a process spawned by Popen into fd with splice() so it never
+	 * passes through user space. stderr is captured concurrently. Blocks until the process
+	 * terminates. Throws if fd cannot take the data, after terminating and reaping the process
+	 * @param RunningProcess context returned by Popen
+	 * @param file descriptor to move stdout into
+	 * @param optional pipe that also receives a copy of stdout through tee()
+	 * @return An optional CompletedProcess object with stderr and exit status
+	 * */
+	static std::optional<CompletedProcess> Splice(
+	    const RunningProcess& context, int fd, int teefd = -1,
+	    size_t limit = SUBPROCESS_CAPTURE_LIMIT
+	);
+
+	/*
+	 * @brief Hand the stdout of a process spawned by Popen to callback in chunks as it arrives.
+	 * stderr is captured concurrently. Blocks until the process terminates
+	 * @param RunningProcess context returned by Popen
+	 * @param callback invoked with each chunk read from stdout. The view is only valid for the call
+	 * @return An optional CompletedProcess object with stderr and exit status
+	 * */
+	static std::optional<CompletedProcess> Stream(
+	    const RunningProcess& context, const chunk_callback& callback,
+	    size_t limit = SUBPROCESS_CAPTURE_LIMIT
+	);
+
+	/*
+	 * @brief Like Stream with a callback, but stdout is written into ring for a consumer thread.
+	 * The ring is closed once stdout reaches end of file
+	 * */
+	static std::optional<CompletedProcess> Stream(
+	    const RunningProcess& context, ByteRing& ring, size_t limit = SUBPROCESS_CAPTURE_LIMIT
 	);
 
 	/*
@@ -98,11 +150,33 @@ public:
 	 * */
 	int SetStdout(int fd);
 
+	/*
+	 * @brief set the stdin to a file descriptor, such as the read end of a pipe fed by another
+	 * process. The child inherits stdin from the parent by default
+	 * */
+	void SetStdin(int fd);
+
+	/*
+	 * @brief Cap the bytes of stdout and stderr kept by Run. Output past the cap is still drained
+	 * so the child never blocks, but it is discarded
+	 * */
+	void SetCaptureLimit(size_t bytes);
+
+	size_t CaptureLimit() const { return capturelimit_; }
+
+	void SetLauncher(Launcher launcher);
+
 private:
 	cmd cmd_ {};
 	arglist args_ {};
 	int stdoutfd_ {};
+	int stdinfd_ {};
 	bool capturestdout_ {};
+	size_t capturelimit_ {SUBPROCESS_CAPTURE_LIMIT};
+	Launcher launcher_ {Launcher::Spawn};
+
+	pid_t fork_(char** argv, int stdoutfd, int stderrfd);
+	pid_t spawn_(char** argv, int stdoutfd, int stderrfd);
 };
 
 }  // namespace libitrace
@@ -0,0 +1,202 @@
+/*
+ * symbols.hpp
+ *
+ * A native ELF symbol table reader with an address lookup table laid out for fast search.
+ * */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace libitrace {
+
+constexpr char SYMCACHE_MAGIC[8]      = {'I', 'T', 'R', 'A', 'C', 'E', 'S', 'Y'};
+constexpr uint32_t SYMCACHE_VERSION   = 1;
+constexpr const char* SYMCACHE_SUFFIX = ".sym";
+
+/*
+ * @struct Symbol
+ * @brief A function symbol. start is the virtual address in the ELF file, not the address it is
+ * loaded at
+ * */
+struct Symbol {
+	std::string_view name {};
+	uint64_t start {};
+	uint64_t size {};
+};
+
+/*
+ * @struct ResolvedSymbol
+ * @brief A runtime address resolved by SymbolResolver
+ * */
+struct ResolvedSymbol {
+	std::string_view name {};
+	std::string_view dso {};
+	uint64_t offset {};  // from the start of the symbol
+};
+
+/*
+ * Layout of a cache file, named <build id>.sym:
+ *   SymbolCacheHeader
+ *   SymbolCacheEntry per symbol, sorted by start
+ *   ElfSegment per loadable segment
+ *   names, each terminated by a NUL
+ * */
+struct SymbolCacheHeader {
+	char magic[8] {};
+	uint32_t version {};
+	uint32_t type {};  // ELF e_type
+	uint64_t symbols {};
+	uint64_t segments {};
+	uint64_t names_size {};
+};
+
+struct SymbolCacheEntry {
+	uint64_t start {};
+	uint64_t size {};
+	uint32_t name {};  // offset into the names
+	uint32_t name_size {};
+};
+
+/*
+ * @struct ElfSegment
+ * @brief A PT_LOAD program header, used to find the load bias of a mapping
+ * */
+struct ElfSegment {
+	uint64_t vaddr {};
+	uint64_t offset {};
+	uint64_t filesz {};
+};
+
+/*
+ * @class ElfSymbols
+ * @brief The function symbols of one ELF file from .symtab and .dynsym. Symbols are sorted by
+ * address and their starts are copied into an Eytzinger (breadth first) ordered array, so a lookup
+ * is a branch free descent whose first levels share cache lines. Tables are cached on disk by
+ * build id so a binary is only parsed once
+ * */
+class ElfSymbols {
+public:
+	ElfSymbols() = delete;
+	ElfSymbols(const ElfSymbols&) = delete;
+	ElfSymbols& operator=(const ElfSymbols&) = delete;
+
+	/*
+	 * @brief Load the symbols of an ELF file. Throws if it is not a 64 bit ELF file
+	 * @param path to the ELF file
+	 * @param directory of the cache, no caching if empty
+	 * */
+	explicit ElfSymbols(const std::string& path, const std::string& cachedir = DefaultCacheDir());
+
+	/*
+	 * @brief symbols directory of DecodeCache::DefaultDir()
+	 * */
+	static std::string DefaultCacheDir();
+
+	/*
+	 * @brief Read the GNU build id note of an ELF file as hex
+	 * @return std::nullopt if the file has none
+	 * */
+	static std::optional<std::string> ReadBuildId(const std::string& path);
+
+	/*
+	 * @brief Find the function containing a file virtual address
+	 * */
+	std::optional<Symbol> Lookup(uint64_t addr) const;
+
+	/*
+	 * @brief The i-th symbol in address order
+	 * */
+	Symbol At(size_t i) const { return symbol_(symbols_[i]); }
+
+	/*
+	 * @brief Find a function by its symbol name, as written in the symbol table (mangled for C++)
+	 * */
+	std::optional<Symbol> Find(std::string_view name) const;
+
+	/*
+	 * @brief Load bias of a mapping of this file, i.e. runtime address minus file virtual address
+	 * @param runtime address the mapping starts at
+	 * @param file offset the mapping starts at
+	 * */
+	uint64_t LoadBias(uint64_t start, uint64_t offset) const;
+
+	/*
+	 * @brief Offset in the file of a file virtual address, which is what address filters on a
+	 * file take
+	 * @return std::nullopt if no loadable segment holds the address
+	 * */
+	std::optional<uint64_t> FileOffset(uint64_t addr) const;
+
+	const std::string& Path() const { return path_; }
+	const std::string& BuildId() const { return buildid_; }
+	size_t Size() const { return symbols_.size(); }
+	bool FromCache() const { return fromcache_; }
+
+private:
+	std::string path_ {};
+	std::string buildid_ {};
+	uint32_t type_ {};
+	bool fromcache_ {false};
+	std::vector<SymbolCacheEntry> symbols_ {};
+	std::vector<ElfSegment> segments_ {};
+	std::string names_ {};
+
+	// eytzinger_[1..n] holds the starts in breadth first order and rank_[k] the sorted index of
+	// slot k. Slot 0 is unused so the children of k are 2k and 2k + 1
+	std::vector<uint64_t> eytzinger_ {};
+	std::vector<uint32_t> rank_ {};
+
+	void parse_(const uint8_t* data, size_t size);
+	bool load_cache_(const std::string& file);
+	void store_cache_(const std::string& dir) const;
+	void build_eytzinger_();
+	size_t fill_eytzinger_(size_t next, size_t slot);
+	Symbol symbol_(const SymbolCacheEntry& entry) const;
+};
+
+/*
+ * @class SymbolResolver
+ * @brief Resolves runtime addresses of a process through the ELF files mapped into it
+ * */
+class SymbolResolver {
+public:
+	explicit SymbolResolver(const std::string& cachedir = ElfSymbols::DefaultCacheDir())
+	    : cachedir_ {cachedir} {}
+
+	/*
+	 * @brief Add a file mapped at [start, end) from file offset
+	 * */
+	void AddMapping(const std::string& path, uint64_t start, uint64_t end, uint64_t offset);
+
+	/*
+	 * @brief Add every executable file mapping of a running process from /proc/<pid>/maps
+	 * */
+	void AddProcess(pid_t pid);
+
+	/*
+	 * @brief Find the function containing a runtime address
+	 * */
+	std::optional<ResolvedSymbol> Lookup(uint64_t addr) const;
+
+private:
+	struct Mapping {
+		uint64_t start {};
+		uint64_t end {};
+		uint64_t bias {};
+		const ElfSymbols* symbols {nullptr};
+	};
+
+	std::string cachedir_ {};
+	std::unordered_map<std::string, std::unique_ptr<ElfSymbols>> objects_ {};
+	std::vector<Mapping> mappings_ {};  // sorted by start
+};
+
+}  // namespace libitrace
@@ -0,0 +1,99 @@
+/*
+ * traceindex.hpp
+ *
+ * A sparse timestamp index stored next to a decoded text trace so time ranges can be sliced out
+ * of it without running perf script again.
+ * */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace libitrace {
+
+constexpr char TRACEINDEX_MAGIC[8]      = {'I', 'T', 'R', 'A', 'C', 'E', 'I', 'X'};
+constexpr uint32_t TRACEINDEX_VERSION   = 1;
+constexpr size_t TRACEINDEX_STRIDE      = 1024;  // records between index entries
+constexpr const char* TRACEINDEX_SUFFIX = ".idx";
+
+/*
+ * @struct TraceIndexHeader
+ * @brief Start of the sidecar. The size and mtime of the trace detect a stale index
+ * */
+struct TraceIndexHeader {
+	char magic[8] {};
+	uint32_t version {};
+	uint32_t stride {};
+	uint64_t trace_size {};
+	uint64_t trace_mtime {};  // nanoseconds
+	uint64_t entries {};
+};
+
+/*
+ * @struct TraceIndexEntry
+ * @brief Timestamp and byte offset of every stride-th sample line
+ * */
+struct TraceIndexEntry {
+	uint64_t time {};
+	uint64_t offset {};
+};
+
+/*
+ * @class TraceIndex
+ * @brief Maps a decoded text trace and its sidecar index. A time range is found by binary
+ * searching the index and then parsing at most one stride of lines on either end
+ * */
+class TraceIndex {
+public:
+	TraceIndex() = delete;
+	TraceIndex(const TraceIndex&) = delete;
+	TraceIndex& operator=(const TraceIndex&) = delete;
+
+	/*
+	 * @brief Map a trace and load its sidecar. Throws if HasIndex is false
+	 * @param path to the text trace, not the sidecar
+	 * */
+	explicit TraceIndex(const std::string& trace);
+	~TraceIndex();
+
+	/*
+	 * @brief Scan a text trace and write its sidecar. Traces that are not in timestamp order get
+	 * no sidecar since they cannot be binary searched
+	 * @param path to the text trace
+	 * @param number of records between index entries
+	 * */
+	static void Build(const std::string& trace, size_t stride = TRACEINDEX_STRIDE);
+
+	/*
+	 * @brief Check if a trace has a sidecar that is up to date with it
+	 * */
+	static bool HasIndex(const std::string& trace);
+
+	static std::string SidecarPath(const std::string& trace) { return trace + TRACEINDEX_SUFFIX; }
+
+	/*
+	 * @brief Find the lines of every sample within [start, end] along with the source lines
+	 * interleaved after them
+	 * @param start time in nanoseconds, unbounded if not given
+	 * @param end time in nanoseconds, unbounded if not given
+	 * @return view into the mapped trace, valid for the lifetime of the index
+	 * */
+	std::string_view Slice(
+	    std::optional<uint64_t> start = std::nullopt, std::optional<uint64_t> end = std::nullopt
+	) const;
+
+	size_t Entries() const { return entries_.size(); }
+
+private:
+	const char* data_ {nullptr};
+	size_t size_ {0};
+	std::vector<TraceIndexEntry> entries_ {};
+
+	template <typename Pred>
+	size_t scan_(size_t from, Pred pred) const;
+};
+
+}  // namespace libitrace
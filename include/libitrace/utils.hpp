@@ -1,9 +1,13 @@
 #pragma once
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 
 #include "libitrace/subprocess.hpp"
 
@@ -21,8 +25,37 @@ namespace libitrace {
 		exit(EXIT_FAILURE); \
 	} while (0)
 
+/*
+ * @brief Throw a std::runtime_error of what and the description of error. For failures the
+ * caller can recover from, where die would end the process
+ * */
+[[noreturn]] void throw_errno(const std::string& what, int error = errno);
+
 void print_perf_args(const libitrace::arglist& perfargs);
 std::string format_args(const libitrace::arglist& args);
 std::string timespec_to_string(const timespec& ts);
+uint64_t timespec_to_ns(const timespec& ts);
+timespec ns_to_timespec(uint64_t ns);
+
+/*
+ * @brief Now on CLOCK_MONOTONIC, the clock of a trace recorded with -k CLOCK_MONOTONIC
+ * */
+uint64_t monotonic_ns();
+
+/*
+ * @brief Parse a <seconds>.<fraction> timestamp as printed by perf into nanoseconds
+ * @return std::nullopt if the string is not a timestamp
+ * */
+std::optional<uint64_t> parse_timestamp(std::string_view str);
+
+/*
+ * @brief Write all of data to fd, retrying short and interrupted writes. Throws on failure
+ * */
+void write_all(int fd, const void* data, size_t size);
+
+/*
+ * @brief Create a directory and any missing parents. Throws on failure
+ * */
+void make_dirs(const std::string& path);
 
 }  // namespace libitrace
@@ -0,0 +1,123 @@
+#include "calltree.hpp"
+
+#include "libitrace/calltree.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::cout, std::cerr, std::endl;
+
+namespace {
+
+std::vector<uint32_t> children(const libitrace::CallTree& tree, uint32_t id) {
+	std::vector<uint32_t> ids {};
+	for (uint32_t child = tree.Node(id).first_child; child != libitrace::CALLTREE_NONE;
+	     child          = tree.Node(child).next_sibling)
+		ids.push_back(child);
+	std::sort(ids.begin(), ids.end(), [&tree](uint32_t a, uint32_t b) {
+		return tree.Node(a).inclusive > tree.Node(b).inclusive;
+	});
+	return ids;
+}
+
+std::string label(const libitrace::CallTree& tree, uint32_t id) {
+	uint32_t function = tree.Node(id).function;
+	std::string name {tree.Name(function)};
+	if (!tree.Dso(function).empty()) {
+		name += " (";
+		name += tree.Dso(function);
+		name += ')';
+	}
+	return name;
+}
+
+void print_tree(
+    const libitrace::CallTree& tree, uint32_t id, size_t depth, size_t max_depth, uint64_t min_time,
+    uint64_t total
+) {
+	char buf[128] {};
+	for (uint32_t child : children(tree, id)) {
+		const auto& node = tree.Node(child);
+		if (node.inclusive < min_time) break;
+
+		std::snprintf(
+		    buf, sizeof(buf), "%7.2f%% %16" PRIu64 " %16" PRIu64 " %12" PRIu64 "  ",
+		    total > 0 ? 100.0 * node.inclusive / total : 0.0, node.inclusive, node.exclusive,
+		    node.calls
+		);
+		cout << buf << std::string(depth * 2, ' ') << label(tree, child) << '\n';
+		if (depth + 1 < max_depth) print_tree(tree, child, depth + 1, max_depth, min_time, total);
+	}
+}
+
+// One line per call path with exclusive time, the input format of flamegraph tools
+void print_folded(const libitrace::CallTree& tree, uint32_t id, std::string& path) {
+	size_t length = path.size();
+	for (uint32_t child : children(tree, id)) {
+		const auto& node = tree.Node(child);
+		if (!path.empty()) path += ';';
+		path += tree.Name(node.function);
+		if (node.exclusive > 0) cout << path << ' ' << node.exclusive << '\n';
+		print_folded(tree, child, path);
+		path.resize(length);
+	}
+}
+
+}  // namespace
+
+void calltree(const argparse::ArgumentParser& args) {
+	std::string infile {};
+	try {
+		infile = args.get<std::string>("input");
+	} catch (std::logic_error& e) {
+		cerr << e.what() << "\n";
+		cerr << args;
+		exit(1);
+	}
+
+	int max_depth = args.get<int>("max-depth");
+	double min_percent = args.get<double>("min-percent");
+	if (max_depth < 0 || min_percent < 0) {
+		cerr << "Depth and percentage must not be negative" << endl;
+		exit(1);
+	}
+
+	libitrace::CallTree tree {infile};
+	try {
+		tree.Run();
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+
+	if (args.get<bool>("folded")) {
+		std::string path {};
+		print_folded(tree, tree.Root(), path);
+		cout.flush();
+		return;
+	}
+
+	uint64_t total = tree.Node(tree.Root()).inclusive;
+	char buf[128] {};
+	std::snprintf(
+	    buf, sizeof(buf), "%8s %16s %16s %12s  %s", "%", "inclusive ns", "exclusive ns", "calls",
+	    "call path"
+	);
+	cout << buf << '\n';
+	print_tree(
+	    tree, tree.Root(), 0, max_depth == 0 ? SIZE_MAX : max_depth,
+	    static_cast<uint64_t>(total * min_percent / 100), total
+	);
+
+	const auto& stats = tree.Stats();
+	std::snprintf(
+	    buf, sizeof(buf), "[ %zu calls, %zu returns, %zu frames unwound, %zu nodes ]", stats.calls,
+	    stats.returns, stats.unwound, tree.Nodes()
+	);
+	cout << buf << endl;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <argparse/argparse.hpp>
+
+void calltree(const argparse::ArgumentParser& args);
@@ -1,8 +1,17 @@
+#include "decode.hpp"
+
 #include "libitrace/decode.hpp"
 
-#include "decode.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <stdexcept>
+#include <tuple>
+
+#include "libitrace/utils.hpp"
 
-using std::cerr, std::endl;
+using std::cout, std::cerr, std::endl;
 
 struct timespec parse_time(std::string time) {
 	size_t split = time.find(".");
@@ -68,7 +77,76 @@ std::pair<std::optional<struct timespec>, std::optional<struct timespec>> parse_
 	return std::make_pair(start, end);
 }
 
+// Validates the decode options once and returns what applies them to a Decode
+libitrace::BatchDecode::Configure decode_options(const argparse::ArgumentParser& args) {
+	std::optional<struct timespec> start {std::nullopt};
+	std::optional<struct timespec> end {std::nullopt};
+	bool time = args.is_used("time");
+	if (time) std::tie(start, end) = parse_time_input(args.get<std::string>("time"));
+
+	int jobs {1};
+	if (args.is_used("jobs")) {
+		jobs = args.get<int>("jobs");
+		if (jobs < 1) {
+			cerr << "Number of jobs must be at least 1" << endl;
+			exit(1);
+		}
+	}
+
+	std::string split = args.get<std::string>("split");
+	if (split != "psb" && split != "time") {
+		cerr << "Split must be psb or time" << endl;
+		exit(1);
+	}
+
+	std::string format = args.get<std::string>("format");
+	if (format != "bin" && format != "text") {
+		cerr << "Format must be text or bin" << endl;
+		exit(1);
+	}
+	if (format == "bin" && args.is_used("src")) {
+		cerr << "A bin trace only keeps samples, --src cannot be used with it" << endl;
+		exit(1);
+	}
+
+	if (args.is_used("cache-size") && !args.get<bool>("cache")) {
+		cerr << "--cache-size only applies with --cache" << endl;
+		exit(1);
+	}
+
+	std::optional<uint64_t> cache_bytes {std::nullopt};
+	if (args.get<bool>("cache")) {
+		cache_bytes = libitrace::DECODECACHE_MAX_BYTES;
+		if (args.is_used("cache-size")) {
+			int mib = args.get<int>("cache-size");
+			if (mib < 0) {
+				cerr << "Cache size must not be negative" << endl;
+				exit(1);
+			}
+			cache_bytes = static_cast<uint64_t>(mib) << 20;
+		}
+	}
+
+	bool src   = args.is_used("src");
+	bool index = args.get<bool>("index");
+	return [=](libitrace::Decode& instance) {
+		instance.UseXed();
+		if (time) instance.AddTimeRange(start, end);
+		if (src) instance.AddSource();
+		if (jobs > 1) instance.SetJobs(jobs);
+		if (split == "time") instance.SetSplit(libitrace::DecodeSplit::Time);
+		if (format == "bin") instance.SetFormat(libitrace::DecodeFormat::Bin);
+		if (index) instance.WriteIndex();
+		if (cache_bytes) instance.UseCache(libitrace::DecodeCache::DefaultDir(), *cache_bytes);
+	};
+}
+
 void decode(const argparse::ArgumentParser& args) {
+	if (args.is_used("batch")) {
+		decode_batch(args);
+		return;
+	}
+
 	std::string infile {};
 	std::string outfile {};
 
@@ -81,15 +159,138 @@ void decode(const argparse::ArgumentParser& args) {
 		exit(1);
 	}
 
-	libitrace::Decode instance(infile, outfile);
-	instance.UseXed();
+	libitrace::Decode instance {infile, outfile};
+	try {
+		decode_options(args)(instance);
+		instance.Run();
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+
+	print_worker_stats(instance.WorkerStats());
+	if (instance.Cache()) print_cache_stats(*instance.Cache());
+}
+
+void decode_batch(const argparse::ArgumentParser& args) {
+	for (const char* single : {"input", "output"}) {
+		if (args.is_used(single)) {
+			cerr << "--batch decodes every trace into <trace>.trace, --" << single
+			     << " cannot be used with it" << endl;
+			exit(1);
+		}
+	}
+
+	libitrace::BatchDecode batch {args.get<std::string>("batch"), decode_options(args)};
+	batch.SetForce(args.get<bool>("force"));
+
+	std::vector<libitrace::BatchEntry> entries {};
+	auto start = std::chrono::steady_clock::now();
+	try {
+		entries = batch.Run(print_batch_entry);
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+	double seconds =
+	    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-	if (args.is_used("time")) {
-		auto [start, end] = parse_time_input(args.get<std::string>("time"));
-		instance.AddTimeRange(start, end);
+	size_t decoded {}, fresh {}, failed {};
+	uint64_t bytes {};
+	for (const auto& entry : entries) {
+		if (entry.status == libitrace::BatchStatus::Decoded) {
+			decoded++;
+			bytes += entry.bytes;
+		} else if (entry.status == libitrace::BatchStatus::UpToDate) {
+			fresh++;
+		} else {
+			failed++;
+		}
 	}
 
-    if (args.is_used("src")) instance.AddSource();
+	double mib = bytes / 1048576.0;
+	char buf[256] {};
+	std::snprintf(
+	    buf, sizeof(buf),
+	    "[ batch: %zu decoded, %zu up to date, %zu failed, %.2f MiB trace in %.2f s (%.2f MiB/s) ]",
+	    decoded, fresh, failed, mib, seconds, seconds > 0 ? mib / seconds : 0.0
+	);
+	cout << buf << endl;
+	if (failed > 0) exit(1);
+}
+
+void print_batch_entry(const libitrace::BatchEntry& entry) {
+	char buf[512] {};
+	if (entry.status == libitrace::BatchStatus::UpToDate) {
+		std::snprintf(buf, sizeof(buf), "[ up to date: %s ]", entry.outfile.c_str());
+	} else if (entry.status == libitrace::BatchStatus::Failed) {
+		std::string error = entry.error.substr(0, entry.error.find('\n'));
+		std::snprintf(buf, sizeof(buf), "[ failed: %s: %s ]", entry.infile.c_str(), error.c_str());
+	} else {
+		double mib = entry.bytes / 1048576.0;
+		std::snprintf(
+		    buf, sizeof(buf), "[ %s: %.2f MiB trace, %.2f MiB in %.2f s (%.2f MiB/s)%s ]",
+		    entry.infile.c_str(), mib, entry.out_bytes / 1048576.0, entry.seconds,
+		    entry.seconds > 0 ? mib / entry.seconds : 0.0, entry.cached ? ", cached" : ""
+		);
+	}
+	cout << buf << endl;
+}
+
+void print_cache_stats(const libitrace::DecodeCache& cache) {
+	const auto& stats = cache.Stats();
+	if (stats.hits + stats.misses == 0) return;
+
+	auto totals = cache.Totals();
+	char buf[256] {};
+	std::snprintf(
+	    buf, sizeof(buf),
+	    "[ cache %s: %.2f MiB saved (all runs: %" PRIu64 " hits, %" PRIu64 " misses, %.2f MiB "
+	    "saved) ]",
+	    stats.hits ? "hit" : "miss", stats.bytes_saved / 1048576.0, totals.hits, totals.misses,
+	    totals.bytes_saved / 1048576.0
+	);
+	cout << buf << endl;
+}
+
+void print_worker_stats(const std::vector<libitrace::DecodeWorkerStats>& stats) {
+	if (stats.empty()) return;
+
+	auto window = [](const std::optional<struct timespec>& ts) {
+		return ts ? libitrace::timespec_to_string(*ts) : std::string {};
+	};
+
+	size_t bytes {};
+	double slowest {};
+	double queued {};
+	char buf[256] {};
+	for (const auto& worker : stats) {
+		double mib = worker.bytes / 1048576.0;
+		if (worker.aux_bytes > 0) {
+			std::snprintf(
+			    buf, sizeof(buf),
+			    "[ shard %zu cpu %d: %.2f MiB trace, %.2f MiB in %.2f s (%.2f MiB/s) ]",
+			    worker.window, worker.cpu, worker.aux_bytes / 1048576.0, mib, worker.seconds,
+			    worker.seconds > 0 ? mib / worker.seconds : 0.0
+			);
+		} else {
+			std::snprintf(
+			    buf, sizeof(buf), "[ worker %zu %s,%s: %.2f MiB in %.2f s (%.2f MiB/s) ]",
+			    worker.window, window(worker.start_time).c_str(), window(worker.end_time).c_str(),
+			    mib, worker.seconds, worker.seconds > 0 ? mib / worker.seconds : 0.0
+			);
+		}
+		cout << buf << endl;
+
+		bytes += worker.bytes;
+		slowest = std::max(slowest, worker.seconds);
+		queued  = std::max(queued, worker.queued);
+	}
 
-	instance.Run();
+	double mib = bytes / 1048576.0;
+	std::snprintf(
+	    buf, sizeof(buf), "[ total: %.2f MiB in %.2f s (%.2f MiB/s), %.2f s queued at most ]", mib,
+	    slowest, slowest > 0 ? mib / slowest : 0.0, queued
+	);
+	cout << buf << endl;
 }
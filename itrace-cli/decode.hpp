@@ -1,5 +1,13 @@
 #pragma once
 
 #include <argparse/argparse.hpp>
+#include <vector>
+
+#include "libitrace/batchdecode.hpp"
+#include "libitrace/decode.hpp"
 
 void decode(const argparse::ArgumentParser& args);
+void decode_batch(const argparse::ArgumentParser& args);
+void print_batch_entry(const libitrace::BatchEntry& entry);
+void print_worker_stats(const std::vector<libitrace::DecodeWorkerStats>& stats);
+void print_cache_stats(const libitrace::DecodeCache& cache);
@@ -1,21 +1,14 @@
 #include "export.hpp"
 
-#include <unistd.h>
+#include "libitrace/export.hpp"
 
+#include <cstdio>
 #include <cstdlib>
+#include <stdexcept>
 
-#include "libitrace/subprocess.hpp"
-#include "libitrace/utils.hpp"
-
-using std::cerr, std::endl;
+using std::cout, std::cerr, std::endl;
 
 void exporter(const argparse::ArgumentParser& args) {
-	if (access(FILTER_PATH, F_OK) != 0) {
-		cerr << "libperf2perfetto.so not found in /usr/local/lib. Run ./setup.py --export --install"
-		     << endl;
-		exit(1);
-	}
-
 	std::string infile {};
 	std::string outfile {};
 	try {
@@ -27,15 +20,20 @@ void exporter(const argparse::ArgumentParser& args) {
 		exit(1);
 	}
 
-	libitrace::arglist perfargs = {"script",     "-i",
-	                               infile,       "--itrace=bei0ns",
-	                               "--dlfilter", std::string(FILTER_PATH),
-	                               "--dlarg",    outfile,
-	                               "--dlarg",    "t"};
-	libitrace::print_perf_args(perfargs);
+	libitrace::Export instance {infile, outfile};
+	try {
+		instance.Run();
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
 
-	libitrace::Subprocess perfscript {"perf", perfargs};
-	auto res = perfscript.Run();
-	if (!res) throw std::runtime_error("Error decoding trace data");
-	if (res->Exit != 0) throw std::runtime_error(res->Stderr);
+	const auto& stats = instance.Stats();
+	char buf[256] {};
+	std::snprintf(
+	    buf, sizeof(buf), "[ %zu events from %zu samples, %.2f MiB in %.2f s (%.0f events/s) ]",
+	    stats.events, stats.samples, stats.bytes / 1048576.0, stats.seconds,
+	    stats.seconds > 0 ? stats.events / stats.seconds : 0.0
+	);
+	cout << buf << endl;
 }
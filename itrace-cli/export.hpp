@@ -2,6 +2,4 @@
 
 #include <argparse/argparse.hpp>
 
-constexpr const char* FILTER_PATH = "/usr/local/lib/libperf2perfetto.so";
-
 void exporter(const argparse::ArgumentParser& args);
@@ -0,0 +1,125 @@
+#include "info.hpp"
+
+#include "libitrace/info.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using std::cout, std::cerr, std::endl;
+
+namespace {
+
+std::string mib(uint64_t bytes) {
+	char buf[32] {};
+	std::snprintf(buf, sizeof(buf), "%.1f MiB", bytes / 1048576.0);
+	return buf;
+}
+
+std::string ms(uint64_t ns) {
+	char buf[32] {};
+	std::snprintf(buf, sizeof(buf), "%.3f ms", ns / 1e6);
+	return buf;
+}
+
+template <typename T>
+std::string join(const T& items, const char* separator) {
+	std::string joined {};
+	for (const auto& item : items) {
+		if constexpr (std::is_arithmetic_v<typename T::value_type>) {
+			if (!joined.empty()) joined += separator;
+			joined += std::to_string(item);
+		} else if (!item.empty()) {
+			if (!joined.empty()) joined += separator;
+			joined += item;
+		}
+	}
+	return joined;
+}
+
+void row(const char* label, const std::string& value) {
+	if (value.empty()) return;
+	char buf[32] {};
+	std::snprintf(buf, sizeof(buf), "%-12s", label);
+	cout << buf << value << '\n';
+}
+
+}  // namespace
+
+void info(const argparse::ArgumentParser& args) {
+	std::string infile {};
+	try {
+		infile = args.get<std::string>("input");
+	} catch (std::logic_error& e) {
+		cerr << e.what() << "\n";
+		cerr << args;
+		exit(1);
+	}
+
+	libitrace::TraceInfo traceinfo {infile};
+	try {
+		traceinfo.Run();
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+	const auto& s = traceinfo.Summary();
+
+	row("file", s.path + ", " + mib(s.file_size));
+	row("perf", s.perf_version);
+	row("host", join(std::vector<std::string> {s.hostname, s.os_release, s.arch}, " "));
+	if (s.cpus_online) {
+		row("cpu", s.cpu_desc + (s.cpu_desc.empty() ? "" : ", ") + std::to_string(s.cpus_online) +
+		               " online");
+	}
+	row("command", join(s.cmdline, " "));
+	row("events", join(s.events, ", "));
+
+	if (auto duration = s.Duration()) {
+		char buf[96] {};
+		std::snprintf(
+		    buf, sizeof(buf), " (%" PRIu64 ".%09" PRIu64 " to %" PRIu64 ".%09" PRIu64 ")",
+		    *s.first_time / 1000000000, *s.first_time % 1000000000, *s.last_time / 1000000000,
+		    *s.last_time % 1000000000
+		);
+		row("duration", ms(*duration) + buf);
+	}
+
+	if (!s.cpus.empty())
+		row("cpus", join(s.cpus, ",") + " (" + std::to_string(s.cpus.size()) + ")");
+	row("threads", std::to_string(s.tids.size()) + " in " + std::to_string(s.pids.size()) +
+	                   " processes");
+	for (const auto& [tid, comm] : s.comms) row("", std::to_string(tid) + " " + comm);
+	row("records", std::to_string(s.records) + ", " + std::to_string(s.mmaps) + " mmaps, " +
+	                   std::to_string(s.switches) + " context switches");
+
+	row("aux data", mib(s.aux_bytes) + " in " + std::to_string(s.aux_buffers) + " buffers");
+	if (s.aux_bytes_per_cpu.size() > 1) {
+		for (const auto& [cpu, bytes] : s.aux_bytes_per_cpu)
+			row("", "cpu " + std::to_string(cpu) + " " + mib(bytes));
+	}
+
+	if (!s.HasLoss()) {
+		row("data loss", "none");
+		cout.flush();
+		return;
+	}
+
+	row("data loss", "WARNING the decoded trace will have gaps");
+	if (s.aux_truncated) {
+		row("", std::to_string(s.aux_truncated) + " of " + std::to_string(s.aux_records) +
+		            " AUX records truncated, the trace buffer filled up faster than perf wrote it");
+	}
+	if (s.aux_collision)
+		row("", std::to_string(s.aux_collision) + " AUX records with sample collisions");
+	if (s.lost_records) {
+		row("", std::to_string(s.lost_events) + " sideband events lost in " +
+		            std::to_string(s.lost_records) + " LOST records");
+	}
+	if (s.lost_samples) row("", std::to_string(s.lost_samples) + " samples lost");
+	cout.flush();
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <argparse/argparse.hpp>
+
+void info(const argparse::ArgumentParser& args);
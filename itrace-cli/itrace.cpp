@@ -4,25 +4,24 @@
 #include <iostream>
 #include <string>
 
+#include "calltree.hpp"
 #include "decode.hpp"
 #include "export.hpp"
-#include "libitrace/subprocess.hpp"
+#include "info.hpp"
+#include "latency.hpp"
+#include "libitrace/ptcaps.hpp"
 #include "record.hpp"
+#include "spans.hpp"
+#include "stats.hpp"
 
 using std::cerr;
 
-bool intelpt_available() {
-	libitrace::Subprocess p {
-	    "perf", {"list", "|", "grep", "intel_pt"}
-	};
-	auto res {p.Run()};
-	if (res && res->Exit == 0 && !res->Stdout.empty()) return true;
-	return false;
-}
-
 void parseargs(
     int argc, char** argv, argparse::ArgumentParser& program, argparse::ArgumentParser& recordargs,
-    argparse::ArgumentParser& decodeargs, argparse::ArgumentParser& exportargs
+    argparse::ArgumentParser& decodeargs, argparse::ArgumentParser& exportargs,
+    argparse::ArgumentParser& statsargs, argparse::ArgumentParser& calltreeargs,
+    argparse::ArgumentParser& infoargs, argparse::ArgumentParser& latencyargs,
+    argparse::ArgumentParser& spansargs
 ) {
 	recordargs.add_description("Record the trace of a program");
 	recordargs.add_argument("target")
@@ -32,19 +31,89 @@ void parseargs(
 	    .help("Output file of trace")
 	    .default_value(std::string("itrace.data"));
 	recordargs.add_argument("-p", "--pid").help("Process id to attach to").scan<'i', int>();
+	recordargs.add_argument("--pids")
+	    .help(
+	        "Comma separated process ids to attach to together, each traced into <output>.<pid> "
+	        "with a manifest in <output>.manifest"
+	    );
+	recordargs.add_argument("--cgroup")
+	    .help("Attach to every process of a cgroup like --pids, relative to /sys/fs/cgroup");
 	recordargs.add_argument("-s", "--filter-symbol").help("Symbol to filter trace data on");
 	recordargs.add_argument("-a", "--filter-instr-ptr")
 	    .help(
 	        "Instruction pointer addresses to filter trace data on. Formatted "
 	        "as <start>,<end> where addresses are in hex"
 	    );
+	recordargs.add_argument("--filter-from")
+	    .help(
+	        "Trace only the hottest functions of a previous trace of the program, or of itrace "
+	        "stats --csv output of one, in as many ranges as there are address filters"
+	    );
+	recordargs.add_argument("--filter-coverage")
+	    .help("Share of the previous profile --filter-from aims to cover")
+	    .default_value(0.95)
+	    .scan<'g', double>();
+	recordargs.add_argument("--pt-profile")
+	    .help(
+	        "Packet configuration picked from the capabilities of this machine: low-overhead, "
+	        "balanced or cycle-accurate"
+	    )
+	    .default_value(std::string("cycle-accurate"));
 	recordargs.add_argument("-S", "--snapshot")
 	    .help("Record the trace in snapshot mode")
 	    .implicit_value(true);
+	recordargs.add_argument("-l", "--live")
+	    .help(
+	        "Decode the trace while it is recorded and print the top functions as it runs instead "
+	        "of writing the output file"
+	    )
+	    .default_value(false)
+	    .implicit_value(true);
+	recordargs.add_argument("--interval")
+	    .help("Seconds between updates of --live")
+	    .default_value(1.0)
+	    .scan<'g', double>();
+	recordargs.add_argument("-n", "--top")
+	    .help("Number of functions printed by --live")
+	    .default_value(10)
+	    .scan<'i', int>();
+	recordargs.add_argument("--switch-output")
+	    .help(
+	        "Rotate the output file at a size such as 100M or a time such as 30s. Chunks are named "
+	        "after the output file with a timestamp appended"
+	    );
+	recordargs.add_argument("--max-chunks")
+	    .help("Keep only the newest chunks of --switch-output")
+	    .default_value(0)
+	    .scan<'i', int>();
+	recordargs.add_argument("--max-bytes")
+	    .help("Keep only the newest chunks of --switch-output that fit in a size such as 10G");
+	recordargs.add_argument("-c", "--control")
+	    .help(
+	        "Start with tracing off and toggle it from stdin with [e] and [d] through perf's "
+	        "control fifos, printing how long each toggle took"
+	    )
+	    .default_value(false)
+	    .implicit_value(true);
+	recordargs.add_argument("--duty-cycle")
+	    .help(
+	        "Only trace for <on> ms out of every <period> ms, each period moved by up to <jitter> "
+	        "ms. Formatted as <on>,<period>[,<jitter>]. The windows are saved to <output>.windows "
+	        "for itrace stats --windows"
+	    );
+	recordargs.add_argument("--control-dir")
+	    .help("Directory of the control fifos of --control, another process can write to them");
+	recordargs.add_argument("--decode-chunks")
+	    .help("Decode every completed chunk of --switch-output into <chunk>.trace while recording")
+	    .default_value(false)
+	    .implicit_value(true);
 
 	decodeargs.add_description("Decode a trace into human readable form");
 	decodeargs.add_argument("-i", "--input")
-	    .help("Path to .data trace file")
+	    .help(
+	        "Path to .data trace file, or a bin trace or a text trace decoded with --index to "
+	        "slice by --time without running perf again"
+	    )
 	    .default_value(std::string("itrace.data"));
 	decodeargs.add_argument("-o", "--output")
 	    .help("Output file of trace")
@@ -58,6 +127,51 @@ void parseargs(
 	decodeargs.add_argument("-s", "--src")
 	    .help("Interleave source code and source line in decode.")
 	    .implicit_value(true);
+	decodeargs.add_argument("-f", "--format")
+	    .help(
+	        "Output format, text for perf script output or bin for a seekable columnar trace. A bin "
+	        "trace can be given as the input to slice it by --time or regenerate the text. It only "
+	        "keeps samples, so it cannot be used with --src"
+	    )
+	    .default_value(std::string("text"));
+	decodeargs.add_argument("-j", "--jobs")
+	    .help("Split the trace and decode the parts concurrently with <jobs> perf script runs")
+	    .scan<'i', int>();
+	decodeargs.add_argument("--split")
+	    .help(
+	        "How -j splits the trace. psb cuts the trace data into shards at sync points so each "
+	        "perf script only reads its shard, time gives each perf script a time window of the "
+	        "whole trace"
+	    )
+	    .default_value(std::string("psb"));
+	decodeargs.add_argument("--index")
+	    .help(
+	        "Write an index next to a text output so a later decode of it with --time is sliced "
+	        "out without running perf again"
+	    )
+	    .default_value(false)
+	    .implicit_value(true);
+	decodeargs.add_argument("--cache")
+	    .help(
+	        "Reuse the output of an earlier decode of the same trace with the same arguments, and "
+	        "keep a copy of the output otherwise. The cache is in $ITRACE_CACHE_DIR or "
+	        "~/.cache/itrace"
+	    )
+	    .default_value(false)
+	    .implicit_value(true);
+	decodeargs.add_argument("--cache-size")
+	    .help("Size in MiB the decode cache is kept under by evicting least recently used outputs")
+	    .scan<'i', int>();
+	decodeargs.add_argument("--batch")
+	    .help(
+	        "Decode every trace in a directory into <trace>.trace, largest first and as many at "
+	        "once as there are job slots ($ITRACE_JOBS). Traces decoded since they last changed "
+	        "are skipped"
+	    );
+	decodeargs.add_argument("--force")
+	    .help("Decode the traces of --batch even if their outputs are up to date")
+	    .default_value(false)
+	    .implicit_value(true);
 
 	exportargs.add_description(
 	    "Export a trace into .fzf (Fuchsia trace format) for viewing with "
@@ -70,9 +184,101 @@ void parseargs(
 	    .help("Output file of trace")
 	    .default_value(std::string("itrace.ftf"));
 
+	statsargs.add_description(
+	    "Print a flat profile of a trace: instructions, calls and, if recorded with cyc, cycles "
+	    "per function"
+	);
+	statsargs.add_argument("-i", "--input")
+	    .help("Path to .data trace file")
+	    .default_value(std::string("itrace.data"));
+	statsargs.add_argument("-n", "--top")
+	    .help("Number of rows to print, 0 for all")
+	    .default_value(20)
+	    .scan<'i', int>();
+	statsargs.add_argument("--sort")
+	    .help("Sort by instructions, cycles or calls. Cycles if available, otherwise instructions");
+	statsargs.add_argument("--dso")
+	    .help("Aggregate per DSO instead of per function")
+	    .default_value(false)
+	    .implicit_value(true);
+	statsargs.add_argument("--windows")
+	    .help(
+	        "Print the windows of a trace recorded with --duty-cycle and extrapolate its counts to "
+	        "the whole recording"
+	    )
+	    .default_value(false)
+	    .implicit_value(true);
+	statsargs.add_argument("--csv")
+	    .help("Print comma separated values instead of a table")
+	    .default_value(false)
+	    .implicit_value(true);
+
+	calltreeargs.add_description(
+	    "Rebuild the call stacks of a trace and print inclusive and exclusive time per call path"
+	);
+	calltreeargs.add_argument("-i", "--input")
+	    .help("Path to .data trace file")
+	    .default_value(std::string("itrace.data"));
+	calltreeargs.add_argument("-d", "--max-depth")
+	    .help("Deepest call path to print, 0 for all")
+	    .default_value(0)
+	    .scan<'i', int>();
+	calltreeargs.add_argument("-m", "--min-percent")
+	    .help("Hide call paths with less than this percentage of the total time")
+	    .default_value(0.5)
+	    .scan<'g', double>();
+	calltreeargs.add_argument("--folded")
+	    .help("Print every call path with its exclusive time in the folded format of flamegraphs")
+	    .default_value(false)
+	    .implicit_value(true);
+
+	infoargs.add_description(
+	    "Summarize a trace without decoding it: time span, cpus, threads, AUX data volume and "
+	    "whether any data was lost"
+	);
+	infoargs.add_argument("-i", "--input")
+	    .help("Path to .data trace file")
+	    .default_value(std::string("itrace.data"));
+
+	latencyargs.add_description(
+	    "Measure the duration of every call of a function and print percentiles and the longest "
+	    "calls"
+	);
+	latencyargs.add_argument("-i", "--input")
+	    .help("Path to .data trace file")
+	    .default_value(std::string("itrace.data"));
+	latencyargs.add_argument("-s", "--symbol").help("Function to measure").required();
+	latencyargs.add_argument("-n", "--worst")
+	    .help("Number of longest calls to print with their time ranges")
+	    .default_value(10)
+	    .scan<'i', int>();
+
+	spansargs.add_description(
+	    "Measure every span of a thread from entering the start function to returning from the end "
+	    "function, and break the time inside them down per function"
+	);
+	spansargs.add_argument("-i", "--input")
+	    .help("Path to .data trace file")
+	    .default_value(std::string("itrace.data"));
+	spansargs.add_argument("-s", "--start").help("Function whose entry starts a span").required();
+	spansargs.add_argument("-e", "--end").help("Function whose return ends a span").required();
+	spansargs.add_argument("-n", "--top")
+	    .help("Number of functions to print with their time inside spans")
+	    .default_value(20)
+	    .scan<'i', int>();
+	spansargs.add_argument("-l", "--list")
+	    .help("Print every span as start,end,tid,duration followed by function:ns pairs")
+	    .default_value(false)
+	    .implicit_value(true);
+
 	program.add_subparser(recordargs);
 	program.add_subparser(decodeargs);
 	program.add_subparser(exportargs);
+	program.add_subparser(statsargs);
+	program.add_subparser(calltreeargs);
+	program.add_subparser(infoargs);
+	program.add_subparser(latencyargs);
+	program.add_subparser(spansargs);
 
 	try {
 		program.parse_args(argc, argv);
@@ -84,7 +290,7 @@ void parseargs(
 }
 
 int main(int argc, char** argv) {
-	if (!intelpt_available()) {
+	if (!libitrace::PtCaps::Host().Available()) {
 		cerr << "Intel PT unavailable\n";
 		cerr << "Check list of processors that support Intel PT: "
 		     << "https://www.intel.com/content/www/us/en/support/articles/"
@@ -96,7 +302,15 @@ int main(int argc, char** argv) {
 	argparse::ArgumentParser recordargs("record");
 	argparse::ArgumentParser decodeargs("decode");
 	argparse::ArgumentParser exportargs("export");
-	parseargs(argc, argv, program, recordargs, decodeargs, exportargs);
+	argparse::ArgumentParser statsargs("stats");
+	argparse::ArgumentParser calltreeargs("calltree");
+	argparse::ArgumentParser infoargs("info");
+	argparse::ArgumentParser latencyargs("latency");
+	argparse::ArgumentParser spansargs("spans");
+	parseargs(
+	    argc, argv, program, recordargs, decodeargs, exportargs, statsargs, calltreeargs, infoargs,
+	    latencyargs, spansargs
+	);
 
 	if (program.is_subcommand_used("record")) {
 		record(recordargs);
@@ -104,6 +318,16 @@ int main(int argc, char** argv) {
 		decode(decodeargs);
 	} else if (program.is_subcommand_used("export")) {
 		exporter(exportargs);
+	} else if (program.is_subcommand_used("stats")) {
+		stats(statsargs);
+	} else if (program.is_subcommand_used("calltree")) {
+		calltree(calltreeargs);
+	} else if (program.is_subcommand_used("info")) {
+		info(infoargs);
+	} else if (program.is_subcommand_used("latency")) {
+		latency(latencyargs);
+	} else if (program.is_subcommand_used("spans")) {
+		spans(spansargs);
 	} else {
 		cerr << "Unknown subcommand\n";
 		cerr << program.help().str();
@@ -0,0 +1,104 @@
+#include "latency.hpp"
+
+#include "libitrace/latency.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include "libitrace/utils.hpp"
+
+using std::cout, std::cerr, std::endl;
+
+std::string format_duration(uint64_t ns) {
+	char buf[32] {};
+	if (ns < 1000) {
+		std::snprintf(buf, sizeof(buf), "%" PRIu64 " ns", ns);
+	} else if (ns < 1000000) {
+		std::snprintf(buf, sizeof(buf), "%.2f us", ns / 1e3);
+	} else if (ns < 1000000000) {
+		std::snprintf(buf, sizeof(buf), "%.2f ms", ns / 1e6);
+	} else {
+		std::snprintf(buf, sizeof(buf), "%.3f s", ns / 1e9);
+	}
+	return buf;
+}
+
+void print_histogram(const libitrace::LatencyHistogram& histogram) {
+	char buf[64] {};
+	std::snprintf(buf, sizeof(buf), "%-8s %" PRIu64, "calls", histogram.Count());
+	cout << buf << '\n';
+	if (histogram.Count() == 0) return;
+
+	auto row = [&buf](const char* label, uint64_t ns) {
+		std::snprintf(buf, sizeof(buf), "%-8s %s", label, format_duration(ns).c_str());
+		cout << buf << '\n';
+	};
+	row("min", histogram.Min());
+	row("mean", static_cast<uint64_t>(histogram.Mean()));
+	row("p50", histogram.Percentile(50));
+	row("p90", histogram.Percentile(90));
+	row("p99", histogram.Percentile(99));
+	row("p99.9", histogram.Percentile(99.9));
+	row("max", histogram.Max());
+}
+
+void latency(const argparse::ArgumentParser& args) {
+	std::string infile {};
+	std::string symbol {};
+	try {
+		infile = args.get<std::string>("input");
+		symbol = args.get<std::string>("symbol");
+	} catch (std::logic_error& e) {
+		cerr << e.what() << "\n";
+		cerr << args;
+		exit(1);
+	}
+
+	int worst = args.get<int>("worst");
+	if (worst < 0) {
+		cerr << "Number of worst calls must not be negative" << endl;
+		exit(1);
+	}
+
+	libitrace::Latency instance {infile, symbol, static_cast<size_t>(worst)};
+	try {
+		instance.Run();
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+
+	const auto& stats = instance.Stats();
+	if (stats.calls == 0) {
+		cerr << "No complete calls of " << symbol << " in the trace" << endl;
+		exit(1);
+	}
+
+	print_histogram(instance.Histogram());
+
+	auto calls = instance.Worst();
+	if (!calls.empty()) cout << "\nlongest calls, decode one with itrace decode -t <start>,<end>\n";
+	char buf[128] {};
+	for (const auto& call : calls) {
+		std::string start = libitrace::timespec_to_string(libitrace::ns_to_timespec(call.start));
+		std::string end   = libitrace::timespec_to_string(libitrace::ns_to_timespec(call.end));
+		std::snprintf(
+		    buf, sizeof(buf), "%12s  tid %-8d %s,%s", format_duration(call.Duration()).c_str(),
+		    call.tid, start.c_str(), end.c_str()
+		);
+		cout << buf << '\n';
+	}
+
+	if (stats.unmatched || stats.open || stats.dropped) {
+		std::snprintf(
+		    buf, sizeof(buf),
+		    "\n[ %zu returns before the trace started, %zu calls open at its end, %zu dropped ]",
+		    stats.unmatched, stats.open, stats.dropped
+		);
+		cout << buf << '\n';
+	}
+	cout.flush();
+}
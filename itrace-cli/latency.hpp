@@ -0,0 +1,17 @@
+#pragma once
+
+#include <argparse/argparse.hpp>
+
+#include "libitrace/histogram.hpp"
+
+void latency(const argparse::ArgumentParser& args);
+
+/*
+ * @brief Print the count, mean and percentiles of a histogram of durations in nanoseconds
+ * */
+void print_histogram(const libitrace::LatencyHistogram& histogram);
+
+/*
+ * @brief Format a duration in nanoseconds with the largest unit that keeps it at or above one
+ * */
+std::string format_duration(uint64_t ns);
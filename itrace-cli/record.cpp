@@ -1,3 +1,5 @@
+#include "record.hpp"
+
 #include "libitrace/record.hpp"
 
 #include <signal.h>
@@ -5,13 +7,22 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <argparse/argparse.hpp>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <iterator>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#include "libitrace/decode.hpp"
+#include "libitrace/dutycycle.hpp"
+#include "libitrace/profile.hpp"
+#include "libitrace/recordgroup.hpp"
 #include "libitrace/subprocess.hpp"
 #include "libitrace/utils.hpp"
-#include "record.hpp"
 
 using std::cout, std::cerr, std::endl;
 
@@ -32,6 +43,365 @@ std::optional<std::pair<long, long>> parse_ipfilter(std::string ipfilter) {
 	return std::make_pair(start, end);
 }
 
+void print_live_top(const libitrace::Profile& profile, size_t top, double seconds, size_t samples) {
+	auto functions = profile.Functions();
+	top            = std::min(top, functions.size());
+	std::partial_sort(
+	    functions.begin(), functions.begin() + top, functions.end(),
+	    [](const auto& a, const auto& b) { return a.instructions > b.instructions; }
+	);
+	uint64_t total = profile.Total().instructions;
+
+	char buf[256] {};
+	std::snprintf(buf, sizeof(buf), "--- %.1f s, %zu samples ---", seconds, samples);
+	cout << buf << '\n';
+	for (size_t i {0}; i < top; ++i) {
+		const auto& entry = functions[i];
+		std::snprintf(
+		    buf, sizeof(buf), "%6.2f%% %16" PRIu64 "  %.*s",
+		    total ? 100.0 * entry.instructions / total : 0.0, entry.instructions,
+		    static_cast<int>(entry.name.size()), entry.name.data()
+		);
+		cout << buf << '\n';
+	}
+	cout.flush();
+}
+
+void print_filter_plan(const libitrace::FilterPlan& plan) {
+	char buf[128] {};
+	for (const auto& range : plan.ranges) {
+		std::snprintf(
+		    buf, sizeof(buf), "filter 0x%" PRIx64 "-0x%" PRIx64 " %7.2f%%  %zu functions",
+		    range.start, range.end, plan.total ? 100.0 * range.weight / plan.total : 0.0,
+		    range.functions
+		);
+		cout << buf << '\n';
+	}
+	std::snprintf(
+	    buf, sizeof(buf), "[ %zu ranges cover %.2f%% of the program's profile", plan.ranges.size(),
+	    100.0 * plan.Coverage()
+	);
+	cout << buf;
+	if (plan.unresolved) cout << ", " << plan.unresolved << " hot functions not in its symbols";
+	cout << " ]" << endl;
+}
+
+void record_live(
+    libitrace::Record& instance, const argparse::ArgumentParser& args, std::optional<pid_t> pid
+) {
+	double interval = args.get<double>("interval");
+	int top         = args.get<int>("top");
+	if (interval <= 0 || top < 0) {
+		cerr << "Provide a positive --interval and a non negative --top" << endl;
+		exit(1);
+	}
+
+	// perf script reads the trace from stdin, which the cycle check cannot inspect beforehand
+	libitrace::Profile profile {"-"};
+	profile.SetCycles(instance.HasCycles());
+
+	using clock = std::chrono::steady_clock;
+	auto period = std::chrono::duration_cast<clock::duration>(
+	    std::chrono::duration<double>(interval)
+	);
+	auto begin = clock::now();
+	auto next  = begin + period;
+	size_t samples {0};
+	libitrace::ScriptParser parser {[&](const libitrace::ScriptRecord& record) {
+		profile.Add(record);
+		// The clock is only read every few thousand samples to keep it off the hot path
+		if (++samples % 4096 != 0) return;
+		auto now = clock::now();
+		if (now < next) return;
+		next = now + period;
+		print_live_top(profile, top, std::chrono::duration<double>(now - begin).count(), samples);
+	}};
+
+	if (pid) {
+		cout << "Press [ENTER] to stop trace" << endl;
+		std::thread {[&instance] {
+			fd_set readfds;
+			FD_ZERO(&readfds);
+			FD_SET(STDIN_FILENO, &readfds);
+			if (select(STDIN_FILENO + 1, &readfds, NULL, NULL, NULL) == -1) die("select");
+			instance.StopLive();
+		}}.detach();
+	}
+
+	libitrace::LiveStats stats {};
+	try {
+		stats = instance.Live(profile.Arglist(), parser, pid);
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+
+	print_live_top(profile, top, stats.seconds, samples);
+	char buf[128] {};
+	std::snprintf(
+	    buf, sizeof(buf), "[ %.2f MB of trace decoded into %.2f MB in %.1f s ]",
+	    stats.trace_bytes / 1048576.0, stats.script_bytes / 1048576.0, stats.seconds
+	);
+	cout << buf << endl;
+}
+
+// Bytes of a size with an optional K, M or G suffix
+std::optional<uint64_t> parse_size(const std::string& size) {
+	size_t end {};
+	uint64_t value {};
+	try {
+		value = std::stoull(size, &end);
+	} catch (std::logic_error& e) { return std::nullopt; }
+
+	std::string suffix = size.substr(end);
+	if (suffix.empty()) return value;
+	if (suffix == "K") return value << 10;
+	if (suffix == "M") return value << 20;
+	if (suffix == "G") return value << 30;
+	return std::nullopt;
+}
+
+void record_rotating(
+    libitrace::Record& instance, const argparse::ArgumentParser& args, std::optional<pid_t> pid
+) {
+	int max_chunks = args.get<int>("max-chunks");
+	std::optional<uint64_t> max_bytes {0};
+	if (args.is_used("max-bytes")) max_bytes = parse_size(args.get<std::string>("max-bytes"));
+	if (max_chunks < 0 || !max_bytes) {
+		cerr << "Provide a non negative --max-chunks and a --max-bytes such as 10G" << endl;
+		exit(1);
+	}
+
+	std::function<void(const std::string&)> worker {};
+	if (args.get<bool>("decode-chunks")) {
+		worker = [](const std::string& chunk) {
+			libitrace::Decode decode {chunk, chunk + ".trace"};
+			decode.SetPriority(libitrace::JobPriority::Batch);
+			decode.Run();
+		};
+	}
+
+	libitrace::RotationStats stats {};
+	try {
+		instance.SetRotation(args.get<std::string>("switch-output"), max_chunks, *max_bytes);
+		if (pid) {
+			cout << "Press [ENTER] to stop trace" << endl;
+			std::thread {[&instance] {
+				fd_set readfds;
+				FD_ZERO(&readfds);
+				FD_SET(STDIN_FILENO, &readfds);
+				if (select(STDIN_FILENO + 1, &readfds, NULL, NULL, NULL) == -1) die("select");
+				instance.StopRotating();
+			}}.detach();
+		}
+		stats = instance.RunRotating(worker, pid);
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+
+	char buf[512] {};
+	for (const auto& chunk : stats.chunks) {
+		char processed[32] {"-"};
+		if (chunk.processed)
+			std::snprintf(processed, sizeof(processed), "%.1f s", *chunk.processed);
+		std::snprintf(
+		    buf, sizeof(buf), "%10.2f MB  done %8.1f s  processed %-10s %s%s",
+		    chunk.bytes / 1048576.0, chunk.completed, processed, chunk.path.c_str(),
+		    chunk.dropped ? " (dropped)" : ""
+		);
+		cout << buf << '\n';
+	}
+	std::snprintf(
+	    buf, sizeof(buf), "[ %zu chunks in %.1f s, %zu dropped", stats.chunks.size(),
+	    stats.seconds, stats.dropped
+	);
+	cout << buf;
+	if (worker) {
+		std::snprintf(
+		    buf, sizeof(buf),
+		    ", %zu before they were decoded, up to %zu chunks waiting and %.1f s behind",
+		    stats.unprocessed, stats.backlog, stats.max_lag
+		);
+		cout << buf;
+	}
+	cout << " ]" << endl;
+}
+
+void record_controlled(libitrace::Record& instance, std::optional<pid_t> pid, bool snapshot) {
+	libitrace::RunningProcess context {};
+	try {
+		context = pid ? instance.Attach(*pid) : instance.Start();
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+
+	auto report = [](const char* state, std::chrono::nanoseconds took) {
+		char buf[64] {};
+		std::snprintf(buf, sizeof(buf), "tracing %s in %.1f us", state, took.count() / 1e3);
+		cout << buf << endl;
+	};
+
+	const char* usage = snapshot ? "Enter [e] to enable tracing, [d] to disable it, [s] to take a "
+	                               "snapshot, [q] to quit"
+	                             : "Enter [e] to enable tracing, [d] to disable it, [q] to quit";
+	cout << usage << endl;
+
+	bool quit {false};
+	char c {};
+	while (!quit && std::cin.get(c)) {
+		try {
+			if (c == 'e') {
+				report("enabled", instance.Enable());
+			} else if (c == 'd') {
+				report("disabled", instance.Disable());
+			} else if (c == 's' && snapshot) {
+				instance.TakeSnapshot(context);
+			} else if (c == 'q') {
+				quit = true;
+			} else if (c != '\n') {
+				cout << usage << endl;
+			}
+		} catch (const std::runtime_error& e) { cerr << e.what() << endl; }
+	}
+
+	// Without a terminal, such as when started by the TUI, the fifos are driven by another process
+	// and the recording runs until perf exits
+	if (quit) kill(context.Pid, SIGINT);
+	auto res = libitrace::Subprocess::Wait(context, true);
+	if (!res || res->Exit != 0) {
+		cerr << "Error waiting for perf record" << endl;
+		if (res) cerr << res->Stderr << endl;
+		exit(1);
+	}
+}
+
+// <on>,<period>[,<jitter>] in milliseconds
+std::optional<libitrace::DutyCycleSchedule> parse_duty_cycle(const std::string& spec) {
+	std::stringstream ss(spec);
+	std::vector<double> values {};
+	std::string token {};
+	while (std::getline(ss, token, ',')) {
+		try {
+			values.push_back(std::stod(token));
+		} catch (std::logic_error& e) { return std::nullopt; }
+		if (values.back() < 0) return std::nullopt;
+	}
+	if (values.size() < 2 || values.size() > 3) return std::nullopt;
+
+	libitrace::DutyCycleSchedule schedule {};
+	schedule.on_ns     = values[0] * 1e6;
+	schedule.period_ns = values[1] * 1e6;
+	schedule.jitter_ns = values.size() == 3 ? values[2] * 1e6 : 0;
+	return schedule;
+}
+
+void record_duty_cycled(
+    libitrace::Record& instance, const std::string& spec, const std::string& outfile,
+    std::optional<pid_t> pid
+) {
+	auto schedule = parse_duty_cycle(spec);
+	if (!schedule) {
+		cerr << "Provide the duty cycle as <on>,<period>[,<jitter>] in milliseconds" << endl;
+		exit(1);
+	}
+
+	libitrace::RunningProcess context {};
+	std::unique_ptr<libitrace::DutyCycler> cycler {};
+	try {
+		cycler = std::make_unique<libitrace::DutyCycler>(instance, *schedule);
+		instance.UseControl();
+		context = pid ? instance.Attach(*pid) : instance.Start();
+		cycler->Start();
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+
+	if (pid) {
+		cout << "Press [ENTER] to stop trace" << endl;
+		fd_set readfds;
+		FD_ZERO(&readfds);
+		FD_SET(STDIN_FILENO, &readfds);
+		if (select(STDIN_FILENO + 1, &readfds, NULL, NULL, NULL) == -1) die("select");
+
+		// Close the last window while perf still acknowledges
+		cycler->Stop();
+		kill(context.Pid, SIGINT);
+	}
+	auto res = libitrace::Subprocess::Wait(context, true);
+	cycler->Stop();
+	if (!res || res->Exit != 0) {
+		cerr << "Error waiting for perf record" << endl;
+		if (res) cerr << res->Stderr << endl;
+		exit(1);
+	}
+
+	const auto& log  = cycler->Log();
+	std::string path = libitrace::DutyCycleLog::PathFor(outfile);
+	try {
+		log.Save(path);
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+
+	char buf[256] {};
+	std::snprintf(
+	    buf, sizeof(buf), "[ %zu windows, tracing was on for %.1f%% of %.1f s, saved to %s ]",
+	    log.windows.size(), log.duration ? 100.0 * log.Traced() / log.duration : 0.0,
+	    log.duration / 1e9, path.c_str()
+	);
+	cout << buf << endl;
+}
+
+// <pid>,<pid>,...
+std::optional<std::vector<pid_t>> parse_pids(const std::string& list) {
+	std::stringstream ss(list);
+	std::vector<pid_t> pids {};
+	std::string token {};
+	while (std::getline(ss, token, ',')) {
+		try {
+			pids.push_back(std::stoi(token));
+		} catch (std::logic_error& e) { return std::nullopt; }
+		if (pids.back() <= 0) return std::nullopt;
+	}
+	if (pids.empty()) return std::nullopt;
+	return pids;
+}
+
+void record_group(
+    libitrace::Record& instance, const std::vector<pid_t>& pids, const std::string& outfile
+) {
+	try {
+		libitrace::RecordGroup group {instance, pids, outfile};
+		cout << "Tracing " << pids.size() << " processes, press [ENTER] to stop" << endl;
+		auto manifest = group.Run(STDIN_FILENO);
+
+		bool failed {false};
+		for (const auto& member : manifest.members) {
+			char buf[128] {};
+			std::snprintf(
+			    buf, sizeof(buf), "%8d  %-16s  %10" PRIu64 " bytes  ", member.pid,
+			    member.comm.c_str(), member.bytes
+			);
+			cout << buf << member.outfile;
+			if (member.exit != 0 || member.enabled == 0) {
+				cout << "  failed: " << member.error;
+				failed = true;
+			}
+			cout << endl;
+		}
+		cout << "tracing started within " << manifest.Skew() / 1e3 << " us, manifest in "
+		     << libitrace::GroupManifest::PathFor(outfile) << endl;
+		if (failed) exit(1);
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+}
+
 void record(const argparse::ArgumentParser& args) {
 	std::vector<std::string> target {};
 	std::string outfile {};
@@ -44,15 +414,24 @@ void record(const argparse::ArgumentParser& args) {
 		exit(1);
 	}
 
-	if (target.empty()) {
+	bool group = args.is_used("pids") || args.is_used("cgroup");
+	if (target.empty() && !group && !args.is_used("pid")) {
 		cerr << "Specify a target program\n";
 		cerr << args << "\n";
 		exit(1);
 	}
 
-	std::string program = target[0];
-	std::vector<std::string> programargs(target.begin() + 1, target.end());
-	libitrace::Record instance(program, programargs, outfile);
+	std::string program = target.empty() ? "" : target[0];
+	std::vector<std::string> programargs {};
+	if (!target.empty()) programargs.assign(target.begin() + 1, target.end());
+	libitrace::Record instance {program, programargs, outfile};
+
+	auto pt = libitrace::parse_pt_profile(args.get<std::string>("pt-profile"));
+	if (!pt) {
+		cerr << "Provide a --pt-profile of low-overhead, balanced or cycle-accurate" << endl;
+		exit(1);
+	}
+	instance.SetPtProfile(*pt);
 
 	if (args.is_used("snapshot")) instance.SetSnapshotMode();
 
@@ -73,7 +452,105 @@ void record(const argparse::ArgumentParser& args) {
 		instance.AddInstrPtrFilter(start, end);
 	}
 
-	if (args.is_used("pid") && args.is_used("snapshot")) {
+	if (args.is_used("filter-from")) {
+		double coverage = args.get<double>("filter-coverage");
+		if (coverage <= 0 || coverage > 1) {
+			cerr << "Provide a --filter-coverage above 0 and at most 1" << endl;
+			exit(1);
+		}
+		try {
+			std::string profile = args.get<std::string>("filter-from");
+			print_filter_plan(instance.AddProfileFilter(profile, coverage));
+		} catch (const std::runtime_error& e) {
+			cerr << e.what() << endl;
+			exit(1);
+		}
+	}
+
+	// Each of these runs perf its own way, so only one of them can be given
+	const char* exclusive[] = {"live", "switch-output", "duty-cycle", "control"};
+	for (size_t i = 0; i < std::size(exclusive); ++i) {
+		for (size_t j = i + 1; j < std::size(exclusive); ++j) {
+			if (args.is_used(exclusive[i]) && args.is_used(exclusive[j])) {
+				cerr << "--" << exclusive[i] << " cannot be combined with --" << exclusive[j] << endl;
+				exit(1);
+			}
+		}
+	}
+	for (const char* chunks : {"decode-chunks", "max-chunks"}) {
+		if (args.is_used(chunks) && !args.is_used("switch-output")) {
+			cerr << "--" << chunks << " only applies to --switch-output" << endl;
+			exit(1);
+		}
+	}
+
+	if (group) {
+		const char* modes[] = {"pid", "snapshot", "live", "switch-output", "control", "duty-cycle"};
+		for (const char* mode : modes) {
+			if (args.is_used(mode)) {
+				cerr << "--pids and --cgroup cannot be combined with --" << mode << endl;
+				exit(1);
+			}
+		}
+		std::vector<pid_t> pids {};
+		if (args.is_used("pids")) {
+			auto parsed = parse_pids(args.get<std::string>("pids"));
+			if (!parsed) {
+				cerr << "Provide --pids as a comma separated list of process ids" << endl;
+				exit(1);
+			}
+			pids = *parsed;
+		}
+		if (args.is_used("cgroup")) {
+			try {
+				auto procs = libitrace::cgroup_pids(args.get<std::string>("cgroup"));
+				pids.insert(pids.end(), procs.begin(), procs.end());
+			} catch (const std::runtime_error& e) {
+				cerr << e.what() << endl;
+				exit(1);
+			}
+		}
+		record_group(instance, pids, outfile);
+
+	} else if (args.get<bool>("live")) {
+		if (args.is_used("snapshot")) {
+			cerr << "Snapshot mode cannot be recorded live" << endl;
+			exit(1);
+		}
+		std::optional<pid_t> pid {};
+		if (args.is_used("pid")) pid = args.get<int>("pid");
+		record_live(instance, args, pid);
+
+	} else if (args.is_used("switch-output")) {
+		std::optional<pid_t> pid {};
+		if (args.is_used("pid")) pid = args.get<int>("pid");
+		record_rotating(instance, args, pid);
+
+	} else if (args.is_used("duty-cycle")) {
+		if (args.is_used("snapshot")) {
+			cerr << "Snapshot mode cannot be duty cycled" << endl;
+			exit(1);
+		}
+		std::optional<pid_t> pid {};
+		if (args.is_used("pid")) pid = args.get<int>("pid");
+		record_duty_cycled(instance, args.get<std::string>("duty-cycle"), outfile, pid);
+
+	} else if (args.get<bool>("control")) {
+		try {
+			if (args.is_used("control-dir")) {
+				instance.UseControl(args.get<std::string>("control-dir"));
+			} else {
+				instance.UseControl();
+			}
+		} catch (const std::runtime_error& e) {
+			cerr << e.what() << endl;
+			exit(1);
+		}
+		std::optional<pid_t> pid {};
+		if (args.is_used("pid")) pid = args.get<int>("pid");
+		record_controlled(instance, pid, args.is_used("snapshot"));
+
+	} else if (args.is_used("pid") && args.is_used("snapshot")) {
 		// attach with snapshotting
 		pid_t pid                         = args.get<int>("pid");
 		libitrace::RunningProcess context = instance.Attach(pid);
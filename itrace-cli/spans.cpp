@@ -0,0 +1,90 @@
+#include "spans.hpp"
+
+#include "libitrace/spans.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include "latency.hpp"
+#include "libitrace/utils.hpp"
+
+using std::cout, std::cerr, std::endl;
+
+void spans(const argparse::ArgumentParser& args) {
+	std::string infile {};
+	std::string start {};
+	std::string end {};
+	try {
+		infile = args.get<std::string>("input");
+		start  = args.get<std::string>("start");
+		end    = args.get<std::string>("end");
+	} catch (std::logic_error& e) {
+		cerr << e.what() << "\n";
+		cerr << args;
+		exit(1);
+	}
+
+	int top = args.get<int>("top");
+	if (top < 0) {
+		cerr << "Number of functions must not be negative" << endl;
+		exit(1);
+	}
+
+	libitrace::SpanExtractor instance {infile, start, end};
+	if (args.get<bool>("list")) {
+		// start,end,tid,duration then function:ns for every function of the span
+		instance.SetCallback([&instance](const libitrace::Span& span) {
+			std::string from = libitrace::timespec_to_string(libitrace::ns_to_timespec(span.start));
+			std::string to   = libitrace::timespec_to_string(libitrace::ns_to_timespec(span.end));
+			cout << from << ',' << to << ',' << span.tid << ',' << span.Duration();
+			for (const auto& [function, ns] : span.breakdown)
+				cout << ',' << instance.Name(function) << ':' << ns;
+			cout << '\n';
+		});
+	}
+	try {
+		instance.Run();
+	} catch (const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		exit(1);
+	}
+
+	const auto& stats = instance.Stats();
+	if (stats.spans == 0) {
+		cerr << "No complete spans from " << start << " to " << end << " in the trace" << endl;
+		exit(1);
+	}
+	if (args.get<bool>("list")) cout << '\n';
+
+	print_histogram(instance.Histogram());
+
+	auto functions = instance.Functions();
+	if (!functions.empty()) cout << "\ntime inside spans per function\n";
+	char buf[256] {};
+	uint64_t total = instance.Total();
+	for (size_t i {0}; i < functions.size() && i < static_cast<size_t>(top); ++i) {
+		const auto& function = functions[i];
+		std::snprintf(
+		    buf, sizeof(buf), "%6.2f%%  %12s  max %12s  in %" PRIu64 " spans  %.*s",
+		    total ? 100.0 * function.time / total : 0.0, format_duration(function.time).c_str(),
+		    format_duration(function.max_time).c_str(), function.spans,
+		    static_cast<int>(instance.Name(function.function).size()),
+		    instance.Name(function.function).data()
+		);
+		cout << buf << '\n';
+	}
+
+	if (stats.restarted || stats.unmatched || stats.open) {
+		std::snprintf(
+		    buf, sizeof(buf),
+		    "\n[ %zu spans restarted before their end, %zu ends without a start, %zu spans open "
+		    "at the end of the trace ]",
+		    stats.restarted, stats.unmatched, stats.open
+		);
+		cout << buf << '\n';
+	}
+	cout.flush();
+}
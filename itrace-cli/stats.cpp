@@ -0,0 +1,213 @@
+#include "stats.hpp"
+
+#include "libitrace/dutycycle.hpp"
+#include "libitrace/profile.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+using std::cout, std::cerr, std::endl;
+
+namespace {
+
+enum class SortKey { Instructions, Cycles, Calls };
+
+uint64_t sort_value(const libitrace::ProfileEntry& entry, SortKey key) {
+	switch (key) {
+		case SortKey::Cycles: return entry.cycles;
+		case SortKey::Calls: return entry.calls;
+		default: return entry.instructions;
+	}
+}
+
+// Quote a CSV field if it contains a separator, quote or newline
+std::string csv_field(std::string_view field) {
+	if (field.find_first_of(",\"\n") == std::string_view::npos) return std::string {field};
+	std::string quoted {"\""};
+	for (char c : field) {
+		if (c == '"') quoted += '"';
+		quoted += c;
+	}
+	quoted += '"';
+	return quoted;
+}
+
+void print_csv(const std::vector<libitrace::ProfileEntry>& entries, bool cycles) {
+	cout << "function,dso,instructions" << (cycles ? ",cycles" : "") << ",calls\n";
+	for (const auto& entry : entries) {
+		cout << csv_field(entry.name) << ',' << csv_field(entry.dso) << ',' << entry.instructions;
+		if (cycles) cout << ',' << entry.cycles;
+		cout << ',' << entry.calls << '\n';
+	}
+	cout.flush();
+}
+
+void print_table(
+    const std::vector<libitrace::ProfileEntry>& entries, const libitrace::ProfileEntry& total,
+    SortKey key, bool cycles
+) {
+	char buf[256] {};
+	std::snprintf(buf, sizeof(buf), "%7s %16s", "%", "instructions");
+	cout << buf;
+	if (cycles) {
+		std::snprintf(buf, sizeof(buf), " %16s %6s", "cycles", "IPC");
+		cout << buf;
+	}
+	std::snprintf(buf, sizeof(buf), " %12s  %s", "calls", "function / dso");
+	cout << buf << '\n';
+
+	uint64_t whole = sort_value(total, key);
+	for (const auto& entry : entries) {
+		double percent = whole > 0 ? 100.0 * sort_value(entry, key) / whole : 0.0;
+		std::snprintf(buf, sizeof(buf), "%6.2f%% %16" PRIu64, percent, entry.instructions);
+		cout << buf;
+		if (cycles) {
+			double ipc = entry.cycles > 0 ? static_cast<double>(entry.instructions) / entry.cycles
+			                              : 0.0;
+			std::snprintf(buf, sizeof(buf), " %16" PRIu64 " %6.2f", entry.cycles, ipc);
+			cout << buf;
+		}
+		std::snprintf(buf, sizeof(buf), " %12" PRIu64 "  ", entry.calls);
+		cout << buf;
+		if (!entry.name.empty()) cout << entry.name << ' ';
+		cout << '(' << entry.dso << ")\n";
+	}
+	cout.flush();
+}
+
+void print_windows(const libitrace::WindowedProfile& profile, bool cycles) {
+	const auto& windows = profile.Windows();
+	char buf[256] {};
+	std::snprintf(
+	    buf, sizeof(buf), "%8s %12s %12s %12s %16s", "window", "start ms", "length us", "samples",
+	    "instructions"
+	);
+	cout << buf << (cycles ? "           cycles\n" : "\n");
+
+	for (size_t i {0}; i < windows.size(); ++i) {
+		const auto& window = windows[i];
+		std::snprintf(
+		    buf, sizeof(buf), "%8zu %12.3f %12.1f %12" PRIu64 " %16" PRIu64, i,
+		    (window.start - windows.front().start) / 1e6, (window.end - window.start) / 1e3,
+		    window.samples, window.instructions
+		);
+		cout << buf;
+		if (cycles) {
+			std::snprintf(buf, sizeof(buf), " %16" PRIu64, window.cycles);
+			cout << buf;
+		}
+		cout << '\n';
+	}
+
+	const auto& log = profile.Log();
+	size_t sampled  = std::count_if(windows.begin(), windows.end(), [](const auto& window) {
+		return window.samples > 0;
+	});
+	std::snprintf(
+	    buf, sizeof(buf),
+	    "\n[ %zu of %zu recorded windows have samples, tracing was on for %.1f%% of %.1f s, "
+	    "counts below are extrapolated by %.2fx ]\n\n",
+	    sampled, log.windows.size(),
+	    log.duration ? 100.0 * log.Traced() / log.duration : 0.0, log.duration / 1e9,
+	    profile.Scale()
+	);
+	cout << buf;
+}
+
+// Estimate the counts of the whole recording from those of its traced windows
+void extrapolate(libitrace::ProfileEntry& entry, double scale) {
+	entry.instructions = static_cast<uint64_t>(entry.instructions * scale + 0.5);
+	entry.cycles       = static_cast<uint64_t>(entry.cycles * scale + 0.5);
+	entry.calls        = static_cast<uint64_t>(entry.calls * scale + 0.5);
+}
+
+}  // namespace
+
+void stats(const argparse::ArgumentParser& args) {
+	std::string infile {};
+	try {
+		infile = args.get<std::string>("input");
+	} catch (std::logic_error& e) {
+		cerr << e.what() << "\n";
+		cerr << args;
+		exit(1);
+	}
+
+	int top = args.get<int>("top");
+	if (top < 0) {
+		cerr << "Number of rows must not be negative" << endl;
+		exit(1);
+	}
+
+	std::optional<libitrace::DutyCycleLog> log {};
+	if (args.get<bool>("windows")) {
+		std::string path = libitrace::DutyCycleLog::PathFor(infile);
+		try {
+			log = libitrace::DutyCycleLog::Load(path);
+		} catch (const std::runtime_error& e) {
+			cerr << e.what() << endl;
+			exit(1);
+		}
+		if (!log) {
+			cerr << "No windows at " << path << ", record the trace with --duty-cycle" << endl;
+			exit(1);
+		}
+	}
+
+	// A duty cycled trace is profiled through WindowedProfile, which owns its Profile
+	std::unique_ptr<libitrace::WindowedProfile> windowed {};
+	std::unique_ptr<libitrace::Profile> whole {};
+	if (log) {
+		windowed = std::make_unique<libitrace::WindowedProfile>(infile, *log);
+		windowed->Run();
+	} else {
+		whole = std::make_unique<libitrace::Profile>(infile);
+		whole->Run();
+	}
+	const libitrace::Profile& profile = windowed ? windowed->Counts() : *whole;
+	bool cycles                       = profile.HasCycles();
+
+	SortKey key = cycles ? SortKey::Cycles : SortKey::Instructions;
+	if (args.is_used("sort")) {
+		std::string sort = args.get<std::string>("sort");
+		if (sort == "instructions") {
+			key = SortKey::Instructions;
+		} else if (sort == "cycles" && cycles) {
+			key = SortKey::Cycles;
+		} else if (sort == "calls") {
+			key = SortKey::Calls;
+		} else if (sort == "cycles") {
+			cerr << "Trace was recorded without cyc so it has no cycle counts" << endl;
+			exit(1);
+		} else {
+			cerr << "Sort key must be instructions, cycles or calls" << endl;
+			exit(1);
+		}
+	}
+
+	auto entries = args.get<bool>("dso") ? profile.Dsos() : profile.Functions();
+	auto total   = profile.Total();
+	if (windowed) {
+		for (auto& entry : entries) extrapolate(entry, windowed->Scale());
+		extrapolate(total, windowed->Scale());
+	}
+
+	size_t rows  = top == 0 ? entries.size() : std::min<size_t>(top, entries.size());
+	std::partial_sort(
+	    entries.begin(), entries.begin() + rows, entries.end(),
+	    [key](const libitrace::ProfileEntry& a, const libitrace::ProfileEntry& b) {
+		    return sort_value(a, key) > sort_value(b, key);
+	    }
+	);
+	entries.resize(rows);
+
+	if (args.get<bool>("csv")) {
+		print_csv(entries, cycles);
+	} else {
+		if (windowed) print_windows(*windowed, cycles);
+		print_table(entries, total, key, cycles);
+	}
+}
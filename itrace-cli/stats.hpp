@@ -0,0 +1,5 @@
+#pragma once
+
+#include <argparse/argparse.hpp>
+
+void stats(const argparse::ArgumentParser& args);
@@ -10,9 +10,14 @@
 #include <ftxui/dom/elements.hpp>
 #include <map>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "libitrace/control.hpp"
+#include "libitrace/scheduler.hpp"
+#include "libitrace/subprocess.hpp"
+
 using namespace ftxui;
 
 int main() {
@@ -28,8 +33,9 @@ int main() {
 	// --- Argument labels ---
 	std::map<std::string, std::vector<std::string>> args_labels = {
 	    {"Record",
-	     {"Target", "Output", "PID", "Filter Symbol", "Filter Instruction Pointer", "Snapshot"}},
-	    {"Decode", {"Input", "Output", "Time Window"}                                          },
+	     {"Target", "Output", "PID", "Filter Symbol", "Filter Instruction Pointer", "Snapshot",
+	      "Control"}                                                                         },
+	    {"Decode", {"Input", "Output", "Time Window", "Format", "Jobs"}                        },
 	    {"Export", {"Input", "Output"}	                                                     }
 	};
 
@@ -41,11 +47,14 @@ int main() {
 	      "Symbol to filter trace data on",
 	      "Instruction pointer addresses to filter trace data on. Formatted as <start>,<end> where "
 	      "addresses are in hex",
-	      "Record the trace in snapshot mode"}                      },
+	      "Record the trace in snapshot mode",
+	      "Start with tracing off and toggle it with [e] and [d] while recording"}},
 	    {"Decode",
 	     {"Path to .data trace file [nargs=0..1] [default: itrace.data]",
 	      "Output file of trace [nargs=0..1] [default: itrace.trace]",
-	      "Only decode trace within <start>,<end> time window..."}  },
+	      "Only decode trace within <start>,<end> time window...",
+	      "Output format, text or bin [default: text]",
+	      "Decode <jobs> time windows concurrently"}                },
 	    {"Export",
 	     {"Path to .data trace file [nargs=0..1] [default: itrace.data]",
 	      "Output file of trace [nargs=0..1] [default: itrace.ftf]"}}
@@ -53,14 +62,14 @@ int main() {
 
 	// --- Default argument values ---
 	std::map<std::string, std::vector<std::string>> input_values;
-	input_values["Record"] = {"", "itrace.data", "", "", "", "No"};
-	input_values["Decode"] = {"itrace.data", "itrace.trace", ""};
+	input_values["Record"] = {"", "itrace.data", "", "", "", "No", "No"};
+	input_values["Decode"] = {"itrace.data", "itrace.trace", "", "", ""};
 	input_values["Export"] = {"itrace.data", "itrace.ftf"};
 
 	// --- Optional argument formats ---
 	std::map<std::string, std::vector<std::string>> arg_formats;
-	arg_formats["Record"] = {"<target>", "<output>", "<pid>", "<symbol>", "<start>,<end>", ""};
-	arg_formats["Decode"] = {"<input>", "<output>", "<start>,<end>"};
+	arg_formats["Record"] = {"<target>", "<output>", "<pid>", "<symbol>", "<start>,<end>", "", ""};
+	arg_formats["Decode"] = {"<input>", "<output>", "<start>,<end>", "<text|bin>", "<jobs>"};
 	arg_formats["Export"] = {"<input>", "<output>"};
 
 	// --- Full command storage ---
@@ -72,6 +81,13 @@ int main() {
 	int snapshot_selected                     = input_values["Record"][5] == "Yes" ? 1 : 0;
 	Component snapshot_toggle                 = Toggle(&snapshot_entries, &snapshot_selected);
 
+	// --- Control toggle, the recording is toggled through fifos in control_dir ---
+	int control_selected     = input_values["Record"][6] == "Yes" ? 1 : 0;
+	Component control_toggle = Toggle(&snapshot_entries, &control_selected);
+	std::string control_dir  = libitrace::TraceControl::DefaultDir();
+	std::unique_ptr<libitrace::TraceControl> control {};
+	bool controlled {false};
+
 	// --- Components ---
 	auto menu           = Menu(&commands, &menu_selected);
 	auto menu_container = Container::Vertical({menu});
@@ -84,6 +100,8 @@ int main() {
 		for (size_t i = 0; i < labels.size(); ++i) {
 			if (labels[i] == "Snapshot") {
 				components.push_back(snapshot_toggle);
+			} else if (labels[i] == "Control") {
+				components.push_back(control_toggle);
 			} else {
 				std::string placeholder = input_values[cmd][i].empty() ? arg_formats[cmd][i] : "";
 				components.push_back(Input(
@@ -118,12 +136,13 @@ int main() {
 
 	auto reset_inputs = [&]() {
 		// Reset input values
-		input_values["Record"] = {"", "itrace.data", "", "", "", "No"};
-		input_values["Decode"] = {"itrace.data", "itrace.trace", ""};
+		input_values["Record"] = {"", "itrace.data", "", "", "", "No", "No"};
+		input_values["Decode"] = {"itrace.data", "itrace.trace", "", "", ""};
 		input_values["Export"] = {"itrace.data", "itrace.ftf"};
 
 		// Reset toggles
 		snapshot_selected = 0;
+		control_selected  = 0;
 
 		// Reset focused indices
 		for (auto& cmd : commands) { focused_input_index[cmd] = 0; }
@@ -139,25 +158,33 @@ int main() {
 		return pid;
 	};
 
-	// --- Blocking command runner ---
-	auto run_command = [](const std::string& cmd) {
-		std::array<char, 128> buffer;
-		std::string result;
-		std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"), pclose);
-		if (!pipe) return std::string("Failed to run command\n");
-		while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) result += buffer.data();
-		return result;
+	// --- Blocking command runner, queued so concurrent decodes and exports share the cores ---
+	auto run_command = [](const std::string& cmd, const std::string& done) {
+		libitrace::Subprocess shell {"/bin/sh", {"-c", cmd}};
+		auto res = libitrace::JobScheduler::Global().Submit(shell)->Wait();
+		if (res.state == libitrace::JobState::Cancelled) return std::string {"Cancelled"};
+		if (!res.process || res.process->Exit != 0) return std::string {"Failed to run command"};
+
+		char buf[128] {};
+		std::snprintf(
+		    buf, sizeof(buf), "%s in %.1f s after %.1f s queued", done.c_str(), res.run_seconds,
+		    res.wait_seconds
+		);
+		return std::string {buf};
 	};
 
 	// --- CLI flags mapping ---
 	std::map<std::string, std::string> cli_flags = {
 	    {"Time Window",                "--time"            },
+	    {"Format",                     "--format"          },
+	    {"Jobs",                       "--jobs"            },
 	    {"Input",	                  "--input"           },
 	    {"Output",	                 "--output"          },
 	    {"PID",	                    "--pid"             },
 	    {"Filter Symbol",              "--filter-symbol"   },
 	    {"Filter Instruction Pointer", "--filter-instr-ptr"},
 	    {"Snapshot",                   "--snapshot"        },
+	    {"Control",                    "--control"         },
 	    {"Target",	                 ""                  }
 	};
 
@@ -272,9 +299,28 @@ int main() {
 						waitpid(running_processes[cmd], nullptr, 0);
 						running_processes[cmd] = 0;
 						command_output[cmd]    = "Recording stopped.";
+						control.reset();
+						controlled = false;
 						return true;
 					}
 				}
+				if ((e == Event::Character('e') || e == Event::Character('d')) && cmd == "Record" &&
+				    controlled && running_processes[cmd] > 0) {
+					// The fifos only exist once perf started, so they are opened on first use
+					try {
+						if (!control)
+							control = std::make_unique<libitrace::TraceControl>(control_dir, false);
+						bool enable = e == Event::Character('e');
+						auto took   = enable ? control->Enable() : control->Disable();
+						char buf[64] {};
+						std::snprintf(
+						    buf, sizeof(buf), "Tracing %s in %.1f us", enable ? "on" : "off",
+						    took.count() / 1e3
+						);
+						command_output[cmd] = buf;
+					} catch (const std::runtime_error& err) { command_output[cmd] = err.what(); }
+					return true;
+				}
 			} else {
 				if (e == Event::ArrowDown) {
 					arg_selected = (arg_selected + 1) % input_components[cmd].size();
@@ -306,6 +352,9 @@ int main() {
 						const std::string& label = args_labels[cmd][i];
 						if (label == "Snapshot") {
 							if (snapshot_selected == 1) { command_line += " --snapshot"; }
+						} else if (label == "Control") {
+							if (control_selected == 1)
+								command_line += " --control --control-dir " + control_dir;
 						} else if (!input_values[cmd][i].empty()) {
 							command_line += " " + cli_flags[label] + " " + input_values[cmd][i];
 							if (label == "Input") input_file = input_values[cmd][i];
@@ -315,7 +364,14 @@ int main() {
 					full_command[cmd] = command_line;
 
 					// Show starting message
-					if (cmd == "Record") {
+					if (cmd == "Record" && control_selected == 1) {
+						// stdin stays with the TUI, the hotkeys below drive the control fifos
+						running_processes[cmd] = run_command_async(command_line + " < /dev/null");
+						controlled             = true;
+						command_output[cmd] =
+						    "Recording started with tracing off, press [e] to turn it on and [d] "
+						    "to turn it off ...";
+					} else if (cmd == "Record") {
 						running_processes[cmd] = run_command_async(command_line);
 						command_output[cmd]    = "Recording started ...";
 					} else if (cmd == "Decode") {
@@ -323,16 +379,14 @@ int main() {
 
 						// Run asynchronously in background thread
 						std::thread([&, command_line, cmd]() {
-							std::string result               = run_command(command_line);
-							command_output[cmd]              = "Completed decoding!";
+							command_output[cmd] = run_command(command_line, "Completed decoding");
 							show_completed_output_popup[cmd] = true;
 						}).detach();
 					} else if (cmd == "Export") {
 						command_output[cmd] = "Exporting file " + input_file + "...";
 
 						std::thread([&, command_line, cmd]() {
-							std::string result               = run_command(command_line);
-							command_output[cmd]              = "Completed exporting!";
+							command_output[cmd] = run_command(command_line, "Completed exporting");
 							show_completed_output_popup[cmd] = true;
 						}).detach();
 					}
@@ -354,7 +408,8 @@ int main() {
 	menu_container->TakeFocus();
 	screen.Loop(ui);
 
-	// Kill any running Record process on exit
+	// Stop queued and running decodes and exports, and any running Record process on exit
+	libitrace::JobScheduler::Global().CancelAll();
 	if (running_processes["Record"] > 0) {
 		kill(running_processes["Record"], SIGINT);
 		waitpid(running_processes["Record"], nullptr, 0);
@@ -39,20 +39,6 @@ def build_xed():
 
     subprocess.run(["bin/xed", "-version"], check=True)
 
-def build_perf2perfetto():
-    if not os.path.exists("deps/perf2perfetto"):
-        subprocess.run(
-            ["git", "clone", "https://github.com/michoecho/perf2perfetto.git", "deps/perf2perfetto"],
-            check=True
-        )
-
-    if not os.path.exists("bin/libperf2perfetto.so"):
-        subprocess.run(
-            ["cargo", "build", "--release"],
-            cwd="deps/perf2perfetto"
-        )
-        shutil.copy2("deps/perf2perfetto/target/release/libperf2perfetto.so", "bin/libperf2perfetto.so")
-
 def build_itrace():
     subprocess.run(["cmake", "-DCMAKE_INSTALL_PREFIX=/usr/local/bin",".."], cwd="build", check=True)
     subprocess.run(["make", "-j", str(os.cpu_count())], cwd="build", check=True)
@@ -61,8 +47,6 @@ def build_itrace():
 def install():
     shutil.copy2("build/itrace", "/usr/local/bin")
     shutil.copy2("bin/xed", "/usr/local/bin")
-    if os.path.exists("bin/libperf2perfetto.so"):
-        shutil.copy2("bin/libperf2perfetto.so", "/usr/local/lib")
 
 if __name__ == "__main__":
     print("Setting up itrace...")
@@ -82,12 +66,6 @@ if __name__ == "__main__":
         action="store_true",
         default=False,
     )
-    parser.add_argument(
-        "--export",
-        help="Build dependency needed for exporting trace to Perfetto. Need Rust and cargo",
-        action="store_true",
-        default=False,
-    )
     parser.add_argument(
         "--install",
         help="Install the binaries. Requires sudo",
@@ -109,8 +87,6 @@ if __name__ == "__main__":
     # Install and build Intel x86 Encoder/Decoder (Intel xed)
     build_xed()
     build_itrace()
-    if args.export:
-        build_perf2perfetto()
 
     if args.install:
         install()
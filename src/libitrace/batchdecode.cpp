@@ -0,0 +1,119 @@
+#include "libitrace/batchdecode.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "libitrace/perfdata.hpp"
+#include "libitrace/scheduler.hpp"
+
+namespace libitrace {
+
+namespace {
+
+uint64_t file_size(const std::string& path) {
+	struct stat st {};
+	return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+}  // namespace
+
+std::vector<std::string> BatchDecode::Discover(const std::string& dir) {
+	DIR* handle = opendir(dir.c_str());
+	if (!handle) throw std::runtime_error("Cannot read the directory " + dir);
+
+	std::string prefix = dir.empty() || dir.back() == '/' ? dir : dir + "/";
+	std::vector<std::pair<uint64_t, std::string>> traces {};
+	while (dirent* entry = readdir(handle)) {
+		std::string path = prefix + entry->d_name;
+		struct stat st {};
+		if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+		// Outputs, indexes and manifests sit next to the traces and are told apart by the magic
+		if (PerfData::IsPerfData(path)) traces.emplace_back(st.st_size, std::move(path));
+	}
+	closedir(handle);
+
+	// Longest processing time first, with the size standing in for the time
+	std::sort(traces.begin(), traces.end(), [](const auto& a, const auto& b) {
+		return a.first != b.first ? a.first > b.first : a.second < b.second;
+	});
+
+	std::vector<std::string> paths {};
+	for (auto& trace : traces) paths.push_back(std::move(trace.second));
+	return paths;
+}
+
+bool BatchDecode::UpToDate(const std::string& infile, const std::string& outfile) {
+	struct stat in {}, out {};
+	if (stat(infile.c_str(), &in) != 0 || stat(outfile.c_str(), &out) != 0) return false;
+	if (out.st_size == 0) return false;
+	if (out.st_mtim.tv_sec != in.st_mtim.tv_sec) return out.st_mtim.tv_sec > in.st_mtim.tv_sec;
+	return out.st_mtim.tv_nsec >= in.st_mtim.tv_nsec;
+}
+
+std::vector<BatchEntry> BatchDecode::Run(const Progress& progress) {
+	std::vector<std::string> traces = Discover(dir_);
+	std::vector<BatchEntry> entries(traces.size());
+	for (size_t i = 0; i < traces.size(); i++) {
+		entries[i].infile  = traces[i];
+		entries[i].outfile = OutfileFor(traces[i]);
+		entries[i].bytes   = file_size(traces[i]);
+	}
+
+	// Each thread drives one decode at a time and takes the largest trace left as it finishes one.
+	// The perf scripts themselves are bounded by the job scheduler
+	std::atomic<size_t> next {0};
+	std::mutex lock {};
+	auto worker = [&]() {
+		for (size_t i = next++; i < entries.size(); i = next++) {
+			decode_(entries[i]);
+			if (!progress) continue;
+			std::lock_guard<std::mutex> guard {lock};
+			progress(entries[i]);
+		}
+	};
+
+	size_t nthreads = std::min(entries.size(), JobScheduler::Global().Slots());
+	std::vector<std::thread> threads {};
+	for (size_t i {0}; i < nthreads; ++i) threads.emplace_back(worker);
+	for (auto& t : threads) t.join();
+
+	return entries;
+}
+
+void BatchDecode::decode_(BatchEntry& entry) {
+	if (!force_ && UpToDate(entry.infile, entry.outfile)) {
+		entry.status    = BatchStatus::UpToDate;
+		entry.out_bytes = file_size(entry.outfile);
+		return;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	try {
+		Decode decode {entry.infile, entry.outfile};
+		if (configure_) configure_(decode);
+		decode.SetPriority(JobPriority::Batch);
+		decode.Run();
+		entry.status = BatchStatus::Decoded;
+		entry.cached = decode.Cache() && decode.Cache()->Stats().hits > 0;
+	} catch (const std::exception& e) {
+		entry.status = BatchStatus::Failed;
+		entry.error  = e.what();
+		// perf prints to the terminal when its output goes straight to the outfile
+		if (entry.error.empty()) entry.error = "perf script failed";
+		// A partial output would be taken as up to date by the next batch
+		unlink(entry.outfile.c_str());
+	}
+	entry.seconds =
+	    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	entry.out_bytes = file_size(entry.outfile);
+}
+
+}  // namespace libitrace
@@ -0,0 +1,367 @@
+#include "libitrace/bintrace.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "libitrace/utils.hpp"
+
+namespace {
+
+enum BinTraceColumn : size_t {
+	Time,
+	Ip,
+	Pid,
+	Tid,
+	Cpu,
+	Comm,
+	Event,
+	Flags,
+	Sym,
+	SymOff,
+	Dso,
+	Addr,
+	AddrSym,
+	AddrSymOff,
+	AddrDso,
+	Insn,
+	InsnCnt,
+	CycCnt,
+	Period,
+	NumColumns
+};
+
+uint64_t zigzag(int64_t value) {
+	return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+	return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void put_varint(std::vector<uint8_t>& column, uint64_t value) {
+	while (value >= 0x80) {
+		column.push_back(static_cast<uint8_t>(value) | 0x80);
+		value >>= 7;
+	}
+	column.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t get_varint(const uint8_t*& cursor, const uint8_t* end) {
+	uint64_t value {0};
+	for (int shift {0}; cursor < end && shift < 64; shift += 7) {
+		uint8_t byte = *cursor++;
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) return value;
+	}
+	throw std::runtime_error("Binary trace block is corrupt");
+}
+
+}  // namespace
+
+namespace libitrace {
+
+BinTraceWriter::BinTraceWriter(const std::string& path, size_t block_records)
+    : block_records_ {std::max<size_t>(block_records, 1)},
+      columns_(NumColumns) {
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd_ == -1) throw_errno("Cannot open " + path);
+
+	// id 0 is the empty string so fields perf did not print cost a single byte
+	strings_.Intern({});
+
+	BinTraceHeader header {};
+	memcpy(header.magic, BINTRACE_MAGIC, sizeof(header.magic));
+	header.version       = BINTRACE_VERSION;
+	header.block_records = block_records_;
+	write_(&header, sizeof(header));
+}
+
+BinTraceWriter::~BinTraceWriter() {
+	if (fd_ == -1) return;
+	// A writer left behind by an error is only closed, the error that got here is the one to report
+	try {
+		Close();
+	} catch (const std::runtime_error&) {
+		close(fd_);
+	}
+}
+
+void BinTraceWriter::Append(const ScriptRecord& record) {
+	if (block_.records == 0) {
+		block_.min_time = record.time;
+		block_.max_time = record.time;
+		prev_time_      = 0;
+		prev_ip_        = 0;
+	}
+	block_.min_time = std::min(block_.min_time, record.time);
+	block_.max_time = std::max(block_.max_time, record.time);
+
+	put_varint(columns_[Time], zigzag(static_cast<int64_t>(record.time - prev_time_)));
+	put_varint(columns_[Ip], zigzag(static_cast<int64_t>(record.ip - prev_ip_)));
+	put_varint(columns_[Pid], zigzag(record.pid));
+	put_varint(columns_[Tid], zigzag(record.tid));
+	put_varint(columns_[Cpu], zigzag(record.cpu));
+	put_varint(columns_[Comm], strings_.Intern(record.comm));
+	put_varint(columns_[Event], strings_.Intern(record.event));
+	put_varint(columns_[Flags], strings_.Intern(record.flags));
+	put_varint(columns_[Sym], strings_.Intern(record.sym));
+	put_varint(columns_[SymOff], record.symoff);
+	put_varint(columns_[Dso], strings_.Intern(record.dso));
+	// 0 marks a record without a branch target
+	uint64_t addr = record.has_addr ? zigzag(static_cast<int64_t>(record.addr - record.ip)) + 1 : 0;
+	put_varint(columns_[Addr], addr);
+	put_varint(columns_[AddrSym], strings_.Intern(record.addr_sym));
+	put_varint(columns_[AddrSymOff], record.addr_symoff);
+	put_varint(columns_[AddrDso], strings_.Intern(record.addr_dso));
+	put_varint(columns_[Insn], strings_.Intern(record.insn));
+	put_varint(columns_[InsnCnt], record.insn_cnt);
+	put_varint(columns_[CycCnt], record.cyc_cnt);
+	put_varint(columns_[Period], record.period);
+
+	prev_time_ = record.time;
+	prev_ip_   = record.ip;
+	++block_.records;
+	++records_;
+
+	if (block_.records == block_records_) flush_block_();
+}
+
+void BinTraceWriter::Close() {
+	if (fd_ == -1) return;
+	flush_block_();
+
+	BinTraceTrailer trailer {};
+	trailer.strings_offset = offset_;
+	trailer.strings        = strings_.Size();
+	for (const auto& str : strings_.Strings()) {
+		uint32_t length = str.size();
+		write_(&length, sizeof(length));
+		write_(str.data(), str.size());
+	}
+
+	// Keep the index 8 byte aligned so readers can use it straight from the mapping
+	static const char padding[8] {};
+	write_(padding, (8 - offset_ % 8) % 8);
+	trailer.index_offset = offset_;
+	trailer.blocks       = index_.size();
+	trailer.records      = records_;
+	trailer.sorted       = sorted_;
+	write_(index_.data(), index_.size() * sizeof(BinTraceBlock));
+
+	memcpy(trailer.magic, BINTRACE_MAGIC, sizeof(trailer.magic));
+	write_(&trailer, sizeof(trailer));
+
+	close(fd_);
+	fd_ = -1;
+}
+
+void BinTraceWriter::flush_block_() {
+	if (block_.records == 0) return;
+
+	if (!index_.empty() && block_.min_time < index_.back().max_time) sorted_ = false;
+
+	block_.offset = offset_;
+	uint32_t sizes[NumColumns] {};
+	for (size_t i {0}; i < NumColumns; ++i) sizes[i] = columns_[i].size();
+	write_(sizes, sizeof(sizes));
+	for (auto& column : columns_) {
+		write_(column.data(), column.size());
+		column.clear();
+	}
+	block_.size = offset_ - block_.offset;
+
+	index_.push_back(block_);
+	block_ = BinTraceBlock {};
+}
+
+void BinTraceWriter::write_(const void* data, size_t size) {
+	write_all(fd_, data, size);
+	offset_ += size;
+}
+
+BinTraceReader::BinTraceReader(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) throw_errno("Cannot open " + path);
+
+	struct stat st {};
+	if (fstat(fd, &st) == -1) {
+		int error = errno;
+		close(fd);
+		throw_errno("Cannot stat " + path, error);
+	}
+	size_ = st.st_size;
+	if (size_ < sizeof(BinTraceHeader) + sizeof(BinTraceTrailer)) {
+		close(fd);
+		throw std::runtime_error(path + " is not a binary trace");
+	}
+
+	void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	int error = errno;
+	close(fd);
+	if (map == MAP_FAILED) throw_errno("Cannot map " + path, error);
+	data_ = static_cast<const uint8_t*>(map);
+
+	// The constructor does not complete on error so the mapping has to be released here
+	auto invalid = [&](const std::string& reason) {
+		munmap(map, size_);
+		data_ = nullptr;
+		return std::runtime_error(path + reason);
+	};
+
+	BinTraceHeader header {};
+	memcpy(&header, data_, sizeof(header));
+	memcpy(&trailer_, data_ + size_ - sizeof(trailer_), sizeof(trailer_));
+	if (memcmp(header.magic, BINTRACE_MAGIC, sizeof(header.magic)) != 0 ||
+	    memcmp(trailer_.magic, BINTRACE_MAGIC, sizeof(trailer_.magic)) != 0)
+		throw invalid(" is not a binary trace");
+	if (header.version != BINTRACE_VERSION)
+		throw invalid(" has unsupported binary trace version");
+	if (trailer_.index_offset > size_ || trailer_.strings_offset > trailer_.index_offset ||
+	    trailer_.blocks > (size_ - trailer_.index_offset) / sizeof(BinTraceBlock))
+		throw invalid(" has a truncated index");
+
+	blocks_.resize(trailer_.blocks);
+	memcpy(blocks_.data(), data_ + trailer_.index_offset, blocks_.size() * sizeof(BinTraceBlock));
+
+	strings_.reserve(trailer_.strings);
+	const uint8_t* cursor = data_ + trailer_.strings_offset;
+	const uint8_t* end    = data_ + trailer_.index_offset;
+	for (uint64_t i {0}; i < trailer_.strings; ++i) {
+		uint32_t length {};
+		if (cursor + sizeof(length) > end) throw invalid(" has a corrupt string table");
+		memcpy(&length, cursor, sizeof(length));
+		cursor += sizeof(length);
+		if (cursor + length > end) throw invalid(" has a corrupt string table");
+		strings_.emplace_back(reinterpret_cast<const char*>(cursor), length);
+		cursor += length;
+	}
+}
+
+BinTraceReader::~BinTraceReader() {
+	if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+bool BinTraceReader::IsBinTrace(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) return false;
+
+	char magic[sizeof(BINTRACE_MAGIC)] {};
+	bool res = read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+	           memcmp(magic, BINTRACE_MAGIC, sizeof(magic)) == 0;
+	close(fd);
+	return res;
+}
+
+void BinTraceReader::Read(
+    const ScriptParser::Callback& callback, std::optional<uint64_t> start,
+    std::optional<uint64_t> end
+) const {
+	uint64_t lo = start.value_or(0);
+	uint64_t hi = end.value_or(UINT64_MAX);
+
+	// Sorted blocks let the first candidate be found by binary search and the scan stop at the
+	// first block past the range. Otherwise every index entry has to be checked
+	auto first = blocks_.begin();
+	if (trailer_.sorted) {
+		first = std::partition_point(
+		    blocks_.begin(), blocks_.end(),
+		    [lo](const BinTraceBlock& block) { return block.max_time < lo; }
+		);
+	}
+
+	for (auto it = first; it != blocks_.end(); ++it) {
+		if (it->min_time > hi) {
+			if (trailer_.sorted) break;
+			continue;
+		}
+		if (it->max_time < lo) continue;
+		read_block_(*it, callback, lo, hi);
+	}
+}
+
+void BinTraceReader::WriteText(int fd, std::optional<uint64_t> start, std::optional<uint64_t> end)
+    const {
+	std::string out {};
+	auto flush = [&]() {
+		write_all(fd, out.data(), out.size());
+		out.clear();
+	};
+
+	Read(
+	    [&](const ScriptRecord& record) {
+		    ScriptParser::FormatLine(record, out);
+		    out += '\n';
+		    if (out.size() >= 1048576) flush();
+	    },
+	    start, end
+	);
+	flush();
+}
+
+void BinTraceReader::read_block_(
+    const BinTraceBlock& block, const ScriptParser::Callback& callback, uint64_t start,
+    uint64_t end
+) const {
+	if (block.offset + block.size > size_)
+		throw std::runtime_error("Binary trace block is truncated");
+
+	uint32_t sizes[NumColumns] {};
+	memcpy(sizes, data_ + block.offset, sizeof(sizes));
+
+	const uint8_t* cursors[NumColumns] {};
+	const uint8_t* ends[NumColumns] {};
+	const uint8_t* column = data_ + block.offset + sizeof(sizes);
+	for (size_t i {0}; i < NumColumns; ++i) {
+		cursors[i] = column;
+		ends[i]    = column + sizes[i];
+		column     = ends[i];
+	}
+	if (column > data_ + block.offset + block.size)
+		throw std::runtime_error("Binary trace block is corrupt");
+
+	auto next   = [&](size_t col) { return get_varint(cursors[col], ends[col]); };
+	auto string = [&](size_t col) {
+		uint64_t id = next(col);
+		if (id >= strings_.size()) throw std::runtime_error("Binary trace string id out of range");
+		return strings_[id];
+	};
+
+	uint64_t time {0}, ip {0};
+	ScriptRecord record {};
+	for (uint64_t i {0}; i < block.records; ++i) {
+		time += unzigzag(next(Time));
+		ip += unzigzag(next(Ip));
+
+		record.time        = time;
+		record.ip          = ip;
+		record.pid         = unzigzag(next(Pid));
+		record.tid         = unzigzag(next(Tid));
+		record.cpu         = unzigzag(next(Cpu));
+		record.comm        = string(Comm);
+		record.event       = string(Event);
+		record.flags       = string(Flags);
+		record.sym         = string(Sym);
+		record.symoff      = next(SymOff);
+		record.dso         = string(Dso);
+		uint64_t addr      = next(Addr);
+		record.has_addr    = addr != 0;
+		record.addr        = addr ? ip + unzigzag(addr - 1) : 0;
+		record.addr_sym    = string(AddrSym);
+		record.addr_symoff = next(AddrSymOff);
+		record.addr_dso    = string(AddrDso);
+		record.insn        = string(Insn);
+		record.insn_cnt    = next(InsnCnt);
+		record.cyc_cnt     = next(CycCnt);
+		record.period      = next(Period);
+
+		if (time >= start && time <= end) callback(record);
+	}
+}
+
+}  // namespace libitrace
@@ -0,0 +1,140 @@
+#include "libitrace/calltree.hpp"
+
+namespace libitrace {
+
+CallTree::CallTree(const std::string& infile) {
+	args_.infile = infile;
+	nodes_.Allocate();
+	nodes_[Root()].function = function_({}, {});
+}
+
+void CallTree::Run() {
+	ScriptParser parser {[this](const ScriptRecord& record) { Add(record); }};
+
+	run_script(call_script_arglist(args_), parser);
+	Finish();
+}
+
+void CallTree::Add(const ScriptRecord& record) {
+	bool call = record.HasFlag("call");
+	if (!call && !record.HasFlag("return")) return;
+
+	auto function = [this](std::string_view sym, std::string_view dso) {
+		return function_(sym.empty() ? SCRIPT_UNKNOWN : sym, dso);
+	};
+
+	ThreadState& thread = thread_(record);
+	advance_(thread, record.time);
+
+	// The branch leaves the function on top of the stack. If it does not, calls or returns were
+	// missed and the stack is brought back in line first
+	sync_(thread, function(record.sym, record.dso), record.time);
+
+	if (call) {
+		++stats_.calls;
+		push_(thread, function(record.addr_sym, record.addr_dso), record.time);
+	} else {
+		++stats_.returns;
+		if (thread.stack.size() > 1) pop_(thread, record.time);
+		if (record.has_addr) sync_(thread, function(record.addr_sym, record.addr_dso), record.time);
+	}
+}
+
+void CallTree::Finish() {
+	for (auto& [tid, thread] : threads_) {
+		while (thread.stack.size() > 1) pop_(thread, thread.last);
+		// The thread node is closed too so its inclusive time covers the whole thread
+		Frame& root = thread.stack.front();
+		nodes_[root.node].inclusive += thread.last - root.entered;
+		nodes_[Root()].inclusive += thread.last - root.entered;
+		root.entered = thread.last;
+	}
+}
+
+uint32_t CallTree::function_(std::string_view name, std::string_view dso) {
+	uint32_t nameid = names_.Intern(name);
+	uint32_t dsoid  = names_.Intern(dso);
+
+	auto [it, inserted] = function_ids_.try_emplace(
+	    (static_cast<uint64_t>(nameid) << 32) | dsoid, functions_.size()
+	);
+	if (inserted) functions_.push_back({nameid, dsoid});
+	return it->second;
+}
+
+uint32_t CallTree::child_(uint32_t parent, uint32_t function) {
+	auto [it, inserted] =
+	    children_.try_emplace((static_cast<uint64_t>(parent) << 32) | function, 0);
+	if (!inserted) return it->second;
+
+	uint32_t id        = nodes_.Allocate();
+	CallTreeNode& node = nodes_[id];
+	node.parent        = parent;
+	node.function      = function;
+	node.next_sibling  = nodes_[parent].first_child;
+
+	nodes_[parent].first_child = id;
+	it->second                 = id;
+	return id;
+}
+
+CallTree::ThreadState& CallTree::thread_(const ScriptRecord& record) {
+	auto [it, inserted] = threads_.try_emplace(record.tid);
+	ThreadState& thread = it->second;
+	if (inserted) {
+		std::string name {record.comm};
+		name += ' ';
+		name += std::to_string(record.tid);
+		uint32_t node = child_(Root(), function_(name, {}));
+		++nodes_[node].calls;
+		thread.stack.push_back({node, record.time});
+		thread.last = record.time;
+	}
+	return thread;
+}
+
+void CallTree::advance_(ThreadState& thread, uint64_t time) {
+	// Time since the previous event of the thread was spent in whatever is on top of its stack
+	if (time > thread.last) {
+		nodes_[thread.stack.back().node].exclusive += time - thread.last;
+		thread.last = time;
+	}
+}
+
+void CallTree::push_(ThreadState& thread, uint32_t function, uint64_t time) {
+	uint32_t node = child_(thread.stack.back().node, function);
+	++nodes_[node].calls;
+	thread.stack.push_back({node, time});
+}
+
+void CallTree::pop_(ThreadState& thread, uint64_t time) {
+	Frame& frame = thread.stack.back();
+	nodes_[frame.node].inclusive += time - frame.entered;
+	thread.stack.pop_back();
+}
+
+void CallTree::sync_(ThreadState& thread, uint32_t function, uint64_t time) {
+	if (nodes_[thread.stack.back().node].function == function) return;
+	++stats_.resynced;
+
+	// A caller further down means the frames above it were left without a return, as longjmp and
+	// exceptions do
+	for (size_t depth = thread.stack.size() - 1; depth > 0; --depth) {
+		if (nodes_[thread.stack[depth - 1].node].function != function) continue;
+		while (thread.stack.size() > depth) {
+			pop_(thread, time);
+			++stats_.unwound;
+		}
+		return;
+	}
+
+	// Otherwise the function was entered without a call that was seen: a tail call replaces the
+	// top frame, and code entered before tracing started becomes the outermost frame
+	if (thread.stack.size() > 1) {
+		pop_(thread, time);
+		++stats_.unwound;
+	}
+	push_(thread, function, time);
+}
+
+}  // namespace libitrace
@@ -0,0 +1,86 @@
+#include "libitrace/control.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "libitrace/utils.hpp"
+
+namespace libitrace {
+
+TraceControl::TraceControl(const std::string& dir, bool create)
+    : dir_ {dir},
+      ctl_ {dir + "/ctl.fifo"},
+      ack_ {dir + "/ack.fifo"} {
+	if (create) {
+		make_dirs(dir_);
+		for (const auto& fifo : {ctl_, ack_}) {
+			if (mkfifo(fifo.c_str(), 0600) == -1 && errno != EEXIST)
+				throw std::runtime_error("Cannot create fifo " + fifo + ": " + strerror(errno));
+		}
+		owner_ = true;
+	}
+
+	ctlfd_ = open(ctl_.c_str(), O_RDWR | O_CLOEXEC);
+	ackfd_ = open(ack_.c_str(), O_RDWR | O_CLOEXEC | O_NONBLOCK);
+	if (ctlfd_ == -1 || ackfd_ == -1) {
+		std::string error = strerror(errno);
+		if (ctlfd_ != -1) close(ctlfd_);
+		if (ackfd_ != -1) close(ackfd_);
+		throw std::runtime_error("Cannot open control fifos in " + dir_ + ": " + error);
+	}
+}
+
+TraceControl::~TraceControl() {
+	close(ctlfd_);
+	close(ackfd_);
+	if (!owner_) return;
+	unlink(ctl_.c_str());
+	unlink(ack_.c_str());
+	rmdir(dir_.c_str());
+}
+
+std::string TraceControl::DefaultDir() {
+	const char* tmp = getenv("TMPDIR");
+	return std::string {tmp && *tmp ? tmp : "/tmp"} + "/itrace-control-" + std::to_string(getpid());
+}
+
+std::string TraceControl::PerfArg() const { return "fifo:" + ctl_ + "," + ack_; }
+
+std::chrono::nanoseconds TraceControl::command_(const std::string& command) {
+	// An ack left over from a command that timed out must not be taken for this one
+	char buf[64];
+	while (read(ackfd_, buf, sizeof(buf)) > 0) {}
+
+	auto begin       = std::chrono::steady_clock::now();
+	std::string line = command + "\n";
+	write_all(ctlfd_, line.data(), line.size());
+
+	// perf answers every command with "ack\n"
+	auto deadline = begin + std::chrono::milliseconds {CONTROL_ACK_TIMEOUT_MS};
+	std::string ack {};
+	while (ack.find('\n') == std::string::npos) {
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+		    deadline - std::chrono::steady_clock::now()
+		);
+		pollfd fd {ackfd_, POLLIN, 0};
+		int ready = left.count() > 0 ? poll(&fd, 1, left.count()) : 0;
+		if (ready == -1 && errno == EINTR) continue;
+		if (ready == -1) throw_errno("Cannot wait for the acknowledgement of " + command);
+		if (ready == 0) throw std::runtime_error("perf did not acknowledge " + command);
+
+		ssize_t bytes = read(ackfd_, buf, sizeof(buf));
+		if (bytes == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+		if (bytes == -1) throw_errno("Cannot read the acknowledgement of " + command);
+		if (bytes == 0) throw std::runtime_error("perf exited before acknowledging " + command);
+		ack.append(buf, bytes);
+	}
+	return std::chrono::steady_clock::now() - begin;
+}
+
+}  // namespace libitrace
@@ -1,25 +1,168 @@
 #include "libitrace/decode.hpp"
 
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <ctime>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <thread>
 
+#include "libitrace/bintrace.hpp"
+#include "libitrace/scheduler.hpp"
+#include "libitrace/shard.hpp"
 #include "libitrace/subprocess.hpp"
+#include "libitrace/traceindex.hpp"
 #include "libitrace/utils.hpp"
 
 namespace libitrace {
 
+namespace {
+
+constexpr size_t SHARDS_PER_JOB = 4;  // so workers that finish early pick up more shards
+
+/*
+ * @brief Run tasks on up to threads threads and no more than one per core, each thread taking the
+ * next task as it finishes one. The first error a task throws is rethrown once every thread is done
+ * */
+void run_pool(size_t tasks, size_t threads, const std::function<void(size_t)>& task) {
+	std::atomic<size_t> next {0};
+	std::mutex errlock {};
+	std::string error {};
+	auto worker = [&]() {
+		for (size_t i = next++; i < tasks; i = next++) {
+			try {
+				task(i);
+			} catch (const std::runtime_error& e) {
+				std::lock_guard<std::mutex> guard {errlock};
+				if (error.empty()) error = e.what();
+			}
+		}
+	};
+
+	size_t cores    = std::max(1u, std::thread::hardware_concurrency());
+	size_t nthreads = std::min({tasks, threads, cores});
+	std::vector<std::thread> pool {};
+	for (size_t i {0}; i < nthreads; ++i) pool.emplace_back(worker);
+	for (auto& t : pool) t.join();
+
+	if (!error.empty()) throw std::runtime_error(error);
+}
+
+/*
+ * @brief Map a part of a parallel decode for reading. Empty parts are not mapped
+ * */
+std::string_view map_part(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) throw_errno("Cannot open " + path);
+	struct stat st {};
+	if (fstat(fd, &st) == -1) {
+		int error = errno;
+		close(fd);
+		throw_errno("Cannot stat " + path, error);
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return {};
+	}
+
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	int error = errno;
+	close(fd);
+	if (map == MAP_FAILED) throw_errno("Cannot map " + path, error);
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	return {static_cast<const char*>(map), static_cast<size_t>(st.st_size)};
+}
+
+}  // namespace
+
 void Decode::Run() {
-	arglist perfargs = build_arglist_();
+	if (format_ == DecodeFormat::Bin && args_.src)
+		throw std::runtime_error("Source lines cannot be kept in a binary trace");
+
+	// Traces that are already decoded are sliced instead of running perf script again
+	if (BinTraceReader::IsBinTrace(args_.infile)) {
+		run_bin_input_();
+	} else if (TraceIndex::HasIndex(args_.infile)) {
+		run_indexed_input_();
+	} else if (cache_) {
+		run_cached_();
+	} else {
+		run_perf_();
+	}
+
+	// A second pass over the output, so only done when asked for
+	if (index_ && format_ == DecodeFormat::Text) TraceIndex::Build(outfile_);
+}
+
+void Decode::Stream(ScriptParser& parser) {
+	JobOptions options {};
+	options.priority = priority_;
+	run_script(build_arglist_(args_), parser, options);
+}
+
+void Decode::run_perf_() {
+	if (jobs_ > 1 && split_ == DecodeSplit::Psb) {
+		run_sharded_();
+	} else if (jobs_ > 1) {
+		run_parallel_();
+	} else {
+		run_script_();
+	}
+}
+
+void Decode::run_cached_() {
+	std::string key = cache_key_();
+	if (cache_->Fetch(key, outfile_)) return;
+	run_perf_();
+	cache_->Store(key, outfile_);
+}
+
+std::string Decode::cache_key_() {
+	// The path of the trace is left out since the cache identifies it by content. The number of
+	// jobs is left out too since a parallel decode produces the same output
+	ScriptArgs normalized {args_};
+	normalized.infile.clear();
+	arglist args = build_arglist_(normalized);
+	args.push_back(format_ == DecodeFormat::Bin ? "bin" : "text");
+
+	// A different perf may decode the same trace differently
+	Subprocess perfversion {"perf", {"--version"}};
+	auto res = JobScheduler::Global().Run(perfversion);
+	if (res && res->Exit == 0) args.push_back(res->Stdout);
+
+	return DecodeCache::Key(args_.infile, args);
+}
+
+void Decode::run_script_() {
+	if (format_ == DecodeFormat::Bin) {
+		BinTraceWriter writer {outfile_};
+		ScriptParser parser {[&writer](const ScriptRecord& record) { writer.Append(record); }};
+		Stream(parser);
+		writer.Close();
+		return;
+	}
+
+	arglist perfargs = build_arglist_(args_);
 	print_perf_args(perfargs);
 	Subprocess perfscript {"perf", perfargs};
 
 	// set to everyone rw but umask will mask it to something different
-	int fd = open(outfile_.c_str(), O_RDWR | O_CREAT, 0660);
-	if (fd == -1) die("open");
+	int fd = open(outfile_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1) throw_errno("Cannot open " + outfile_);
 	perfscript.SetStdout(fd);
 
-	auto res = perfscript.Run();
+	JobOptions options {};
+	options.priority = priority_;
+	auto res         = JobScheduler::Global().Run(perfscript, options);
+	close(fd);
 	if (!res) throw std::runtime_error("Error decoding trace data");
 	if (res->Exit != 0) throw std::runtime_error(res->Stderr);
 }
@@ -37,23 +180,410 @@ void Decode::AddSource() {
     args_.src= true;
 }
 
-libitrace::arglist Decode::build_arglist_() {
-	arglist args {args_.prefix};
-	args.insert(args.end(), args_.synth_events);
-	args.insert(args.end(), args_.insn_trace);
-	args.insert(args.end(), {"-i", args_.infile});
+void Decode::SetPriority(JobPriority priority) { priority_ = priority; }
+
+void Decode::SetJobs(size_t jobs) { jobs_ = std::max<size_t>(jobs, 1); }
+
+void Decode::SetSplit(DecodeSplit split) { split_ = split; }
+
+void Decode::SetFormat(DecodeFormat format) { format_ = format; }
+
+void Decode::WriteIndex() { index_ = true; }
+
+void Decode::UseCache(const std::string& dir, uint64_t max_bytes) {
+	cache_ = std::make_unique<DecodeCache>(dir, max_bytes);
+}
+
+void Decode::run_parallel_() {
+	// Only the interior window boundaries are computed from the span. The first and last window
+	// stay open ended unless the user gave a time range so no sample is lost to rounding.
+	uint64_t first {}, last {};
+	if (args_.start_time && args_.end_time) {
+		first = timespec_to_ns(*args_.start_time);
+		last  = timespec_to_ns(*args_.end_time);
+	} else {
+		auto [span_first, span_last] = time_span_();
+		first = args_.start_time ? timespec_to_ns(*args_.start_time) : span_first;
+		last  = args_.end_time ? timespec_to_ns(*args_.end_time) : span_last;
+	}
+	if (last <= first) throw std::runtime_error("Time range of trace is empty");
+
+	size_t windows = std::min<uint64_t>(jobs_, last - first);
+	uint64_t width = (last - first) / windows;
+
+	std::vector<ScriptArgs> windowargs(windows, args_);
+	stats_.assign(windows, DecodeWorkerStats {});
+	for (size_t i {0}; i < windows; ++i) {
+		// --time is inclusive on both ends so windows end 1ns before the next one starts
+		if (i > 0) windowargs[i].start_time = ns_to_timespec(first + i * width);
+		if (i + 1 < windows) windowargs[i].end_time = ns_to_timespec(first + (i + 1) * width - 1);
+
+		stats_[i].window     = i;
+		stats_[i].start_time = windowargs[i].start_time;
+		stats_[i].end_time   = windowargs[i].end_time;
+		print_perf_args(build_arglist_(windowargs[i]));
+	}
+
+	auto partfile = [this](size_t i) { return outfile_ + ".part" + std::to_string(i); };
+
+	// The workers of a parallel decode queue behind single decodes
+	JobOptions batch {JobPriority::Batch};
+	try {
+		run_pool(windows, jobs_, [&](size_t i) {
+			auto begin = std::chrono::steady_clock::now();
+
+			int fd = open(partfile(i).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+			if (fd == -1) throw_errno("Cannot open " + partfile(i));
+
+			Subprocess perfscript {"perf", build_arglist_(windowargs[i])};
+			perfscript.SetStdout(fd);
+			JobResult res = JobScheduler::Global().Submit(perfscript, batch)->Wait();
+
+			struct stat st {};
+			if (fstat(fd, &st) == 0) stats_[i].bytes = st.st_size;
+			close(fd);
+			stats_[i].queued = res.wait_seconds;
+			stats_[i].seconds =
+			    std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() -
+			    res.wait_seconds;
+
+			if (res.state != JobState::Done || !res.process)
+				throw std::runtime_error("Error decoding trace data");
+			if (res.process->Exit != 0) throw std::runtime_error(res.process->Stderr);
+		});
+	} catch (const std::runtime_error&) {
+		for (size_t i {0}; i < windows; ++i) unlink(partfile(i).c_str());
+		throw;
+	}
+
+	// Windows are disjoint and in time order so concatenating them keeps the output sorted
+	if (format_ == DecodeFormat::Bin) {
+		BinTraceWriter writer {outfile_};
+		ScriptParser parser {[&writer](const ScriptRecord& record) { writer.Append(record); }};
+		for (size_t i {0}; i < windows; ++i) {
+			int in = open(partfile(i).c_str(), O_RDONLY);
+			if (in == -1) throw_errno("Cannot open " + partfile(i));
+			parser.ParseFd(in);
+			close(in);
+			unlink(partfile(i).c_str());
+		}
+		writer.Close();
+		return;
+	}
+
+	int out = open(outfile_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (out == -1) throw_errno("Cannot open " + outfile_);
+	for (size_t i {0}; i < windows; ++i) {
+		int in = open(partfile(i).c_str(), O_RDONLY);
+		if (in == -1) {
+			int error = errno;
+			close(out);
+			throw_errno("Cannot open " + partfile(i), error);
+		}
+		size_t remaining = stats_[i].bytes;
+		while (remaining > 0) {
+			ssize_t sent = sendfile(out, in, nullptr, remaining);
+			if (sent <= 0) {
+				int error = sent == 0 ? EIO : errno;
+				close(in);
+				close(out);
+				throw_errno("Cannot copy " + partfile(i) + " to " + outfile_, error);
+			}
+			remaining -= sent;
+		}
+		close(in);
+		unlink(partfile(i).c_str());
+	}
+	close(out);
+}
+
+void Decode::run_sharded_() {
+	TraceSharder sharder {args_.infile};
+	uint64_t target = std::max(SHARD_MIN_BYTES, sharder.AuxBytes() / (jobs_ * SHARDS_PER_JOB));
+	std::vector<TraceShard> shards = sharder.Split(target);
+	if (shards.size() < 2) {
+		run_script_();
+		return;
+	}
+
+	auto shardfile = [this](size_t i) { return outfile_ + ".shard" + std::to_string(i); };
+	std::vector<std::string> parts {};
+	for (size_t i {0}; i < shards.size(); ++i)
+		parts.push_back(outfile_ + ".part" + std::to_string(i));
+
+	stats_.assign(shards.size(), DecodeWorkerStats {});
+	for (const auto& shard : shards) {
+		stats_[shard.index].window    = shard.index;
+		stats_[shard.index].cpu       = shard.cpu;
+		stats_[shard.index].aux_bytes = shard.bytes;
+	}
+
+	ScriptArgs shardargs {args_};
+	shardargs.infile = shardfile(0);
+	print_perf_args(build_arglist_(shardargs));
+
+	// Largest shards first so the last ones to finish are short
+	std::vector<size_t> order(shards.size());
+	for (size_t i {0}; i < order.size(); ++i) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&shards](size_t a, size_t b) {
+		return shards[a].bytes > shards[b].bytes;
+	});
+
+	// A shard file is as large as the trace apart from the AUX data of the other shards, so only
+	// the jobs_ shards being decoded are on disk at a time
+	JobOptions batch {JobPriority::Batch};
+	try {
+		run_pool(shards.size(), jobs_, [&](size_t task) {
+			const TraceShard& shard = shards[order[task]];
+			auto begin              = std::chrono::steady_clock::now();
+
+			ScriptArgs args {args_};
+			args.infile = shardfile(shard.index);
+			sharder.Write(shard, args.infile);
+
+			int fd = open(parts[shard.index].c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+			if (fd == -1) {
+				int error = errno;
+				unlink(args.infile.c_str());
+				throw_errno("Cannot open " + parts[shard.index], error);
+			}
+
+			Subprocess perfscript {"perf", build_arglist_(args)};
+			perfscript.SetStdout(fd);
+			JobResult res = JobScheduler::Global().Submit(perfscript, batch)->Wait();
+			unlink(args.infile.c_str());
+
+			DecodeWorkerStats& stats = stats_[shard.index];
+			struct stat st {};
+			if (fstat(fd, &st) == 0) stats.bytes = st.st_size;
+			close(fd);
+			stats.queued = res.wait_seconds;
+			stats.seconds =
+			    std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() -
+			    res.wait_seconds;
+
+			if (res.state != JobState::Done || !res.process)
+				throw std::runtime_error("Error decoding trace data");
+			if (res.process->Exit != 0) throw std::runtime_error(res.process->Stderr);
+		});
+	} catch (const std::runtime_error&) {
+		for (const auto& part : parts) unlink(part.c_str());
+		throw;
+	}
+
+	merge_parts_(parts);
+}
+
+void Decode::merge_parts_(const std::vector<std::string>& parts) {
+	// Each part is sorted by time. A group is a sample line and the source lines printed after
+	// it, and groups are merged by the time of their sample with ties going to the earlier part
+	struct Part {
+		std::string_view data {};
+		size_t pos {0};
+		uint64_t time {};
+		std::string_view group {};
+	};
+
+	std::vector<Part> inputs(parts.size());
+	auto unmap = [&inputs]() {
+		for (const auto& part : inputs) {
+			if (!part.data.empty()) munmap(const_cast<char*>(part.data.data()), part.data.size());
+		}
+	};
+	try {
+		for (size_t i {0}; i < parts.size(); ++i) inputs[i].data = map_part(parts[i]);
+	} catch (const std::runtime_error&) {
+		unmap();
+		for (const auto& part : parts) unlink(part.c_str());
+		throw;
+	}
+	// The mappings keep the data of the parts after they are unlinked
+	for (const auto& part : parts) unlink(part.c_str());
+
+	auto next_line = [](const Part& part, size_t pos) {
+		size_t newline = part.data.find('\n', pos);
+		return newline == std::string_view::npos ? part.data.size() : newline + 1;
+	};
+	auto next_group = [&next_line](Part& part) {
+		if (part.pos == part.data.size()) return false;
+
+		ScriptRecord record {};
+		size_t begin = part.pos;
+		size_t end   = next_line(part, begin);
+		bool sample  = ScriptParser::ParseLine(part.data.substr(begin, end - begin), record);
+		part.time    = sample ? record.time : 0;
+		while (end < part.data.size()) {
+			size_t line_end = next_line(part, end);
+			if (ScriptParser::ParseLine(part.data.substr(end, line_end - end), record)) break;
+			end = line_end;
+		}
+
+		part.group = part.data.substr(begin, end - begin);
+		part.pos   = end;
+		return true;
+	};
+
+	using Entry = std::pair<uint64_t, size_t>;  // time, part
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap {};
+	for (size_t i {0}; i < inputs.size(); ++i)
+		if (next_group(inputs[i])) heap.push({inputs[i].time, i});
+
+	std::optional<BinTraceWriter> writer {};
+	std::optional<ScriptParser> parser {};
+	int out {-1};
+	std::string buffer {};
+	try {
+		if (format_ == DecodeFormat::Bin) {
+			writer.emplace(outfile_);
+			parser.emplace([&writer](const ScriptRecord& record) { writer->Append(record); });
+		} else {
+			out = open(outfile_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+			if (out == -1) throw_errno("Cannot open " + outfile_);
+		}
+
+		while (!heap.empty()) {
+			Part& part = inputs[heap.top().second];
+			heap.pop();
+
+			if (parser) {
+				parser->Feed(part.group);
+				if (part.group.back() != '\n') parser->Feed("\n");
+			} else {
+				buffer.append(part.group);
+				if (part.group.back() != '\n') buffer.push_back('\n');
+				if (buffer.size() >= 1048576) {
+					write_all(out, buffer.data(), buffer.size());
+					buffer.clear();
+				}
+			}
+
+			if (next_group(part))
+				heap.push({part.time, static_cast<size_t>(&part - inputs.data())});
+		}
+
+		if (parser) {
+			parser->Finish();
+			writer->Close();
+		} else {
+			write_all(out, buffer.data(), buffer.size());
+		}
+	} catch (const std::runtime_error&) {
+		if (out != -1) close(out);
+		unmap();
+		throw;
+	}
+
+	if (out != -1) close(out);
+	unmap();
+}
+
+void Decode::run_bin_input_() {
+	check_not_infile_();
+	BinTraceReader reader {args_.infile};
+
+	std::optional<uint64_t> start {}, end {};
+	if (args_.start_time) start = timespec_to_ns(*args_.start_time);
+	if (args_.end_time) end = timespec_to_ns(*args_.end_time);
+
+	if (format_ == DecodeFormat::Bin) {
+		BinTraceWriter writer {outfile_};
+		reader.Read([&writer](const ScriptRecord& record) { writer.Append(record); }, start, end);
+		writer.Close();
+		return;
+	}
+
+	int fd = open(outfile_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1) throw_errno("Cannot open " + outfile_);
+	try {
+		reader.WriteText(fd, start, end);
+	} catch (const std::runtime_error&) {
+		close(fd);
+		throw;
+	}
+	close(fd);
+}
+
+void Decode::run_indexed_input_() {
+	check_not_infile_();
+	TraceIndex index {args_.infile};
+
+	std::optional<uint64_t> start {}, end {};
+	if (args_.start_time) start = timespec_to_ns(*args_.start_time);
+	if (args_.end_time) end = timespec_to_ns(*args_.end_time);
+	std::string_view slice = index.Slice(start, end);
+
+	if (format_ == DecodeFormat::Bin) {
+		BinTraceWriter writer {outfile_};
+		ScriptParser parser {[&writer](const ScriptRecord& record) { writer.Append(record); }};
+		parser.Feed(slice);
+		parser.Finish();
+		writer.Close();
+		return;
+	}
+
+	int fd = open(outfile_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1) throw_errno("Cannot open " + outfile_);
+	try {
+		write_all(fd, slice.data(), slice.size());
+	} catch (const std::runtime_error&) {
+		close(fd);
+		throw;
+	}
+	close(fd);
+}
+
+void Decode::check_not_infile_() {
+	// The input is mapped while the output is written so truncating it would lose the trace
+	struct stat in {}, out {};
+	if (stat(args_.infile.c_str(), &in) == 0 && stat(outfile_.c_str(), &out) == 0 &&
+	    in.st_dev == out.st_dev && in.st_ino == out.st_ino)
+		throw std::runtime_error("Output file must differ from a decoded input trace");
+}
+
+std::pair<uint64_t, uint64_t> Decode::time_span_() {
+	Subprocess perfreport {"perf", {"report", "--header-only", "-i", args_.infile}};
+	auto res = JobScheduler::Global().Run(perfreport);
+	if (!res) throw std::runtime_error("Error reading trace header");
+	if (res->Exit != 0) throw std::runtime_error(res->Stderr);
+
+	// # time of first sample : 12345.678901
+	// # time of last sample : 12346.789012
+	std::optional<uint64_t> first {}, last {};
+	std::istringstream stream {res->Stdout};
+	std::string line {};
+	while (std::getline(stream, line)) {
+		size_t colon = line.find(':');
+		if (colon == std::string::npos) continue;
+		std::string value = line.substr(colon + 1);
+		value.erase(0, value.find_first_not_of(' '));
+		if (line.find("time of first sample") != std::string::npos) first = parse_timestamp(value);
+		if (line.find("time of last sample") != std::string::npos) last = parse_timestamp(value);
+	}
+
+	if (!first || !last)
+		throw std::runtime_error("Trace has no sample times, provide a time range to decode -j");
+
+	// perf only prints microseconds so widen the span to cover the truncated digits
+	return {*first, *last + 1000};
+}
+
+libitrace::arglist Decode::build_arglist_(const ScriptArgs& scriptargs) {
+	arglist args {scriptargs.prefix};
+	args.insert(args.end(), scriptargs.synth_events);
+	args.insert(args.end(), scriptargs.insn_trace);
+	args.insert(args.end(), {"-i", scriptargs.infile});
 
-	if (args_.xed) args.insert(args.end(), "--xed");
+	if (scriptargs.xed) args.insert(args.end(), "--xed");
 
-	if (args_.start_time || args_.end_time) {
+	if (scriptargs.start_time || scriptargs.end_time) {
 		std::string timerange {};
-		if (args_.start_time) timerange += timespec_to_string(*args_.start_time);
+		if (scriptargs.start_time) timerange += timespec_to_string(*scriptargs.start_time);
 		timerange += ",";
-		if (args_.end_time) timerange += timespec_to_string(*args_.end_time);
+		if (scriptargs.end_time) timerange += timespec_to_string(*scriptargs.end_time);
 		args.insert(args.end(), {"--time", timerange});
 	}
 
-    if (args_.src) {
+    if (scriptargs.src) {
         args.insert(args.end(), {"-F," "+srccode,+time"});
     }
 
@@ -0,0 +1,242 @@
+#include "libitrace/decodecache.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include "libitrace/utils.hpp"
+
+namespace {
+
+constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325;
+constexpr uint64_t FNV_PRIME  = 0x100000001b3;
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i {0}; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+// Entries are named by two 64 bit digests in hex
+bool is_entry(const char* name) {
+	if (strlen(name) != 32) return false;
+	return std::all_of(name, name + 32, [](char c) {
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+	});
+}
+
+// Copy a whole file in the kernel. std::nullopt if from does not exist, such as an entry another
+// process just evicted
+std::optional<uint64_t> copy_file(const std::string& from, const std::string& to) {
+	int in = open(from.c_str(), O_RDONLY);
+	if (in == -1 && errno == ENOENT) return std::nullopt;
+	if (in == -1) libitrace::throw_errno("Cannot open " + from);
+	struct stat st {};
+	int out = fstat(in, &st) == -1 ? -1 : open(to.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (out == -1) {
+		int error = errno;
+		close(in);
+		libitrace::throw_errno("Cannot copy " + from + " to " + to, error);
+	}
+
+	uint64_t remaining = st.st_size;
+	while (remaining > 0) {
+		ssize_t sent = sendfile(out, in, nullptr, remaining);
+		if (sent == -1 && errno == EINTR) continue;
+		if (sent <= 0) {
+			// A short copy is reported like a failed one
+			int error = sent == 0 ? EIO : errno;
+			close(in);
+			close(out);
+			libitrace::throw_errno("Cannot copy " + from + " to " + to, error);
+		}
+		remaining -= sent;
+	}
+	close(in);
+	close(out);
+	return st.st_size;
+}
+
+}  // namespace
+
+namespace libitrace {
+
+DecodeCache::DecodeCache(const std::string& dir, uint64_t max_bytes)
+    : dir_ {dir},
+      max_bytes_ {max_bytes} {
+	make_dirs(dir_);
+}
+
+std::string DecodeCache::DefaultDir() {
+	if (const char* dir = getenv("ITRACE_CACHE_DIR"); dir && *dir) return dir;
+	if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg)
+		return std::string {xdg} + "/itrace";
+	const char* home = getenv("HOME");
+	return std::string {home && *home ? home : "/tmp"} + "/.cache/itrace";
+}
+
+std::string DecodeCache::Key(const std::string& trace, const arglist& args) {
+	int fd = open(trace.c_str(), O_RDONLY);
+	if (fd == -1) throw_errno("Cannot open " + trace);
+	struct stat st {};
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		throw_errno("Cannot stat " + trace);
+	}
+
+	// Hash evenly spaced blocks including the first and the last. The perf.data header is at the
+	// start and the feature sections with the sample time range are at the end, so two different
+	// recordings are all but certain to differ in a sampled block
+	uint64_t size    = st.st_size;
+	uint64_t content = fnv1a(FNV_OFFSET, &size, sizeof(size));
+	std::vector<char> block(DECODECACHE_SAMPLE_BYTES);
+	size_t samples = size > DECODECACHE_SAMPLES * block.size() ? DECODECACHE_SAMPLES : 1;
+	size_t length  = samples == 1 ? size : block.size();
+	block.resize(std::max<size_t>(length, 1));
+	for (size_t i {0}; i < samples; ++i) {
+		uint64_t offset = samples == 1 ? 0 : i * (size - length) / (samples - 1);
+		size_t loaded {0};
+		while (loaded < length) {
+			ssize_t bytes = pread(fd, block.data() + loaded, length - loaded, offset + loaded);
+			if (bytes == -1 && errno == EINTR) continue;
+			if (bytes <= 0) {
+				int error = bytes == 0 ? EIO : errno;
+				close(fd);
+				throw_errno("Cannot read " + trace, error);
+			}
+			loaded += bytes;
+		}
+		content = fnv1a(content, block.data(), length);
+	}
+	close(fd);
+
+	uint64_t arghash = FNV_OFFSET;
+	for (const auto& arg : args) arghash = fnv1a(arghash, arg.c_str(), arg.size() + 1);
+
+	char key[33] {};
+	std::snprintf(key, sizeof(key), "%016" PRIx64 "%016" PRIx64, content, arghash);
+	return key;
+}
+
+bool DecodeCache::Fetch(const std::string& key, const std::string& outfile) {
+	std::string entry = entry_(key);
+	auto bytes        = copy_file(entry, outfile);
+	if (!bytes) {
+		record_(false, 0);
+		return false;
+	}
+
+	// The mtime of an entry is its last use so eviction drops the least recently used first
+	utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+	record_(true, *bytes);
+	return true;
+}
+
+void DecodeCache::Store(const std::string& key, const std::string& file) {
+	struct stat st {};
+	if (stat(file.c_str(), &st) == -1) throw_errno("Cannot stat " + file);
+	if (static_cast<uint64_t>(st.st_size) > max_bytes_) return;
+
+	// Copy under a temporary name so a concurrent Fetch never sees a partial entry. Threads of one
+	// process can store the same key, two copies of a trace have one, so the name is per call
+	static std::atomic<uint64_t> stores {0};
+	std::string temp = entry_(key) + DECODECACHE_TEMP_MARK + std::to_string(getpid()) + "." +
+	                   std::to_string(stores++);
+	try {
+		if (!copy_file(file, temp)) throw_errno("Cannot open " + file, ENOENT);
+	} catch (const std::runtime_error&) {
+		unlink(temp.c_str());
+		throw;
+	}
+	if (rename(temp.c_str(), entry_(key).c_str()) == -1) {
+		int error = errno;
+		unlink(temp.c_str());
+		throw_errno("Cannot add " + file + " to the decode cache", error);
+	}
+	evict_();
+}
+
+DecodeCacheStats DecodeCache::Totals() const {
+	DecodeCacheStats totals {};
+	int fd = open((dir_ + "/" + DECODECACHE_STATS).c_str(), O_RDONLY);
+	if (fd == -1) return totals;
+	flock(fd, LOCK_SH);
+	if (pread(fd, &totals, sizeof(totals), 0) != sizeof(totals)) totals = {};
+	close(fd);
+	return totals;
+}
+
+void DecodeCache::record_(bool hit, uint64_t bytes) {
+	auto count = [hit, bytes](DecodeCacheStats& stats) {
+		if (hit) {
+			++stats.hits;
+			stats.bytes_saved += bytes;
+		} else {
+			++stats.misses;
+		}
+	};
+	count(stats_);
+
+	// Other processes may update the totals at the same time
+	int fd = open((dir_ + "/" + DECODECACHE_STATS).c_str(), O_RDWR | O_CREAT, 0660);
+	if (fd == -1) return;
+	flock(fd, LOCK_EX);
+	DecodeCacheStats totals {};
+	if (pread(fd, &totals, sizeof(totals), 0) != sizeof(totals)) totals = {};
+	count(totals);
+	if (pwrite(fd, &totals, sizeof(totals), 0) != sizeof(totals)) perror("pwrite");
+	close(fd);
+}
+
+void DecodeCache::evict_() {
+	struct Entry {
+		std::string path {};
+		uint64_t size {};
+		struct timespec used {};
+	};
+
+	DIR* dir = opendir(dir_.c_str());
+	if (!dir) throw_errno("Cannot read the decode cache " + dir_);
+	std::vector<Entry> entries {};
+	uint64_t total {0};
+	while (struct dirent* ent = readdir(dir)) {
+		if (!is_entry(ent->d_name)) continue;
+		Entry entry {entry_(ent->d_name)};
+		struct stat st {};
+		if (stat(entry.path.c_str(), &st) == -1) continue;
+		entry.size = st.st_size;
+		entry.used = st.st_mtim;
+		total += entry.size;
+		entries.push_back(std::move(entry));
+	}
+	closedir(dir);
+
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+		if (a.used.tv_sec != b.used.tv_sec) return a.used.tv_sec < b.used.tv_sec;
+		return a.used.tv_nsec < b.used.tv_nsec;
+	});
+
+	for (const auto& entry : entries) {
+		if (total <= max_bytes_) break;
+		// Another process may have evicted it already
+		if (unlink(entry.path.c_str()) == 0 || errno == ENOENT) total -= entry.size;
+	}
+}
+
+}  // namespace libitrace
@@ -0,0 +1,171 @@
+#include "libitrace/dutycycle.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include "libitrace/utils.hpp"
+
+namespace libitrace {
+
+namespace {
+
+// Logs of windows timed since the recording started, which cannot be matched to the trace, have
+// no clock in their header and are refused
+constexpr std::string_view LOG_HEADER = "# itrace duty cycle monotonic";
+
+}  // namespace
+
+uint64_t DutyCycleLog::Traced() const {
+	uint64_t traced {0};
+	for (const auto& window : windows) traced += window.end - window.start;
+	return traced;
+}
+
+double DutyCycleLog::Scale() const {
+	uint64_t traced = Traced();
+	return traced > 0 ? static_cast<double>(duration) / traced : 1.0;
+}
+
+void DutyCycleLog::Save(const std::string& path) const {
+	std::ofstream out {path};
+	if (!out) throw std::runtime_error("Cannot write duty cycle log " + path);
+
+	out << LOG_HEADER << ' ' << schedule.on_ns << ' ' << schedule.period_ns << ' '
+	    << schedule.jitter_ns << ' ' << duration << '\n';
+	for (const auto& window : windows) out << window.start << ' ' << window.end << '\n';
+	if (!out) throw std::runtime_error("Cannot write duty cycle log " + path);
+}
+
+std::optional<DutyCycleLog> DutyCycleLog::Load(const std::string& path) {
+	std::ifstream in {path};
+	if (!in) return std::nullopt;
+
+	std::string header {};
+	std::getline(in, header);
+	if (header.compare(0, LOG_HEADER.size(), LOG_HEADER) != 0)
+		throw std::runtime_error(path + " is not a duty cycle log");
+
+	DutyCycleLog log {};
+	std::istringstream fields {header.substr(LOG_HEADER.size())};
+	if (!(fields >> log.schedule.on_ns >> log.schedule.period_ns >> log.schedule.jitter_ns >>
+	      log.duration))
+		throw std::runtime_error(path + " is not a duty cycle log");
+
+	DutyWindow window {};
+	while (in >> window.start >> window.end) log.windows.push_back(window);
+	return log;
+}
+
+DutyCycler::DutyCycler(Record& record, const DutyCycleSchedule& schedule) : record_ {record} {
+	if (schedule.on_ns == 0 || schedule.period_ns < schedule.on_ns)
+		throw std::runtime_error("The on time must be positive and at most the period");
+	if (schedule.jitter_ns > schedule.period_ns - schedule.on_ns)
+		throw std::runtime_error("The jitter must be at most the off time");
+	log_.schedule = schedule;
+	record_.SetClock("CLOCK_MONOTONIC");
+}
+
+void DutyCycler::Start() {
+	if (thread_.joinable()) return;
+	stop_   = false;
+	thread_ = std::thread {[this] { run_(); }};
+}
+
+void DutyCycler::Stop() {
+	{
+		std::lock_guard<std::mutex> guard {lock_};
+		stop_ = true;
+	}
+	wake_.notify_one();
+	if (thread_.joinable()) thread_.join();
+}
+
+void DutyCycler::run_() {
+	using clock = std::chrono::steady_clock;
+	const DutyCycleSchedule& schedule = log_.schedule;
+
+	std::mt19937_64 rng {std::random_device {}()};
+	std::uniform_int_distribution<int64_t> jitter {
+	    -static_cast<int64_t>(schedule.jitter_ns), static_cast<int64_t>(schedule.jitter_ns)
+	};
+
+	uint64_t begin = monotonic_ns();
+	auto next      = clock::now();
+	std::unique_lock<std::mutex> guard {lock_};
+	while (!wake_.wait_until(guard, next, [this] { return stop_; })) {
+		// Toggling blocks for the round trip to perf, which must not hold up Stop
+		guard.unlock();
+		DutyWindow window {};
+		try {
+			record_.Enable();
+			window.start = monotonic_ns();
+		} catch (const std::runtime_error&) {
+			guard.lock();
+			break;
+		}
+		guard.lock();
+
+		auto off     = clock::now() + std::chrono::nanoseconds {schedule.on_ns};
+		bool stopped = wake_.wait_until(guard, off, [this] { return stop_; });
+
+		guard.unlock();
+		try {
+			record_.Disable();
+		} catch (const std::runtime_error&) {
+			// perf is gone, the window ran until it stopped acknowledging
+			stopped = true;
+		}
+		window.end = monotonic_ns();
+		guard.lock();
+		log_.windows.push_back(window);
+		if (stopped) break;
+
+		// Windows that were missed, such as while the host was stalled, are skipped rather than
+		// run back to back
+		next += std::chrono::nanoseconds {static_cast<int64_t>(schedule.period_ns) + jitter(rng)};
+		if (next < clock::now()) next = clock::now();
+	}
+	log_.duration = monotonic_ns() - begin;
+}
+
+WindowedProfile::WindowedProfile(const std::string& infile, const DutyCycleLog& log)
+    : profile_ {infile},
+      log_ {log} {
+	std::sort(log_.windows.begin(), log_.windows.end(), [](const auto& a, const auto& b) {
+		return a.start < b.start;
+	});
+	for (const auto& window : log_.windows) windows_.push_back({window.start, window.end});
+	profile_.SetObserver([this](const ScriptRecord& record) { Add(record); });
+}
+
+void WindowedProfile::Run() { profile_.Run(); }
+
+void WindowedProfile::Add(const ScriptRecord& record) {
+	if (windows_.empty()) return;
+
+	// The last window starting at or before the sample, unless it ended and the next one is closer
+	auto next = std::upper_bound(
+	    windows_.begin(), windows_.end(), record.time,
+	    [](uint64_t time, const WindowStats& window) { return time < window.start; }
+	);
+	auto it = next == windows_.begin() ? next : std::prev(next);
+	if (next != windows_.begin() && next != windows_.end() && record.time > it->end &&
+	    next->start - record.time < record.time - it->end)
+		it = next;
+
+	WindowStats& window = *it;
+	++window.samples;
+	if (record.event.substr(0, 12) == "instructions") {
+		++window.instructions;
+	} else {
+		window.instructions += record.insn_cnt;
+		window.cycles += record.cyc_cnt;
+	}
+}
+
+}  // namespace libitrace
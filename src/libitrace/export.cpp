@@ -0,0 +1,86 @@
+#include "libitrace/export.hpp"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "libitrace/fuchsia.hpp"
+#include "libitrace/parser.hpp"
+#include "libitrace/utils.hpp"
+
+namespace {
+
+struct ThreadState {
+	pid_t pid {};
+	uint64_t last {};
+	std::vector<std::string> stack {};
+	size_t overflow {0};  // calls past EXPORT_MAX_DEPTH that were not pushed
+};
+
+}  // namespace
+
+namespace libitrace {
+
+void Export::Run() {
+	auto begin = std::chrono::steady_clock::now();
+
+	FuchsiaWriter writer {outfile_};
+	std::unordered_map<pid_t, ThreadState> threads {};
+	std::unordered_set<pid_t> processes {};
+	char addrbuf[32] {};
+
+	ScriptParser parser {[&](const ScriptRecord& record) {
+		pid_t pid              = record.pid != -1 ? record.pid : record.tid;
+		auto [entry, inserted] = threads.try_emplace(record.tid);
+		ThreadState& thread    = entry->second;
+		if (inserted) {
+			thread.pid = pid;
+			if (processes.insert(pid).second) writer.ProcessName(pid, record.comm);
+			writer.ThreadName(pid, record.tid, record.comm);
+		}
+		thread.last = record.time;
+
+		if (record.HasFlag("call")) {
+			if (thread.stack.size() >= EXPORT_MAX_DEPTH) {
+				++thread.overflow;
+				return;
+			}
+			std::string_view name = record.addr_sym;
+			if (name.empty() || name == SCRIPT_UNKNOWN) {
+				std::snprintf(addrbuf, sizeof(addrbuf), "0x%" PRIx64, record.addr);
+				name = addrbuf;
+			}
+			writer.DurationBegin(pid, record.tid, record.time, record.addr_dso, name);
+			thread.stack.emplace_back(name);
+		} else if (record.HasFlag("return")) {
+			if (thread.overflow > 0) {
+				--thread.overflow;
+				return;
+			}
+			// Returns from functions entered before tracing started have no slice to close
+			if (thread.stack.empty()) return;
+			writer.DurationEnd(pid, record.tid, record.time, {}, thread.stack.back());
+			thread.stack.pop_back();
+		}
+	}};
+
+	run_script(call_script_arglist(args_), parser);
+
+	// Close whatever is still open at the last timestamp seen on each thread
+	for (auto& [tid, thread] : threads) {
+		for (auto it = thread.stack.rbegin(); it != thread.stack.rend(); ++it)
+			writer.DurationEnd(thread.pid, tid, thread.last, {}, *it);
+	}
+	writer.Close();
+
+	stats_.samples = parser.Records();
+	stats_.events  = writer.Events();
+	stats_.bytes   = writer.Bytes();
+	stats_.seconds =
+	    std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+}  // namespace libitrace
@@ -0,0 +1,191 @@
+#include "libitrace/filterplan.hpp"
+
+#include <cxxabi.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "libitrace/perfdata.hpp"
+#include "libitrace/profile.hpp"
+
+namespace libitrace {
+
+namespace {
+
+std::string_view basename(std::string_view path) {
+	size_t slash = path.rfind('/');
+	return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+// Split a line of itrace stats --csv, where fields with separators are quoted and quotes doubled
+std::vector<std::string> csv_fields(const std::string& line) {
+	std::vector<std::string> fields {1};
+	bool quoted {false};
+	for (size_t i {0}; i < line.size(); ++i) {
+		char c = line[i];
+		if (quoted && c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+			fields.back() += '"';
+			++i;
+		} else if (c == '"') {
+			quoted = !quoted;
+		} else if (c == ',' && !quoted) {
+			fields.emplace_back();
+		} else {
+			fields.back() += c;
+		}
+	}
+	return fields;
+}
+
+std::vector<HotFunction> read_csv(const std::string& path) {
+	std::ifstream in {path};
+	if (!in) throw std::runtime_error("Cannot open profile " + path);
+
+	std::string line {};
+	std::getline(in, line);
+	auto header = csv_fields(line);
+	if (header.size() < 4 || header[0] != "function" || header[1] != "dso")
+		throw std::runtime_error(path + " is neither a trace nor itrace stats --csv output");
+	size_t column = header[3] == "cycles" ? 3 : 2;
+
+	std::vector<HotFunction> functions {};
+	while (std::getline(in, line)) {
+		auto fields = csv_fields(line);
+		if (fields.size() != header.size()) continue;
+		try {
+			functions.push_back({fields[0], fields[1], std::stoull(fields[column])});
+		} catch (const std::logic_error&) {
+			throw std::runtime_error("Malformed line in " + path + ": " + line);
+		}
+	}
+	return functions;
+}
+
+// perf prints demangled names, the symbol table has them mangled
+std::string demangle(std::string_view name) {
+	int status {};
+	std::string mangled {name};
+	char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+	if (status != 0 || !demangled) return mangled;
+	std::string result {demangled};
+	free(demangled);
+	return result;
+}
+
+}  // namespace
+
+std::vector<HotFunction> read_hot_functions(const std::string& path) {
+	if (!PerfData::IsPerfData(path)) return read_csv(path);
+
+	Profile profile {path};
+	profile.Run();
+	std::vector<HotFunction> functions {};
+	for (const auto& entry : profile.Functions()) {
+		uint64_t weight = profile.HasCycles() ? entry.cycles : entry.instructions;
+		functions.push_back({std::string {entry.name}, std::string {entry.dso}, weight});
+	}
+	return functions;
+}
+
+FilterPlan plan_filters(
+    const ElfSymbols& symbols, const std::vector<HotFunction>& functions, size_t slots,
+    double coverage
+) {
+	if (slots == 0) throw std::runtime_error("Intel PT has no address filters on this machine");
+
+	std::string_view program = basename(symbols.Path());
+	std::vector<const HotFunction*> hot {};
+	FilterPlan plan {};
+	for (const auto& function : functions) {
+		if (function.weight == 0 || basename(function.dso) != program) continue;
+		hot.push_back(&function);
+		plan.total += function.weight;
+	}
+	std::sort(hot.begin(), hot.end(), [](const HotFunction* a, const HotFunction* b) {
+		return a->weight > b->weight;
+	});
+
+	// Names as perf prints them, with and without the parameter list it adds to C++ functions
+	std::unordered_map<std::string, Symbol> byname {};
+	for (size_t i {0}; i < symbols.Size(); ++i) {
+		Symbol symbol = symbols.At(i);
+		if (symbol.size == 0) continue;
+		std::string name = demangle(symbol.name);
+		byname.emplace(std::string {symbol.name}, symbol);
+		byname.emplace(name.substr(0, name.find('(')), symbol);
+		byname.emplace(std::move(name), symbol);
+	}
+
+	// Filters on a file take offsets into it, not the addresses it is linked at
+	std::vector<FilterRange> resolved {};
+	for (const HotFunction* function : hot) {
+		auto it     = byname.find(function->name);
+		auto offset = it != byname.end() ? symbols.FileOffset(it->second.start) : std::nullopt;
+		if (!offset) {
+			++plan.unresolved;
+		} else {
+			resolved.push_back({*offset, *offset + it->second.size, function->weight, 1});
+		}
+	}
+
+	std::vector<FilterRange> ranges {};
+	uint64_t chosen {0};
+	for (const auto& function : resolved) {
+		if (chosen >= coverage * plan.total) break;
+		ranges.push_back(function);
+		chosen += function.weight;
+	}
+	if (ranges.empty())
+		throw std::runtime_error("No hot function of the profile is in " + symbols.Path());
+
+	// Overlapping and touching ranges cost nothing to merge
+	std::sort(ranges.begin(), ranges.end(), [](const FilterRange& a, const FilterRange& b) {
+		return a.start < b.start;
+	});
+	auto merge = [&ranges](size_t i) {
+		ranges[i].end = std::max(ranges[i].end, ranges[i + 1].end);
+		ranges[i].weight += ranges[i + 1].weight;
+		ranges[i].functions += ranges[i + 1].functions;
+		ranges.erase(ranges.begin() + i + 1);
+	};
+	for (size_t i {0}; i + 1 < ranges.size();) {
+		if (ranges[i + 1].start <= ranges[i].end) {
+			merge(i);
+		} else {
+			++i;
+		}
+	}
+
+	while (ranges.size() > slots) {
+		size_t best {0};
+		for (size_t i {1}; i + 1 < ranges.size(); ++i) {
+			if (ranges[i + 1].start - ranges[i].end < ranges[best + 1].start - ranges[best].end)
+				best = i;
+		}
+		merge(best);
+	}
+
+	// Merging may have pulled in hot functions that were not chosen, they are covered as well
+	for (auto& range : ranges) range.weight = range.functions = 0;
+	for (const auto& function : resolved) {
+		auto it = std::upper_bound(
+		    ranges.begin(), ranges.end(), function.start,
+		    [](uint64_t offset, const FilterRange& range) { return offset < range.start; }
+		);
+		if (it == ranges.begin() || function.start >= std::prev(it)->end) continue;
+		std::prev(it)->weight += function.weight;
+		++std::prev(it)->functions;
+		plan.covered += function.weight;
+	}
+
+	plan.ranges = std::move(ranges);
+	return plan;
+}
+
+}  // namespace libitrace
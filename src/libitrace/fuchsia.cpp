@@ -0,0 +1,219 @@
+#include "libitrace/fuchsia.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "libitrace/utils.hpp"
+
+namespace {
+
+constexpr uint64_t RECORD_INITIALIZATION = 1;
+constexpr uint64_t RECORD_STRING         = 2;
+constexpr uint64_t RECORD_THREAD         = 3;
+constexpr uint64_t RECORD_EVENT          = 4;
+constexpr uint64_t RECORD_KERNEL_OBJECT  = 7;
+
+constexpr uint64_t EVENT_DURATION_BEGIN = 2;
+constexpr uint64_t EVENT_DURATION_END   = 3;
+
+constexpr uint64_t ARGUMENT_KOID = 8;
+
+constexpr uint64_t OBJECT_PROCESS = 1;
+constexpr uint64_t OBJECT_THREAD  = 2;
+
+constexpr uint64_t TICKS_PER_SECOND = 1000000000;  // perf timestamps are in nanoseconds
+
+size_t words(size_t bytes) { return (bytes + 7) / 8; }
+
+uint64_t record_header(uint64_t type, size_t words) { return type | (words << 4); }
+
+}  // namespace
+
+namespace libitrace {
+
+FuchsiaWriter::FuchsiaWriter(const std::string& path, size_t bufsize)
+    : buffer_(std::max<size_t>(bufsize / sizeof(uint64_t), words(FXT_MAX_STRING_BYTES) + 1)) {
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd_ == -1) throw_errno("Cannot open " + path);
+
+	string_slots_.reserve(FXT_MAX_STRINGS + 1);
+	string_slots_.emplace_back();
+	thread_slots_.reserve(FXT_MAX_THREADS + 1);
+	thread_slots_.emplace_back();
+
+	put_(FXT_MAGIC);
+	put_(record_header(RECORD_INITIALIZATION, 2));
+	put_(TICKS_PER_SECOND);
+}
+
+FuchsiaWriter::~FuchsiaWriter() {
+	if (fd_ == -1) return;
+	// A writer left behind by an error is only closed, the error that got here is the one to report
+	try {
+		Close();
+	} catch (const std::runtime_error&) {
+		close(fd_);
+	}
+}
+
+void FuchsiaWriter::DurationBegin(
+    pid_t pid, pid_t tid, uint64_t time, std::string_view category, std::string_view name
+) {
+	event_(EVENT_DURATION_BEGIN, pid, tid, time, category, name);
+}
+
+void FuchsiaWriter::DurationEnd(
+    pid_t pid, pid_t tid, uint64_t time, std::string_view category, std::string_view name
+) {
+	event_(EVENT_DURATION_END, pid, tid, time, category, name);
+}
+
+void FuchsiaWriter::ProcessName(pid_t pid, std::string_view name) {
+	kernel_object_(OBJECT_PROCESS, pid, name, -1);
+}
+
+void FuchsiaWriter::ThreadName(pid_t pid, pid_t tid, std::string_view name) {
+	kernel_object_(OBJECT_THREAD, tid, name, pid);
+}
+
+void FuchsiaWriter::Close() {
+	if (fd_ == -1) return;
+	flush_();
+	close(fd_);
+	fd_ = -1;
+}
+
+uint16_t FuchsiaWriter::string_ref_(std::string_view str) {
+	if (str.empty()) return 0;
+	str = str.substr(0, FXT_MAX_STRING_BYTES);
+
+	auto it = strings_.find(str);
+	if (it != strings_.end()) {
+		string_slots_[it->second].used = serial_;
+		return it->second;
+	}
+
+	size_t ref = string_slots_.size();
+	if (ref <= FXT_MAX_STRINGS) {
+		string_slots_.emplace_back();
+	} else {
+		ref = victim_(string_slots_, string_clock_, FXT_MAX_STRINGS);
+		strings_.erase(string_slots_[ref].key);
+	}
+	auto& slot = string_slots_[ref];
+	slot.key.assign(str);
+	slot.used = serial_;
+	strings_.emplace(slot.key, ref);
+
+	// Writing a string record to an index that is in use replaces its string for later records
+	size_t size = 1 + words(str.size());
+	reserve_(size);
+	put_(record_header(RECORD_STRING, size) | (ref << 16) | (str.size() << 32));
+	put_bytes_(str);
+
+	return ref;
+}
+
+uint8_t FuchsiaWriter::thread_ref_(pid_t pid, pid_t tid) {
+	uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(pid)) << 32) |
+	               static_cast<uint32_t>(tid);
+
+	auto it = threads_.find(key);
+	if (it != threads_.end()) {
+		thread_slots_[it->second].used = serial_;
+		return it->second;
+	}
+
+	size_t ref = thread_slots_.size();
+	if (ref <= FXT_MAX_THREADS) {
+		thread_slots_.emplace_back();
+	} else {
+		ref = victim_(thread_slots_, thread_clock_, FXT_MAX_THREADS);
+		threads_.erase(thread_slots_[ref].key);
+	}
+	thread_slots_[ref] = {key, serial_};
+	threads_.emplace(key, ref);
+
+	reserve_(3);
+	put_(record_header(RECORD_THREAD, 3) | (ref << 16));
+	put_(pid);
+	put_(tid);
+
+	return ref;
+}
+
+template <typename Key>
+size_t FuchsiaWriter::victim_(std::vector<Slot<Key>>& slots, size_t& clock, size_t max) {
+	// Slots are handed out in order so the next one round robin is the oldest. Slots referenced by
+	// the record being written are skipped so they are not replaced before it is complete
+	do {
+		clock = clock % max + 1;
+	} while (slots[clock].used == serial_);
+	return clock;
+}
+
+void FuchsiaWriter::event_(
+    uint64_t type, pid_t pid, pid_t tid, uint64_t time, std::string_view category,
+    std::string_view name
+) {
+	++serial_;
+	uint64_t thread = thread_ref_(pid, tid);
+	uint64_t cat    = string_ref_(category);
+	uint64_t label  = string_ref_(name);
+
+	reserve_(2);
+	put_(
+	    record_header(RECORD_EVENT, 2) | (type << 16) | (thread << 24) | (cat << 32) | (label << 48)
+	);
+	put_(time);
+	++events_;
+}
+
+void FuchsiaWriter::kernel_object_(
+    uint64_t type, uint64_t koid, std::string_view name, pid_t process
+) {
+	++serial_;
+	uint64_t label = string_ref_(name);
+	uint64_t arg   = process != -1 ? string_ref_("process") : 0;
+	uint64_t args  = process != -1 ? 1 : 0;
+
+	size_t size = 2 + args * 2;
+	reserve_(size);
+	put_(record_header(RECORD_KERNEL_OBJECT, size) | (type << 16) | (label << 24) | (args << 40));
+	put_(koid);
+	if (args) {
+		put_(ARGUMENT_KOID | (2 << 4) | (arg << 16));
+		put_(process);
+	}
+}
+
+void FuchsiaWriter::put_(uint64_t word) {
+	if (used_ == buffer_.size()) flush_();
+	buffer_[used_++] = word;
+}
+
+void FuchsiaWriter::put_bytes_(std::string_view bytes) {
+	size_t size = words(bytes.size());
+	reserve_(size);
+	char* dst = reinterpret_cast<char*>(buffer_.data() + used_);
+	memcpy(dst, bytes.data(), bytes.size());
+	memset(dst + bytes.size(), 0, size * sizeof(uint64_t) - bytes.size());
+	used_ += size;
+}
+
+void FuchsiaWriter::reserve_(size_t words) {
+	if (used_ + words > buffer_.size()) flush_();
+}
+
+void FuchsiaWriter::flush_() {
+	size_t size = used_ * sizeof(uint64_t);
+	write_all(fd_, buffer_.data(), size);
+	bytes_ += size;
+	used_ = 0;
+}
+
+}  // namespace libitrace
@@ -0,0 +1,74 @@
+#include "libitrace/histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace libitrace {
+
+namespace {
+
+constexpr uint64_t LINEAR     = 1ull << HISTOGRAM_PRECISION_BITS;  // exact buckets
+constexpr uint64_t SUBBUCKETS = LINEAR / 2;                         // per power of two above them
+constexpr size_t BUCKETS      = LINEAR + (64 - HISTOGRAM_PRECISION_BITS) * SUBBUCKETS;
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() : counts_(BUCKETS) {}
+
+void LatencyHistogram::Record(uint64_t value, uint64_t count) {
+	counts_[Index(value)] += count;
+	count_ += count;
+	min_ = std::min(min_, value);
+	max_ = std::max(max_, value);
+	sum_ += static_cast<double>(value) * count;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+	for (size_t i {0}; i < BUCKETS; ++i) counts_[i] += other.counts_[i];
+	count_ += other.count_;
+	min_ = std::min(min_, other.min_);
+	max_ = std::max(max_, other.max_);
+	sum_ += other.sum_;
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const {
+	if (count_ == 0) return 0;
+	if (percentile >= 100) return max_;
+
+	uint64_t rank = std::max<uint64_t>(1, std::ceil(percentile / 100 * count_));
+	uint64_t seen {0};
+	for (size_t i {0}; i < BUCKETS; ++i) {
+		seen += counts_[i];
+		if (seen >= rank) return std::clamp(UpperBound(i), min_, max_);
+	}
+	return max_;
+}
+
+size_t LatencyHistogram::Index(uint64_t value) {
+	if (value < LINEAR) return value;
+
+	// The top bits below the leading one pick the sub bucket within its power of two
+	int msb      = 63 - __builtin_clzll(value);
+	int shift    = msb - HISTOGRAM_PRECISION_BITS + 1;
+	uint64_t sub = (value >> shift) - SUBBUCKETS;
+	return LINEAR + static_cast<size_t>(msb - HISTOGRAM_PRECISION_BITS) * SUBBUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::UpperBound(size_t index) {
+	if (index < LINEAR) return index;
+
+	size_t above = index - LINEAR;
+	int shift    = above / SUBBUCKETS + 1;
+	uint64_t sub = above % SUBBUCKETS;
+	uint64_t low = (sub + SUBBUCKETS) << shift;
+	return low + ((1ull << shift) - 1);
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> LatencyHistogram::Buckets() const {
+	std::vector<std::pair<uint64_t, uint64_t>> buckets {};
+	for (size_t i {0}; i < BUCKETS; ++i)
+		if (counts_[i]) buckets.emplace_back(UpperBound(i), counts_[i]);
+	return buckets;
+}
+
+}  // namespace libitrace
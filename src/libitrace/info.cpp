@@ -0,0 +1,115 @@
+#include "libitrace/info.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "libitrace/perfdata.hpp"
+
+namespace libitrace {
+
+namespace {
+
+template <typename T>
+T field(const uint8_t* record, size_t offset) {
+	T value {};
+	memcpy(&value, record + sizeof(PerfEventHeader) + offset, sizeof(value));
+	return value;
+}
+
+}  // namespace
+
+void TraceInfo::Run() {
+	PerfData data {summary_.path};
+	TraceSummary& s = summary_;
+	s.file_size     = data.Size();
+
+	s.perf_version = data.FeatureString(PerfFeature::Version).value_or("");
+	s.hostname     = data.FeatureString(PerfFeature::Hostname).value_or("");
+	s.os_release   = data.FeatureString(PerfFeature::OsRelease).value_or("");
+	s.arch         = data.FeatureString(PerfFeature::Arch).value_or("");
+	s.cpu_desc     = data.FeatureString(PerfFeature::CpuDesc).value_or("");
+	s.cmdline      = data.FeatureStrings(PerfFeature::Cmdline);
+
+	if (auto nrcpus = data.Feature(PerfFeature::NrCpus); nrcpus && nrcpus->size >= 8)
+		memcpy(&s.cpus_online, data.Data() + nrcpus->offset + 4, sizeof(s.cpus_online));
+
+	for (const auto& attr : data.Attrs())
+		s.events.push_back(attr.name.empty() ? "type " + std::to_string(attr.type) : attr.name);
+
+	auto see_time = [&s](uint64_t time) {
+		if (time == 0) return;
+		s.first_time = std::min(s.first_time.value_or(time), time);
+		s.last_time  = std::max(s.last_time.value_or(time), time);
+	};
+	auto see_thread = [&s](uint32_t pid, uint32_t tid) {
+		if (static_cast<pid_t>(pid) > 0) s.pids.insert(pid);
+		if (static_cast<pid_t>(tid) > 0) s.tids.insert(tid);
+	};
+
+	data.Records([&](const PerfEventHeader& header, uint64_t offset) {
+		const uint8_t* record = data.Data() + offset;
+		++s.records;
+
+		if (auto time = data.RecordTime(header, offset)) see_time(*time);
+		if (auto cpu = data.RecordCpu(header, offset)) s.cpus.insert(*cpu);
+
+		switch (header.type) {
+			case PERF_RECORD_COMM: {
+				auto pid = field<uint32_t>(record, 0);
+				auto tid = field<uint32_t>(record, 4);
+				see_thread(pid, tid);
+
+				const char* comm = reinterpret_cast<const char*>(record + sizeof(header) + 8);
+				size_t max   = header.size - std::min<size_t>(header.size, sizeof(header) + 8);
+				s.comms[tid] = std::string {comm, strnlen(comm, max)};
+				break;
+			}
+			case PERF_RECORD_FORK:
+			case PERF_RECORD_EXIT:
+				see_thread(field<uint32_t>(record, 0), field<uint32_t>(record, 8));
+				break;
+			case PERF_RECORD_MMAP:
+			case PERF_RECORD_MMAP2: ++s.mmaps; break;
+			case PERF_RECORD_ITRACE_START:
+				see_thread(field<uint32_t>(record, 0), field<uint32_t>(record, 4));
+				++s.itrace_starts;
+				break;
+			case PERF_RECORD_SWITCH:
+			case PERF_RECORD_SWITCH_CPU_WIDE: ++s.switches; break;
+			case PERF_RECORD_LOST:
+				++s.lost_records;
+				s.lost_events += field<uint64_t>(record, 8);
+				break;
+			case PERF_RECORD_LOST_SAMPLES: s.lost_samples += field<uint64_t>(record, 0); break;
+			case PERF_RECORD_AUX: {
+				auto flags = field<uint64_t>(record, 16);
+				++s.aux_records;
+				if (flags & PERF_AUX_FLAG_TRUNCATED) ++s.aux_truncated;
+				if (flags & PERF_AUX_FLAG_PARTIAL) ++s.aux_partial;
+				if (flags & PERF_AUX_FLAG_COLLISION) ++s.aux_collision;
+				break;
+			}
+			case PERF_RECORD_AUXTRACE: {
+				PerfAuxtraceEvent event {};
+				memcpy(&event, record, sizeof(event));
+				++s.aux_buffers;
+				s.aux_bytes += event.size;
+				s.aux_bytes_per_cpu[static_cast<int>(event.cpu)] += event.size;
+				break;
+			}
+		}
+	});
+
+	// perf record writes the exact span of the samples if it saw any
+	auto sampletime = data.Feature(PerfFeature::SampleTime);
+	if (sampletime && sampletime->size >= 16) {
+		uint64_t first {}, last {};
+		memcpy(&first, data.Data() + sampletime->offset, sizeof(first));
+		memcpy(&last, data.Data() + sampletime->offset + 8, sizeof(last));
+		see_time(first);
+		see_time(last);
+	}
+}
+
+}  // namespace libitrace
@@ -0,0 +1,15 @@
+#include "libitrace/interner.hpp"
+
+namespace libitrace {
+
+uint32_t StringInterner::Intern(std::string_view str) {
+	auto it = ids_.find(str);
+	if (it != ids_.end()) return it->second;
+
+	uint32_t id = strings_.size();
+	strings_.emplace_back(str);
+	ids_.emplace(strings_.back(), id);
+	return id;
+}
+
+}  // namespace libitrace
@@ -0,0 +1,76 @@
+#include "libitrace/latency.hpp"
+
+#include <algorithm>
+
+namespace {
+
+bool longer(const libitrace::LatencyCall& a, const libitrace::LatencyCall& b) {
+	return a.Duration() > b.Duration();
+}
+
+}  // namespace
+
+namespace libitrace {
+
+void Latency::Run() {
+	ScriptParser parser {[this](const ScriptRecord& record) { Add(record); }};
+
+	run_script(call_script_arglist(args_), parser);
+	Finish();
+}
+
+void Latency::Add(const ScriptRecord& record) {
+	if (record.Enters(symbol_)) {
+		enter_(record.tid, record.time);
+	} else if (record.Returns(symbol_)) {
+		exit_(record.tid, record.time);
+	}
+}
+
+void Latency::Finish() {
+	for (auto& [tid, open] : open_) {
+		stats_.open += open.size();
+		open.clear();
+	}
+}
+
+std::vector<LatencyCall> Latency::Worst() const {
+	std::vector<LatencyCall> worst {heap_};
+	std::sort_heap(worst.begin(), worst.end(), longer);
+	return worst;
+}
+
+void Latency::enter_(pid_t tid, uint64_t time) {
+	auto& open = open_[tid];
+	if (open.size() == LATENCY_MAX_DEPTH) {
+		// Entries that never return, e.g. left by longjmp, would otherwise pile up
+		open.erase(open.begin());
+		++stats_.dropped;
+	}
+	open.push_back(time);
+}
+
+void Latency::exit_(pid_t tid, uint64_t time) {
+	auto it = open_.find(tid);
+	if (it == open_.end() || it->second.empty()) {
+		++stats_.unmatched;
+		return;
+	}
+
+	LatencyCall call {it->second.back(), std::max(time, it->second.back()), tid};
+	it->second.pop_back();
+	++stats_.calls;
+	histogram_.Record(call.Duration());
+
+	if (worst_ == 0) return;
+	if (heap_.size() < worst_) {
+		heap_.push_back(call);
+		std::push_heap(heap_.begin(), heap_.end(), longer);
+	} else if (call.Duration() > heap_.front().Duration()) {
+		std::pop_heap(heap_.begin(), heap_.end(), longer);
+		heap_.back() = call;
+		std::push_heap(heap_.begin(), heap_.end(), longer);
+	}
+}
+
+}  // namespace libitrace
@@ -0,0 +1,401 @@
+#include "libitrace/parser.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cinttypes>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#include "libitrace/utils.hpp"
+
+namespace {
+
+bool is_space(char c) { return c == ' ' || c == '\t'; }
+
+bool is_digits(std::string_view str) {
+	if (str.empty()) return false;
+	for (char c : str)
+		if (c < '0' || c > '9') return false;
+	return true;
+}
+
+bool is_hex(std::string_view str) {
+	if (str.empty()) return false;
+	for (char c : str)
+		if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+	return true;
+}
+
+template <typename T>
+T to_int(std::string_view str, int base = 10) {
+	T value {};
+	std::from_chars(str.data(), str.data() + str.size(), value, base);
+	return value;
+}
+
+std::string_view trim(std::string_view str) {
+	while (!str.empty() && is_space(str.front())) str.remove_prefix(1);
+	while (!str.empty() && is_space(str.back())) str.remove_suffix(1);
+	return str;
+}
+
+// Returns the next whitespace separated token and moves pos past it
+std::string_view next_token(std::string_view line, size_t& pos) {
+	while (pos < line.size() && is_space(line[pos])) ++pos;
+	size_t begin = pos;
+	while (pos < line.size() && !is_space(line[pos])) ++pos;
+	return line.substr(begin, pos - begin);
+}
+
+// Parses `<ip> <sym>+0x<off> (<dso>)` where everything after the ip is optional. The symbol ends
+// at the first " (" because demangled C++ names carry their own parentheses but never a space
+// before them
+bool parse_location(
+    std::string_view segment, uint64_t& ip, std::string_view& sym, uint64_t& symoff,
+    std::string_view& dso
+) {
+	size_t pos {0};
+	std::string_view token = next_token(segment, pos);
+	if (!is_hex(token)) return false;
+	ip = to_int<uint64_t>(token, 16);
+
+	std::string_view rest = trim(segment.substr(pos));
+	if (rest.empty()) return true;
+
+	size_t open = rest.front() == '(' ? 0 : rest.find(" (");
+	std::string_view symbol = trim(rest.substr(0, open));
+	if (open != std::string_view::npos) {
+		size_t close = rest.find(')', open);
+		size_t begin = rest.front() == '(' ? 1 : open + 2;
+		if (close != std::string_view::npos) dso = rest.substr(begin, close - begin);
+	}
+
+	size_t plus = symbol.rfind("+0x");
+	if (plus != std::string_view::npos && is_hex(symbol.substr(plus + 3))) {
+		symoff = to_int<uint64_t>(symbol.substr(plus + 3), 16);
+		symbol = symbol.substr(0, plus);
+	}
+	sym = symbol;
+
+	return true;
+}
+
+// Length of the `<ip> <sym> (<dso>)` prefix of str, i.e. up to and including the closing paren
+size_t location_length(std::string_view str) {
+	size_t open = str.find(" (");
+	if (open == std::string_view::npos) return str.size();
+	size_t close = str.find(')', open);
+	return close == std::string_view::npos ? str.size() : close + 1;
+}
+
+}  // namespace
+
+namespace libitrace {
+
+bool ScriptRecord::HasFlag(std::string_view flag) const {
+	size_t pos {0};
+	while ((pos = flags.find(flag, pos)) != std::string_view::npos) {
+		size_t end = pos + flag.size();
+		if ((pos == 0 || flags[pos - 1] == ' ') && (end == flags.size() || flags[end] == ' '))
+			return true;
+		pos = end;
+	}
+	return false;
+}
+
+bool ScriptRecord::Enters(std::string_view function) const {
+	if (!has_addr || addr_symoff != 0 || addr_sym != function) return false;
+	return HasFlag("call") || (sym != function && !HasFlag("return"));
+}
+
+bool ScriptRecord::Returns(std::string_view function) const {
+	return sym == function && HasFlag("return");
+}
+
+void ScriptParser::Feed(std::string_view chunk) {
+	bytes_ += chunk.size();
+
+	// Finish the line left over from the previous chunk before parsing in place
+	if (used_ > 0) {
+		size_t newline = chunk.find('\n');
+		if (newline == std::string_view::npos) {
+			append_(chunk.data(), chunk.size());
+			return;
+		}
+		append_(chunk.data(), newline);
+		parse_line_(std::string_view {buffer_.data(), used_});
+		used_ = 0;
+		chunk.remove_prefix(newline + 1);
+	}
+
+	size_t consumed = parse_lines_(chunk.data(), chunk.size());
+	append_(chunk.data() + consumed, chunk.size() - consumed);
+}
+
+void ScriptParser::Finish() {
+	if (used_ > 0) parse_line_(std::string_view {buffer_.data(), used_});
+	used_ = 0;
+}
+
+size_t ScriptParser::ParseFd(int fd) {
+	size_t total {0};
+	while (true) {
+		// A line longer than the whole buffer is the only reason to grow it
+		if (used_ == buffer_.size()) buffer_.resize(buffer_.size() * 2);
+
+		ssize_t bytes = read(fd, buffer_.data() + used_, buffer_.size() - used_);
+		if (bytes == -1 && errno == EINTR) continue;
+		if (bytes == -1) throw std::runtime_error(std::string {"read: "} + strerror(errno));
+		if (bytes == 0) break;
+
+		used_ += bytes;
+		total += bytes;
+		bytes_ += bytes;
+
+		size_t consumed = parse_lines_(buffer_.data(), used_);
+		memmove(buffer_.data(), buffer_.data() + consumed, used_ - consumed);
+		used_ -= consumed;
+	}
+	Finish();
+
+	return total;
+}
+
+bool ScriptParser::ParseLine(std::string_view line, ScriptRecord& record) {
+	// comm pid/tid [cpu] time: period event: flags ip sym+off (dso) => addr sym+off (dso) insn
+	record = ScriptRecord {};
+	size_t pos {0};
+	std::string_view token = next_token(line, pos);
+	if (token.empty()) return false;
+
+	// comm may contain spaces so it runs until the first pid, cpu or timestamp token
+	size_t comm_begin = token.data() - line.data();
+	size_t comm_end   = pos;
+	token             = next_token(line, pos);
+	while (!token.empty()) {
+		size_t slash = token.find('/');
+		if (is_digits(token.substr(0, slash)) &&
+		    (slash == std::string_view::npos || is_digits(token.substr(slash + 1))))
+			break;
+		if (token.front() == '[') break;
+		if (token.back() == ':' && parse_timestamp(token.substr(0, token.size() - 1))) break;
+		comm_end = pos;
+		token    = next_token(line, pos);
+	}
+	record.comm = line.substr(comm_begin, comm_end - comm_begin);
+
+	size_t slash = token.find('/');
+	if (slash != std::string_view::npos) {
+		record.pid = to_int<pid_t>(token.substr(0, slash));
+		record.tid = to_int<pid_t>(token.substr(slash + 1));
+		token      = next_token(line, pos);
+	} else if (is_digits(token)) {
+		record.tid = to_int<pid_t>(token);
+		token      = next_token(line, pos);
+	}
+
+	if (token.size() > 2 && token.front() == '[' && token.back() == ']') {
+		record.cpu = to_int<int>(token.substr(1, token.size() - 2));
+		token      = next_token(line, pos);
+	}
+
+	// Lines without a timestamp are interleaved source code or perf diagnostics
+	if (token.empty() || token.back() != ':') return false;
+	auto time = parse_timestamp(token.substr(0, token.size() - 1));
+	if (!time) return false;
+	record.time = *time;
+
+	// A period is only printed in front of an event name
+	size_t mark = pos;
+	token       = next_token(line, pos);
+	if (is_digits(token)) {
+		size_t lookahead           = pos;
+		std::string_view following = next_token(line, lookahead);
+		if (!following.empty() && following.back() == ':') {
+			record.period = to_int<uint64_t>(token);
+			token         = next_token(line, pos);
+		}
+	}
+	if (!token.empty() && token.back() == ':') {
+		record.event = token.substr(0, token.size() - 1);
+		mark         = pos;
+		token        = next_token(line, pos);
+	}
+
+	// Flags are words such as `call` or `tr strt` that precede the hex ip
+	size_t flags_begin = mark;
+	while (!token.empty() && !is_hex(token)) {
+		mark  = pos;
+		token = next_token(line, pos);
+	}
+	record.flags = trim(line.substr(flags_begin, mark - flags_begin));
+	if (token.empty()) return true;
+
+	std::string_view rest = line.substr(pos - token.size());
+	size_t arrow          = rest.find(" => ");
+	std::string_view from = rest.substr(0, arrow);
+	from                  = from.substr(0, location_length(from));
+	parse_location(from, record.ip, record.sym, record.symoff, record.dso);
+	rest.remove_prefix(from.size());
+
+	if (arrow != std::string_view::npos) {
+		rest                = trim(rest).substr(2);
+		std::string_view to = trim(rest);
+		to                  = to.substr(0, location_length(to));
+		record.has_addr     = parse_location(
+		    to, record.addr, record.addr_sym, record.addr_symoff, record.addr_dso
+		);
+		rest = rest.substr(to.data() + to.size() - rest.data());
+	}
+
+	// IPC: 0.62 (36/58)
+	rest = trim(rest);
+	if (rest.substr(0, 4) == "IPC:") {
+		size_t open  = rest.find('(');
+		size_t slash = rest.find('/', open);
+		size_t close = rest.find(')', slash);
+		if (close != std::string_view::npos) {
+			record.insn_cnt = to_int<uint64_t>(rest.substr(open + 1, slash - open - 1));
+			record.cyc_cnt  = to_int<uint64_t>(rest.substr(slash + 1, close - slash - 1));
+			rest            = trim(rest.substr(close + 1));
+		}
+	}
+
+	if (rest.substr(0, 5) == "insn:") rest = trim(rest.substr(5));
+	record.insn = rest;
+
+	return true;
+}
+
+void ScriptParser::FormatLine(const ScriptRecord& record, std::string& line) {
+	char buf[128] {};
+	auto append_location = [&](uint64_t ip, std::string_view sym, uint64_t symoff,
+	                           std::string_view dso) {
+		std::snprintf(buf, sizeof(buf), "%16" PRIx64, ip);
+		line += buf;
+		if (!sym.empty()) {
+			line += ' ';
+			line += sym;
+			std::snprintf(buf, sizeof(buf), "+0x%" PRIx64, symoff);
+			line += buf;
+		}
+		if (!dso.empty()) {
+			line += " (";
+			line += dso;
+			line += ')';
+		}
+	};
+
+	if (record.comm.size() < 16) line.append(16 - record.comm.size(), ' ');
+	line += record.comm;
+	line += ' ';
+	if (record.pid != -1) {
+		std::snprintf(buf, sizeof(buf), "%6d/%-6d ", record.pid, record.tid);
+		line += buf;
+	} else if (record.tid != -1) {
+		std::snprintf(buf, sizeof(buf), "%6d ", record.tid);
+		line += buf;
+	}
+	if (record.cpu != -1) {
+		std::snprintf(buf, sizeof(buf), "[%03d] ", record.cpu);
+		line += buf;
+	}
+	std::snprintf(
+	    buf, sizeof(buf), "%" PRIu64 ".%09" PRIu64 ": ", record.time / 1000000000,
+	    record.time % 1000000000
+	);
+	line += buf;
+
+	if (record.period > 0 && !record.event.empty()) {
+		std::snprintf(buf, sizeof(buf), "%10" PRIu64 " ", record.period);
+		line += buf;
+	}
+	if (!record.event.empty()) {
+		line += record.event;
+		line += ": ";
+	}
+	if (!record.flags.empty()) {
+		line += record.flags;
+		line += ' ';
+	}
+
+	append_location(record.ip, record.sym, record.symoff, record.dso);
+	if (record.has_addr) {
+		line += " => ";
+		append_location(record.addr, record.addr_sym, record.addr_symoff, record.addr_dso);
+	}
+
+	if (record.cyc_cnt > 0) {
+		uint64_t ipc = record.insn_cnt * 100 / record.cyc_cnt;
+		std::snprintf(
+		    buf, sizeof(buf), " \t IPC: %" PRIu64 ".%02" PRIu64 " (%" PRIu64 "/%" PRIu64 ") ",
+		    ipc / 100, ipc % 100, record.insn_cnt, record.cyc_cnt
+		);
+		line += buf;
+	}
+
+	if (!record.insn.empty()) {
+		line += "\t\t";
+		line += record.insn;
+	}
+}
+
+size_t ScriptParser::parse_lines_(const char* data, size_t size) {
+	size_t begin {0};
+	while (begin < size) {
+		const char* newline = static_cast<const char*>(memchr(data + begin, '\n', size - begin));
+		if (!newline) break;
+		size_t end = newline - data;
+		parse_line_(std::string_view {data + begin, end - begin});
+		begin = end + 1;
+	}
+	return begin;
+}
+
+void ScriptParser::parse_line_(std::string_view line) {
+	// Lines are always parsed in input order so the offset only has to move past each one
+	line_offset_ = offset_;
+	offset_ += line.size() + 1;
+	if (trim(line).empty()) return;
+
+	ScriptRecord record {};
+	if (ParseLine(line, record)) {
+		++records_;
+		callback_(record);
+	} else {
+		++skipped_;
+	}
+}
+
+void ScriptParser::append_(const char* data, size_t size) {
+	if (used_ + size > buffer_.size()) buffer_.resize(std::max(buffer_.size() * 2, used_ + size));
+	memcpy(buffer_.data() + used_, data, size);
+	used_ += size;
+}
+
+arglist call_script_arglist(const CallScriptArgs& args) {
+	arglist perfargs {args.prefix};
+	perfargs.insert(perfargs.end(), {"-i", args.infile});
+	perfargs.insert(perfargs.end(), args.synth_events);
+	perfargs.insert(perfargs.end(), {"-F", args.fields});
+	return perfargs;
+}
+
+void run_script(const arglist& perfargs, ScriptParser& parser, const JobOptions& options) {
+	print_perf_args(perfargs);
+	Subprocess perfscript {"perf", perfargs};
+
+	// stderr is drained while stdout is parsed so a chatty perf cannot stall on a full pipe
+	auto feed = [&parser](std::string_view chunk) { parser.Feed(chunk); };
+	auto res  = JobScheduler::Global().Stream(perfscript, feed, options);
+	parser.Finish();
+	if (!res) throw std::runtime_error("Error reading trace data");
+	if (res->Exit != 0) throw std::runtime_error(res->Stderr);
+}
+
+}  // namespace libitrace
@@ -0,0 +1,281 @@
+#include "libitrace/perfdata.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "libitrace/utils.hpp"
+
+namespace libitrace {
+
+namespace {
+
+// Offsets into perf_event_attr
+constexpr size_t PERF_ATTR_SAMPLE_TYPE     = 24;
+constexpr size_t PERF_ATTR_FLAGS           = 40;
+constexpr uint64_t PERF_ATTR_SAMPLE_ID_ALL = 1ull << 18;
+constexpr size_t PERF_ATTR_MIN_SIZE        = 64;  // PERF_ATTR_SIZE_VER0
+
+}  // namespace
+
+PerfData::PerfData(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) throw_errno("Cannot open " + path);
+
+	struct stat st {};
+	if (fstat(fd, &st) == -1) {
+		int error = errno;
+		close(fd);
+		throw_errno("Cannot stat " + path, error);
+	}
+	size_ = st.st_size;
+	if (size_ < sizeof(PerfFileHeader)) {
+		close(fd);
+		throw std::runtime_error(path + " is not a perf.data file");
+	}
+
+	void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	int error = errno;
+	close(fd);
+	if (map == MAP_FAILED) throw_errno("Cannot map " + path, error);
+	data_ = static_cast<const uint8_t*>(map);
+
+	// The constructor does not complete on error so the mapping has to be released here
+	auto invalid = [&](const std::string& reason) {
+		munmap(map, size_);
+		data_ = nullptr;
+		return std::runtime_error(path + reason);
+	};
+
+	memcpy(&header_, data_, sizeof(header_));
+	if (header_.magic != PERF_MAGIC) throw invalid(" is not a perf.data file");
+	if (header_.data.offset > size_ || header_.data.size > size_ - header_.data.offset)
+		throw invalid(" has a truncated data section");
+
+	try {
+		read_attrs_();
+		read_features_();
+
+		// The time conversion is needed before any AUX data is interpreted, and perf writes it
+		// near the start of the data section
+		Records([this](const PerfEventHeader& header, uint64_t offset) {
+			if (header.type != PERF_RECORD_TIME_CONV || timeconv_) return;
+			if (header.size < sizeof(PerfTimeConv)) return;
+			PerfTimeConv conv {};
+			memcpy(&conv, data_ + offset, sizeof(conv));
+			timeconv_ = conv;
+		});
+	} catch (const std::runtime_error& e) {
+		throw invalid(std::string {": "} + e.what());
+	}
+}
+
+PerfData::~PerfData() {
+	if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+bool PerfData::IsPerfData(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) return false;
+
+	uint64_t magic {};
+	bool res = read(fd, &magic, sizeof(magic)) == sizeof(magic) && magic == PERF_MAGIC;
+	close(fd);
+	return res;
+}
+
+void PerfData::Records(const Callback& callback) const {
+	uint64_t offset = header_.data.offset;
+	uint64_t end    = header_.data.offset + header_.data.size;
+	while (offset + sizeof(PerfEventHeader) <= end) {
+		PerfEventHeader header {};
+		memcpy(&header, data_ + offset, sizeof(header));
+		if (header.size < sizeof(header) || offset + header.size > end)
+			throw std::runtime_error("perf.data record is corrupt");
+
+		uint64_t next = offset + header.size;
+		if (header.type == PERF_RECORD_AUXTRACE) {
+			if (header.size < sizeof(PerfAuxtraceEvent))
+				throw std::runtime_error("perf.data AUXTRACE record is corrupt");
+			uint64_t aux {};
+			memcpy(&aux, data_ + offset + offsetof(PerfAuxtraceEvent, size), sizeof(aux));
+			if (aux > end - next) throw std::runtime_error("perf.data AUX data is truncated");
+			next += aux;
+		}
+
+		callback(header, offset);
+		offset = next;
+	}
+}
+
+std::optional<uint64_t> PerfData::RecordTime(const PerfEventHeader& header, uint64_t offset) const {
+	if (!time_pos_ || header.type == PERF_RECORD_SAMPLE) return std::nullopt;
+	if (header.type >= PERF_RECORD_USER_TYPE_START || header.size < sample_id_size_ + 8)
+		return std::nullopt;
+
+	uint64_t time {};
+	memcpy(&time, data_ + offset + header.size - sample_id_size_ + *time_pos_, sizeof(time));
+	return time;
+}
+
+std::optional<int> PerfData::RecordCpu(const PerfEventHeader& header, uint64_t offset) const {
+	if (!cpu_pos_ || header.type == PERF_RECORD_SAMPLE) return std::nullopt;
+	if (header.type >= PERF_RECORD_USER_TYPE_START || header.size < sample_id_size_ + 8)
+		return std::nullopt;
+
+	uint32_t cpu {};
+	memcpy(&cpu, data_ + offset + header.size - sample_id_size_ + *cpu_pos_, sizeof(cpu));
+	return static_cast<int>(cpu);
+}
+
+std::optional<PerfFileSection> PerfData::Feature(PerfFeature feature) const {
+	size_t bit = static_cast<size_t>(feature);
+	if (bit >= features_.size() || features_[bit].size == 0) return std::nullopt;
+	return features_[bit];
+}
+
+std::optional<std::string> PerfData::FeatureString(PerfFeature feature) const {
+	auto section = Feature(feature);
+	if (!section) return std::nullopt;
+
+	uint64_t offset = section->offset;
+	std::string str {};
+	if (!read_string_(offset, section->offset + section->size, str)) return std::nullopt;
+	return str;
+}
+
+std::vector<std::string> PerfData::FeatureStrings(PerfFeature feature) const {
+	std::vector<std::string> strs {};
+	auto section = Feature(feature);
+	if (!section || section->size < sizeof(uint32_t)) return strs;
+
+	uint32_t count {};
+	memcpy(&count, data_ + section->offset, sizeof(count));
+	uint64_t offset = section->offset + sizeof(count);
+	uint64_t end    = section->offset + section->size;
+	for (uint32_t i {0}; i < count; ++i) {
+		std::string str {};
+		if (!read_string_(offset, end, str)) break;
+		strs.push_back(std::move(str));
+	}
+	return strs;
+}
+
+std::optional<uint64_t> PerfData::TscToTime(uint64_t tsc) const {
+	if (!timeconv_) return std::nullopt;
+
+	// Split like the kernel does so the multiplication cannot overflow
+	uint64_t shift = timeconv_->time_shift;
+	uint64_t quot  = tsc >> shift;
+	uint64_t rem   = tsc & ((1ull << shift) - 1);
+	return timeconv_->time_zero + quot * timeconv_->time_mult +
+	       ((rem * timeconv_->time_mult) >> shift);
+}
+
+void PerfData::read_attrs_() {
+	const auto& section = header_.attrs;
+	if (section.offset > size_ || section.size > size_ - section.offset)
+		throw std::runtime_error("truncated attribute section");
+	if (section.size == 0) return;
+	if (header_.attr_size < PERF_ATTR_MIN_SIZE + sizeof(PerfFileSection))
+		throw std::runtime_error("unsupported attribute size");
+
+	// Each attribute is followed by the section of its sample ids
+	for (uint64_t pos {0}; pos + header_.attr_size <= section.size; pos += header_.attr_size) {
+		const uint8_t* attr = data_ + section.offset + pos;
+		PerfAttr entry {};
+		uint64_t flags {};
+		memcpy(&entry.type, attr, sizeof(entry.type));
+		memcpy(&entry.config, attr + 8, sizeof(entry.config));
+		memcpy(&entry.sample_type, attr + PERF_ATTR_SAMPLE_TYPE, sizeof(entry.sample_type));
+		memcpy(&flags, attr + PERF_ATTR_FLAGS, sizeof(flags));
+		entry.sample_id_all = flags & PERF_ATTR_SAMPLE_ID_ALL;
+		attrs_.push_back(entry);
+	}
+
+	// perf refuses to record events whose sample_id layouts differ, so the first one describes all
+	for (const auto& attr : attrs_) {
+		if (!attr.sample_id_all) continue;
+
+		uint64_t type = attr.sample_type;
+		size_t pos {0};
+		if (type & PERF_SAMPLE_TID) pos += 8;
+		if (type & PERF_SAMPLE_TIME) {
+			time_pos_ = pos;
+			pos += 8;
+		}
+		if (type & PERF_SAMPLE_ID) pos += 8;
+		if (type & PERF_SAMPLE_STREAM_ID) pos += 8;
+		if (type & PERF_SAMPLE_CPU) {
+			cpu_pos_ = pos;
+			pos += 8;
+		}
+		if (type & PERF_SAMPLE_IDENTIFIER) pos += 8;
+		sample_id_size_ = pos;
+		break;
+	}
+}
+
+void PerfData::read_features_() {
+	// The feature sections are indexed by a table right after the data section, with one entry
+	// per set bit in adds_features
+	uint64_t offset = header_.data.offset + header_.data.size;
+	for (size_t bit {0}; bit < 256; ++bit) {
+		if (!(header_.adds_features[bit / 64] & (1ull << (bit % 64)))) continue;
+		if (offset + sizeof(PerfFileSection) > size_)
+			throw std::runtime_error("truncated feature table");
+
+		PerfFileSection section {};
+		memcpy(&section, data_ + offset, sizeof(section));
+		offset += sizeof(section);
+		if (section.offset > size_ || section.size > size_ - section.offset) continue;
+
+		if (features_.size() <= bit) features_.resize(bit + 1);
+		features_[bit] = section;
+	}
+
+	read_event_desc_();
+}
+
+void PerfData::read_event_desc_() {
+	auto section = Feature(PerfFeature::EventDesc);
+	if (!section || section->size < 2 * sizeof(uint32_t)) return;
+
+	uint32_t count {}, attr_size {};
+	memcpy(&count, data_ + section->offset, sizeof(count));
+	memcpy(&attr_size, data_ + section->offset + sizeof(count), sizeof(attr_size));
+	uint64_t offset = section->offset + 2 * sizeof(uint32_t);
+	uint64_t end    = section->offset + section->size;
+
+	// Events are described in the same order as the attribute section
+	for (uint32_t i {0}; i < count && i < attrs_.size(); ++i) {
+		uint32_t ids {};
+		if (offset + attr_size + sizeof(ids) > end) return;
+		offset += attr_size;
+		memcpy(&ids, data_ + offset, sizeof(ids));
+		offset += sizeof(ids);
+
+		if (!read_string_(offset, end, attrs_[i].name)) return;
+		offset += static_cast<uint64_t>(ids) * sizeof(uint64_t);
+	}
+}
+
+bool PerfData::read_string_(uint64_t& offset, uint64_t end, std::string& str) const {
+	// A u32 length followed by the string, padded with NULs to that length
+	uint32_t length {};
+	if (offset + sizeof(length) > end) return false;
+	memcpy(&length, data_ + offset, sizeof(length));
+	offset += sizeof(length);
+	if (length > end - offset) return false;
+
+	const char* chars = reinterpret_cast<const char*>(data_ + offset);
+	str.assign(chars, strnlen(chars, length));
+	offset += length;
+	return true;
+}
+
+}  // namespace libitrace
@@ -0,0 +1,119 @@
+#include "libitrace/profile.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "libitrace/scheduler.hpp"
+#include "libitrace/subprocess.hpp"
+#include "libitrace/utils.hpp"
+
+namespace libitrace {
+
+void Profile::Run() {
+	cycles_ = trace_has_cyc_();
+
+	ScriptParser parser {[this](const ScriptRecord& record) {
+		Add(record);
+		if (observer_) observer_(record);
+	}};
+
+	run_script(build_arglist_(), parser);
+}
+
+void Profile::Add(const ScriptRecord& record) {
+	// Instruction samples are counted one by one, branches carry the counts of the code that ran
+	// up to them when the trace has cycles
+	if (record.event.substr(0, 12) == "instructions") {
+		++function_(record.sym, record.dso).instructions;
+		return;
+	}
+
+	if (record.insn_cnt > 0 || record.cyc_cnt > 0) {
+		Counters& counters = function_(record.sym, record.dso);
+		counters.instructions += record.insn_cnt;
+		counters.cycles += record.cyc_cnt;
+	}
+
+	if (record.has_addr && record.HasFlag("call"))
+		++function_(record.addr_sym, record.addr_dso).calls;
+}
+
+std::vector<ProfileEntry> Profile::Functions() const {
+	std::vector<ProfileEntry> entries {};
+	entries.reserve(counters_.size());
+	for (const auto& counters : counters_) {
+		entries.push_back(
+		    {names_[counters.sym], names_[counters.dso], counters.instructions, counters.cycles,
+		     counters.calls}
+		);
+	}
+	return entries;
+}
+
+std::vector<ProfileEntry> Profile::Dsos() const {
+	std::unordered_map<uint32_t, size_t> index {};
+	std::vector<ProfileEntry> entries {};
+	for (const auto& counters : counters_) {
+		auto [it, inserted] = index.try_emplace(counters.dso, entries.size());
+		if (inserted) entries.push_back({{}, names_[counters.dso]});
+		ProfileEntry& entry = entries[it->second];
+		entry.instructions += counters.instructions;
+		entry.cycles += counters.cycles;
+		entry.calls += counters.calls;
+	}
+	return entries;
+}
+
+ProfileEntry Profile::Total() const {
+	ProfileEntry total {};
+	for (const auto& counters : counters_) {
+		total.instructions += counters.instructions;
+		total.cycles += counters.cycles;
+		total.calls += counters.calls;
+	}
+	return total;
+}
+
+Profile::Counters& Profile::function_(std::string_view sym, std::string_view dso) {
+	if (sym.empty()) sym = SCRIPT_UNKNOWN;
+	if (dso.empty()) dso = SCRIPT_UNKNOWN;
+
+	uint32_t symid      = names_.Intern(sym);
+	uint32_t dsoid      = names_.Intern(dso);
+	auto [it, inserted] = functions_.try_emplace(
+	    (static_cast<uint64_t>(symid) << 32) | dsoid, counters_.size()
+	);
+	if (inserted) counters_.push_back({symid, dsoid});
+	return counters_[it->second];
+}
+
+bool Profile::trace_has_cyc_() const {
+	// The event is named after its config, e.g. intel_pt/cyc,cyc_thresh=1,noretcomp=1/u
+	Subprocess perfevlist {"perf", {"evlist", "-i", args_.infile}};
+	auto res = JobScheduler::Global().Run(perfevlist);
+	if (!res) throw std::runtime_error("Error reading trace events");
+	if (res->Exit != 0) throw std::runtime_error(res->Stderr);
+
+	std::string_view out {res->Stdout};
+	for (size_t pos = out.find("intel_pt/"); pos != std::string_view::npos;
+	     pos        = out.find("intel_pt/", pos + 1)) {
+		std::string_view config = out.substr(pos + 9);
+		config                  = config.substr(0, config.find('/'));
+		while (!config.empty()) {
+			std::string_view term = config.substr(0, config.find(','));
+			if (term == "cyc" || term == "cyc=1") return true;
+			config.remove_prefix(std::min(term.size() + 1, config.size()));
+		}
+	}
+	return false;
+}
+
+libitrace::arglist Profile::build_arglist_() const {
+	arglist args {args_.prefix};
+	args.insert(args.end(), {"-i", args_.infile});
+	args.insert(args.end(), cycles_ ? args_.cyc_synth_events : args_.synth_events);
+	args.insert(args.end(), {"-F", cycles_ ? args_.cyc_fields : args_.fields});
+	return args;
+}
+
+}  // namespace libitrace
@@ -0,0 +1,152 @@
+#include "libitrace/ptcaps.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <climits>
+#include <sstream>
+
+namespace libitrace {
+
+std::optional<PtProfile> parse_pt_profile(const std::string& name) {
+	if (name == "low-overhead") return PtProfile::LowOverhead;
+	if (name == "balanced") return PtProfile::Balanced;
+	if (name == "cycle-accurate") return PtProfile::CycleAccurate;
+	return std::nullopt;
+}
+
+std::string pt_profile_name(PtProfile profile) {
+	switch (profile) {
+		case PtProfile::LowOverhead: return "low-overhead";
+		case PtProfile::Balanced: return "balanced";
+		case PtProfile::CycleAccurate: return "cycle-accurate";
+	}
+	return "";
+}
+
+std::string PtConfig::Event(const std::string& modifier) const {
+	std::stringstream ss {};
+	ss << "intel_pt/";
+	if (cyc) {
+		ss << "cyc,";
+		if (cyc_thresh) ss << "cyc_thresh=" << *cyc_thresh << ",";
+	}
+	if (psb_period) ss << "psb_period=" << *psb_period << ",";
+	if (mtc_period) ss << "mtc_period=" << *mtc_period << ",";
+	if (!branch) ss << "branch=0,";
+	ss << "noretcomp=" << (noretcomp ? 1 : 0) << "/" << modifier;
+	return ss.str();
+}
+
+PtCaps::PtCaps(const std::string& root) : root_ {root} {
+	struct stat st {};
+	available_ = stat(root_.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+	if (!available_) return;
+
+	caps_    = read_dir_(root_ + "/caps");
+	formats_ = read_dir_(root_ + "/format");
+}
+
+const PtCaps& PtCaps::Host() {
+	static const PtCaps host {[] {
+		const char* root = getenv(PT_SYSFS_ROOT_ENV);
+		return std::string {root && *root ? root : PT_SYSFS_ROOT};
+	}()};
+	return host;
+}
+
+std::optional<uint64_t> PtCaps::Cap(const std::string& name) const {
+	auto it = caps_.find(name);
+	if (it == caps_.end()) return std::nullopt;
+
+	// The kernel prints every cap in hex
+	char* end {};
+	uint64_t value = strtoull(it->second.c_str(), &end, 16);
+	if (end == it->second.c_str()) return std::nullopt;
+	return value;
+}
+
+std::vector<unsigned> PtCaps::Valid(const std::string& bitmap) const {
+	std::vector<unsigned> values {};
+	uint64_t bits = Cap(bitmap).value_or(0);
+	for (unsigned i = 0; i < 64; i++) {
+		if (bits & (uint64_t {1} << i)) values.push_back(i);
+	}
+	return values;
+}
+
+size_t PtCaps::AddressRanges() const {
+	return static_cast<size_t>(Cap("num_address_ranges").value_or(0));
+}
+
+PtConfig PtCaps::Config(PtProfile profile) const {
+	PtConfig config {};
+	bool cyc = Has("psb_cyc") && HasTerm("cyc");
+
+	switch (profile) {
+		case PtProfile::LowOverhead:
+			// Sync and timing packets as rarely as allowed, and returns compressed
+			config.psb_period = nearest_("psb_period", "psb_periods", UINT_MAX);
+			config.mtc_period = nearest_("mtc_period", "mtc_periods", UINT_MAX);
+			config.noretcomp  = false;
+			break;
+		case PtProfile::Balanced:
+			// A CYC packet per 32 cycles at most keeps timing within a few instructions
+			config.cyc        = cyc;
+			config.cyc_thresh = cyc ? nearest_("cyc_thresh", "cycle_thresholds", 6) : std::nullopt;
+			config.psb_period = nearest_("psb_period", "psb_periods", 3);
+			config.mtc_period = nearest_("mtc_period", "mtc_periods", 3);
+			break;
+		case PtProfile::CycleAccurate:
+			config.cyc        = cyc;
+			config.cyc_thresh = cyc ? nearest_("cyc_thresh", "cycle_thresholds", 1) : std::nullopt;
+			config.mtc_period = nearest_("mtc_period", "mtc_periods", 0);
+			break;
+	}
+	config.branch = true;  // the control flow is what every decode reads
+	return config;
+}
+
+std::optional<unsigned> PtCaps::nearest_(
+    const std::string& term, const std::string& bitmap, unsigned wanted
+) const {
+	if (!HasTerm(term)) return std::nullopt;
+
+	std::optional<unsigned> best {};
+	for (unsigned value : Valid(bitmap)) {
+		unsigned distance = value > wanted ? value - wanted : wanted - value;
+		if (!best || distance < (*best > wanted ? *best - wanted : wanted - *best)) best = value;
+	}
+	return best;
+}
+
+std::map<std::string, std::string> PtCaps::read_dir_(const std::string& dir) {
+	std::map<std::string, std::string> files {};
+	DIR* d = opendir(dir.c_str());
+	if (!d) return files;
+
+	while (struct dirent* ent = readdir(d)) {
+		std::string name = ent->d_name;
+		if (name == "." || name == "..") continue;
+
+		int fd = open((dir + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1) continue;
+		char buf[128];
+		ssize_t n = read(fd, buf, sizeof(buf));
+		close(fd);
+		if (n < 0) continue;
+
+		std::string value {buf, static_cast<size_t>(n)};
+		while (!value.empty() && isspace(static_cast<unsigned char>(value.back())))
+			value.pop_back();
+		files.emplace(std::move(name), std::move(value));
+	}
+	closedir(d);
+	return files;
+}
+
+}  // namespace libitrace
@@ -0,0 +1,258 @@
+#include "libitrace/ptscan.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace libitrace {
+
+namespace {
+
+constexpr uint8_t PSB[PT_PSB_SIZE] {0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82,
+                                    0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82};
+
+// Little endian loads of 8 bytes of a PSB, depending on whether they start with 02 or 82
+constexpr uint64_t PSB_EVEN = 0x8202820282028202ull;
+constexpr uint64_t PSB_ODD  = 0x0282028202820282ull;
+
+constexpr size_t PSB_HEADER_MAX = 256;  // PSB+ is a handful of packets before PSBEND
+
+/*
+ * @brief A PSB starting at i always covers the 8 byte word at the multiple of 8 in [i, i + 8], so
+ * the scan only compares whole words and this finds the PSB that covers one
+ * @return offset of the PSB, size if the word is not part of one
+ * */
+size_t psb_at_word(const uint8_t* data, size_t size, size_t from, size_t word) {
+	size_t start = word >= from + 8 ? word - 8 : from;
+	for (size_t i {start}; i <= word && i + PT_PSB_SIZE <= size; ++i)
+		if (data[i] == 0x02 && memcmp(data + i, PSB, PT_PSB_SIZE) == 0) return i;
+	return size;
+}
+
+uint64_t load64(const uint8_t* data) {
+	uint64_t value {};
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+#ifdef __SSE2__
+/*
+ * @brief Bit 8k of the result is set if every byte of word k of the 64 byte block is 02 or 82, as
+ * they all are in a word covered by a PSB
+ * */
+uint64_t psb_words(const uint8_t* data) {
+	const __m128i low  = _mm_set1_epi8(0x7f);
+	const __m128i psb  = _mm_set1_epi8(0x02);
+	uint64_t bytes {};
+	for (int i {0}; i < 4; ++i) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i));
+		uint64_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(block, low), psb));
+		bytes |= mask << (16 * i);
+	}
+	bytes &= bytes >> 1;
+	bytes &= bytes >> 2;
+	bytes &= bytes >> 4;
+	return bytes & 0x0101010101010101ull;
+}
+#endif
+
+}  // namespace
+
+std::vector<PtSyncPoint> PtScanner::Scan(bool deep) {
+	stats_ = {};
+	std::vector<PtSyncPoint> points {};
+
+	perfdata_.Records([&](const PerfEventHeader& header, uint64_t offset) {
+		if (header.type != PERF_RECORD_AUXTRACE) return;
+		PerfAuxtraceEvent event {};
+		memcpy(&event, perfdata_.Data() + offset, sizeof(event));
+		scan_buffer_(event, offset, deep, points);
+	});
+
+	return points;
+}
+
+size_t PtScanner::FindPsb(const uint8_t* data, size_t size, size_t from) {
+	if (size < PT_PSB_SIZE || from > size - PT_PSB_SIZE) return size;
+
+	size_t word = (from + 7) & ~size_t {7};
+
+#ifdef __SSE2__
+	for (; word + 64 <= size; word += 64) {
+		for (uint64_t candidates = psb_words(data + word); candidates;
+		     candidates &= candidates - 1) {
+			size_t at      = word + __builtin_ctzll(candidates);
+			uint64_t value = load64(data + at);
+			if (value != PSB_EVEN && value != PSB_ODD) continue;
+			size_t found = psb_at_word(data, size, from, at);
+			if (found != size) return found;
+		}
+	}
+#endif
+
+	for (; word + 8 <= size; word += 8) {
+		uint64_t value = load64(data + word);
+		if (value != PSB_EVEN && value != PSB_ODD) continue;
+		size_t found = psb_at_word(data, size, from, word);
+		if (found != size) return found;
+	}
+
+	return size;
+}
+
+size_t PtScanner::PacketLength(const uint8_t* data, size_t size) {
+	if (size == 0) return 0;
+	auto fits = [size](size_t length) -> size_t { return length <= size ? length : 0; };
+
+	uint8_t byte = data[0];
+	if (byte == 0x00) return 1;  // PAD
+
+	if (byte == 0x02) {
+		if (size < 2) return 0;
+		uint8_t ext = data[1];
+		if ((ext & 0x1f) == 0x12) {  // PTWRITE with a 4 or 8 byte payload
+			switch ((ext >> 5) & 0x3) {
+				case 0: return fits(6);
+				case 1: return fits(10);
+				default: return 0;
+			}
+		}
+		switch (ext) {
+			case 0x23:  // PSBEND
+			case 0x33:  // BEP
+			case 0x62:  // EXSTOP
+			case 0x83:  // TraceStop
+			case 0xb3:  // BEP with IP
+			case 0xe2:  // EXSTOP with IP
+			case 0xf3:  // OVF
+				return 2;
+			case 0x63: return fits(3);  // BBP
+			case 0x03:                  // CBR
+			case 0x13:                  // CFE
+			case 0x22:                  // PWRE
+				return fits(4);
+			case 0x73:  // TMA
+			case 0xa2:  // PWRX
+			case 0xc8:  // VMCS
+				return fits(7);
+			case 0x43:  // PIP
+			case 0xa3:  // long TNT
+				return fits(8);
+			case 0xc2: return fits(10);  // MWAIT
+			case 0x53:                   // EVD
+			case 0xc3:                   // MNT
+				return fits(11);
+			case 0x82: return fits(PT_PSB_SIZE);
+			default: return 0;
+		}
+	}
+
+	if ((byte & 0x3) == 0x3) {  // CYC, exp bits chain further bytes while their low bit is set
+		if (!(byte & 0x4)) return 1;
+		for (size_t i {1}; i < size; ++i)
+			if (!(data[i] & 0x1)) return i + 1;
+		return 0;
+	}
+
+	switch (byte) {
+		case 0x19: return fits(8);  // TSC
+		case 0x59:                  // MTC
+		case 0x99:                  // MODE
+			return fits(2);
+	}
+
+	switch (byte & 0x1f) {
+		case 0x01:  // TIP.PGD
+		case 0x0d:  // TIP
+		case 0x11:  // TIP.PGE
+		case 0x1d: {  // FUP
+			constexpr int ipbytes[8] {0, 2, 4, 6, 6, -1, 8, -1};
+			int length = ipbytes[byte >> 5];
+			return length < 0 ? 0 : fits(1 + length);
+		}
+	}
+
+	if (!(byte & 0x1)) return 1;  // short TNT
+
+	return 0;
+}
+
+void PtScanner::scan_buffer_(
+    const PerfAuxtraceEvent& event, uint64_t offset, bool deep, std::vector<PtSyncPoint>& points
+) {
+	const uint8_t* data = perfdata_.Data() + offset + event.header.size;
+	size_t size         = event.size;
+	++stats_.buffers;
+	stats_.aux_bytes += size;
+
+	size_t pos = FindPsb(data, size);
+	while (pos < size) {
+		size_t next = FindPsb(data, size, pos + PT_PSB_SIZE);
+
+		PtSyncPoint point {};
+		point.offset     = offset + event.header.size + pos;
+		point.aux_offset = event.offset + pos;
+		point.size       = next - pos;
+		point.cpu        = static_cast<int>(event.cpu);
+		point.tid        = static_cast<pid_t>(event.tid);
+
+		size_t header = psb_header_(data + pos, next - pos, point);
+		if (point.tsc) point.time = perfdata_.TscToTime(point.tsc).value_or(0);
+		if (deep) walk_(data + pos + header, next - pos - header, point);
+
+		points.push_back(point);
+		++stats_.psbs;
+		pos = next;
+	}
+}
+
+size_t PtScanner::psb_header_(const uint8_t* data, size_t size, PtSyncPoint& point) {
+	size_t limit = std::min(size, PSB_HEADER_MAX);
+	size_t pos   = PT_PSB_SIZE;
+	while (pos < limit) {
+		size_t length = PacketLength(data + pos, size - pos);
+		if (length == 0) break;
+
+		const uint8_t* packet = data + pos;
+		pos += length;
+		if (packet[0] == 0x19) {
+			uint64_t tsc {};
+			memcpy(&tsc, packet + 1, 7);
+			point.tsc = tsc;
+		} else if (packet[0] == 0x02 && packet[1] == 0x73) {
+			point.ctc = packet[2] | packet[3] << 8;
+			point.fc  = packet[5] | (packet[6] & 0x1) << 8;
+		} else if (packet[0] == 0x02 && packet[1] == 0x23) {
+			return pos;
+		}
+	}
+
+	// No PSBEND, a deep scan walks the header packets again
+	return PT_PSB_SIZE;
+}
+
+void PtScanner::walk_(const uint8_t* data, size_t size, PtSyncPoint& point) {
+	size_t pos {0};
+	while (pos < size) {
+		size_t length = PacketLength(data + pos, size - pos);
+		if (length == 0) {
+			++stats_.errors;
+			return;
+		}
+
+		uint8_t byte = data[pos];
+		if (byte == 0x59)
+			++point.mtc;
+		else if ((byte & 0x3) == 0x3)
+			++point.cyc;
+
+		++stats_.packets;
+		pos += length;
+	}
+}
+
+}  // namespace libitrace
@@ -1,14 +1,67 @@
 #include "libitrace/record.hpp"
 
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
+#include "libitrace/scheduler.hpp"
 #include "libitrace/subprocess.hpp"
+#include "libitrace/symbols.hpp"
 #include "libitrace/utils.hpp"
 
+namespace {
+
+constexpr std::string_view DUMP_PREFIX = "[ perf record: Dump ";
+constexpr std::string_view DUMP_SUFFIX = " ]";
+constexpr size_t CHUNK_STAMP           = 16;  // digits of the YYYYmmddHHMMSScc perf appends
+
+bool is_digits(std::string_view str) {
+	return !str.empty() && std::all_of(str.begin(), str.end(), [](char c) {
+		return c >= '0' && c <= '9';
+	});
+}
+
+// Rotated chunks of outfile that were modified since the recording started, oldest first
+std::vector<std::string> find_chunks(const std::string& outfile, time_t since) {
+	size_t slash       = outfile.rfind('/');
+	std::string prefix = slash == std::string::npos ? "" : outfile.substr(0, slash + 1);
+	std::string base   = outfile.substr(prefix.size());
+
+	std::vector<std::string> chunks {};
+	DIR* dir = opendir(prefix.empty() ? "." : prefix.c_str());
+	if (!dir) return chunks;
+	while (dirent* entry = readdir(dir)) {
+		std::string_view name {entry->d_name};
+		if (name.size() != base.size() + 1 + CHUNK_STAMP || name.substr(0, base.size()) != base ||
+		    name[base.size()] != '.' || !is_digits(name.substr(base.size() + 1)))
+			continue;
+
+		std::string path = prefix + std::string {name};
+		struct stat st {};
+		if (stat(path.c_str(), &st) == 0 && st.st_mtime >= since) chunks.push_back(path);
+	}
+	closedir(dir);
+
+	std::sort(chunks.begin(), chunks.end());
+	return chunks;
+}
+
+}  // namespace
+
 namespace libitrace {
 
 void Record::Run() {
@@ -20,8 +73,10 @@ void Record::Run() {
 	auto args = build_arglist_();
 	print_perf_args(args);
 
+	// Realtime so the recording never waits behind decodes of the same process
 	Subprocess perfrecord {"perf", args};
-	auto res {perfrecord.Run()};
+	JobOptions realtime {JobPriority::Realtime};
+	auto res = JobScheduler::Global().Run(perfrecord, realtime);
 	if (!res) throw std::runtime_error("Error starting perf record instance");
 	if (res->Exit != 0) throw std::runtime_error(res->Stderr);
 }
@@ -39,11 +94,339 @@ RunningProcess Record::Attach(pid_t pid) {
 	return *res;
 }
 
+arglist Record::AttachArglist(pid_t pid, const std::string& outfile, const std::string& control) {
+	RecordArgs saved         = perfargs_;
+	perfargs_.pid            = pid;
+	perfargs_.outfile        = outfile;
+	perfargs_.control        = control;
+	perfargs_.start_disabled = true;
+
+	// Without a program the filters are on the ELF file each process runs
+	if (perfargs_.program.empty()) {
+		char exe[PATH_MAX];
+		std::string link = "/proc/" + std::to_string(pid) + "/exe";
+		ssize_t n        = readlink(link.c_str(), exe, sizeof(exe) - 1);
+
+		perfargs_.program = n > 0 ? std::string {exe, static_cast<size_t>(n)} : link;
+	}
+
+	arglist args = build_arglist_();
+	perfargs_    = saved;
+	return args;
+}
+
+RunningProcess Record::Start() {
+	if (perfargs_.program.empty())
+		throw std::runtime_error("Specify a target program when tracing with Start()");
+
+	auto args = build_arglist_();
+	print_perf_args(args);
+	Subprocess perfrecord {"perf", args};
+
+	auto res {perfrecord.Popen()};
+	if (!res) throw std::runtime_error("Error starting perf record instance");
+
+	return *res;
+}
+
+void Record::UseControl(const std::string& dir, bool start_disabled) {
+	control_                 = std::make_unique<TraceControl>(dir);
+	perfargs_.control        = control_->PerfArg();
+	perfargs_.start_disabled = start_disabled;
+}
+
+std::chrono::nanoseconds Record::Enable() {
+	if (!control_) throw std::runtime_error("Call UseControl before enabling tracing");
+	return control_->Enable();
+}
+
+std::chrono::nanoseconds Record::Disable() {
+	if (!control_) throw std::runtime_error("Call UseControl before disabling tracing");
+	return control_->Disable();
+}
+
+void Record::SetClock(const std::string& clockid) { perfargs_.clockid = clockid; }
+
+LiveStats Record::Live(const arglist& scriptargs, ScriptParser& parser, std::optional<pid_t> pid) {
+	if (perfargs_.snapshot) throw std::runtime_error("Snapshot mode cannot be recorded live");
+	if (pid) perfargs_.pid = pid;
+
+	// perf record -o - writes the trace in perf's pipe format, which perf script -i - reads back
+	std::string outfile = perfargs_.outfile;
+	perfargs_.outfile   = "-";
+	arglist recordargs  = build_arglist_();
+	perfargs_.outfile   = outfile;
+
+	int feed[2] {};
+	if (pipe2(feed, O_CLOEXEC) == -1) throw_errno("Cannot create the live pipe");
+	if (fcntl(feed[0], F_SETPIPE_SZ, RECORD_LIVE_PIPE_BYTES) == -1) {
+		int error = errno;
+		close(feed[0]);
+		close(feed[1]);
+		throw_errno("Cannot resize the live pipe", error);
+	}
+
+	print_perf_args(scriptargs);
+	Subprocess perfscript {"perf", scriptargs};
+	perfscript.SetStdin(feed[0]);
+	auto script = perfscript.Popen();
+	if (!script) {
+		close(feed[0]);
+		close(feed[1]);
+		throw std::runtime_error("Error starting perf script instance");
+	}
+
+	print_perf_args(recordargs);
+	Subprocess perfrecord {"perf", recordargs};
+	auto record = perfrecord.Popen();
+	if (!record) {
+		close(feed[1]);
+		Subprocess::Wait(*script);
+		close(feed[0]);
+		throw std::runtime_error("Error starting perf record instance");
+	}
+	live_ = record->Pid;
+
+	LiveStats stats {};
+	auto begin = std::chrono::steady_clock::now();
+
+	// The trace is spliced from perf record into perf script without passing through user space.
+	// Closing the write end once perf record is done is what ends perf script
+	std::optional<CompletedProcess> recorded {};
+	std::thread feeder {[&] {
+		recorded = Subprocess::Splice(*record, feed[1]);
+		live_    = -1;
+		close(feed[1]);
+	}};
+
+	std::optional<CompletedProcess> decoded {};
+	std::exception_ptr error {};
+	try {
+		decoded = Subprocess::Stream(*script, [&](std::string_view chunk) {
+			stats.script_bytes += chunk.size();
+			parser.Feed(chunk);
+		});
+		parser.Finish();
+	} catch (...) {
+		error = std::current_exception();
+	}
+
+	// The read end stays open until here so the feeder never writes into a closed pipe. If perf
+	// script stopped early, perf record is stopped and whatever it still writes is discarded
+	if (error || !decoded || decoded->Exit != 0) {
+		StopLive();
+		char buf[65536];
+		while (read(feed[0], buf, sizeof(buf)) > 0) {}
+	}
+	feeder.join();
+	close(feed[0]);
+
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	if (error) std::rethrow_exception(error);
+	if (!decoded) throw std::runtime_error("Error decoding trace data");
+	if (decoded->Exit != 0) throw std::runtime_error(decoded->Stderr);
+	if (!recorded) throw std::runtime_error("Error waiting for perf record instance");
+	if (recorded->Exit != 0) throw std::runtime_error(recorded->Stderr);
+
+	stats.trace_bytes = recorded->Stdout_bytes;
+	return stats;
+}
+
+void Record::StopLive() {
+	pid_t pid = live_;
+	if (pid != -1) kill(pid, SIGINT);
+}
+
+void Record::SetRotation(const std::string& threshold, size_t max_chunks, uint64_t max_bytes) {
+	// perf takes a size with a B, K, M or G suffix or a time with an s, m, h or d suffix
+	std::string_view units {"BKMGsmhd"};
+	if (threshold.size() < 2 || units.find(threshold.back()) == std::string_view::npos ||
+	    !is_digits(std::string_view {threshold}.substr(0, threshold.size() - 1)))
+		throw std::runtime_error("Provide a rotation threshold such as 100M or 30s");
+
+	perfargs_.switch_output = threshold;
+	max_chunks_             = max_chunks;
+	max_bytes_              = max_bytes;
+}
+
+RotationStats Record::RunRotating(
+    const std::function<void(const std::string&)>& worker, std::optional<pid_t> pid
+) {
+	if (!perfargs_.switch_output) throw std::runtime_error("Set a rotation with SetRotation");
+	if (perfargs_.snapshot) throw std::runtime_error("Snapshot mode cannot be rotated");
+	if (pid) perfargs_.pid = pid;
+
+	auto args = build_arglist_();
+	print_perf_args(args);
+	Subprocess perfrecord {"perf", args};
+
+	time_t since = time(nullptr);
+	auto begin   = std::chrono::steady_clock::now();
+	auto elapsed = [&begin] {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	};
+
+	auto context = perfrecord.Popen();
+	if (!context) throw std::runtime_error("Error starting perf record instance");
+	live_ = context->Pid;
+
+	// Everything below is shared with the worker thread under lock
+	RotationStats stats {};
+	std::mutex lock {};
+	std::condition_variable ready {};
+	std::deque<size_t> queue {};
+	std::optional<size_t> busy {};
+	std::exception_ptr error {};
+	bool done {false};
+
+	std::thread thread {};
+	if (worker) {
+		thread = std::thread {[&] {
+			std::unique_lock<std::mutex> guard {lock};
+			while (true) {
+				ready.wait(guard, [&] { return done || !queue.empty(); });
+				if (queue.empty()) return;
+				size_t index = queue.front();
+				queue.pop_front();
+				busy             = index;
+				std::string path = stats.chunks[index].path;
+
+				guard.unlock();
+				std::exception_ptr failed {};
+				try {
+					worker(path);
+				} catch (...) {
+					failed = std::current_exception();
+				}
+				guard.lock();
+
+				busy.reset();
+				if (failed && !error) error = failed;
+				RecordChunk& chunk = stats.chunks[index];
+				chunk.processed    = elapsed();
+				stats.max_lag      = std::max(stats.max_lag, *chunk.processed - chunk.completed);
+			}
+		}};
+	}
+
+	auto add_chunk = [&](const std::string& path) {
+		struct stat st {};
+		uint64_t bytes = stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+
+		std::lock_guard<std::mutex> guard {lock};
+		for (const auto& chunk : stats.chunks)
+			if (chunk.path == path) return;
+		stats.chunks.push_back({path, bytes, elapsed()});
+		if (worker) {
+			queue.push_back(stats.chunks.size() - 1);
+			stats.backlog = std::max(stats.backlog, queue.size());
+			ready.notify_one();
+		}
+
+		// Drop the oldest chunks past the limits, always keeping the newest one and the one the
+		// worker is busy with
+		size_t kept {0};
+		uint64_t kept_bytes {0};
+		for (const auto& chunk : stats.chunks) {
+			if (chunk.dropped) continue;
+			++kept;
+			kept_bytes += chunk.bytes;
+		}
+		for (size_t i {0}; i + 1 < stats.chunks.size(); ++i) {
+			if (!((max_chunks_ && kept > max_chunks_) || (max_bytes_ && kept_bytes > max_bytes_)))
+				break;
+			RecordChunk& chunk = stats.chunks[i];
+			if (chunk.dropped || busy == i) continue;
+
+			unlink(chunk.path.c_str());
+			chunk.dropped = true;
+			--kept;
+			kept_bytes -= chunk.bytes;
+			++stats.dropped;
+
+			auto queued = std::find(queue.begin(), queue.end(), i);
+			if (queued != queue.end()) {
+				queue.erase(queued);
+				++stats.unprocessed;
+			}
+		}
+	};
+
+	// perf reports every chunk it completes on stderr, so stderr is the stream that is handed to
+	// the callback while stdout, the output of the target, is what gets captured
+	std::string pending {};
+	std::string messages {};
+	auto on_stderr = [&](std::string_view data) {
+		pending.append(data);
+		size_t start {0};
+		for (size_t end; (end = pending.find('\n', start)) != std::string::npos; start = end + 1) {
+			std::string_view line {pending.data() + start, end - start};
+			if (line.size() > DUMP_PREFIX.size() + DUMP_SUFFIX.size() &&
+			    line.substr(0, DUMP_PREFIX.size()) == DUMP_PREFIX &&
+			    line.substr(line.size() - DUMP_SUFFIX.size()) == DUMP_SUFFIX) {
+				line.remove_prefix(DUMP_PREFIX.size());
+				line.remove_suffix(DUMP_SUFFIX.size());
+				add_chunk(std::string {line});
+			} else {
+				messages.append(line);
+				messages += '\n';
+			}
+		}
+		pending.erase(0, start);
+	};
+
+	RunningProcess swapped {*context};
+	std::swap(swapped.Stdout_pipe, swapped.Stderr_pipe);
+	auto res = Subprocess::Stream(swapped, on_stderr);
+	live_    = -1;
+
+	// Pick up chunks perf completed without reporting them, such as when it runs with --quiet
+	for (const auto& path : find_chunks(perfargs_.outfile, since)) add_chunk(path);
+
+	{
+		std::lock_guard<std::mutex> guard {lock};
+		done = true;
+	}
+	ready.notify_one();
+	if (thread.joinable()) thread.join();
+	stats.seconds = elapsed();
+
+	if (!res) throw std::runtime_error("Error waiting for perf record instance");
+	if (res->Exit != 0) throw std::runtime_error(messages);
+	if (error) std::rethrow_exception(error);
+	return stats;
+}
+
 void Record::AddSymbolFilter(std::string symbol) {
+	try {
+		ElfSymbols symbols {program_path_()};
+		auto found  = symbols.Find(symbol);
+		auto offset = found ? symbols.FileOffset(found->start) : std::nullopt;
+		if (offset && found->size > 0) {
+			AddInstrPtrFilter(*offset, *offset + found->size);
+			return;
+		}
+	} catch (const std::runtime_error&) {
+		// Not an ELF file we can read, perf gets to try
+	}
+
 	perfargs_.symbol = symbol;
 	perfargs_.filter = true;
 }
 
+FilterPlan Record::AddProfileFilter(const std::string& profile, double coverage) {
+	size_t used  = perfargs_.instrptr_ranges.size() + (perfargs_.symbol ? 1 : 0);
+	size_t slots = PtCaps::Host().AddressRanges();
+	if (slots == 0) throw std::runtime_error("Intel PT has no address filters on this machine");
+	if (slots <= used) throw std::runtime_error("Every address filter slot is already in use");
+
+	auto functions = read_hot_functions(profile);
+	ElfSymbols symbols {program_path_()};
+	FilterPlan plan = plan_filters(symbols, functions, slots - used, coverage);
+	for (const auto& range : plan.ranges) AddInstrPtrFilter(range.start, range.end);
+	return plan;
+}
+
 void Record::AddInstrPtrFilter(long start, long end) {
 	if (end <= start)
 		throw std::runtime_error("Provide a valid instruction range <start>,<end> in hex");
@@ -51,8 +434,8 @@ void Record::AddInstrPtrFilter(long start, long end) {
 	long size = end - start;
 	std::stringstream ss {};
 	ss << "0x" << std::hex << start << "/0x" << size;
-	perfargs_.instrptr_range = ss.str();
-	perfargs_.filter         = true;
+	perfargs_.instrptr_ranges.push_back(ss.str());
+	perfargs_.filter = true;
 }
 
 void Record::SetSnapshotMode() { perfargs_.snapshot = true; }
@@ -61,6 +444,10 @@ void Record::TakeSnapshot(const RunningProcess& context) {
 	if (!perfargs_.snapshot)
 		throw std::runtime_error("Start record with snapshot mode to take snapshot");
 
+	if (control_) {
+		control_->Snapshot();
+		return;
+	}
 	kill(context.Pid, SIGUSR2);
 }
 
@@ -71,16 +458,22 @@ arglist Record::build_arglist_() {
 
 	if (perfargs_.filter) {
 		std::string filter {};
-		if (perfargs_.symbol)
-			filter += "filter " + *perfargs_.symbol + " @ " + perfargs_.program + " ";
+		std::string object = program_path_();
+		if (perfargs_.symbol) filter += "filter " + *perfargs_.symbol + " @ " + object + " ";
 
-		if (perfargs_.instrptr_range)
-			filter += "filter " + *perfargs_.instrptr_range + " @ " + perfargs_.program;
+		for (const auto& range : perfargs_.instrptr_ranges)
+			filter += "filter " + range + " @ " + object + " ";
+		filter.pop_back();
 
 		args.insert(args.end(), {"--filter", filter});
 	}
 
 	if (perfargs_.snapshot) args.insert(args.end(), {"--snapshot"});
+	if (perfargs_.switch_output)
+		args.insert(args.end(), {"--switch-output=" + *perfargs_.switch_output});
+	if (perfargs_.control) args.insert(args.end(), {"--control=" + *perfargs_.control});
+	if (perfargs_.start_disabled) args.insert(args.end(), {"--delay=-1"});
+	if (perfargs_.clockid) args.insert(args.end(), {"-k", *perfargs_.clockid});
 
 	if (perfargs_.pid) {
 		args.insert(args.end(), {"-p", std::to_string(*perfargs_.pid)});
@@ -92,18 +485,19 @@ arglist Record::build_arglist_() {
 	return args;
 }
 
-bool Record::check_cyc_avail() {
-	int fd = open("/sys/bus/event_source/devices/intel_pt/caps/psb_cyc", O_RDONLY);
-	if (fd == -1) throw std::runtime_error("Error opening file that indiates cyc support");
-
-	char val {};
-	if (read(fd, &val, sizeof(char)) == -1)
-		throw std::runtime_error("Error checking cyc availability");
-	close(fd);
+std::string Record::program_path_() const {
+	// perf runs the program through $PATH but the ELF file has to be opened directly
+	const std::string& program = perfargs_.program;
+	if (program.find('/') != std::string::npos) return program;
 
-	if (val == '1') return true;
-
-	return false;
+	const char* path = getenv("PATH");
+	std::stringstream dirs {path ? path : ""};
+	std::string dir {};
+	while (std::getline(dirs, dir, ':')) {
+		std::string candidate = (dir.empty() ? "." : dir) + "/" + program;
+		if (access(candidate.c_str(), X_OK) == 0) return candidate;
+	}
+	return program;
 }
 
 }  // namespace libitrace
@@ -0,0 +1,341 @@
+#include "libitrace/recordgroup.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "libitrace/utils.hpp"
+
+namespace libitrace {
+
+namespace {
+
+constexpr std::string_view MANIFEST_HEADER =
+    "# itrace group pid enabled disabled exit bytes output comm";
+constexpr std::string_view READY_MESSAGE = "Events disabled";  // perf record --delay=-1
+constexpr size_t STDERR_LIMIT            = 65536;
+constexpr uint64_t STOP_EVENT            = UINT64_MAX;  // epoll data of the eventfd of Stop
+constexpr uint64_t STOPFD_EVENT          = UINT64_MAX - 1;
+
+std::string read_comm(pid_t pid) {
+	std::ifstream in {"/proc/" + std::to_string(pid) + "/comm"};
+	std::string comm {};
+	std::getline(in, comm);
+	return comm;
+}
+
+std::string last_line(std::string_view text) {
+	while (!text.empty() && text.back() == '\n') text.remove_suffix(1);
+	size_t newline = text.rfind('\n');
+	return std::string {newline == std::string_view::npos ? text : text.substr(newline + 1)};
+}
+
+}  // namespace
+
+uint64_t GroupManifest::Skew() const {
+	uint64_t first {UINT64_MAX};
+	uint64_t last {0};
+	for (const auto& member : members) {
+		if (member.enabled == 0) continue;
+		first = std::min(first, member.enabled);
+		last  = std::max(last, member.enabled);
+	}
+	return last > first ? last - first : 0;
+}
+
+void GroupManifest::Save(const std::string& path) const {
+	std::ofstream out {path};
+	if (!out) throw std::runtime_error("Cannot write group manifest " + path);
+
+	// Tab separated with comm last, which may hold spaces
+	out << MANIFEST_HEADER << '\n';
+	for (const auto& member : members) {
+		out << member.pid << '\t' << member.enabled << '\t' << member.disabled << '\t'
+		    << member.exit << '\t' << member.bytes << '\t' << member.outfile << '\t' << member.comm
+		    << '\n';
+	}
+	if (!out) throw std::runtime_error("Cannot write group manifest " + path);
+}
+
+std::optional<GroupManifest> GroupManifest::Load(const std::string& path) {
+	std::ifstream in {path};
+	if (!in) return std::nullopt;
+
+	std::string line {};
+	std::getline(in, line);
+	if (line != MANIFEST_HEADER) throw std::runtime_error(path + " is not a group manifest");
+
+	GroupManifest manifest {};
+	while (std::getline(in, line)) {
+		if (line.empty()) continue;
+		std::istringstream fields {line};
+		GroupMember member {};
+		if (!(fields >> member.pid >> member.enabled >> member.disabled >> member.exit >>
+		      member.bytes))
+			throw std::runtime_error(path + " is not a group manifest");
+		fields.ignore(1, '\t');
+		std::getline(fields, member.outfile, '\t');
+		std::getline(fields, member.comm);
+		manifest.members.push_back(std::move(member));
+	}
+	return manifest;
+}
+
+std::vector<pid_t> cgroup_pids(const std::string& cgroup) {
+	std::string path = cgroup + "/cgroup.procs";
+	if (cgroup.empty() || cgroup[0] != '/') path = std::string {CGROUP_ROOT} + "/" + path;
+
+	std::ifstream in {path};
+	if (!in) throw std::runtime_error("Cannot read the processes of the cgroup in " + path);
+
+	std::vector<pid_t> pids {};
+	pid_t pid {};
+	while (in >> pid) pids.push_back(pid);
+	return pids;
+}
+
+RecordGroup::RecordGroup(Record& record, const std::vector<pid_t>& pids, const std::string& outfile)
+    : record_ {record},
+      outfile_ {outfile} {
+	if (pids.empty()) throw std::runtime_error("Provide at least one process to trace");
+
+	std::vector<pid_t> unique = pids;
+	std::sort(unique.begin(), unique.end());
+	unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+	children_.resize(unique.size());
+	for (size_t i = 0; i < unique.size(); i++) {
+		GroupMember& member = children_[i].member;
+		member.pid          = unique[i];
+		member.comm         = read_comm(unique[i]);
+		member.outfile      = OutfileFor(outfile_, unique[i]);
+	}
+
+	stopfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (stopfd_ == -1) throw_errno("eventfd");
+}
+
+RecordGroup::~RecordGroup() {
+	for (auto& child : children_) {
+		if (!child.running) continue;
+		kill(child.process.Pid, SIGINT);
+		reap_(child);
+	}
+	close(stopfd_);
+}
+
+void RecordGroup::Stop() {
+	uint64_t one {1};
+	if (write(stopfd_, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		throw_errno("Cannot stop the group");
+}
+
+void RecordGroup::start_(Child& child) {
+	std::string dir = TraceControl::DefaultDir() + "." + std::to_string(child.member.pid);
+	child.control   = std::make_unique<TraceControl>(dir);
+
+	arglist args =
+	    record_.AttachArglist(child.member.pid, child.member.outfile, child.control->PerfArg());
+	print_perf_args(args);
+	Subprocess perfrecord {"perf", args};
+	auto res = perfrecord.Popen();
+	if (!res) throw std::runtime_error("Error starting perf record instance");
+
+	child.process = *res;
+	child.running = true;
+	child.open    = 2;
+	for (int fd : {child.process.Stdout_pipe, child.process.Stderr_pipe})
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+void RecordGroup::read_(Child& child, int fd, int epfd) {
+	char buf[4096];
+	while (true) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n > 0) {
+			// perf record -o writes nothing to stdout, stderr holds its messages
+			if (fd != child.process.Stderr_pipe) continue;
+			if (child.stderr_.size() < STDERR_LIMIT) child.stderr_.append(buf, n);
+			if (child.stderr_.find(READY_MESSAGE) != std::string::npos) child.ready = true;
+			continue;
+		}
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && errno == EAGAIN) return;
+		if (n == -1) throw_errno("Cannot read perf record of " + std::to_string(child.member.pid));
+		break;
+	}
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+	close(fd);
+	if (fd == child.process.Stderr_pipe) {
+		child.process.Stderr_pipe = -1;
+	} else {
+		child.process.Stdout_pipe = -1;
+	}
+	if (--child.open == 0) reap_(child);
+}
+
+void RecordGroup::reap_(Child& child) {
+	// Also called by the destructor, so a failed wait is recorded on the member instead of thrown
+	int status {};
+	int waited {};
+	while ((waited = waitpid(child.process.Pid, &status, 0)) == -1 && errno == EINTR) {}
+	std::string error = waited == -1 ? std::string {"waitpid: "} + strerror(errno) : "";
+	child.running     = false;
+	for (int* fd : {&child.process.Stdout_pipe, &child.process.Stderr_pipe}) {
+		if (*fd != -1) close(*fd);
+		*fd = -1;
+	}
+	child.open = 0;
+
+	GroupMember& member = child.member;
+	if (waited == -1) member.exit = -1;
+	else member.exit = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	if (member.enabled != 0 && member.disabled == 0) member.disabled = monotonic_ns();
+	if (member.exit != 0) member.error = waited == -1 ? error : last_line(child.stderr_);
+
+	struct stat st {};
+	if (stat(member.outfile.c_str(), &st) == 0) member.bytes = st.st_size;
+	child.control.reset();
+}
+
+void RecordGroup::enable_all_() {
+	// Back to back so the traces start together, each enable only waits for its own ack
+	for (auto& child : children_) {
+		if (!child.running) continue;
+		try {
+			child.control->Enable();
+			child.member.enabled = monotonic_ns();
+		} catch (const std::runtime_error& e) {
+			child.member.error = e.what();
+		}
+	}
+}
+
+void RecordGroup::disable_all_() {
+	for (auto& child : children_) {
+		if (!child.running || child.member.enabled == 0) continue;
+		try {
+			child.control->Disable();
+			child.member.disabled = monotonic_ns();
+		} catch (const std::runtime_error& e) {
+			child.member.error = e.what();
+		}
+	}
+}
+
+GroupManifest RecordGroup::Run(int stopfd) {
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) throw_errno("epoll_create1");
+
+	// Children still running after an error are stopped and reaped by the destructor
+	try {
+		run_(epfd, stopfd);
+	} catch (...) {
+		close(epfd);
+		throw;
+	}
+	close(epfd);
+
+	GroupManifest manifest {};
+	for (const auto& child : children_) manifest.members.push_back(child.member);
+	manifest.Save(GroupManifest::PathFor(outfile_));
+	return manifest;
+}
+
+void RecordGroup::run_(int epfd, int stopfd) {
+	auto watch = [epfd](int fd, uint64_t data) {
+		struct epoll_event ev {};
+		ev.events   = EPOLLIN;
+		ev.data.u64 = data;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) throw_errno("epoll_ctl");
+	};
+	watch(stopfd_, STOP_EVENT);
+	if (stopfd != -1) watch(stopfd, STOPFD_EVENT);
+
+	for (size_t i = 0; i < children_.size(); i++) {
+		start_(children_[i]);
+		watch(children_[i].process.Stdout_pipe, i * 2);
+		watch(children_[i].process.Stderr_pipe, i * 2 + 1);
+	}
+
+	enum class Phase { Starting, Running, Stopping };
+	Phase phase   = Phase::Starting;
+	auto deadline = std::chrono::steady_clock::now() +
+	                std::chrono::milliseconds {GROUP_READY_TIMEOUT_MS};
+
+	auto stop = [&] {
+		if (phase == Phase::Running) disable_all_();
+		for (auto& child : children_) {
+			if (child.running) kill(child.process.Pid, SIGINT);
+		}
+		phase = Phase::Stopping;
+	};
+
+	while (std::any_of(children_.begin(), children_.end(), [](const Child& c) {
+		return c.running;
+	})) {
+		int timeout {-1};
+		if (phase == Phase::Starting) {
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+			    deadline - std::chrono::steady_clock::now()
+			);
+			timeout = std::max<int>(0, left.count());
+		}
+
+		struct epoll_event events[64];
+		int n = epoll_wait(epfd, events, 64, timeout);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) throw_errno("epoll_wait");
+
+		bool stopping {false};
+		for (int i = 0; i < n; i++) {
+			uint64_t data = events[i].data.u64;
+			if (data == STOP_EVENT) {
+				uint64_t count {};
+				if (read(stopfd_, &count, sizeof(count)) == -1 && errno != EAGAIN)
+					throw_errno("Cannot read the stop eventfd");
+				stopping = true;
+			} else if (data == STOPFD_EVENT) {
+				char buf[256];
+				ssize_t got = read(stopfd, buf, sizeof(buf));
+				if (got > 0) {
+					stopping = true;
+				} else if (got == 0) {
+					epoll_ctl(epfd, EPOLL_CTL_DEL, stopfd, nullptr);
+				}
+			} else {
+				Child& child = children_[data / 2];
+				int fd       = data % 2 ? child.process.Stderr_pipe : child.process.Stdout_pipe;
+				read_(child, fd, epfd);
+			}
+		}
+
+		if (stopping && phase != Phase::Stopping) {
+			stop();
+		} else if (phase == Phase::Starting) {
+			bool ready = std::all_of(children_.begin(), children_.end(), [](const Child& c) {
+				return !c.running || c.ready;
+			});
+			if (ready || std::chrono::steady_clock::now() >= deadline) {
+				enable_all_();
+				phase = Phase::Running;
+			}
+		}
+	}
+}
+
+}  // namespace libitrace
@@ -0,0 +1,101 @@
+#include "libitrace/ring.hpp"
+
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain ints");
+
+uint32_t* futex_word(std::atomic<uint32_t>& word) { return reinterpret_cast<uint32_t*>(&word); }
+
+}  // namespace
+
+namespace libitrace {
+
+ByteRing::ByteRing(size_t capacity) {
+	size_t size {1};
+	while (size < capacity) size <<= 1;
+	buffer_.resize(size);
+	mask_ = size - 1;
+}
+
+size_t ByteRing::Write(const char* data, size_t size) {
+	size_t head = head_.load(std::memory_order_relaxed);
+	size_t tail = tail_.load(std::memory_order_acquire);
+	size        = std::min(size, buffer_.size() - (head - tail));
+
+	// The free space may wrap around the end of the buffer
+	size_t offset = head & mask_;
+	size_t first  = std::min(size, buffer_.size() - offset);
+	memcpy(buffer_.data() + offset, data, first);
+	memcpy(buffer_.data(), data + first, size - first);
+
+	head_.store(head + size, std::memory_order_release);
+	if (size > 0) notify_(written_, reader_waiting_);
+	return size;
+}
+
+size_t ByteRing::Read(char* data, size_t size) {
+	size_t tail = tail_.load(std::memory_order_relaxed);
+	size_t head = head_.load(std::memory_order_acquire);
+	size        = std::min(size, head - tail);
+
+	size_t offset = tail & mask_;
+	size_t first  = std::min(size, buffer_.size() - offset);
+	memcpy(data, buffer_.data() + offset, first);
+	memcpy(data + first, buffer_.data(), size - first);
+
+	tail_.store(tail + size, std::memory_order_release);
+	if (size > 0) notify_(drained_, writer_waiting_);
+	return size;
+}
+
+void ByteRing::WriteAll(const char* data, size_t size) {
+	while (size > 0) {
+		// Taken before trying so a read that lands in between cancels the wait
+		uint32_t seen  = drained_.load();
+		size_t written = Write(data, size);
+		if (written == 0) wait_(drained_, seen, writer_waiting_);
+		data += written;
+		size -= written;
+	}
+}
+
+size_t ByteRing::ReadSome(char* data, size_t size) {
+	while (true) {
+		// Check closed before reading so bytes written just before Close are not missed
+		uint32_t seen = written_.load();
+		bool closed   = closed_.load(std::memory_order_acquire);
+		size_t read   = Read(data, size);
+		if (read > 0 || closed) return read;
+		wait_(written_, seen, reader_waiting_);
+	}
+}
+
+void ByteRing::Close() {
+	closed_.store(true, std::memory_order_release);
+	notify_(written_, reader_waiting_);
+}
+
+void ByteRing::notify_(std::atomic<uint32_t>& word, const std::atomic<bool>& waiting) {
+	// Sequentially consistent with the waiter setting its flag, so one of the two sees the other
+	word.fetch_add(1);
+	if (waiting.load())
+		syscall(SYS_futex, futex_word(word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+void ByteRing::wait_(std::atomic<uint32_t>& word, uint32_t seen, std::atomic<bool>& waiting) {
+	waiting.store(true);
+	// The kernel only sleeps while the word still holds seen, a notify in between returns at once
+	if (word.load() == seen)
+		syscall(SYS_futex, futex_word(word), FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+	waiting.store(false);
+}
+
+}  // namespace libitrace
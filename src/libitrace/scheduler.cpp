@@ -0,0 +1,366 @@
+#include "libitrace/scheduler.hpp"
+
+#include <signal.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace libitrace {
+
+namespace {
+
+double seconds(std::chrono::steady_clock::duration duration) {
+	return std::chrono::duration<double>(duration).count();
+}
+
+uint64_t available_memory() {
+	// MemAvailable:   16318032 kB
+	std::ifstream in {"/proc/meminfo"};
+	std::string key {};
+	uint64_t kib {};
+	std::string rest {};
+	while (in >> key >> kib) {
+		if (key == "MemAvailable:") return kib * 1024;
+		std::getline(in, rest);
+	}
+	return 0;
+}
+
+bool finished(JobState state) { return state != JobState::Queued && state != JobState::Running; }
+
+}  // namespace
+
+JobResult Job::Wait() {
+	std::unique_lock<std::mutex> guard {scheduler_.lock_};
+	scheduler_.done_.wait(guard, [this] { return finished(state_); });
+	if (error_) std::rethrow_exception(error_);
+
+	JobResult res {};
+	res.state   = state_;
+	res.process = result_;
+	if (started_ == clock::time_point {}) {
+		res.wait_seconds = seconds(finished_ - submitted_);
+	} else {
+		res.wait_seconds = seconds(started_ - submitted_);
+		res.run_seconds  = seconds(finished_ - started_);
+	}
+	return res;
+}
+
+void Job::Cancel() {
+	std::lock_guard<std::mutex> guard {scheduler_.lock_};
+	scheduler_.cancel_(*this);
+}
+
+JobState Job::State() const {
+	std::lock_guard<std::mutex> guard {scheduler_.lock_};
+	return state_;
+}
+
+JobScheduler::JobScheduler(size_t slots) : slots_ {std::max<size_t>(1, slots)} {
+	watchdog_ = std::thread {[this] { watch_loop_(); }};
+}
+
+JobScheduler::~JobScheduler() {
+	{
+		std::lock_guard<std::mutex> guard {lock_};
+		stop_ = true;
+		auto now = clock::now();
+		for (auto& queue : queues_) {
+			for (auto& job : queue) {
+				job->cancelled_ = true;
+				finish_(*job, JobState::Cancelled, now);
+			}
+			queue.clear();
+		}
+		for (auto& job : running_) cancel_(*job);
+	}
+	work_.notify_all();
+	watch_.notify_all();
+
+	for (auto& worker : workers_) worker.join();
+	watchdog_.join();
+}
+
+size_t JobScheduler::DefaultSlots() {
+	const char* env = getenv(JOBS_ENV);
+	if (env && *env) {
+		long jobs = strtol(env, nullptr, 10);
+		if (jobs > 0) return jobs;
+	}
+
+	size_t slots    = std::max(1u, std::thread::hardware_concurrency());
+	uint64_t memory = available_memory();
+	if (memory > 0)
+		slots = std::min<size_t>(slots, std::max<uint64_t>(1, memory / JOB_MEMORY_BYTES));
+	return slots;
+}
+
+JobScheduler& JobScheduler::Global() {
+	static JobScheduler scheduler {};
+	return scheduler;
+}
+
+std::shared_ptr<Job> JobScheduler::Submit(
+    Subprocess process, const JobOptions& options, JobBody body
+) {
+	std::shared_ptr<Job> job {new Job {*this, std::move(process), std::move(body), options}};
+
+	std::lock_guard<std::mutex> guard {lock_};
+	if (stop_) throw std::runtime_error("Job scheduler is shutting down");
+
+	job->submitted_ = clock::now();
+	if (options.timeout) {
+		job->deadline_ = job->submitted_ + *options.timeout;
+		watch_.notify_one();
+	}
+	queues_[static_cast<size_t>(options.priority)].push_back(job);
+
+	if (idle_ == 0) spawn_worker_();
+	work_.notify_one();
+	return job;
+}
+
+std::optional<CompletedProcess> JobScheduler::Run(Subprocess process, const JobOptions& options) {
+	return wait_(Submit(std::move(process), options));
+}
+
+std::optional<CompletedProcess> JobScheduler::Stream(
+    Subprocess process, const chunk_callback& callback, const JobOptions& options
+) {
+	// The body runs on a worker while this thread waits, so the callback never runs concurrently
+	// with the caller
+	return wait_(Submit(std::move(process), options, [&callback](const RunningProcess& context) {
+		return Subprocess::Stream(context, callback);
+	}));
+}
+
+void JobScheduler::SetSlots(size_t slots) {
+	std::lock_guard<std::mutex> guard {lock_};
+	slots_ = std::max<size_t>(1, slots);
+	if (idle_ == 0 && !stop_) spawn_worker_();
+	work_.notify_all();
+}
+
+size_t JobScheduler::Slots() const {
+	std::lock_guard<std::mutex> guard {lock_};
+	return slots_;
+}
+
+void JobScheduler::CancelAll() {
+	std::lock_guard<std::mutex> guard {lock_};
+	for (auto& queue : queues_) {
+		while (!queue.empty()) cancel_(*queue.front());
+	}
+	for (auto& job : running_) cancel_(*job);
+}
+
+SchedulerStats JobScheduler::Stats() const {
+	std::lock_guard<std::mutex> guard {lock_};
+	return stats_;
+}
+
+std::shared_ptr<Job> JobScheduler::take_() {
+	// Realtime jobs never wait for a slot
+	size_t priority = 0;
+	if (queues_[0].empty()) {
+		if (busy_ >= slots_) return nullptr;
+		priority = queues_[1].empty() ? 2 : 1;
+		if (queues_[priority].empty()) return nullptr;
+		++busy_;
+	}
+
+	std::shared_ptr<Job> job = queues_[priority].front();
+	queues_[priority].pop_front();
+	job->state_   = JobState::Running;
+	job->started_ = clock::now();
+	running_.push_back(job);
+	return job;
+}
+
+void JobScheduler::spawn_worker_() {
+	// Counted as idle until it takes its first job so concurrent submissions do not each spawn one
+	++idle_;
+	workers_.emplace_back([this] { work_loop_(); });
+}
+
+void JobScheduler::work_loop_() {
+	std::unique_lock<std::mutex> guard {lock_};
+	while (true) {
+		std::shared_ptr<Job> job {};
+		work_.wait(guard, [this, &job] {
+			if (stop_) return true;
+			job = take_();
+			return job != nullptr;
+		});
+		if (!job) break;
+
+		// Make sure another worker is around for the next job that may be admitted
+		--idle_;
+		if (idle_ == 0 && !stop_) spawn_worker_();
+
+		guard.unlock();
+		run_(job);
+		guard.lock();
+		++idle_;
+	}
+	--idle_;
+}
+
+void JobScheduler::run_(const std::shared_ptr<Job>& job) {
+	auto context = job->process_.Popen();
+	{
+		std::lock_guard<std::mutex> guard {lock_};
+		auto now = clock::now();
+		if (!context) {
+			finish_(*job, JobState::Done, now);
+			return;
+		}
+
+		// Cancelled or expired between being taken and started
+		job->pid_ = context->Pid;
+		if (!job->cancelled_ && job->deadline_ && *job->deadline_ <= now) job->timed_out_ = true;
+		if (job->cancelled_ || job->timed_out_) terminate_(*job, now);
+	}
+
+	std::optional<CompletedProcess> result {};
+	std::exception_ptr error {};
+	try {
+		if (job->body_) {
+			result = job->body_(*context);
+		} else {
+			result = Subprocess::Wait(*context, true, job->process_.CaptureLimit());
+		}
+	} catch (...) { error = std::current_exception(); }
+
+	std::lock_guard<std::mutex> guard {lock_};
+	job->pid_ = -1;
+	job->kill_at_.reset();
+	job->result_ = std::move(result);
+	job->error_  = error;
+	JobState state {JobState::Done};
+	if (job->cancelled_) {
+		state = JobState::Cancelled;
+	} else if (job->timed_out_) {
+		state = JobState::TimedOut;
+	}
+	finish_(*job, state, clock::now());
+}
+
+void JobScheduler::watch_loop_() {
+	std::unique_lock<std::mutex> guard {lock_};
+	while (!stop_ || !running_.empty()) {
+		auto now = clock::now();
+		std::optional<clock::time_point> next {};
+		auto consider = [&next](clock::time_point at) {
+			if (!next || at < *next) next = at;
+		};
+
+		for (auto& queue : queues_) {
+			for (auto it = queue.begin(); it != queue.end();) {
+				std::shared_ptr<Job> job = *it;
+				if (!job->deadline_) {
+					++it;
+				} else if (*job->deadline_ > now) {
+					consider(*job->deadline_);
+					++it;
+				} else {
+					it              = queue.erase(it);
+					job->timed_out_ = true;
+					finish_(*job, JobState::TimedOut, now);
+				}
+			}
+		}
+
+		for (auto& job : running_) {
+			if (job->deadline_ && !job->timed_out_ && !job->cancelled_) {
+				if (*job->deadline_ <= now) {
+					job->timed_out_ = true;
+					terminate_(*job, now);
+				} else {
+					consider(*job->deadline_);
+				}
+			}
+			if (job->kill_at_ && *job->kill_at_ <= now) {
+				kill(job->pid_, SIGKILL);
+				job->kill_at_.reset();
+			} else if (job->kill_at_) {
+				consider(*job->kill_at_);
+			}
+		}
+
+		if (next) {
+			watch_.wait_until(guard, *next);
+		} else {
+			watch_.wait(guard);
+		}
+	}
+}
+
+void JobScheduler::cancel_(Job& job) {
+	auto now = clock::now();
+	if (job.state_ == JobState::Queued) {
+		auto& queue = queues_[static_cast<size_t>(job.options_.priority)];
+		auto it     = std::find_if(queue.begin(), queue.end(), [&job](const auto& queued) {
+			return queued.get() == &job;
+		});
+		std::shared_ptr<Job> keep = *it;  // alive until it is finished
+		queue.erase(it);
+		job.cancelled_ = true;
+		finish_(job, JobState::Cancelled, now);
+	} else if (job.state_ == JobState::Running && !job.cancelled_) {
+		job.cancelled_ = true;
+		terminate_(job, now);
+	}
+}
+
+void JobScheduler::terminate_(Job& job, clock::time_point now) {
+	// Before the process exists run_ terminates it as soon as it is started
+	if (job.pid_ == -1 || job.kill_at_) return;
+	kill(job.pid_, SIGTERM);
+	job.kill_at_ = now + std::chrono::milliseconds {JOB_KILL_GRACE_MS};
+	watch_.notify_one();
+}
+
+void JobScheduler::finish_(Job& job, JobState state, clock::time_point now) {
+	bool started = job.state_ == JobState::Running;
+	job.state_    = state;
+	job.finished_ = now;
+
+	double wait = seconds((started ? job.started_ : now) - job.submitted_);
+	stats_.wait_seconds += wait;
+	stats_.max_wait_seconds = std::max(stats_.max_wait_seconds, wait);
+	if (state == JobState::Done) ++stats_.done;
+	if (state == JobState::Cancelled) ++stats_.cancelled;
+	if (state == JobState::TimedOut) ++stats_.timed_out;
+
+	if (started) {
+		stats_.run_seconds += seconds(now - job.started_);
+		running_.erase(std::find_if(running_.begin(), running_.end(), [&job](const auto& running) {
+			return running.get() == &job;
+		}));
+		if (job.options_.priority != JobPriority::Realtime) --busy_;
+		work_.notify_one();
+		watch_.notify_one();
+	}
+	done_.notify_all();
+}
+
+std::optional<CompletedProcess> JobScheduler::wait_(const std::shared_ptr<Job>& job) {
+	JobResult res = job->Wait();
+	if (res.state == JobState::Done) return res.process;
+
+	std::string name = "Subprocess";
+	if (res.process) {
+		name = res.process->Cmd;
+		if (!res.process->Arglist.empty()) name += " " + res.process->Arglist[0];
+	}
+	throw std::runtime_error(
+	    name + (res.state == JobState::Cancelled ? " was cancelled" : " timed out")
+	);
+}
+
+}  // namespace libitrace
@@ -0,0 +1,197 @@
+#include "libitrace/shard.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+#include "libitrace/ptscan.hpp"
+#include "libitrace/utils.hpp"
+
+namespace libitrace {
+
+namespace {
+
+constexpr size_t SHARD_WRITE_BUFFER = 1048576;
+
+struct AuxBuffer {
+	uint64_t record {};
+	PerfAuxtraceEvent event {};
+};
+
+}  // namespace
+
+std::vector<TraceShard> TraceSharder::Split(uint64_t target) const {
+	target = std::max<uint64_t>(target, 1);
+
+	// AUX buffers are queued by the index of the mmap they were read from, one per cpu or thread
+	std::map<uint32_t, std::vector<AuxBuffer>> queues {};
+	perfdata_.Records([&](const PerfEventHeader& header, uint64_t offset) {
+		if (header.type != PERF_RECORD_AUXTRACE) return;
+		AuxBuffer buffer {offset, {}};
+		memcpy(&buffer.event, perfdata_.Data() + offset, sizeof(buffer.event));
+		queues[buffer.event.idx].push_back(buffer);
+	});
+
+	std::vector<TraceShard> shards {};
+	for (const auto& [idx, buffers] : queues) {
+		TraceShard shard {};
+		shard.cpu = static_cast<int>(buffers.front().event.cpu);
+		shard.tid = static_cast<pid_t>(buffers.front().event.tid);
+
+		for (const auto& buffer : buffers) {
+			const uint8_t* data = perfdata_.Data() + buffer.record + buffer.event.header.size;
+			uint64_t size       = buffer.event.size;
+
+			// Jump ahead to where the shard is full and cut at the next PSB from there. Data
+			// before the first PSB of a stream stays in the first shard, perf skips it anyway
+			uint64_t pos {0};
+			while (pos < size) {
+				uint64_t needed = shard.bytes < target ? target - shard.bytes : 1;
+				uint64_t from   = pos + needed;
+				uint64_t psb    = from < size ? PtScanner::FindPsb(data, size, from) : size;
+
+				shard.pieces.push_back({buffer.record, pos, psb});
+				shard.bytes += psb - pos;
+				pos = psb;
+				if (psb == size) break;
+
+				shard.index = shards.size();
+				shards.push_back(std::move(shard));
+				shard       = TraceShard {};
+				shard.cpu   = static_cast<int>(buffer.event.cpu);
+				shard.tid   = static_cast<pid_t>(buffer.event.tid);
+			}
+		}
+
+		if (shard.bytes > 0) {
+			shard.index = shards.size();
+			shards.push_back(std::move(shard));
+		}
+	}
+
+	return shards;
+}
+
+void TraceSharder::Write(const TraceShard& shard, const std::string& path) const {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1) throw_errno("Cannot open " + path);
+	try {
+		write_(shard, fd);
+	} catch (const std::runtime_error&) {
+		close(fd);
+		unlink(path.c_str());
+		throw;
+	}
+	close(fd);
+}
+
+void TraceSharder::write_(const TraceShard& shard, int fd) const {
+	const PerfFileHeader& in = perfdata_.Header();
+	const uint8_t* base      = perfdata_.Data();
+	PerfFileHeader out       = in;
+
+	// Header, attributes, the sample ids of each attribute, data section, feature table, features
+	std::string buffer(sizeof(out), '\0');
+	out.attrs.offset = sizeof(out);
+	buffer.append(reinterpret_cast<const char*>(base + in.attrs.offset), in.attrs.size);
+
+	size_t attrs = in.attr_size ? in.attrs.size / in.attr_size : 0;
+	for (size_t i {0}; i < attrs; ++i) {
+		size_t entry = sizeof(out) + i * in.attr_size + in.attr_size - sizeof(PerfFileSection);
+		PerfFileSection ids {};
+		memcpy(&ids, buffer.data() + entry, sizeof(ids));
+		if (ids.offset > perfdata_.Size() || ids.size > perfdata_.Size() - ids.offset) ids = {};
+
+		PerfFileSection moved {buffer.size(), ids.size};
+		memcpy(buffer.data() + entry, &moved, sizeof(moved));
+		buffer.append(reinterpret_cast<const char*>(base + ids.offset), ids.size);
+	}
+
+	out.data.offset  = buffer.size();
+	out.event_types  = {};
+	uint64_t written = 0;
+	auto flush       = [&]() {
+		write_all(fd, buffer.data(), buffer.size());
+		written += buffer.size();
+		buffer.clear();
+	};
+	flush();
+
+	// Sideband records are copied whole, AUXTRACE records only for the pieces of this shard. Both
+	// are in file order so a single cursor finds the pieces
+	size_t piece {0};
+	perfdata_.Records([&](const PerfEventHeader& header, uint64_t offset) {
+		if (header.type != PERF_RECORD_AUXTRACE) {
+			buffer.append(reinterpret_cast<const char*>(base + offset), header.size);
+			if (buffer.size() >= SHARD_WRITE_BUFFER) flush();
+			return;
+		}
+		if (piece == shard.pieces.size() || shard.pieces[piece].record != offset) return;
+
+		const auto& range = shard.pieces[piece++];
+		uint64_t size     = range.end - range.begin;
+		uint64_t padding  = -size & 7;  // records stay 8 byte aligned, PAD packets are zeros
+
+		PerfAuxtraceEvent event {};
+		memcpy(&event, base + offset, sizeof(event));
+		event.size = size + padding;
+		event.offset += range.begin;
+
+		buffer.append(reinterpret_cast<const char*>(&event), sizeof(event));
+		buffer.append(
+		    reinterpret_cast<const char*>(base + offset + sizeof(event)),
+		    header.size - sizeof(event)
+		);
+		flush();
+		write_all(fd, base + offset + header.size + range.begin, size);
+		buffer.append(padding, '\0');
+		written += size;
+	});
+	flush();
+	out.data.size = written - out.data.offset;
+
+	// The AUXTRACE feature indexes AUX buffers by their offsets in the original file, so it is
+	// left out and perf queues the buffers as it reads the data section
+	std::vector<PerfFileSection> table {};
+	std::vector<int> bits {};
+	uint64_t feature_offset = written;
+	for (int bit {0}; bit < 256; ++bit) {
+		auto feature = static_cast<PerfFeature>(bit);
+		auto section = perfdata_.Feature(feature);
+		if (!section || feature == PerfFeature::Auxtrace) continue;
+		table.push_back(*section);
+		bits.push_back(bit);
+	}
+
+	memset(out.adds_features, 0, sizeof(out.adds_features));
+	uint64_t body = feature_offset + table.size() * sizeof(PerfFileSection);
+	for (size_t i {0}; i < table.size(); ++i) {
+		out.adds_features[bits[i] / 64] |= 1ull << (bits[i] % 64);
+		PerfFileSection moved {body, table[i].size};
+		buffer.append(reinterpret_cast<const char*>(&moved), sizeof(moved));
+		body += table[i].size;
+	}
+	for (const auto& section : table)
+		buffer.append(reinterpret_cast<const char*>(base + section.offset), section.size);
+	flush();
+
+	ssize_t res = pwrite(fd, &out, sizeof(out), 0);
+	if (res != sizeof(out)) throw_errno("Cannot write the shard header", res == -1 ? errno : EIO);
+}
+
+uint64_t TraceSharder::AuxBytes() const {
+	uint64_t bytes {0};
+	perfdata_.Records([&](const PerfEventHeader& header, uint64_t offset) {
+		if (header.type != PERF_RECORD_AUXTRACE) return;
+		PerfAuxtraceEvent event {};
+		memcpy(&event, perfdata_.Data() + offset, sizeof(event));
+		bytes += event.size;
+	});
+	return bytes;
+}
+
+}  // namespace libitrace
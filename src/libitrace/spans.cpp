@@ -0,0 +1,113 @@
+#include "libitrace/spans.hpp"
+
+#include <algorithm>
+
+namespace {
+
+constexpr std::string_view UNTRACED = "[untraced]";
+
+}  // namespace
+
+namespace libitrace {
+
+SpanExtractor::SpanExtractor(
+    const std::string& infile, const std::string& start, const std::string& end
+)
+    : start_ {start},
+      end_ {end} {
+	args_.fields = SCRIPT_ENTRY_FIELDS;
+	args_.infile = infile;
+	untraced_    = names_.Intern(UNTRACED);
+}
+
+void SpanExtractor::Run() {
+	ScriptParser parser {[this](const ScriptRecord& record) { Add(record); }};
+
+	run_script(call_script_arglist(args_), parser);
+	Finish();
+}
+
+void SpanExtractor::Add(const ScriptRecord& record) {
+	auto [it, inserted] = threads_.try_emplace(record.tid);
+	ThreadState& thread = it->second;
+	if (inserted) {
+		thread.function = names_.Intern(record.sym.empty() ? SCRIPT_UNKNOWN : record.sym);
+		thread.last     = record.time;
+	}
+	advance_(thread, record.time);
+
+	if (record.Enters(start_)) {
+		if (thread.open) ++stats_.restarted;
+		thread.open       = true;
+		thread.span.start = record.time;
+		thread.span.tid   = record.tid;
+		thread.breakdown.clear();
+	}
+
+	if (record.Returns(end_)) {
+		if (thread.open) {
+			close_(thread, record.time);
+		} else {
+			++stats_.unmatched;
+		}
+	}
+
+	if (record.HasFlag("tr end")) {
+		thread.function = untraced_;
+	} else if (record.has_addr && !record.addr_sym.empty()) {
+		thread.function = names_.Intern(record.addr_sym);
+	} else if (record.has_addr) {
+		thread.function = names_.Intern(SCRIPT_UNKNOWN);
+	}
+}
+
+void SpanExtractor::Finish() {
+	for (auto& [tid, thread] : threads_) {
+		if (!thread.open) continue;
+		++stats_.open;
+		thread.open = false;
+		thread.breakdown.clear();
+	}
+}
+
+std::vector<SpanFunction> SpanExtractor::Functions() const {
+	std::vector<SpanFunction> functions {};
+	functions.reserve(functions_.size());
+	for (const auto& [id, function] : functions_) functions.push_back(function);
+	std::sort(functions.begin(), functions.end(), [](const SpanFunction& a, const SpanFunction& b) {
+		return a.time > b.time;
+	});
+	return functions;
+}
+
+void SpanExtractor::advance_(ThreadState& thread, uint64_t time) {
+	if (time <= thread.last) return;
+	if (thread.open) thread.breakdown[thread.function] += time - thread.last;
+	thread.last = time;
+}
+
+void SpanExtractor::close_(ThreadState& thread, uint64_t time) {
+	Span& span = thread.span;
+	span.end   = std::max(time, span.start);
+	span.breakdown.assign(thread.breakdown.begin(), thread.breakdown.end());
+	std::sort(span.breakdown.begin(), span.breakdown.end(), [](const auto& a, const auto& b) {
+		return a.second > b.second;
+	});
+
+	++stats_.spans;
+	histogram_.Record(span.Duration());
+	total_ += span.Duration();
+	for (const auto& [id, ns] : span.breakdown) {
+		SpanFunction& function = functions_[id];
+		function.function      = id;
+		function.time += ns;
+		++function.spans;
+		function.max_time = std::max(function.max_time, ns);
+	}
+
+	if (callback_) callback_(span);
+	thread.open = false;
+	thread.breakdown.clear();
+}
+
+}  // namespace libitrace
@@ -4,33 +4,173 @@
 
 #include "libitrace/subprocess.hpp"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <optional>
+#include <vector>
 
 #include "libitrace/utils.hpp"
 
 // Helper functions
-std::string read_pipe(int fd) {
-	std::string out {};
-	char buf[1048576] {};
-	ssize_t bytes {};
-	while ((bytes = read(fd, buf, sizeof(buf)))) {
-		if (bytes == 0 || bytes == -1) break;
-		out.append(buf, bytes);
+namespace {
+
+constexpr size_t DRAIN_CHUNK = 1048576;
+
+/*
+ * One pipe drained by drain_pipes. Its output is either read into capture, keeping at most limit
+ * bytes, handed to callback or ring as it is read, or spliced into splicefd after being copied
+ * into teefd
+ * */
+struct PipeDrain {
+	int pipe {-1};
+	std::string* capture {nullptr};
+	const libitrace::chunk_callback* callback {nullptr};
+	libitrace::ByteRing* ring {nullptr};
+	int splicefd {-1};
+	int teefd {-1};
+	size_t bytes {0};
+	bool truncated {false};
+};
+
+// Returns false once the pipe reaches end of file
+bool drain_once(PipeDrain& drain, std::vector<char>& buf, size_t limit) {
+	if (drain.splicefd != -1) {
+		ssize_t size = DRAIN_CHUNK;
+		if (drain.teefd != -1) {
+			size = tee(drain.pipe, drain.teefd, DRAIN_CHUNK, 0);
+			if (size == -1 && errno == EINTR) return true;
+			if (size == -1) libitrace::throw_errno("tee");
+			if (size == 0) return false;
+		}
+
+		// Move exactly what was teed so the copy and the destination stay in step
+		ssize_t moved {0};
+		do {
+			ssize_t res = splice(drain.pipe, nullptr, drain.splicefd, nullptr, size - moved, 0);
+			if (res == -1 && errno == EINTR) continue;
+			if (res == -1) libitrace::throw_errno("splice");
+			if (res == 0) return false;
+			moved += res;
+		} while (drain.teefd != -1 && moved < size);
+		drain.bytes += moved;
+		return true;
+	}
+
+	ssize_t bytes = read(drain.pipe, buf.data(), buf.size());
+	if (bytes == -1 && (errno == EINTR || errno == EAGAIN)) return true;
+	if (bytes <= 0) return false;
+	drain.bytes += bytes;
+
+	std::string_view chunk {buf.data(), static_cast<size_t>(bytes)};
+	if (drain.callback) (*drain.callback)(chunk);
+	if (drain.ring) drain.ring->WriteAll(buf.data(), bytes);
+	if (drain.capture) {
+		size_t room = limit > drain.capture->size() ? limit - drain.capture->size() : 0;
+		drain.capture->append(buf.data(), std::min<size_t>(bytes, room));
+		if (static_cast<size_t>(bytes) > room) drain.truncated = true;
+	}
+	return true;
+}
+
+// Drain every pipe at once so a child blocked on a full stderr pipe cannot deadlock a reader
+// waiting for stdout to end
+void drain_pipes(PipeDrain* drains, size_t count, size_t limit) {
+	std::vector<char> buf(DRAIN_CHUNK);
+	std::vector<bool> done(count, false);
+	std::vector<pollfd> fds {};
+	std::vector<size_t> index {};
+
+	size_t open = count;
+	while (open > 0) {
+		fds.clear();
+		index.clear();
+		for (size_t i {0}; i < count; ++i) {
+			if (done[i]) continue;
+			fds.push_back({drains[i].pipe, POLLIN, 0});
+			index.push_back(i);
+		}
+
+		if (poll(fds.data(), fds.size(), -1) == -1) {
+			if (errno == EINTR) continue;
+			libitrace::throw_errno("poll");
+		}
+
+		for (size_t i {0}; i < fds.size(); ++i) {
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+			if (!drain_once(drains[index[i]], buf, limit)) {
+				done[index[i]] = true;
+				--open;
+			}
+		}
 	}
-	return out;
 }
 
+// Close the pipes of a process and block until it terminates
+bool reap(const libitrace::RunningProcess& context, libitrace::CompletedProcess& res) {
+	close(context.Stdout_pipe);
+	close(context.Stderr_pipe);
+
+	int stat_loc {};
+	if (waitpid(context.Pid, &stat_loc, 0) != context.Pid) {
+		perror("unexpected pid from wait returned");
+		return false;
+	}
+
+	// Like a shell, so a job the scheduler terminated does not look like it succeeded
+	res.Exit = WIFEXITED(stat_loc) ? WEXITSTATUS(stat_loc) : 128 + WTERMSIG(stat_loc);
+	return true;
+}
+
+// Drain the stdout and stderr of a process. If draining or a consumer throws the process is
+// terminated and reaped so it does not outlive the error
+void drain_process(
+    const libitrace::RunningProcess& context, PipeDrain (&drains)[2],
+    libitrace::CompletedProcess& res, size_t limit
+) {
+	try {
+		drain_pipes(drains, 2, limit);
+	} catch (...) {
+		kill(context.Pid, SIGTERM);
+		reap(context, res);
+		throw;
+	}
+}
+
+// Drain a process whose stdout is consumed by a callback
+std::optional<libitrace::CompletedProcess> consume(
+    const libitrace::RunningProcess& context, PipeDrain& out, size_t limit
+) {
+	libitrace::CompletedProcess res {context.Cmd, context.Arglist};
+	PipeDrain drains[2] {out, {}};
+	drains[1].pipe    = context.Stderr_pipe;
+	drains[1].capture = &res.Stderr;
+	drain_process(context, drains, res, limit);
+
+	res.Stdout_bytes = drains[0].bytes;
+	res.Truncated    = drains[1].truncated;
+
+	if (!reap(context, res)) return std::nullopt;
+	return res;
+}
+
+}  // namespace
+
 namespace libitrace {
 
 std::optional<RunningProcess> Subprocess::Popen() {
 	// [0] is read end, [1] is write end
 	int stdout_pipe[2] {};
 	int stderr_pipe[2] {};
-	if (pipe(stdout_pipe) == -1 || pipe(stderr_pipe) == -1) {
+	// Close on exec keeps concurrently spawned children from holding each other's pipes open,
+	// which would delay end of file. dup2 clears the flag on the child's own stdout and stderr
+	if (pipe2(stdout_pipe, O_CLOEXEC) == -1 || pipe2(stderr_pipe, O_CLOEXEC) == -1) {
 		perror("pipe creation failed");
 		return std::nullopt;
 	}
@@ -41,73 +181,145 @@ std::optional<RunningProcess> Subprocess::Popen() {
 		return std::nullopt;
 	}
 
+	// argv is built in the parent. Allocating between fork and exec is unsafe once the parent has
+	// threads because another thread may hold the allocator lock at the time of the fork
+	std::vector<char*> argv {};
+	argv.reserve(args_.size() + 2);
+	argv.push_back(cmd_.data());
+	for (auto& arg : args_) argv.push_back(arg.data());
+	argv.push_back(nullptr);
+
+	int stdoutfd = capturestdout_ ? stdout_pipe[1] : stdoutfd_;
+	int stderrfd = capturestdout_ ? stderr_pipe[1] : -1;
+
+	pid_t child_pid =
+	    launcher_ == Launcher::Spawn ? spawn_(argv.data(), stdoutfd, stderrfd)
+	                                 : fork_(argv.data(), stdoutfd, stderrfd);
+	if (child_pid == -1) {
+		for (int fd : {stdout_pipe[0], stdout_pipe[1], stderr_pipe[0], stderr_pipe[1]}) close(fd);
+		return std::nullopt;
+	}
+
+	// Close the write ends of the open fds to the pipes to send eof
+	// pipe read before wait because if pipe becomes full causes deadlock
+	close(stdout_pipe[1]);
+	close(stderr_pipe[1]);
+	return RunningProcess {cmd_, args_, child_pid, stdout_pipe[0], stderr_pipe[0]};
+}
+
+pid_t Subprocess::fork_(char** argv, int stdoutfd, int stderrfd) {
 	pid_t child_pid = fork();
 	if (child_pid == -1) {
 		perror("error creating child process");
-		return std::nullopt;
+		return -1;
 	}
 
 	if (child_pid == 0) {
-		// Setup arguments to exec
-		char** argv {new char*[args_.size() + 2]};
-		argv[0] = cmd_.data();
-		for (size_t i {0}; i < args_.size(); ++i) argv[i + 1] = args_[i].data();
-		argv[args_.size() + 1] = nullptr;
-
-		if (capturestdout_) {
-			dup2(stdout_pipe[1], STDOUT_FILENO);
-			close(stdout_pipe[0]);
-			close(stdout_pipe[1]);
-
-			dup2(stderr_pipe[1], STDERR_FILENO);
-			close(stderr_pipe[0]);
-			close(stderr_pipe[1]);
-		} else {
-			dup2(stdoutfd_, STDOUT_FILENO);
-		}
+		// Only async signal safe calls from here on. The pipes are close on exec so only the
+		// duplicated ends survive into the program
+		if (stdinfd_ != -1) dup2(stdinfd_, STDIN_FILENO);
+		dup2(stdoutfd, STDOUT_FILENO);
+		if (stderrfd != -1) dup2(stderrfd, STDERR_FILENO);
 
 		execvp(argv[0], argv);
-		// argv not memory leak because execvp suceeding will mean all memory is
-		// reclaimed. if argv fails need to dealloate
-
-		delete[] argv;
 		perror("execvp failed");
-		exit(1);
+		_exit(1);
 	}
+	return child_pid;
+}
 
-	// Close the write ends of the open fds to the pipes to send eof
-	// pipe read before wait because if pipe becomes full causes deadlock
-	close(stdout_pipe[1]);
-	close(stderr_pipe[1]);
-	return RunningProcess {cmd_, args_, child_pid, stdout_pipe[0], stderr_pipe[0]};
+pid_t Subprocess::spawn_(char** argv, int stdoutfd, int stderrfd) {
+	posix_spawn_file_actions_t actions {};
+	if (posix_spawn_file_actions_init(&actions) != 0) {
+		perror("posix_spawn_file_actions_init");
+		return -1;
+	}
+	if (stdinfd_ != -1) posix_spawn_file_actions_adddup2(&actions, stdinfd_, STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, stdoutfd, STDOUT_FILENO);
+	if (stderrfd != -1) posix_spawn_file_actions_adddup2(&actions, stderrfd, STDERR_FILENO);
+
+	pid_t child_pid {-1};
+	int err = posix_spawnp(&child_pid, argv[0], &actions, nullptr, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (err != 0) {
+		errno = err;
+		perror("posix_spawnp failed");
+		return -1;
+	}
+	return child_pid;
 }
 
 std::optional<CompletedProcess> Subprocess::Run() {
 	auto metadata = Popen();
 	if (!metadata) return std::nullopt;
-	return Wait(*metadata, capturestdout_);
+	return Wait(*metadata, capturestdout_, capturelimit_);
 }
 
 std::optional<CompletedProcess> Subprocess::Wait(
-    const RunningProcess& context, bool capturestdout
+    const RunningProcess& context, bool capturestdout, size_t limit
 ) {
-	std::string stdout {};
-	std::string stderr {};
+	CompletedProcess res {context.Cmd, context.Arglist};
 	if (capturestdout) {
-		stdout = read_pipe(context.Stdout_pipe);
-		stderr = read_pipe(context.Stderr_pipe);
-	}
-	close(context.Stdout_pipe);
-	close(context.Stderr_pipe);
+		PipeDrain drains[2] {};
+		drains[0].pipe    = context.Stdout_pipe;
+		drains[0].capture = &res.Stdout;
+		drains[1].pipe    = context.Stderr_pipe;
+		drains[1].capture = &res.Stderr;
+		drain_process(context, drains, res, limit);
 
-	int stat_loc {};
-	if (waitpid(context.Pid, &stat_loc, 0) != context.Pid) {
-		perror("unexpected pid from wait returned");
-		return std::nullopt;
+		res.Stdout_bytes = drains[0].bytes;
+		res.Truncated    = drains[0].truncated || drains[1].truncated;
 	}
 
-	// TODO: Per wait man page, differentiate different exit conditions
-	return CompletedProcess {context.Cmd, context.Arglist, stdout, stderr, WEXITSTATUS(stat_loc)};
+	if (!reap(context, res)) return std::nullopt;
+	return res;
+}
+
+std::optional<CompletedProcess> Subprocess::Splice(
+    const RunningProcess& context, int fd, int teefd, size_t limit
+) {
+	CompletedProcess res {context.Cmd, context.Arglist};
+	PipeDrain drains[2] {};
+	drains[0].pipe     = context.Stdout_pipe;
+	drains[0].splicefd = fd;
+	drains[0].teefd    = teefd;
+	drains[1].pipe     = context.Stderr_pipe;
+	drains[1].capture  = &res.Stderr;
+	drain_process(context, drains, res, limit);
+
+	res.Stdout_bytes = drains[0].bytes;
+	res.Truncated    = drains[1].truncated;
+
+	if (!reap(context, res)) return std::nullopt;
+	return res;
+}
+
+std::optional<CompletedProcess> Subprocess::Stream(
+    const RunningProcess& context, const chunk_callback& callback, size_t limit
+) {
+	PipeDrain out {};
+	out.pipe     = context.Stdout_pipe;
+	out.callback = &callback;
+	return consume(context, out, limit);
+}
+
+std::optional<CompletedProcess> Subprocess::Stream(
+    const RunningProcess& context, ByteRing& ring, size_t limit
+) {
+	PipeDrain out {};
+	out.pipe = context.Stdout_pipe;
+	out.ring = &ring;
+
+	// The consumer waits for the close to finish, so it has to happen even if draining throws
+	std::optional<CompletedProcess> res {};
+	try {
+		res = consume(context, out, limit);
+	} catch (...) {
+		ring.Close();
+		throw;
+	}
+	ring.Close();
+	return res;
 }
 
 int Subprocess::SetStdout(int fd) {
@@ -116,4 +328,10 @@ int Subprocess::SetStdout(int fd) {
 	return 0;
 }
 
+void Subprocess::SetStdin(int fd) { stdinfd_ = fd; }
+
+void Subprocess::SetCaptureLimit(size_t bytes) { capturelimit_ = bytes; }
+
+void Subprocess::SetLauncher(Launcher launcher) { launcher_ = launcher; }
+
 }  // namespace libitrace
@@ -0,0 +1,402 @@
+#include "libitrace/symbols.hpp"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "libitrace/decodecache.hpp"
+#include "libitrace/utils.hpp"
+
+namespace {
+
+constexpr uint64_t PAGE_MASK = ~static_cast<uint64_t>(4095);
+
+// A read only mapping of a whole file, released when it goes out of scope
+class FileMap {
+public:
+	explicit FileMap(const std::string& path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd == -1) libitrace::throw_errno("Cannot open " + path);
+		struct stat st {};
+		if (fstat(fd, &st) == -1) {
+			int error = errno;
+			close(fd);
+			libitrace::throw_errno("Cannot stat " + path, error);
+		}
+		size_ = st.st_size;
+		if (size_ > 0) {
+			void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+			int error = errno;
+			if (map == MAP_FAILED) {
+				close(fd);
+				libitrace::throw_errno("Cannot map " + path, error);
+			}
+			data_ = static_cast<const uint8_t*>(map);
+		}
+		close(fd);
+	}
+	FileMap(const FileMap&) = delete;
+	FileMap& operator=(const FileMap&) = delete;
+	~FileMap() {
+		if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+	}
+
+	const uint8_t* Data() const { return data_; }
+	size_t Size() const { return size_; }
+
+private:
+	const uint8_t* data_ {nullptr};
+	size_t size_ {0};
+};
+
+// Bounds checked view of count objects at offset of the file
+template <typename T>
+const T* at(const uint8_t* data, size_t size, uint64_t offset, uint64_t count = 1) {
+	if (offset > size || count > (size - offset) / sizeof(T))
+		throw std::runtime_error("ELF file is truncated");
+	return reinterpret_cast<const T*>(data + offset);
+}
+
+const Elf64_Ehdr* elf_header(const uint8_t* data, size_t size) {
+	if (size < sizeof(Elf64_Ehdr) || memcmp(data, ELFMAG, SELFMAG) != 0)
+		throw std::runtime_error("Not an ELF file");
+	if (data[EI_CLASS] != ELFCLASS64 || data[EI_DATA] != ELFDATA2LSB)
+		throw std::runtime_error("Only 64 bit little endian ELF files are supported");
+	return at<Elf64_Ehdr>(data, size, 0);
+}
+
+// Search a note segment or section for NT_GNU_BUILD_ID
+std::optional<std::string> note_build_id(
+    const uint8_t* data, size_t size, uint64_t offset, uint64_t length
+) {
+	static const char hex[] = "0123456789abcdef";
+	uint64_t end = offset + length;
+	while (offset + sizeof(Elf64_Nhdr) <= end) {
+		const auto* note = at<Elf64_Nhdr>(data, size, offset);
+		uint64_t name    = offset + sizeof(Elf64_Nhdr);
+		uint64_t desc    = name + ((note->n_namesz + 3) & ~3u);
+		offset           = desc + ((note->n_descsz + 3) & ~3u);
+		if (offset > end) break;
+
+		if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+		    memcmp(at<char>(data, size, name, 4), "GNU", 4) == 0) {
+			const uint8_t* bytes = at<uint8_t>(data, size, desc, note->n_descsz);
+			std::string id {};
+			for (uint32_t i {0}; i < note->n_descsz; ++i) {
+				id += hex[bytes[i] >> 4];
+				id += hex[bytes[i] & 0xf];
+			}
+			return id;
+		}
+	}
+	return std::nullopt;
+}
+
+std::optional<std::string> find_build_id(const uint8_t* data, size_t size) {
+	const Elf64_Ehdr* ehdr = elf_header(data, size);
+	const auto* phdrs      = at<Elf64_Phdr>(data, size, ehdr->e_phoff, ehdr->e_phnum);
+	for (uint16_t i {0}; i < ehdr->e_phnum; ++i) {
+		if (phdrs[i].p_type != PT_NOTE) continue;
+		auto id = note_build_id(data, size, phdrs[i].p_offset, phdrs[i].p_filesz);
+		if (id) return id;
+	}
+
+	// Separate debug files have no program headers worth reading, only sections
+	const auto* shdrs = at<Elf64_Shdr>(data, size, ehdr->e_shoff, ehdr->e_shnum);
+	for (uint16_t i {0}; i < ehdr->e_shnum; ++i) {
+		if (shdrs[i].sh_type != SHT_NOTE) continue;
+		auto id = note_build_id(data, size, shdrs[i].sh_offset, shdrs[i].sh_size);
+		if (id) return id;
+	}
+	return std::nullopt;
+}
+
+}  // namespace
+
+namespace libitrace {
+
+ElfSymbols::ElfSymbols(const std::string& path, const std::string& cachedir) : path_ {path} {
+	FileMap file {path};
+	auto buildid = find_build_id(file.Data(), file.Size());
+	if (buildid) buildid_ = *buildid;
+
+	// Without a build id there is nothing that identifies the contents, so nothing is cached
+	bool cache = !cachedir.empty() && !buildid_.empty();
+	if (cache && load_cache_(cachedir + "/" + buildid_ + SYMCACHE_SUFFIX)) {
+		fromcache_ = true;
+	} else {
+		parse_(file.Data(), file.Size());
+		if (cache) store_cache_(cachedir);
+	}
+	build_eytzinger_();
+}
+
+std::string ElfSymbols::DefaultCacheDir() { return DecodeCache::DefaultDir() + "/symbols"; }
+
+std::optional<std::string> ElfSymbols::ReadBuildId(const std::string& path) {
+	FileMap file {path};
+	return find_build_id(file.Data(), file.Size());
+}
+
+std::optional<Symbol> ElfSymbols::Lookup(uint64_t addr) const {
+	size_t n = symbols_.size();
+	if (n == 0) return std::nullopt;
+
+	// Descend to the first start greater than addr. The comparison feeds the index arithmetic
+	// instead of a branch, and the trailing ones of k are the right turns taken after the last
+	// left turn, so shifting them out leaves the slot where the search went left for the last time
+	uint64_t k {1};
+	while (k <= n) k = 2 * k + (eytzinger_[k] <= addr);
+	k >>= __builtin_ffsll(~k);
+
+	size_t upper = k ? rank_[k] : n;
+	if (upper == 0) return std::nullopt;
+	const SymbolCacheEntry& entry = symbols_[upper - 1];
+	if (entry.size ? addr - entry.start >= entry.size : addr != entry.start) return std::nullopt;
+	return symbol_(entry);
+}
+
+std::optional<Symbol> ElfSymbols::Find(std::string_view name) const {
+	for (const auto& entry : symbols_) {
+		if (std::string_view {names_.data() + entry.name, entry.name_size} == name)
+			return symbol_(entry);
+	}
+	return std::nullopt;
+}
+
+uint64_t ElfSymbols::LoadBias(uint64_t start, uint64_t offset) const {
+	// Executables are linked at their runtime addresses
+	if (type_ == ET_EXEC) return 0;
+
+	for (const auto& segment : segments_) {
+		if (offset >= (segment.offset & PAGE_MASK) && offset < segment.offset + segment.filesz)
+			return start - (segment.vaddr + offset - segment.offset);
+	}
+	return start - offset;
+}
+
+std::optional<uint64_t> ElfSymbols::FileOffset(uint64_t addr) const {
+	for (const auto& segment : segments_) {
+		if (addr >= segment.vaddr && addr < segment.vaddr + segment.filesz)
+			return addr - segment.vaddr + segment.offset;
+	}
+	return std::nullopt;
+}
+
+void ElfSymbols::parse_(const uint8_t* data, size_t size) {
+	const Elf64_Ehdr* ehdr = elf_header(data, size);
+	type_                  = ehdr->e_type;
+
+	const auto* phdrs = at<Elf64_Phdr>(data, size, ehdr->e_phoff, ehdr->e_phnum);
+	for (uint16_t i {0}; i < ehdr->e_phnum; ++i) {
+		if (phdrs[i].p_type == PT_LOAD)
+			segments_.push_back({phdrs[i].p_vaddr, phdrs[i].p_offset, phdrs[i].p_filesz});
+	}
+
+	struct Candidate {
+		uint64_t start {};
+		uint64_t size {};
+		std::string_view name {};
+		int rank {};  // lower is preferred when several symbols share a start
+	};
+	std::vector<Candidate> candidates {};
+
+	const auto* shdrs = at<Elf64_Shdr>(data, size, ehdr->e_shoff, ehdr->e_shnum);
+	for (uint16_t i {0}; i < ehdr->e_shnum; ++i) {
+		const Elf64_Shdr& section = shdrs[i];
+		if (section.sh_type != SHT_SYMTAB && section.sh_type != SHT_DYNSYM) continue;
+		if (section.sh_link >= ehdr->e_shnum || section.sh_entsize != sizeof(Elf64_Sym)) continue;
+
+		const Elf64_Shdr& strtab = shdrs[section.sh_link];
+		const char* strings      = at<char>(data, size, strtab.sh_offset, strtab.sh_size);
+		uint64_t count           = section.sh_size / sizeof(Elf64_Sym);
+		const auto* syms         = at<Elf64_Sym>(data, size, section.sh_offset, count);
+		for (uint64_t j {0}; j < count; ++j) {
+			const Elf64_Sym& sym = syms[j];
+			int type             = ELF64_ST_TYPE(sym.st_info);
+			if (type != STT_FUNC && type != STT_GNU_IFUNC) continue;
+			if (sym.st_shndx == SHN_UNDEF || sym.st_value == 0 || sym.st_name >= strtab.sh_size)
+				continue;
+
+			const char* name = strings + sym.st_name;
+			size_t length    = strnlen(name, strtab.sh_size - sym.st_name);
+			int bind         = ELF64_ST_BIND(sym.st_info);
+			int rank         = bind == STB_GLOBAL ? 0 : bind == STB_WEAK ? 1 : 2;
+			candidates.push_back({sym.st_value, sym.st_size, {name, length}, rank});
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+		return a.start != b.start ? a.start < b.start : a.rank < b.rank;
+	});
+	candidates.erase(
+	    std::unique(
+	        candidates.begin(), candidates.end(),
+	        [](const Candidate& a, const Candidate& b) { return a.start == b.start; }
+	    ),
+	    candidates.end()
+	);
+
+	symbols_.reserve(candidates.size());
+	for (size_t i {0}; i < candidates.size(); ++i) {
+		const Candidate& candidate = candidates[i];
+		// Hand written assembly often has no size, so it extends to the next symbol
+		uint64_t length = candidate.size;
+		if (length == 0 && i + 1 < candidates.size())
+			length = candidates[i + 1].start - candidate.start;
+
+		symbols_.push_back(
+		    {candidate.start, length, static_cast<uint32_t>(names_.size()),
+		     static_cast<uint32_t>(candidate.name.size())}
+		);
+		names_.append(candidate.name);
+		names_.push_back('\0');
+	}
+}
+
+bool ElfSymbols::load_cache_(const std::string& file) {
+	std::ifstream in {file, std::ios::binary};
+	if (!in) return false;
+
+	SymbolCacheHeader header {};
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+	if (memcmp(header.magic, SYMCACHE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != SYMCACHE_VERSION)
+		return false;
+
+	std::vector<SymbolCacheEntry> symbols(header.symbols);
+	std::vector<ElfSegment> segments(header.segments);
+	std::string names(header.names_size, '\0');
+	if (!in.read(reinterpret_cast<char*>(symbols.data()), symbols.size() * sizeof(symbols[0])) ||
+	    !in.read(reinterpret_cast<char*>(segments.data()), segments.size() * sizeof(segments[0])) ||
+	    !in.read(names.data(), names.size()))
+		return false;
+	for (const auto& entry : symbols)
+		if (entry.name + static_cast<uint64_t>(entry.name_size) > names.size()) return false;
+
+	type_     = header.type;
+	symbols_  = std::move(symbols);
+	segments_ = std::move(segments);
+	names_    = std::move(names);
+	return true;
+}
+
+void ElfSymbols::store_cache_(const std::string& dir) const {
+	try {
+		make_dirs(dir);
+	} catch (const std::runtime_error&) {
+		// A read only cache directory only costs the parse next time
+		return;
+	}
+
+	SymbolCacheHeader header {};
+	memcpy(header.magic, SYMCACHE_MAGIC, sizeof(header.magic));
+	header.version    = SYMCACHE_VERSION;
+	header.type       = type_;
+	header.symbols    = symbols_.size();
+	header.segments   = segments_.size();
+	header.names_size = names_.size();
+
+	// Written under a temporary name so a concurrent reader never sees a partial table
+	std::string file = dir + "/" + buildid_ + SYMCACHE_SUFFIX;
+	std::string temp = file + ".tmp." + std::to_string(getpid());
+	std::ofstream out {temp, std::ios::binary | std::ios::trunc};
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(
+	    reinterpret_cast<const char*>(symbols_.data()), symbols_.size() * sizeof(symbols_[0])
+	);
+	out.write(
+	    reinterpret_cast<const char*>(segments_.data()), segments_.size() * sizeof(segments_[0])
+	);
+	out.write(names_.data(), names_.size());
+	out.close();
+	if (!out || rename(temp.c_str(), file.c_str()) == -1) unlink(temp.c_str());
+}
+
+void ElfSymbols::build_eytzinger_() {
+	eytzinger_.assign(symbols_.size() + 1, 0);
+	rank_.assign(symbols_.size() + 1, 0);
+	fill_eytzinger_(0, 1);
+}
+
+size_t ElfSymbols::fill_eytzinger_(size_t next, size_t slot) {
+	// An in order walk of the implicit tree visits the slots in sorted order
+	if (slot >= eytzinger_.size()) return next;
+	next             = fill_eytzinger_(next, 2 * slot);
+	eytzinger_[slot] = symbols_[next].start;
+	rank_[slot]      = next;
+	return fill_eytzinger_(next + 1, 2 * slot + 1);
+}
+
+Symbol ElfSymbols::symbol_(const SymbolCacheEntry& entry) const {
+	return {{names_.data() + entry.name, entry.name_size}, entry.start, entry.size};
+}
+
+void SymbolResolver::AddMapping(
+    const std::string& path, uint64_t start, uint64_t end, uint64_t offset
+) {
+	auto it = objects_.find(path);
+	if (it == objects_.end()) {
+		std::unique_ptr<ElfSymbols> symbols {};
+		try {
+			symbols = std::make_unique<ElfSymbols>(path, cachedir_);
+		} catch (const std::runtime_error&) {
+			// Files that are not ELF, or are gone, are remembered so they are not tried again
+		}
+		it = objects_.emplace(path, std::move(symbols)).first;
+	}
+	if (!it->second) return;
+
+	Mapping mapping {start, end, it->second->LoadBias(start, offset), it->second.get()};
+	auto pos = std::upper_bound(
+	    mappings_.begin(), mappings_.end(), start,
+	    [](uint64_t addr, const Mapping& mapping) { return addr < mapping.start; }
+	);
+	mappings_.insert(pos, mapping);
+}
+
+void SymbolResolver::AddProcess(pid_t pid) {
+	std::ifstream maps {"/proc/" + std::to_string(pid) + "/maps"};
+	if (!maps) throw std::runtime_error("Cannot read mappings of process " + std::to_string(pid));
+
+	// 55d0c0a00000-55d0c0a21000 r-xp 00002000 08:01 1234 /usr/bin/ls
+	std::string line {};
+	while (std::getline(maps, line)) {
+		std::istringstream fields {line};
+		std::string range {}, perms {}, offset {}, dev {}, inode {}, path {};
+		fields >> range >> perms >> offset >> dev >> inode;
+		std::getline(fields >> std::ws, path);
+		if (perms.find('x') == std::string::npos || path.empty() || path.front() != '/') continue;
+
+		size_t dash = range.find('-');
+		if (dash == std::string::npos) continue;
+		AddMapping(
+		    path, std::stoull(range.substr(0, dash), nullptr, 16),
+		    std::stoull(range.substr(dash + 1), nullptr, 16), std::stoull(offset, nullptr, 16)
+		);
+	}
+}
+
+std::optional<ResolvedSymbol> SymbolResolver::Lookup(uint64_t addr) const {
+	auto it = std::upper_bound(
+	    mappings_.begin(), mappings_.end(), addr,
+	    [](uint64_t addr, const Mapping& mapping) { return addr < mapping.start; }
+	);
+	if (it == mappings_.begin()) return std::nullopt;
+	--it;
+	if (addr >= it->end) return std::nullopt;
+
+	auto symbol = it->symbols->Lookup(addr - it->bias);
+	if (!symbol) return std::nullopt;
+	return ResolvedSymbol {symbol->name, it->symbols->Path(), addr - it->bias - symbol->start};
+}
+
+}  // namespace libitrace
@@ -0,0 +1,178 @@
+#include "libitrace/traceindex.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "libitrace/parser.hpp"
+#include "libitrace/utils.hpp"
+
+namespace {
+
+uint64_t mtime_ns(const struct stat& st) {
+	return static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec;
+}
+
+std::optional<libitrace::TraceIndexHeader> read_header(const std::string& trace, int fd) {
+	struct stat st {};
+	if (stat(trace.c_str(), &st) == -1) return std::nullopt;
+
+	libitrace::TraceIndexHeader header {};
+	if (read(fd, &header, sizeof(header)) != sizeof(header)) return std::nullopt;
+	if (memcmp(header.magic, libitrace::TRACEINDEX_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != libitrace::TRACEINDEX_VERSION)
+		return std::nullopt;
+	if (header.trace_size != static_cast<uint64_t>(st.st_size) ||
+	    header.trace_mtime != mtime_ns(st))
+		return std::nullopt;
+
+	return header;
+}
+
+}  // namespace
+
+namespace libitrace {
+
+TraceIndex::TraceIndex(const std::string& trace) {
+	int idx = open(SidecarPath(trace).c_str(), O_RDONLY);
+	if (idx == -1) throw std::runtime_error(trace + " has no index");
+	auto header = read_header(trace, idx);
+	if (!header) {
+		close(idx);
+		throw std::runtime_error(trace + " has a stale index");
+	}
+
+	entries_.resize(header->entries);
+	size_t bytes = entries_.size() * sizeof(TraceIndexEntry);
+	if (read(idx, entries_.data(), bytes) != static_cast<ssize_t>(bytes)) {
+		close(idx);
+		throw std::runtime_error(trace + " has a truncated index");
+	}
+	close(idx);
+
+	int fd = open(trace.c_str(), O_RDONLY);
+	if (fd == -1) throw_errno("Cannot open " + trace);
+	size_ = header->trace_size;
+	if (size_ == 0) {
+		close(fd);
+		return;
+	}
+
+	void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	int error = errno;
+	close(fd);
+	if (map == MAP_FAILED) throw_errno("Cannot map " + trace, error);
+	data_ = static_cast<const char*>(map);
+}
+
+TraceIndex::~TraceIndex() {
+	if (data_) munmap(const_cast<char*>(data_), size_);
+}
+
+void TraceIndex::Build(const std::string& trace, size_t stride) {
+	stride = std::max<size_t>(stride, 1);
+
+	int fd = open(trace.c_str(), O_RDONLY);
+	if (fd == -1) throw_errno("Cannot open " + trace);
+
+	std::vector<TraceIndexEntry> entries {};
+	size_t records {0};
+	uint64_t last {0};
+	bool sorted {true};
+	ScriptParser parser {[&](const ScriptRecord& record) {
+		if (record.time < last) sorted = false;
+		last = record.time;
+		if (records++ % stride == 0) entries.push_back({record.time, parser.LineOffset()});
+	}};
+	struct stat st {};
+	try {
+		parser.ParseFd(fd);
+		if (fstat(fd, &st) == -1) throw_errno("Cannot stat " + trace);
+	} catch (const std::runtime_error&) {
+		close(fd);
+		throw;
+	}
+	close(fd);
+
+	std::string sidecar = SidecarPath(trace);
+	if (!sorted) {
+		unlink(sidecar.c_str());
+		return;
+	}
+
+	TraceIndexHeader header {};
+	memcpy(header.magic, TRACEINDEX_MAGIC, sizeof(header.magic));
+	header.version     = TRACEINDEX_VERSION;
+	header.stride      = stride;
+	header.trace_size  = st.st_size;
+	header.trace_mtime = mtime_ns(st);
+	header.entries     = entries.size();
+
+	int idx = open(sidecar.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (idx == -1) throw_errno("Cannot open " + sidecar);
+	try {
+		write_all(idx, &header, sizeof(header));
+		write_all(idx, entries.data(), entries.size() * sizeof(TraceIndexEntry));
+	} catch (const std::runtime_error&) {
+		// A partial index would be read as stale at best
+		close(idx);
+		unlink(sidecar.c_str());
+		throw;
+	}
+	close(idx);
+}
+
+bool TraceIndex::HasIndex(const std::string& trace) {
+	int idx = open(SidecarPath(trace).c_str(), O_RDONLY);
+	if (idx == -1) return false;
+	bool res = read_header(trace, idx).has_value();
+	close(idx);
+	return res;
+}
+
+std::string_view TraceIndex::Slice(std::optional<uint64_t> start, std::optional<uint64_t> end)
+    const {
+	auto by_time = [](const TraceIndexEntry& entry, uint64_t time) { return entry.time < time; };
+
+	// Every record before the last entry earlier than start is also earlier than start, so at
+	// most one stride of lines is parsed to find the exact boundary
+	size_t begin {0};
+	if (start) {
+		auto it     = std::lower_bound(entries_.begin(), entries_.end(), *start, by_time);
+		size_t from = it == entries_.begin() ? 0 : std::prev(it)->offset;
+		begin       = scan_(from, [&](uint64_t time) { return time >= *start; });
+	}
+
+	size_t stop {size_};
+	if (end) {
+		auto it = std::upper_bound(
+		    entries_.begin(), entries_.end(), *end,
+		    [](uint64_t time, const TraceIndexEntry& entry) { return time < entry.time; }
+		);
+		size_t from = it == entries_.begin() ? 0 : std::prev(it)->offset;
+		stop        = scan_(std::max(from, begin), [&](uint64_t time) { return time > *end; });
+	}
+
+	if (stop <= begin) return {};
+	return {data_ + begin, stop - begin};
+}
+
+template <typename Pred>
+size_t TraceIndex::scan_(size_t from, Pred pred) const {
+	ScriptRecord record {};
+	while (from < size_) {
+		const char* newline = static_cast<const char*>(memchr(data_ + from, '\n', size_ - from));
+		size_t eol          = newline ? newline - data_ : size_;
+		if (ScriptParser::ParseLine({data_ + from, eol - from}, record) && pred(record.time))
+			return from;
+		from = eol + 1;
+	}
+	return size_;
+}
+
+}  // namespace libitrace
@@ -1,13 +1,24 @@
 #include "libitrace/utils.hpp"
 
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
 using std::cout, std::endl;
 
 namespace libitrace {
 
+void throw_errno(const std::string& what, int error) {
+	throw std::runtime_error(what + ": " + strerror(error));
+}
+
 void print_perf_args(const arglist& perfargs) {
 	cout << "[" << " perf " << format_args(perfargs) << " ]" << endl;
 }
@@ -25,4 +36,66 @@ std::string timespec_to_string(const timespec& ts) {
 	return std::string(buf);
 }
 
+uint64_t timespec_to_ns(const timespec& ts) {
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+timespec ns_to_timespec(uint64_t ns) {
+	timespec ts {};
+	ts.tv_sec  = static_cast<time_t>(ns / 1000000000ull);
+	ts.tv_nsec = static_cast<long>(ns % 1000000000ull);
+	return ts;
+}
+
+uint64_t monotonic_ns() {
+	struct timespec ts {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_to_ns(ts);
+}
+
+std::optional<uint64_t> parse_timestamp(std::string_view str) {
+	uint64_t sec {};
+	size_t i {0};
+	for (; i < str.size() && str[i] != '.'; ++i) {
+		if (str[i] < '0' || str[i] > '9') return std::nullopt;
+		sec = sec * 10 + (str[i] - '0');
+	}
+	if (i == 0 || i == str.size()) return std::nullopt;
+
+	// Fractions shorter than nanoseconds (perf prints microseconds by default) are scaled up
+	uint64_t frac {};
+	int digits {0};
+	for (++i; i < str.size(); ++i) {
+		if (str[i] < '0' || str[i] > '9') return std::nullopt;
+		if (digits < 9) {
+			frac = frac * 10 + (str[i] - '0');
+			++digits;
+		}
+	}
+	if (digits == 0) return std::nullopt;
+	for (; digits < 9; ++digits) frac *= 10;
+
+	return sec * 1000000000ull + frac;
+}
+
+void write_all(int fd, const void* data, size_t size) {
+	const char* bytes = static_cast<const char*>(data);
+	while (size > 0) {
+		ssize_t written = write(fd, bytes, size);
+		if (written == -1 && errno == EINTR) continue;
+		if (written == -1) throw_errno("write");
+		bytes += written;
+		size -= written;
+	}
+}
+
+void make_dirs(const std::string& path) {
+	for (size_t slash = path.find('/', 1);; slash = path.find('/', slash + 1)) {
+		std::string dir = path.substr(0, slash);
+		if (mkdir(dir.c_str(), 0775) == -1 && errno != EEXIST)
+			throw std::runtime_error("Cannot create directory " + dir + ": " + strerror(errno));
+		if (slash == std::string::npos) return;
+	}
+}
+
 }  // namespace libitrace